@@ -32,10 +32,49 @@
 #include "StringTokenizer.h"
 
 #ifdef USE_PCRE
-#include "pcrecpp.h"
+#include <pcre.h>
 #endif
 
 namespace dcpp {
+
+#ifdef USE_PCRE
+struct ADLSearch::Regex : boost::noncopyable {
+    explicit Regex(const string& aPattern) : re(NULL), extra(NULL) {
+        // anchored at both ends, a search has to match the whole name
+        const char* error = NULL;
+        int offset = 0;
+        re = pcre_compile(("(?:" + aPattern + ")\\z").c_str(), PCRE_ANCHORED | PCRE_UTF8 | PCRE_CASELESS, &error, &offset, NULL);
+        if(re) {
+#ifdef PCRE_STUDY_JIT_COMPILE
+            extra = pcre_study(re, PCRE_STUDY_JIT_COMPILE, &error);
+#else
+            extra = pcre_study(re, 0, &error);
+#endif
+        }
+    }
+
+    ~Regex() {
+        if(extra) {
+#ifdef PCRE_STUDY_JIT_COMPILE
+            pcre_free_study(extra);
+#else
+            pcre_free(extra);
+#endif
+        }
+        if(re) {
+            pcre_free(re);
+        }
+    }
+
+    bool match(const string& s) const {
+        return re && pcre_exec(re, extra, s.data(), (int)s.size(), 0, 0, NULL, 0) >= 0;
+    }
+
+    pcre* re;
+    pcre_extra* extra;
+};
+#endif
+
 ADLSearch::ADLSearch() :
 searchString(_("<Enter string>")),
 isActive(true),
@@ -46,17 +85,20 @@ maxFileSize(-1),
 typeFileSize(SizeBytes),
 destDir("ADLSearch"),
 ddIndex(0),
-bUseRegexp(false)
+minSize(-1),
+maxSize(-1)
 {}
 
 void ADLSearch::Prepare(StringMap& params) {
-    // Prepare quick search of substrings
-    stringSearchList.clear();
+    terms.clear();
+    regex.reset();
+
+    minSize = minFileSize >= 0 ? minFileSize * GetSizeBase() : -1;
+    maxSize = maxFileSize >= 0 ? maxFileSize * GetSizeBase() : -1;
+
     #ifdef USE_PCRE
     if(searchString.find("$Re:") == 0){
-        regexpstring.clear();
-        regexpstring=searchString.substr(4);
-        bUseRegexp = true;
+        regex = std::make_shared<Regex>(searchString.substr(4));
     } else {
     #endif
         // Replace parameters such as %[nick]
@@ -66,8 +108,7 @@ void ADLSearch::Prepare(StringMap& params) {
         StringTokenizer<string> st(stringParams, ' ');
         for(StringIter i = st.getTokens().begin(); i != st.getTokens().end(); ++i) {
             if(!i->empty()) {
-                // Add substring search
-                stringSearchList.push_back(StringSearch(*i));
+                terms.push_back(*i);
             }
         }
     #ifdef USE_PCRE
@@ -128,68 +169,73 @@ int64_t ADLSearch::GetSizeBase() {
     }
 }
 
-bool ADLSearch::MatchesFile(const string& f, const string& fp, int64_t size) {
-    // Check status
-    if(!isActive) {
+bool ADLSearch::MatchesSize(int64_t size) const {
+    if(size < 0) {
+        return true;
+    }
+    if(minSize >= 0 && size < minSize) {
+        // Too small
+        return false;
+    }
+    if(maxSize >= 0 && size > maxSize) {
+        // Too large
         return false;
     }
+    return true;
+}
 
-    // Check size for files
-    if(size >= 0 && (sourceType == OnlyFile || sourceType == FullPath)) {
-        if(minFileSize >= 0 && size < minFileSize * GetSizeBase()) {
-            // Too small
-            return false;
+bool ADLSearch::MatchesRegex(const string& s) const {
+    #ifdef USE_PCRE
+    return regex && regex->match(s);
+    #else
+    return false;
+    #endif
+}
+
+void ADLSearchManager::Searches::prepare(const SearchCollection& collection) {
+    terms.assign(collection.size(), vector<size_t>());
+    for(int t = ADLSearch::TypeFirst; t < ADLSearch::TypeLast; ++t) {
+        search[t].clear();
+    }
+
+    for(size_t i = 0; i < collection.size(); ++i) {
+        const ADLSearch& s = collection[i];
+        if(!s.isActive || s.regex) {
+            continue;
         }
-        if(maxFileSize >= 0 && size > maxFileSize * GetSizeBase()) {
-            // Too large
-            return false;
+        for(auto j = s.terms.begin(); j != s.terms.end(); ++j) {
+            terms[i].push_back(search[s.sourceType].add(*j));
         }
     }
 
-    // Do search
-    switch(sourceType) {
-    default:
-    case OnlyDirectory: return false;
-    case OnlyFile:      return SearchAll(f);
-    case FullPath:      return SearchAll(fp);
+    for(int t = ADLSearch::TypeFirst; t < ADLSearch::TypeLast; ++t) {
+        search[t].compile();
     }
 }
-bool ADLSearch::MatchesDirectory(const string& d) {
-    // Check status
-    if(!isActive) {
-        return false;
+
+bool ADLSearchManager::Searches::match(const ADLSearch& aSearch, size_t i, const string& s) {
+    if(aSearch.regex) {
+        return aSearch.MatchesRegex(s);
     }
-    if(sourceType != OnlyDirectory) {
+
+    const vector<size_t>& ids = terms[i];
+    if(ids.empty()) {
         return false;
     }
 
-    // Do search
-    return SearchAll(d);
-}
+    // one pass over the text finds the terms of all searches of this type
+    int t = aSearch.sourceType;
+    if(!matched[t]) {
+        search[t].match(s, found[t]);
+        matched[t] = true;
+    }
 
-bool ADLSearch::SearchAll(const string& s) {
-    #ifdef USE_PCRE
-    if(bUseRegexp){
-        pcrecpp::RE_Options options;
-        options.set_utf8(true);
-        options.set_caseless(true);
-        pcrecpp::RE regexp(regexpstring, options);
-        if(regexp.FullMatch(s))
-            return true;
-        else
+    for(auto j = ids.begin(); j != ids.end(); ++j) {
+        if(!found[t][*j]) {
             return false;
-    } else {
-    #endif
-    // Match all substrings
-        for(StringSearch::List::iterator i = stringSearchList.begin(); i != stringSearchList.end(); ++i) {
-            if(!i->match(s)) {
-                return false;
-            }
         }
-        return !stringSearchList.empty();
-    #ifdef USE_PCRE
     }
-    #endif
+    return true;
 }
 
 ///  Load old searches from disk
@@ -323,7 +369,7 @@ void ADLSearchManager::Save()
     }
 }
 
-void ADLSearchManager::MatchesFile(DestDirList& destDirVector, DirectoryListing::File *currentFile, string& fullPath) {
+void ADLSearchManager::MatchesFile(DestDirList& destDirVector, Searches& searches, DirectoryListing::File *currentFile, string& fullPath) {
     // Add to any substructure being stored
     for(auto id = destDirVector.begin(); id != destDirVector.end(); ++id) {
         if(id->subdir != NULL) {
@@ -340,13 +386,22 @@ void ADLSearchManager::MatchesFile(DestDirList& destDirVector, DirectoryListing:
         return;
     }
 
-    string filePath = fullPath + "\\" + currentFile->getName();
+    // The full path is only built when a search needs it
+    string filePath;
+    searches.matched[ADLSearch::OnlyFile] = searches.matched[ADLSearch::FullPath] = false;
+
     // Match searches
     for(auto is = collection.begin(); is != collection.end(); ++is) {
         if(destDirVector[is->ddIndex].fileAdded) {
             continue;
         }
-        if(is->MatchesFile(currentFile->getName(), filePath, currentFile->getSize())) {
+        if(!is->isActive || is->sourceType == ADLSearch::OnlyDirectory || !is->MatchesSize(currentFile->getSize())) {
+            continue;
+        }
+        if(is->sourceType == ADLSearch::FullPath && filePath.empty()) {
+            filePath = fullPath + "\\" + currentFile->getName();
+        }
+        if(searches.match(*is, is - collection.begin(), is->sourceType == ADLSearch::FullPath ? filePath : currentFile->getName())) {
             DirectoryListing::File *copyFile = new DirectoryListing::File(*currentFile, true);
             destDirVector[is->ddIndex].dir->files.push_back(copyFile);
             destDirVector[is->ddIndex].fileAdded = true;
@@ -366,7 +421,7 @@ void ADLSearchManager::MatchesFile(DestDirList& destDirVector, DirectoryListing:
     }
 }
 
-void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, DirectoryListing::Directory* currentDir, string& fullPath) {
+void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, Searches& searches, DirectoryListing::Directory* currentDir, string& fullPath) {
     // Add to any substructure being stored
     for(auto id = destDirVector.begin(); id != destDirVector.end(); ++id) {
         if(id->subdir != NULL) {
@@ -382,12 +437,17 @@ void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, DirectoryLis
         return;
     }
 
+    searches.matched[ADLSearch::OnlyDirectory] = false;
+
     // Match searches
     for(auto is = collection.begin(); is != collection.end(); ++is) {
         if(destDirVector[is->ddIndex].subdir != NULL) {
             continue;
         }
-        if(is->MatchesDirectory(currentDir->getName())) {
+        if(!is->isActive || is->sourceType != ADLSearch::OnlyDirectory) {
+            continue;
+        }
+        if(searches.match(*is, is - collection.begin(), currentDir->getName())) {
             destDirVector[is->ddIndex].subdir =
                 new DirectoryListing::AdlDirectory(fullPath, destDirVector[is->ddIndex].dir, currentDir->getName());
             destDirVector[is->ddIndex].dir->directories.push_back(destDirVector[is->ddIndex].subdir);
@@ -455,20 +515,23 @@ void ADLSearchManager::matchListing(DirectoryListing& aDirList) noexcept {
     PrepareDestinationDirectories(destDirs, aDirList.getRoot(), params);
     setBreakOnFirst(BOOLSETTING(ADLS_BREAK_ON_FIRST));
 
+    Searches searches;
+    searches.prepare(collection);
+
     string path(aDirList.getRoot()->getName());
-    matchRecurse(destDirs, aDirList.getRoot(), path);
+    matchRecurse(destDirs, searches, aDirList.getRoot(), path);
 
     FinalizeDestinationDirectories(destDirs, aDirList.getRoot());
 }
 
-void ADLSearchManager::matchRecurse(DestDirList &aDestList, DirectoryListing::Directory* aDir, string &aPath) {
+void ADLSearchManager::matchRecurse(DestDirList &aDestList, Searches& searches, DirectoryListing::Directory* aDir, string &aPath) {
     for(DirectoryListing::Directory::Iter dirIt = aDir->directories.begin(); dirIt != aDir->directories.end(); ++dirIt) {
         string tmpPath = aPath + "\\" + (*dirIt)->getName();
-        MatchesDirectory(aDestList, *dirIt, tmpPath);
-        matchRecurse(aDestList, *dirIt, tmpPath);
+        MatchesDirectory(aDestList, searches, *dirIt, tmpPath);
+        matchRecurse(aDestList, searches, *dirIt, tmpPath);
     }
     for(DirectoryListing::File::Iter fileIt = aDir->files.begin(); fileIt != aDir->files.end(); ++fileIt) {
-        MatchesFile(aDestList, *fileIt, aPath);
+        MatchesFile(aDestList, searches, *fileIt, aPath);
     }
     StepUpDirectory(aDestList);
 }
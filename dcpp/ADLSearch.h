@@ -25,7 +25,7 @@
 
 #include "Util.h"
 #include "SettingsManager.h"
-#include "StringSearch.h"
+#include "MultiStringSearch.h"
 #include "Singleton.h"
 #include "DirectoryListing.h"
 
@@ -79,19 +79,21 @@ public:
     // Name of the destination directory (empty = 'ADLSearch') and its index
     string destDir;
     unsigned long ddIndex;
-    // Search for file match
-    bool MatchesFile(const string& f, const string& fp, int64_t size);
-    // Search for directory match
-    bool MatchesDirectory(const string& d);
 
 private:
     friend class ADLSearchManager;
-    //decide if regexp should be used
-    bool bUseRegexp;
-    string regexpstring;
-    // Substring searches
-    StringSearch::List stringSearchList;
-    bool SearchAll(const string& s);
+    struct Regex;
+
+    // Size limits in bytes, checked before any string matching
+    bool MatchesSize(int64_t size) const;
+    bool MatchesRegex(const string& s) const;
+
+    // Compiled once per listing by Prepare, empty unless the search string is a regexp
+    std::shared_ptr<Regex> regex;
+    // Substrings that all have to be found
+    StringList terms;
+    int64_t minSize;
+    int64_t maxSize;
 };
 
 ///  Class that holds all active searches
@@ -128,12 +130,25 @@ public:
     void matchListing(DirectoryListing& /*aDirList*/) noexcept;
 
 private:
+    // Substrings of all searches of a source type merged into one automaton each
+    struct Searches {
+        MultiStringSearch search[ADLSearch::TypeLast];
+        // Ids of the terms of each search, in the automaton of its source type
+        vector<vector<size_t> > terms;
+        // Matches for the current name or path
+        MultiStringSearch::Matches found[ADLSearch::TypeLast];
+        bool matched[ADLSearch::TypeLast];
+
+        void prepare(const SearchCollection& collection);
+        bool match(const ADLSearch& aSearch, size_t i, const string& s);
+    };
+
     // @internal
-    void matchRecurse(DestDirList& /*aDestList*/, DirectoryListing::Directory* /*aDir*/, string& /*aPath*/);
+    void matchRecurse(DestDirList& /*aDestList*/, Searches& searches, DirectoryListing::Directory* /*aDir*/, string& /*aPath*/);
     // Search for file match
-    void MatchesFile(DestDirList& destDirVector, DirectoryListing::File *currentFile, string& fullPath);
+    void MatchesFile(DestDirList& destDirVector, Searches& searches, DirectoryListing::File *currentFile, string& fullPath);
     // Search for directory match
-    void MatchesDirectory(DestDirList& destDirVector, DirectoryListing::Directory* currentDir, string& fullPath);
+    void MatchesDirectory(DestDirList& destDirVector, Searches& searches, DirectoryListing::Directory* currentDir, string& fullPath);
     // Step up directory
     void StepUpDirectory(DestDirList& destDirVector);
     // Prepare destination directory indexing
@@ -500,6 +500,10 @@ void AdcHub::handle(AdcCommand::STA, AdcCommand& c) noexcept {
                 return;
             }
     }
+
+    if(c.getFrom() == AdcCommand::HUB_SID)
+        checkSearchFlood(c.getParam(1));
+
     ChatMessage message = { c.getParam(1), u };
     fire(ClientListener::Message(), this, message);
 }
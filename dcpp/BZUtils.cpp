@@ -22,9 +22,12 @@
 #include "Exception.h"
 #include "format.h"
 
+#include <thread>
+
 namespace dcpp {
 
 using std::max;
+using std::min;
 
 BZFilter::BZFilter() {
     memset(&zs, 0, sizeof(zs));
@@ -103,4 +106,351 @@ bool UnBZFilter::operator()(const void* in, size_t& insize, void* out, size_t& o
     return err == BZ_OK;
 }
 
+namespace {
+
+const uint64_t BLOCK_MAGIC = 0x314159265359ULL;
+const uint64_t EOS_MAGIC = 0x177245385090ULL;
+const uint64_t MAGIC_MASK = 0xFFFFFFFFFFFFULL;
+
+/** n bits starting at bit offset pos, n <= 56 */
+uint64_t getBits(const string& data, uint64_t pos, int n) {
+    uint64_t x = 0;
+    size_t b = pos / 8;
+    for(size_t i = 0; i < 8; ++i) {
+        x = (x << 8) | (b + i < data.size() ? (uint8_t)data[b + i] : 0);
+    }
+    return (x << (pos % 8)) >> (64 - n);
+}
+
+class BitWriter {
+public:
+    BitWriter(string& aOut) : out(aOut), acc(0), n(0) { }
+
+    void put(uint64_t x, int bits) {
+        for(int i = bits - 1; i >= 0; --i) {
+            acc = (acc << 1) | ((x >> i) & 1);
+            if(++n == 8) {
+                out += (char)acc;
+                acc = 0;
+                n = 0;
+            }
+        }
+    }
+
+    /** Copy bits [start, end) of data, only while byte aligned */
+    void copy(const string& data, uint64_t start, uint64_t end) {
+        dcassert(n == 0);
+        size_t bytes = (end - start) / 8;
+        size_t b = start / 8;
+        int shift = start % 8;
+        out.reserve(out.size() + bytes + 16);
+        if(shift == 0) {
+            out.append(data, b, bytes);
+        } else {
+            for(size_t i = 0; i < bytes; ++i) {
+                out += (char)(((uint8_t)data[b + i] << shift) | ((uint8_t)data[b + i + 1] >> (8 - shift)));
+            }
+        }
+        start += bytes * 8;
+        if(end > start) {
+            put(getBits(data, start, end - start), end - start);
+        }
+    }
+
+    void flush() {
+        if(n > 0) {
+            put(0, 8 - n);
+        }
+    }
+
+private:
+    string& out;
+    uint32_t acc;
+    int n;
+};
+
+} // namespace
+
+ParallelUnBZStream::ParallelUnBZStream(const string& aData) : data(aData), level(0), window(0),
+    claimed(0), next(0), stopping(false), curPos(0), pos(0), delivered(0), sequentialPos(0), skip(0),
+    sequentialDone(false)
+{
+    split();
+}
+
+ParallelUnBZStream::~ParallelUnBZStream() {
+    stop();
+}
+
+void ParallelUnBZStream::split() {
+    if(data.size() < 14 || data.compare(0, 3, "BZh") != 0 || data[3] < '1' || data[3] > '9') {
+        return;
+    }
+    level = data[3];
+
+    // the second byte of a magic tells at which bit offsets within the byte
+    // before it the magic may start, only those offsets get a full compare
+    uint8_t candidates[256] = { 0 };
+    for(int k = 0; k < 8; ++k) {
+        candidates[(BLOCK_MAGIC >> (32 + k)) & 0xFF] |= 1 << k;
+        candidates[(EOS_MAGIC >> (32 + k)) & 0xFF] |= 1 << k;
+    }
+
+    const uint64_t maxOrigPtr = (level - '0') * 100000;
+    vector<uint64_t> starts;
+    uint64_t firstEos = 0, eos = 0;
+    for(size_t b = 4; b + 7 < data.size(); ++b) {
+        uint8_t c = candidates[(uint8_t)data[b + 1]];
+        if(c == 0) {
+            continue;
+        }
+
+        for(int k = 0; k < 8; ++k) {
+            if(!(c & (1 << k))) {
+                continue;
+            }
+
+            uint64_t p = b * 8 + k;
+            uint64_t magic = getBits(data, p, 48);
+            if(magic == BLOCK_MAGIC) {
+                // block crc and randomised bit follow, then an origPtr that has to fit the block
+                if(getBits(data, p + 48 + 33, 24) < maxOrigPtr) {
+                    starts.push_back(p);
+                }
+            } else if(magic == EOS_MAGIC) {
+                if(firstEos == 0) {
+                    firstEos = p;
+                }
+                eos = p;
+            }
+        }
+    }
+
+    // only a single stream, ending with the end marker followed by its crc and padding
+    if(starts.empty() || firstEos <= starts.back() || (eos + 48 + 32 + 7) / 8 != data.size()) {
+        return;
+    }
+
+    blocks.reserve(starts.size());
+    for(size_t i = 0; i < starts.size(); ++i) {
+        blocks.push_back(Block(starts[i], i + 1 < starts.size() ? starts[i + 1] : eos));
+    }
+}
+
+void ParallelUnBZStream::start() {
+    size_t n = min(max(std::thread::hardware_concurrency(), 1u), (unsigned)MAX_WORKERS);
+    // the reader decodes too, one block is no reason to start any thread
+    n = min(n, blocks.size() - 1);
+    window = max(n, (size_t)1) * BLOCKS_AHEAD;
+
+    for(size_t i = 0; i < n; ++i) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker(*this)));
+        try {
+            workers.back()->start();
+        } catch(const ThreadException&) {
+            // the rest will be done by the reader
+            workers.pop_back();
+            break;
+        }
+    }
+}
+
+void ParallelUnBZStream::stop() {
+    {
+        Lock l(cs);
+        stopping = true;
+    }
+    cond.notify_all();
+
+    for(auto i = workers.begin(); i != workers.end(); ++i) {
+        (*i)->join();
+    }
+    workers.clear();
+}
+
+size_t ParallelUnBZStream::claim() {
+    if(claimed == blocks.size() || claimed >= next + window) {
+        return blocks.size();
+    }
+    blocks[claimed].state = STATE_DECODING;
+    return claimed++;
+}
+
+void ParallelUnBZStream::decode(size_t i) {
+    string out;
+    bool ok = decode(blocks[i], out);
+
+    {
+        Lock l(cs);
+        blocks[i].data.swap(out);
+        blocks[i].state = ok ? STATE_DONE : STATE_FAILED;
+    }
+    cond.notify_all();
+}
+
+bool ParallelUnBZStream::decode(const Block& block, string& out) const {
+    // a standalone stream holding just this block, its crc is the crc of the whole stream
+    string in;
+    in.reserve((block.end - block.start) / 8 + 32);
+    in += "BZh";
+    in += level;
+
+    BitWriter w(in);
+    w.copy(data, block.start, block.end);
+    w.put(EOS_MAGIC, 48);
+    w.put(getBits(data, block.start + 48, 32), 32);
+    w.flush();
+
+    bz_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(BZ2_bzDecompressInit(&zs, 0, 0) != BZ_OK) {
+        return false;
+    }
+
+    zs.next_in = &in[0];
+    zs.avail_in = in.size();
+
+    out.resize((level - '0') * 100000 + 1024);
+    size_t done = 0;
+    int err;
+    while(true) {
+        zs.next_out = &out[done];
+        zs.avail_out = out.size() - done;
+        err = ::BZ2_bzDecompress(&zs);
+        done = out.size() - zs.avail_out;
+        if(err != BZ_OK || zs.avail_out != 0) {
+            break;
+        }
+        // runs of equal bytes may expand to much more than the block size
+        out.resize(out.size() * 2);
+    }
+    BZ2_bzDecompressEnd(&zs);
+
+    out.resize(done);
+    return err == BZ_STREAM_END;
+}
+
+size_t ParallelUnBZStream::read(void* buf, size_t& len) {
+    if(sequential) {
+        return readSequential(buf, len);
+    }
+
+    while(curPos == cur.size()) {
+        if(next == blocks.size()) {
+            len = 0;
+            return 0;
+        }
+
+        if(window == 0) {
+            start();
+        }
+
+        size_t i = blocks.size();
+        {
+            Lock l(cs);
+            while(blocks[next].state == STATE_DECODING) {
+                cond.wait(cs);
+            }
+            if(blocks[next].state == STATE_QUEUED) {
+                // the workers are behind, lend them a hand
+                i = claim();
+            }
+        }
+
+        if(i != blocks.size()) {
+            decode(i);
+        }
+
+        bool failed;
+        {
+            Lock l(cs);
+            failed = blocks[next].state == STATE_FAILED;
+        }
+        if(failed) {
+            startSequential();
+            return readSequential(buf, len);
+        }
+
+        {
+            Lock l(cs);
+            cur.swap(blocks[next].data);
+            string().swap(blocks[next].data);
+            ++next;
+            pos = next == blocks.size() ? data.size() : blocks[next].start / 8;
+        }
+        // the window moved, workers may go on
+        cond.notify_all();
+
+        curPos = 0;
+    }
+
+    len = min(len, cur.size() - curPos);
+    memcpy(buf, &cur[curPos], len);
+    curPos += len;
+    delivered += len;
+    return len;
+}
+
+void ParallelUnBZStream::startSequential() {
+    dcdebug("ParallelUnBZStream: block %u of %u failed, decoding sequentially\n", (unsigned)next, (unsigned)blocks.size());
+    stop();
+
+    sequential.reset(new UnBZFilter);
+    sequentialPos = 0;
+    skip = delivered;
+    string().swap(cur);
+    curPos = 0;
+}
+
+size_t ParallelUnBZStream::readSequential(void* buf, size_t& len) {
+    string skipBuf;
+    while(!sequentialDone) {
+        size_t in = data.size() - sequentialPos;
+        size_t out;
+        void* dest;
+        if(skip > 0) {
+            // the blocks before the bad one were fine and have been read already
+            skipBuf.resize(static_cast<size_t>(min(skip, (uint64_t)64 * 1024)));
+            out = skipBuf.size();
+            dest = &skipBuf[0];
+        } else {
+            out = len;
+            dest = buf;
+        }
+
+        sequentialDone = !(*sequential)(data.data() + sequentialPos, in, dest, out);
+        sequentialPos += in;
+        pos = sequentialPos;
+
+        if(skip > 0) {
+            skip -= min(skip, (uint64_t)out);
+        } else if(out > 0) {
+            len = out;
+            return len;
+        }
+    }
+
+    len = 0;
+    return 0;
+}
+
+int ParallelUnBZStream::Worker::run() {
+    setThreadName("UnBZ");
+
+    while(true) {
+        size_t i = 0;
+        {
+            Lock l(stream.cs);
+            while(!stream.stopping && (i = stream.claim()) == stream.blocks.size() && stream.claimed < stream.blocks.size()) {
+                stream.cond.wait(stream.cs);
+            }
+            if(stream.stopping || i == stream.blocks.size()) {
+                break;
+            }
+        }
+        stream.decode(i);
+    }
+    return 0;
+}
+
 } // namespace dcpp
@@ -20,6 +20,13 @@
 
 #include <bzlib.h>
 
+#include <condition_variable>
+#include <memory>
+
+#include "CriticalSection.h"
+#include "Streams.h"
+#include "Thread.h"
+
 namespace dcpp {
 
 class BZFilter {
@@ -56,4 +63,106 @@ private:
     bz_stream zs;
 };
 
+/**
+ * Decompresses a bzip2 stream held in memory on several threads.
+ *
+ * Blocks of a bzip2 stream are independent of each other, they are found by
+ * scanning for the (bit aligned) block magic, then each one is wrapped into a
+ * standalone stream of its own and decoded by a worker. read() hands out the
+ * decoded blocks in order while the workers keep a few blocks ahead.
+ *
+ * The block magic may also turn up inside compressed data by chance, such a
+ * split makes a block fail to decode. The stream is then decoded once more
+ * from the start by a single UnBZFilter, skipping what was already read.
+ */
+class ParallelUnBZStream : public InputStream {
+public:
+    enum {
+        MAX_WORKERS = 8,
+        /** Decoded blocks each worker may keep waiting for the reader */
+        BLOCKS_AHEAD = 2
+    };
+
+    /** @param aData Complete compressed stream, has to stay around while the stream is read */
+    explicit ParallelUnBZStream(const string& aData);
+    virtual ~ParallelUnBZStream();
+
+    /**
+     * False when the data couldn't be split into blocks (not bzip2, several
+     * concatenated streams...), it should then be read with UnBZFilter.
+     */
+    bool isSplit() const { return !blocks.empty(); }
+    size_t getBlockCount() const { return blocks.size(); }
+
+    /** Compressed bytes read so far */
+    int64_t getPos() const { return pos; }
+
+    virtual size_t read(void* buf, size_t& len);
+
+private:
+    enum State {
+        STATE_QUEUED,
+        STATE_DECODING,
+        STATE_DONE,
+        STATE_FAILED
+    };
+
+    struct Block {
+        Block(uint64_t aStart, uint64_t aEnd) : start(aStart), end(aEnd), state(STATE_QUEUED) { }
+
+        /** Bit offsets of the block magic and of whatever follows the block */
+        uint64_t start;
+        uint64_t end;
+        State state;
+        string data;
+    };
+
+    class Worker : public Thread {
+    public:
+        Worker(ParallelUnBZStream& aStream) : stream(aStream) { }
+    private:
+        virtual int run();
+        ParallelUnBZStream& stream;
+    };
+
+    void split();
+    void start();
+    void stop();
+
+    /** Next block the workers may decode, blocks.size() when there's none */
+    size_t claim();
+    void decode(size_t i);
+    bool decode(const Block& block, string& out) const;
+    /** Switch to decoding the whole stream in one go after a bad split */
+    void startSequential();
+    size_t readSequential(void* buf, size_t& len);
+
+    const string& data;
+    char level;
+
+    vector<Block> blocks;
+    vector<std::unique_ptr<Worker> > workers;
+    size_t window;
+
+    CriticalSection cs;
+    std::condition_variable_any cond;
+    /** First block not handed to a worker yet */
+    size_t claimed;
+    /** Block read() takes from next */
+    size_t next;
+    bool stopping;
+
+    string cur;
+    size_t curPos;
+    int64_t pos;
+
+    /** Decoded bytes handed out so far */
+    uint64_t delivered;
+    std::unique_ptr<UnBZFilter> sequential;
+    /** Compressed bytes the sequential decoder consumed, skipped output still to decode */
+    size_t sequentialPos;
+    uint64_t skip;
+    bool sequentialDone;
+};
+
 } // namespace dcpp
@@ -82,12 +82,12 @@ void BufferedSocket::setSocket(std::unique_ptr<Socket> s) {
     sock = move(s);
 }
 
-void BufferedSocket::accept(const Socket& srv, bool secure, bool allowUntrusted) {
+void BufferedSocket::accept(socket_t aSock, const string& aIp, bool secure, bool allowUntrusted) {
     dcdebug("BufferedSocket::accept() %p\n", (void*)this);
 
     std::unique_ptr<Socket> s(secure ? CryptoManager::getInstance()->getServerSocket(allowUntrusted) : new Socket);
 
-    s->accept(srv);
+    s->accept(aSock, aIp);
 
     setSocket(move(s));
 
@@ -175,7 +175,7 @@ void BufferedSocket::threadRead() {
     if(state != RUNNING)
         return;
 
-    int left = (mode == MODE_DATA) ? ThrottleManager::getInstance()->read(sock.get(), &inbuf[0], (int)inbuf.size()) : sock->read(&inbuf[0], (int)inbuf.size());
+    int left = (mode == MODE_DATA) ? ThrottleManager::getInstance()->read(sock.get(), &inbuf[0], (int)inbuf.size(), throttle.get()) : sock->read(&inbuf[0], (int)inbuf.size());
     if(left == -1) {
         // EWOULDBLOCK, no data received...
         return;
@@ -283,6 +283,16 @@ void BufferedSocket::threadSendFile(InputStream* file) {
     if(disconnecting)
         return;
     dcassert(file != NULL);
+
+    if(sock->canSendFile()) {
+        // compressed or generated content still has to pass through our buffers
+        UploadFileCache::Stream* direct = dynamic_cast<UploadFileCache::Stream*>(file);
+        if(direct) {
+            threadSendFileDirect(*direct);
+            return;
+        }
+    }
+
     size_t sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
     size_t bufSize = max(sockSize, (size_t)64*1024);
 
@@ -341,7 +351,7 @@ void BufferedSocket::threadSendFile(InputStream* file) {
                 }
             } else {
                 writeSize = min(sockSize / 2, writeBuf.size() - writePos);
-                written = ThrottleManager::getInstance()->write(sock.get(), &writeBuf[writePos], writeSize);
+                written = ThrottleManager::getInstance()->write(sock.get(), &writeBuf[writePos], writeSize, throttle.get());
             }
 
             if(written > 0) {
@@ -380,6 +390,50 @@ void BufferedSocket::threadSendFile(InputStream* file) {
     }
 }
 
+void BufferedSocket::threadSendFileDirect(UploadFileCache::Stream& file) {
+    size_t sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
+    size_t chunkSize = max(sockSize, (size_t)64*1024);
+
+    size_t writeSize = 0;
+    int written = 0;
+
+    dcdebug("Starting threadSendFileDirect\n");
+    while(!disconnecting) {
+        if(file.getLeft() == 0) {
+            fire(BufferedSocketListener::TransmitDone());
+            return;
+        }
+
+        int w = sock->wait(0, Socket::WAIT_READ);
+        if(w & Socket::WAIT_READ) {
+            threadRead();
+        }
+
+        if(written == -1) {
+            // the throttle tokens were taken for writeSize already
+            written = sock->sendFile(file.getFile(), file.getPos(), (int)writeSize);
+        } else {
+            writeSize = (size_t)min((int64_t)chunkSize, file.getLeft());
+            written = ThrottleManager::getInstance()->sendFile(sock.get(), file.getFile(), file.getPos(), writeSize, throttle.get());
+        }
+
+        if(written > 0) {
+            file.skip(written);
+            fire(BufferedSocketListener::BytesSent(), (size_t)written, (size_t)written);
+        } else if(written == -1) {
+            while(!disconnecting) {
+                int w = sock->wait(POLL_TIMEOUT, Socket::WAIT_WRITE | Socket::WAIT_READ);
+                if(w & Socket::WAIT_READ) {
+                    threadRead();
+                }
+                if(w & Socket::WAIT_WRITE) {
+                    break;
+                }
+            }
+        }
+    }
+}
+
 void BufferedSocket::write(const char* aBuf, size_t aLen) noexcept {
     if(!sock.get())
         return;
@@ -22,14 +22,16 @@
 #include "BufferedSocketListener.h"
 #include "Semaphore.h"
 #include "Thread.h"
-#include "Speaker.h"
+#include "FastSpeaker.h"
 #include "Util.h"
 #include "Socket.h"
 #include "Atomic.h"
+#include "ThrottleManager.h"
+#include "UploadFileCache.h"
 
 namespace dcpp {
 
-class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread {
+class BufferedSocket : public FastSpeaker<BufferedSocketListener>, private Thread {
 public:
     enum Modes {
         MODE_LINE,
@@ -64,7 +66,7 @@ public:
             Thread::sleep(100);
     }
 
-    void accept(const Socket& srv, bool secure, bool allowUntrusted);
+    void accept(socket_t aSock, const string& aIp, bool secure, bool allowUntrusted);
     void connect(const string& aAddress, uint16_t aPort, bool secure, bool allowUntrusted, bool proxy);
     void connect(const string& aAddress, uint16_t aPort, uint16_t localPort, NatRoles natRole, bool secure, bool allowUntrusted, bool proxy);
 
@@ -96,6 +98,9 @@ public:
 
     void disconnect(bool graceless = false) noexcept { Lock l(cs); if(graceless) disconnecting = true; addTask(DISCONNECT, 0); }
 
+    /** Buckets data transfers are throttled with. Must be called from within a listener callback. */
+    void setThrottle(const ThrottleManager::HandlePtr& aThrottle) { throttle = aThrottle; }
+
     string getLocalIp() const { return sock->getLocalIp(); }
     uint16_t getLocalPort() const { return sock->getLocalPort(); }
 
@@ -152,6 +157,7 @@ private:
     ByteVector sendBuf;
 
     std::unique_ptr<Socket> sock;
+    ThrottleManager::HandlePtr throttle;
     State state;
     bool disconnecting;
 
@@ -161,6 +167,8 @@ private:
     void threadAccept();
     void threadRead();
     void threadSendFile(InputStream* is);
+    /** Let the kernel send a shared file when the socket can, see Socket::canSendFile */
+    void threadSendFileDirect(UploadFileCache::Stream& file);
     void threadSendData();
 
     void fail(const string& aError);
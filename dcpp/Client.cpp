@@ -25,6 +25,7 @@
 #include "FavoriteManager.h"
 #include "TimerManager.h"
 #include "ClientManager.h"
+#include "SearchManager.h"
 #include "version.h"
 
 namespace dcpp {
@@ -268,6 +269,12 @@ uint64_t Client::search(int aSizeMode, int64_t aSize, int aFileType, const strin
     return 0;
 }
 
+void Client::checkSearchFlood(const string& aMessage) {
+    // hubs name the search they refused, other messages mentioning searches are no warnings
+    if(searchQueue.interval && searchQueue.checkFlood(aMessage, GET_TICK()))
+        dcdebug("Search flood warning from %s\n", getHubUrl().c_str());
+}
+
 void Client::on(Line, const string& aLine) noexcept {
     updateActivity();
     COMMAND_DEBUG((Util::stricmp(getEncoding(), Text::utf8) != 0 ? Text::toUtf8(aLine, getEncoding()) : aLine), DebugManager::HUB_IN, getIpPort())
@@ -284,6 +291,8 @@ void Client::on(Second, uint64_t aTick) noexcept {
         SearchCore s;
 
         if(searchQueue.pop(s, aTick)) {
+            if(!s.aliases.empty())
+                SearchManager::getInstance()->addTokenAliases(s.token, s.aliases);
             search(s.sizeType, s.size, s.fileType , s.query, s.token, s.exts);
         }
     }
@@ -76,6 +76,8 @@ public:
 
     uint64_t search(int aSizeMode, int64_t aSize, int aFileType, const string& aString, const string& aToken, const StringList& aExtList, void* owner);
     void cancelSearch(void* aOwner) { searchQueue.cancelSearch(aOwner); }
+    SearchQueue::Stats getSearchStats() const { return searchQueue.getStats(); }
+    uint64_t getEffectiveSearchInterval() const { return searchQueue.getEffectiveInterval(); }
 
     virtual void password(const string& pwd) = 0;
     virtual void info(bool force) = 0;
@@ -189,6 +191,8 @@ protected:
 
     void updateCounts(bool aRemove);
     void updateActivity() { lastActivity = GET_TICK(); }
+    /** Slow down searching when a message from the hub looks like a search flood warning */
+    void checkSearchFlood(const string& aMessage);
 
     virtual string checkNick(const string& nick) = 0;
     virtual void search(int aSizeMode, int64_t aSize, int aFileType, const string& aString, const string& aToken, const StringList& aExtList) = 0;
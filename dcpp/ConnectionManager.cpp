@@ -28,10 +28,18 @@
 #include "LogManager.h"
 
 #include "UserConnection.h"
+#include "extra/ipfilter.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 namespace dcpp {
 
-ConnectionManager::ConnectionManager() : floodCounter(0), server(0), secureServer(0), shuttingDown(false) {
+ConnectionManager::ConnectionManager() : floodCounter(0), attempts(0), failedAttempts(0), server(0),
+    accepted(0), filtered(0), acceptErrors(0), lastAccepted(0), lastAcceptTick(0), acceptRate(0),
+    shuttingDown(false)
+{
     TimerManager::getInstance()->addListener(this);
 
     features.push_back(UserConnection::FEATURE_MINISLOTS);
@@ -49,14 +57,21 @@ ConnectionManager::ConnectionManager() : floodCounter(0), server(0), secureServe
 void ConnectionManager::listen() {
     disconnect();
 
-    server = new Server(false, static_cast<uint16_t>(SETTING(TCP_PORT)), SETTING(BIND_ADDRESS));
+    server = new Server(SETTING(BIND_ADDRESS));
+    try {
+        server->listen(false, static_cast<uint16_t>(SETTING(TCP_PORT)));
 
-    if(!CryptoManager::getInstance()->TLSOk()) {
-        dcdebug("Skipping secure port: %d\n", SETTING(TLS_PORT));
-        return;
+        if(CryptoManager::getInstance()->TLSOk()) {
+            server->listen(true, static_cast<uint16_t>(SETTING(TLS_PORT)));
+        } else {
+            dcdebug("Skipping secure port: %d\n", SETTING(TLS_PORT));
+        }
+    } catch(const Exception&) {
+        // keep serving the port that could be bound
+        server->start();
+        throw;
     }
-
-    secureServer = new Server(true, static_cast<uint16_t>(SETTING(TLS_PORT)), SETTING(BIND_ADDRESS));
+    server->start();
 }
 
 /**
@@ -124,14 +139,43 @@ void ConnectionManager::putConnection(UserConnection* aConn) {
     userConnections.erase(remove(userConnections.begin(), userConnections.end(), aConn), userConnections.end());
 }
 
+namespace {
+
+/** A minute after the first failure, doubled after each further one up to 32 minutes */
+uint64_t getRetryDelay(int errors) {
+    return static_cast<uint64_t>(60 * 1000) << min(max(errors, 1) - 1, 5);
+}
+
+struct AttemptOrder {
+    bool operator()(const ConnectionQueueItem* a, const ConnectionQueueItem* b) const {
+        if(a->getPriority() != b->getPriority())
+            return a->getPriority() > b->getPriority();
+        return a->getLastAttempt() < b->getLastAttempt();
+    }
+};
+
+}
+
+/** Most connections accepted from one socket per wake-up, so that one port can't starve the other */
+static const size_t ACCEPT_BATCH = 64;
+static const uint64_t ACCEPT_RATE_TIME = 10 * 1000;
+
 void ConnectionManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept {
     UserList passiveUsers;
     ConnectionQueueItem::List removed;
+    ConnectionQueueItem::List due;
 
     {
         Lock l(cs);
 
-        bool attemptDone = false;
+        if(aTick >= lastAcceptTick + ACCEPT_RATE_TIME) {
+            uint64_t n = accepted;
+            acceptRate = lastAcceptTick == 0 ? 0 : static_cast<double>(n - lastAccepted) * 1000 / (aTick - lastAcceptTick);
+            lastAccepted = n;
+            lastAcceptTick = aTick;
+        }
+
+        size_t connecting = 0;
 
         for(auto i = downloads.begin(); i != downloads.end(); ++i) {
             ConnectionQueueItem* cqi = *i;
@@ -154,37 +198,26 @@ void ConnectionManager::on(TimerManagerListener::Second, uint64_t aTick) noexcep
                         continue;
                 }
 
-                if(cqi->getLastAttempt() == 0 || (!attemptDone &&
-                    cqi->getLastAttempt() + 60 * 1000 * max(1, cqi->getErrors()) < aTick))
-                {
-                    cqi->setLastAttempt(aTick);
-
-                    QueueItem::Priority prio = QueueManager::getInstance()->hasDownload(cqi->getUser());
-
-                    if(prio == QueueItem::PAUSED) {
-                        removed.push_back(cqi);
-                        continue;
+                if(cqi->getState() == ConnectionQueueItem::CONNECTING) {
+                    if(cqi->getLastAttempt() + 50 * 1000 < aTick) {
+                        cqi->setErrors(cqi->getErrors() + 1);
+                        ++failedAttempts;
+                        fire(ConnectionManagerListener::Failed(), cqi, _("Connection timeout"));
+                        cqi->setState(ConnectionQueueItem::WAITING);
+                    } else {
+                        ++connecting;
                     }
-
-                    bool startDown = DownloadManager::getInstance()->startDownload(prio);
-
-                    if(cqi->getState() == ConnectionQueueItem::WAITING) {
-                        if(startDown) {
-                            cqi->setState(ConnectionQueueItem::CONNECTING);
-                            ClientManager::getInstance()->connect(cqi->getUser(), cqi->getToken());
-                            fire(ConnectionManagerListener::StatusChanged(), cqi);
-                            attemptDone = true;
-                        } else {
-                            cqi->setState(ConnectionQueueItem::NO_DOWNLOAD_SLOTS);
-                            fire(ConnectionManagerListener::Failed(), cqi, _("All download slots taken"));
+                } else if(cqi->getLastAttempt() == 0 || cqi->getLastAttempt() + getRetryDelay(cqi->getErrors()) < aTick) {
+                    // the queue is only asked now and then for users that keep waiting for their turn
+                    if(cqi->getLastPriorityCheck() == 0 || cqi->getLastPriorityCheck() + 10 * 1000 < aTick) {
+                        cqi->setLastPriorityCheck(aTick);
+                        cqi->setPriority(QueueManager::getInstance()->hasDownload(cqi->getUser()));
+                        if(cqi->getPriority() == QueueItem::PAUSED) {
+                            removed.push_back(cqi);
+                            continue;
                         }
-                    } else if(cqi->getState() == ConnectionQueueItem::NO_DOWNLOAD_SLOTS && startDown) {
-                        cqi->setState(ConnectionQueueItem::WAITING);
                     }
-                } else if(cqi->getState() == ConnectionQueueItem::CONNECTING && cqi->getLastAttempt() + 50 * 1000 < aTick) {
-                    cqi->setErrors(cqi->getErrors() + 1);
-                    fire(ConnectionManagerListener::Failed(), cqi, _("Connection timeout"));
-                    cqi->setState(ConnectionQueueItem::WAITING);
+                    due.push_back(cqi);
                 }
             }
         }
@@ -193,6 +226,47 @@ void ConnectionManager::on(TimerManagerListener::Second, uint64_t aTick) noexcep
             putCQI(*m);
         }
 
+        // best downloads first, and those that waited the longest among the same priority
+        sort(due.begin(), due.end(), AttemptOrder());
+
+        size_t maxConnecting = static_cast<size_t>(max(SETTING(CONNECT_MAX_PENDING), 1));
+        int budget = max(SETTING(CONNECT_RATE), 1);
+
+        for(auto i = due.begin(); i != due.end(); ++i) {
+            ConnectionQueueItem* cqi = *i;
+            if(cqi->getState() == ConnectionQueueItem::WAITING && (budget == 0 || connecting >= maxConnecting))
+                continue;
+
+            if(cqi->getLastPriorityCheck() != aTick) {
+                cqi->setPriority(QueueManager::getInstance()->hasDownload(cqi->getUser()));
+                cqi->setLastPriorityCheck(aTick);
+            }
+            QueueItem::Priority prio = static_cast<QueueItem::Priority>(cqi->getPriority());
+            cqi->setLastAttempt(aTick);
+
+            if(prio == QueueItem::PAUSED) {
+                putCQI(cqi);
+                continue;
+            }
+
+            bool startDown = DownloadManager::getInstance()->startDownload(prio);
+
+            if(cqi->getState() == ConnectionQueueItem::WAITING) {
+                if(startDown) {
+                    cqi->setState(ConnectionQueueItem::CONNECTING);
+                    ClientManager::getInstance()->connect(cqi->getUser(), cqi->getToken());
+                    fire(ConnectionManagerListener::StatusChanged(), cqi);
+                    ++attempts;
+                    ++connecting;
+                    --budget;
+                } else {
+                    cqi->setState(ConnectionQueueItem::NO_DOWNLOAD_SLOTS);
+                    fire(ConnectionManagerListener::Failed(), cqi, _("All download slots taken"));
+                }
+            } else if(cqi->getState() == ConnectionQueueItem::NO_DOWNLOAD_SLOTS && startDown) {
+                cqi->setState(ConnectionQueueItem::WAITING);
+            }
+        }
     }
 
     for(auto ui = passiveUsers.begin(); ui != passiveUsers.end(); ++ui) {
@@ -200,6 +274,19 @@ void ConnectionManager::on(TimerManagerListener::Second, uint64_t aTick) noexcep
     }
 }
 
+ConnectionManager::AttemptStats ConnectionManager::getAttemptStats() {
+    Lock l(cs);
+    AttemptStats stats = { 0, 0, attempts, failedAttempts };
+    for(auto i = downloads.begin(); i != downloads.end(); ++i) {
+        if((*i)->getState() == ConnectionQueueItem::CONNECTING) {
+            ++stats.connecting;
+        } else if((*i)->getState() == ConnectionQueueItem::WAITING) {
+            ++stats.waiting;
+        }
+    }
+    return stats;
+}
+
 void ConnectionManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept {
     Lock l(cs);
 
@@ -213,29 +300,113 @@ void ConnectionManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcep
 static const uint32_t FLOOD_TRIGGER = 20000;
 static const uint32_t FLOOD_ADD = 2000;
 
-ConnectionManager::Server::Server(bool secure_, uint16_t aPort, const string& ip_ /* = "0.0.0.0" */) : port(0), secure(secure_), die(false) {
-    sock.create();
-    sock.setSocketOpt(SO_REUSEADDR, 1);
-    ip = SETTING(BIND_IFACE)? sock.getIfaceI4(SETTING(BIND_IFACE_NAME)).c_str() : ip_;
-    port = sock.bind(aPort, ip);
-    sock.listen();
+ConnectionManager::Server::Server(const string& ip_ /* = "0.0.0.0" */) : die(false) {
+    listeners[0].port = listeners[1].port = 0;
+    ip = SETTING(BIND_IFACE)? listeners[0].sock.getIfaceI4(SETTING(BIND_IFACE_NAME)).c_str() : ip_;
+#ifdef __linux__
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd == -1) {
+        throw SocketException(errno);
+    }
+#endif
+}
 
-    start();
+ConnectionManager::Server::~Server() {
+    die = true;
+    join();
+#ifdef __linux__
+    ::close(epfd);
+#endif
+}
+
+void ConnectionManager::Server::listen(bool secure, uint16_t aPort) {
+    Listener& l = listeners[secure];
+    l.sock.disconnect();
+    l.sock.create();
+    l.sock.setSocketOpt(SO_REUSEADDR, 1);
+    l.port = l.sock.bind(aPort, ip);
+    l.sock.listen(SOMAXCONN);
+    l.sock.setBlocking(false);
+
+#ifdef __linux__
+    // closing the old socket took it out of the set already
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = secure;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, l.sock.sock, &ev) == -1) {
+        throw SocketException(errno);
+    }
+#endif
 }
 
 static const uint32_t POLL_TIMEOUT = 250;
 
+int ConnectionManager::Server::wait(bool* ready) {
+    ready[0] = ready[1] = false;
+
+#ifdef __linux__
+    epoll_event events[2];
+    int n = epoll_wait(epfd, events, 2, POLL_TIMEOUT);
+    if(n == -1) {
+        if(errno == EINTR)
+            return 0;
+        throw SocketException(errno);
+    }
+    for(int i = 0; i < n; ++i) {
+        ready[events[i].data.u32] = true;
+    }
+    return n;
+#else
+    fd_set rfd;
+    FD_ZERO(&rfd);
+    socket_t maxFd = 0;
+    for(int i = 0; i < 2; ++i) {
+        if(listeners[i].port != 0) {
+            FD_SET(listeners[i].sock.sock, &rfd);
+            maxFd = max(maxFd, listeners[i].sock.sock);
+        }
+    }
+    if(maxFd == 0) {
+        // nothing bound, select doesn't like empty sets everywhere
+        Thread::sleep(POLL_TIMEOUT);
+        return 0;
+    }
+
+    timeval tv = { 0, POLL_TIMEOUT * 1000 };
+    int n = ::select(static_cast<int>(maxFd + 1), &rfd, NULL, NULL, &tv);
+    if(n == -1) {
+#ifdef _WIN32
+        throw SocketException(::WSAGetLastError());
+#else
+        if(errno == EINTR)
+            return 0;
+        throw SocketException(errno);
+#endif
+    }
+    for(int i = 0; i < 2; ++i) {
+        if(listeners[i].port != 0 && FD_ISSET(listeners[i].sock.sock, &rfd))
+            ready[i] = true;
+    }
+    return n;
+#endif
+}
+
 int ConnectionManager::Server::run() noexcept {
     {
         char threadName[17];
-        snprintf(threadName, sizeof threadName, "Server_%u", port);
+        snprintf(threadName, sizeof threadName, "Server_%u", listeners[0].port);
         setThreadName(threadName);
     }
+    bool ready[2];
     while(!die) {
         try {
             while(!die) {
-                if(sock.wait(POLL_TIMEOUT, Socket::WAIT_READ) == Socket::WAIT_READ) {
-                    ConnectionManager::getInstance()->accept(sock, secure);
+                if(wait(ready) > 0) {
+                    for(int i = 0; i < 2; ++i) {
+                        if(ready[i])
+                            ConnectionManager::getInstance()->accept(listeners[i].sock, i != 0);
+                    }
                 }
             }
         } catch(const Exception& e) {
@@ -245,10 +416,10 @@ int ConnectionManager::Server::run() noexcept {
         bool failed = false;
         while(!die) {
             try {
-                sock.disconnect();
-                sock.create();
-                sock.bind(port, ip);
-                sock.listen();
+                for(int i = 0; i < 2; ++i) {
+                    if(listeners[i].port != 0)
+                        listen(i != 0, listeners[i].port);
+                }
                 if(failed) {
                     LogManager::getInstance()->message(_("Connectivity restored"));
                     failed = false;
@@ -276,37 +447,64 @@ int ConnectionManager::Server::run() noexcept {
  * Someone's connecting, accept the connection and wait for identification...
  * It's always the other fellow that starts sending if he made the connection.
  */
-void ConnectionManager::accept(const Socket& sock, bool secure) noexcept {
-    uint64_t now = GET_TICK();
-
-    if(now > floodCounter) {
-        floodCounter = now + FLOOD_ADD;
-    } else {
-        if(false && now + FLOOD_TRIGGER < floodCounter) {
-            Socket s;
-            try {
-                s.accept(sock);
-            } catch(const SocketException&) {
-                // ...
-            }
-            dcdebug("Connection flood detected!\n");
+void ConnectionManager::accept(Socket& sock, bool secure) noexcept {
+    for(size_t n = 0; n < ACCEPT_BATCH; ++n) {
+        string remoteIp;
+        socket_t s;
+        try {
+            s = sock.acceptPending(remoteIp);
+        } catch(const SocketException& e) {
+            // most likely out of descriptors, leave the rest in the backlog for now
+            dcdebug("ConnectionManager::accept Error: %s\n", e.getError().c_str());
+            ++acceptErrors;
             return;
+        }
+        if(s == INVALID_SOCKET)
+            return;
+
+        uint64_t now = GET_TICK();
+
+        if(now > floodCounter) {
+            floodCounter = now + FLOOD_ADD;
         } else {
-            floodCounter += FLOOD_ADD;
+            if(false && now + FLOOD_TRIGGER < floodCounter) {
+                Socket rejected;
+                rejected.accept(s, remoteIp);
+                dcdebug("Connection flood detected!\n");
+                return;
+            } else {
+                floodCounter += FLOOD_ADD;
+            }
+        }
+
+        if(BOOLSETTING(IPFILTER) && !ipfilter::getInstance()->OK(remoteIp, eDIRECTION_IN)) {
+            Socket rejected;
+            rejected.accept(s, remoteIp);
+            ++filtered;
+            continue;
+        }
+
+        UserConnection* uc = getConnection(false, secure);
+        uc->setFlag(UserConnection::FLAG_INCOMING);
+        uc->setState(UserConnection::STATE_SUPNICK);
+        uc->setLastActivity(now);
+        try {
+            uc->accept(s, remoteIp);
+            ++accepted;
+        } catch(const Exception&) {
+            putConnection(uc);
+            delete uc;
+            ++acceptErrors;
         }
-    }
-    UserConnection* uc = getConnection(false, secure);
-    uc->setFlag(UserConnection::FLAG_INCOMING);
-    uc->setState(UserConnection::STATE_SUPNICK);
-    uc->setLastActivity(GET_TICK());
-    try {
-        uc->accept(sock);
-    } catch(const Exception&) {
-        putConnection(uc);
-        delete uc;
     }
 }
 
+ConnectionManager::AcceptStats ConnectionManager::getAcceptStats() {
+    Lock l(cs);
+    AcceptStats stats = { accepted, filtered, acceptErrors, acceptRate };
+    return stats;
+}
+
 void ConnectionManager::addCTM2HUB(const string &server, const string &port)
 {
     Lock l(cs);
@@ -371,9 +569,7 @@ void ConnectionManager::adcConnect(const OnlineUser& aUser, uint16_t aPort, uint
 
 void ConnectionManager::disconnect() noexcept {
     delete server;
-    delete secureServer;
-
-    server = secureServer = 0;
+    server = 0;
 }
 
 void ConnectionManager::on(AdcCommand::SUP, UserConnection* aSource, const AdcCommand& cmd) noexcept {
@@ -766,6 +962,7 @@ void ConnectionManager::failed(UserConnection* aSource, const string& aError, bo
             cqi->setState(ConnectionQueueItem::WAITING);
             cqi->setLastAttempt(GET_TICK());
             cqi->setErrors(protocolError ? -1 : (cqi->getErrors() + 1));
+            ++failedAttempts;
             fire(ConnectionManagerListener::Failed(), cqi, aError);
         } else if(aSource->isSet(UserConnection::FLAG_UPLOAD)) {
             auto i = find(uploads.begin(), uploads.end(), aSource->getUser());
@@ -794,6 +991,13 @@ void ConnectionManager::disconnect(const UserPtr& aUser) {
     }
 }
 
+void ConnectionManager::disconnect(const UserConnection* aConn, const UserPtr& aUser) {
+    Lock l(cs);
+    auto i = find(userConnections.begin(), userConnections.end(), aConn);
+    if(i != userConnections.end() && (*i)->getUser() == aUser)
+        (*i)->disconnect(true);
+}
+
 void ConnectionManager::disconnect(const UserPtr& aUser, int isDownload) {
     Lock l(cs);
     for(auto i = userConnections.begin(); i != userConnections.end(); ++i) {
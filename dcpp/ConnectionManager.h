@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "TimerManager.h"
 #include "UserConnection.h"
 #include "User.h"
@@ -44,13 +46,17 @@ public:
     };
 
     ConnectionQueueItem(const HintedUser& aUser, bool aDownload) : token(Util::toString(Util::rand())),
-                lastAttempt(0), errors(0), state(WAITING), download(aDownload), user(aUser) { }
+                lastAttempt(0), errors(0), state(WAITING), download(aDownload), priority(0), lastPriorityCheck(0),
+                user(aUser) { }
 
     GETSET(string, token, Token);
     GETSET(uint64_t, lastAttempt, LastAttempt);
     GETSET(int, errors, Errors); // Number of connection errors, or -1 after a protocol error
     GETSET(State, state, State);
     GETSET(bool, download, Download);
+    /** QueueItem::Priority of the best download from the user, attempts are made in its order */
+    GETSET(int, priority, Priority);
+    GETSET(uint64_t, lastPriorityCheck, LastPriorityCheck);
 
     const HintedUser& getUser() const { return user; }
 
@@ -108,6 +114,8 @@ public:
 
     void disconnect(const UserPtr& aUser); // disconnect downloads and uploads
     void disconnect(const UserPtr& aUser, int isDownload);
+    /** Disconnect aConn of aUser only, if it's still there */
+    void disconnect(const UserConnection* aConn, const UserPtr& aUser);
 
     void shutdown();
 
@@ -115,27 +123,65 @@ public:
     void listen();
     void disconnect() noexcept;
 
-    uint16_t getPort() { return server ? static_cast<uint16_t>(server->getPort()) : 0; }
-    uint16_t getSecurePort() { return secureServer ? static_cast<uint16_t>(secureServer->getPort()) : 0; }
+    uint16_t getPort() { return server ? server->getPort(false) : 0; }
+    uint16_t getSecurePort() { return server ? server->getPort(true) : 0; }
 
     void addCTM2HUB(const string &server, const string &port);
 
+    struct AttemptStats {
+        /** Download connections waiting for an attempt */
+        size_t waiting;
+        /** Attempts that haven't connected or timed out yet */
+        size_t connecting;
+        uint64_t attempts;
+        uint64_t failed;
+    };
+    AttemptStats getAttemptStats();
+
+    struct AcceptStats {
+        /** Incoming connections handed over to a UserConnection */
+        uint64_t accepted;
+        /** Incoming connections closed because of the IP filter */
+        uint64_t filtered;
+        uint64_t errors;
+        /** Connections accepted per second, averaged over the last ACCEPT_RATE_TIME */
+        double rate;
+    };
+    AcceptStats getAcceptStats();
+
 private:
 
     unordered_set<string> ddosctm2hub;
 
+    /**
+     * Listens on the plain and the TLS port from a single thread. On Linux both sockets
+     * are watched through epoll, elsewhere with select; every wake-up drains the backlog
+     * of the socket that woke us.
+     */
     class Server : public Thread {
     public:
-        Server(bool secure_, uint16_t port, const string& ip = "0.0.0.0");
-        uint16_t getPort() { return port; }
-        virtual ~Server() { die = true; join(); }
+        Server(const string& ip = "0.0.0.0");
+        virtual ~Server();
+
+        /** (Re)binds the plain or the secure listening socket, must be called before start() */
+        void listen(bool secure, uint16_t aPort);
+        uint16_t getPort(bool secure) const { return listeners[secure].port; }
     private:
         virtual int run() noexcept;
 
-        Socket sock;
-        uint16_t port;
+        struct Listener {
+            Socket sock;
+            uint16_t port;
+        };
+
+        /** @return Number of sockets ready, their indexes (the secure flag) are stored in ready */
+        int wait(bool* ready);
+
+        Listener listeners[2];
         string ip;
-        bool secure;
+#ifdef __linux__
+        int epfd;
+#endif
         bool die;
     };
 
@@ -157,8 +203,17 @@ private:
 
     uint32_t floodCounter;
 
+    uint64_t attempts;
+    uint64_t failedAttempts;
+
     Server* server;
-    Server* secureServer;
+
+    std::atomic<uint64_t> accepted;
+    std::atomic<uint64_t> filtered;
+    std::atomic<uint64_t> acceptErrors;
+    uint64_t lastAccepted;
+    uint64_t lastAcceptTick;
+    double acceptRate;
 
     bool shuttingDown;
 
@@ -178,7 +233,8 @@ private:
 
     bool checkKeyprint(UserConnection *aSource);
 
-    void accept(const Socket& sock, bool secure) noexcept;
+    /** Accepts the connections waiting on a listening socket, at most ACCEPT_BATCH at a time */
+    void accept(Socket& sock, bool secure) noexcept;
 
     void failed(UserConnection* aSource, const string& aError, bool protocolError);
 
@@ -39,7 +39,7 @@ static const char ciphersuites[] =
         "ECDHE-RSA-AES256-SHA384:ECDHE-RSA-AES128-SHA256:"
         "ECDHE-ECDSA-AES256-SHA:ECDHE-RSA-AES256-SHA:ECDHE-RSA-AES128-SHA:"
         "DHE-RSA-AES256-SHA:DHE-RSA-AES128-SHA:"
-        "AES256-GCM-SHA384:AES256-SHA256:AES256-SHA:AES128-SHA"
+        "AES256-GCM-SHA384:AES256-SHA256:AES256-SHA:AES128-SHA:"
         "!aNULL:!eNULL:!EXPORT:!DES:!RC4:!3DES:!MD5:!PSK";
 
 CryptoManager::CryptoManager()
@@ -109,10 +109,19 @@ CryptoManager::CryptoManager()
                 };
 
         if(dh) {
-            dh->p = BN_bin2bn(dh4096_p, sizeof(dh4096_p), 0);
-            dh->g = BN_bin2bn(dh4096_g, sizeof(dh4096_g), 0);
-
-            if(!dh->p || !dh->g) {
+            BIGNUM* p = BN_bin2bn(dh4096_p, sizeof(dh4096_p), 0);
+            BIGNUM* g = BN_bin2bn(dh4096_g, sizeof(dh4096_g), 0);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+            if(!p || !g || !DH_set0_pqg(dh, p, NULL, g)) {
+                BN_free(p);
+                BN_free(g);
+#else
+            dh->p = p;
+            dh->g = g;
+
+            if(!p || !g) {
+#endif
                 dh.reset();
             } else {
                 SSL_CTX_set_options(serverContext, SSL_OP_SINGLE_DH_USE);
@@ -142,14 +151,36 @@ CryptoManager::CryptoManager()
             EC_KEY_free(tmp_ecdh);
         }
 
+        // our list has ECDHE first, don't let clients talk us into the far slower 4096 bit DHE
+        SSL_CTX_set_options(serverContext, SSL_OP_CIPHER_SERVER_PREFERENCE);
+        SSL_CTX_set_options(serverVerContext, SSL_OP_CIPHER_SERVER_PREFERENCE);
+
         SSL_CTX_set_verify(serverContext, SSL_VERIFY_NONE, 0);
         SSL_CTX_set_verify(clientContext, SSL_VERIFY_NONE, 0);
         SSL_CTX_set_verify(clientVerContext, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, 0);
         SSL_CTX_set_verify(serverVerContext, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, 0);
+
+        // Peers reconnect all the time for lists, trees and further segments; let them skip the
+        // key exchange. Servers keep sessions in OpenSSL's cache and hand out tickets, clients
+        // remember them per peer. The keyprint check still sees the certificate of a resumed session.
+        static const unsigned char sidContext[] = "dcpp";
+        static const unsigned char sidVerContext[] = "dcpp-verified";
+        SSL_CTX_set_session_cache_mode(serverContext, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(serverContext, sidContext, sizeof(sidContext) - 1);
+        SSL_CTX_set_session_cache_mode(serverVerContext, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(serverVerContext, sidVerContext, sizeof(sidVerContext) - 1);
+
+        SSL_CTX_set_session_cache_mode(clientContext, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(clientContext, newSession);
+        SSL_CTX_set_session_cache_mode(clientVerContext, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(clientVerContext, newSession);
     }
 }
 
 CryptoManager::~CryptoManager() {
+    for(auto i = sessions.begin(); i != sessions.end(); ++i) {
+        SSL_SESSION_free(i->second);
+    }
 }
 
 bool CryptoManager::TLSOk() const noexcept {
@@ -392,6 +423,54 @@ SSLSocket* CryptoManager::getServerSocket(bool allowUntrusted) {
     return new SSLSocket(allowUntrusted ? serverContext : serverVerContext);
 }
 
+int CryptoManager::newSession(::SSL* ssl, SSL_SESSION* session) {
+    SSLSocket* s = static_cast<SSLSocket*>(SSL_get_app_data(ssl));
+    if(!s || s->peer.empty()) {
+        return 0;
+    }
+
+    getInstance()->putSession(SSL_get_SSL_CTX(ssl), s->peer, session);
+    return 1;
+}
+
+void CryptoManager::putSession(SSL_CTX* ctx, const string& aPeer, SSL_SESSION* session) {
+    Lock l(sessionCS);
+
+    if(sessions.size() >= MAX_SESSIONS) {
+        // drop the expired ones, or everything when they're all still good
+        long now = static_cast<long>(time(NULL));
+        for(auto i = sessions.begin(); i != sessions.end();) {
+            if(SSL_SESSION_get_time(i->second) + SSL_SESSION_get_timeout(i->second) < now) {
+                SSL_SESSION_free(i->second);
+                sessions.erase(i++);
+            } else {
+                ++i;
+            }
+        }
+        if(sessions.size() >= MAX_SESSIONS) {
+            for(auto i = sessions.begin(); i != sessions.end(); ++i) {
+                SSL_SESSION_free(i->second);
+            }
+            sessions.clear();
+        }
+    }
+
+    SSL_SESSION*& old = sessions[make_pair(ctx, aPeer)];
+    if(old) {
+        SSL_SESSION_free(old);
+    }
+    old = session;
+}
+
+void CryptoManager::resumeSession(::SSL* ssl, const string& aPeer) {
+    Lock l(sessionCS);
+    auto i = sessions.find(make_pair(SSL_get_SSL_CTX(ssl), aPeer));
+    if(i != sessions.end()) {
+        // takes its own reference
+        SSL_set_session(ssl, i->second);
+    }
+}
+
 
 void CryptoManager::decodeBZ2(const uint8_t* is, size_t sz, string& os) {
     bz_stream bs = { 0 };
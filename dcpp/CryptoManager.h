@@ -25,6 +25,7 @@
 #include "SettingsManager.h"
 #include "Exception.h"
 #include "Singleton.h"
+#include "CriticalSection.h"
 #include "SSLSocket.h"
 
 namespace dcpp {
@@ -44,6 +45,9 @@ public:
     SSLSocket* getClientSocket(bool allowUntrusted);
     SSLSocket* getServerSocket(bool allowUntrusted);
 
+    /** Offer the session from an earlier connection to aPeer, if there is one */
+    void resumeSession(::SSL* ssl, const string& aPeer);
+
     void loadCertificates() noexcept;
     void generateCertificate();
     bool checkCertificate() noexcept;
@@ -64,6 +68,17 @@ private:
 
     ssl::DH dh;
 
+    /** Client sessions by context and peer address, peers resume them when they still know them */
+    typedef map<pair<SSL_CTX*, string>, SSL_SESSION*> SessionMap;
+    SessionMap sessions;
+    CriticalSection sessionCS;
+
+    enum { MAX_SESSIONS = 1024 };
+
+    /** Called by OpenSSL with every new client session, once the peer has sent it */
+    static int newSession(::SSL* ssl, SSL_SESSION* session);
+    void putSession(SSL_CTX* ctx, const string& aPeer, SSL_SESSION* session);
+
     bool certsLoaded;
 
     vector<uint8_t> keyprint;
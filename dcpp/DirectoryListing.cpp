@@ -31,6 +31,9 @@
 #include "ShareManager.h"
 #include "SimpleXMLReader.h"
 #include "File.h"
+#include "Thread.h"
+
+#include <functional>
 
 #ifdef ff
 #undef ff
@@ -38,16 +41,73 @@
 
 namespace dcpp {
 
+class DirectoryListing::Loader : public Thread {
+public:
+    Loader(DirectoryListing& aList, const string& aName) : list(aList), name(aName) { }
+
+private:
+    virtual int run() {
+        setThreadName("ListLoader");
+        try {
+            list.loadFile(name);
+        } catch(const Exception& e) {
+            if(!list.aborting)
+                list.fire(DirectoryListingListener::Failed(), &list, e.getError());
+            return 0;
+        }
+
+        if(!list.aborting)
+            list.fire(DirectoryListingListener::Loaded(), &list);
+        return 0;
+    }
+
+    DirectoryListing& list;
+    string name;
+};
+
+/** Keeps track of how far into the file the parser has got, and stops it when the listing goes away */
+class ProgressInputStream : public InputStream {
+public:
+    typedef std::function<int64_t ()> PosF;
+
+    ProgressInputStream(InputStream& aStream, const PosF& aPos, int64_t aSize, DirectoryListing& aList) :
+        s(aStream), getPos(aPos), size(aSize), list(aList) { }
+
+    virtual size_t read(void* buf, size_t& len) {
+        if(list.aborting)
+            throw Exception(_("Aborted"));
+
+        size_t n = s.read(buf, len);
+        list.setProgress(getPos(), size);
+        return n;
+    }
+
+private:
+    InputStream& s;
+    PosF getPos;
+    int64_t size;
+    DirectoryListing& list;
+};
+
 DirectoryListing::DirectoryListing(const HintedUser& aUser) :
 user(aUser),
-root(new Directory(NULL, Util::emptyString, false, false))
+root(new Directory(NULL, Util::emptyString, false, false)),
+aborting(false),
+progress(-1)
 {
 }
 
 DirectoryListing::~DirectoryListing() {
+    abort();
     delete root;
 }
 
+void DirectoryListing::abort() {
+    aborting = true;
+    if(loader)
+        loader->join();
+}
+
 UserPtr DirectoryListing::getUserFromFilename(const string& fileName) {
     // General file list name format: [username].[CID].[xml|xml.bz2]
 
@@ -81,17 +141,45 @@ UserPtr DirectoryListing::getUserFromFilename(const string& fileName) {
 }
 
 void DirectoryListing::loadFile(const string& name) {
-    string txt;
-
     // For now, we detect type by ending...
     string ext = Util::getFileExt(name);
 
     dcpp::File ff(name, dcpp::File::READ, dcpp::File::OPEN);
+    int64_t size = ff.getSize();
+    ProgressInputStream::PosF filePos = std::bind(&dcpp::File::getPos, &ff);
+
     if(Util::stricmp(ext, ".bz2") == 0) {
-        FilteredInputStream<UnBZFilter, false> f(&ff);
-        loadXML(f, false);
+        // compressed lists are small enough to be kept in memory while their blocks are decoded in parallel
+        string data = ff.read();
+        ParallelUnBZStream pz(data);
+        if(pz.isSplit()) {
+            ProgressInputStream ps(pz, std::bind(&ParallelUnBZStream::getPos, &pz), size, *this);
+            loadXML(ps, false);
+        } else {
+            ff.setPos(0);
+            FilteredInputStream<UnBZFilter, false> f(&ff);
+            ProgressInputStream ps(f, filePos, size, *this);
+            loadXML(ps, false);
+        }
     } else if(Util::stricmp(ext, ".xml") == 0) {
-        loadXML(ff, false);
+        ProgressInputStream ps(ff, filePos, size, *this);
+        loadXML(ps, false);
+    }
+}
+
+void DirectoryListing::loadFileAsync(const string& name) {
+    if(loader)
+        loader->join();
+
+    loader.reset(new Loader(*this, name));
+    loader->start();
+}
+
+void DirectoryListing::setProgress(int64_t pos, int64_t size) {
+    int p = size > 0 ? static_cast<int>(min(pos, size) * 100 / size) : 0;
+    if(p != progress) {
+        progress = p;
+        fire(DirectoryListingListener::Progress(), this, p);
     }
 }
 
@@ -182,24 +270,21 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 
             DirectoryListing::File* f = new DirectoryListing::File(cur, n, size, tth);
 
-            string l_ts = "";
-
             if (!m_is_first_check_mediainfo_list){
                 m_is_first_check_mediainfo_list = true;
-                l_ts = getAttrib(attribs, sTS, 3);
-                m_is_mediainfo_list = !l_ts.empty();
-            }
-            else if (m_is_mediainfo_list) {
-                l_ts = getAttrib(attribs, sTS, 3);
+                m_is_mediainfo_list = !getAttrib(attribs, sTS, 3).empty();
             }
 
-            if (!l_ts.empty()){
-                f->setTS(atol(l_ts.c_str()));
-                f->setHit(atol(getAttrib(attribs, sHIT, 3).c_str()));
-                f->mediaInfo.video_info = getAttrib(attribs, sMVideo, 3);
-                f->mediaInfo.audio_info = getAttrib(attribs, sMAudio, 3);
-                f->mediaInfo.resolution = getAttrib(attribs, sWH, 3);
-                f->mediaInfo.bitrate    = atoi(getAttrib(attribs, sBR, 4).c_str());
+            if (m_is_mediainfo_list) {
+                const string& l_ts = getAttrib(attribs, sTS, 3);
+                if (!l_ts.empty()){
+                    MediaInfo mi;
+                    mi.video_info = getAttrib(attribs, sMVideo, 3);
+                    mi.audio_info = getAttrib(attribs, sMAudio, 3);
+                    mi.resolution = getAttrib(attribs, sWH, 3);
+                    mi.bitrate    = atoi(getAttrib(attribs, sBR, 4).c_str());
+                    f->setMediaInfo(atol(l_ts.c_str()), atol(getAttrib(attribs, sHIT, 3).c_str()), mi);
+                }
             }
 
             cur->files.push_back(f);
@@ -265,6 +350,9 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 void ListLoader::endTag(const string& name, const string&) {
     if(inListing) {
         if(name == sDirectory) {
+            // the directory is complete, don't keep the slack of the vectors around
+            cur->files.shrink_to_fit();
+            cur->directories.shrink_to_fit();
             cur = cur->getParent();
         } else if(name == sFileListing) {
             // cur should be root now...
@@ -273,6 +361,19 @@ void ListLoader::endTag(const string& name, const string&) {
     }
 }
 
+const MediaInfo& DirectoryListing::File::getMediaInfo() const {
+    static const MediaInfo empty = MediaInfo();
+    return extra ? extra->mediaInfo : empty;
+}
+
+void DirectoryListing::File::setMediaInfo(uint64_t aTS, uint64_t aHit, const MediaInfo& aMediaInfo) {
+    if(!extra)
+        extra.reset(new Extra);
+    extra->ts = aTS;
+    extra->hit = aHit;
+    extra->mediaInfo = aMediaInfo;
+}
+
 string DirectoryListing::getPath(const Directory* d) const {
     if(d == root)
         return "";
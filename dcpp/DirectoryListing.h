@@ -24,12 +24,17 @@
 #include "MerkleTree.h"
 #include "Streams.h"
 #include "MediaInfo.h"
+#include "Speaker.h"
+#include "DirectoryListingListener.h"
+
+#include <atomic>
+#include <memory>
 
 namespace dcpp {
 
 class ListLoader;
 
-class DirectoryListing : boost::noncopyable
+class DirectoryListing : public Speaker<DirectoryListingListener>, boost::noncopyable
 {
 public:
     class Directory;
@@ -50,7 +55,8 @@ public:
         {
         }
 
-        File(const File& rhs, bool _adls = false) : name(rhs.name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot), adls(_adls)
+        File(const File& rhs, bool _adls = false) : name(rhs.name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot),
+            extra(rhs.extra ? new Extra(*rhs.extra) : nullptr), adls(_adls)
         {
         }
 
@@ -65,10 +71,23 @@ public:
         GETSET(int64_t, size, Size);
         GETSET(Directory*, parent, Parent);
         GETSET(TTHValue, tthRoot, TTH);
+
+        uint64_t getTS() const { return extra ? extra->ts : 0; }
+        uint64_t getHit() const { return extra ? extra->hit : 0; }
+        /** Empty unless the list came with media info */
+        const MediaInfo& getMediaInfo() const;
+        void setMediaInfo(uint64_t aTS, uint64_t aHit, const MediaInfo& aMediaInfo);
+
+    private:
+        /** Only lists with media info have these, most files go without */
+        struct Extra {
+            uint64_t ts;
+            uint64_t hit;
+            MediaInfo mediaInfo;
+        };
+        std::unique_ptr<Extra> extra;
+
         GETSET(bool, adls, Adls);
-        GETSET(uint64_t, ts, TS);
-        GETSET(uint64_t, hit, Hit);
-        MediaInfo mediaInfo;
     };
 
     class Directory : public FastAlloc<Directory>, boost::noncopyable {
@@ -129,6 +148,13 @@ public:
     ~DirectoryListing();
 
     void loadFile(const string& name);
+    /**
+     * Load the list on a thread of its own, Loaded or Failed is fired from that
+     * thread once it's done. The listing mustn't be used until then.
+     */
+    void loadFileAsync(const string& name);
+    /** Stop a running loadFileAsync and wait for its thread, Loaded or Failed may still be fired */
+    void abort();
 
     string updateXML(const std::string&);
     string loadXML(InputStream& xml, bool updating);
@@ -159,9 +185,19 @@ public:
 
 private:
     friend class ListLoader;
+    friend class ProgressInputStream;
+
+    class Loader;
+
+    void setProgress(int64_t pos, int64_t size);
 
     Directory* root;
 
+    std::unique_ptr<Loader> loader;
+    /** Set when the listing is destroyed while still loading */
+    std::atomic<bool> aborting;
+    int progress;
+
 };
 
 inline bool operator==(DirectoryListing::Directory::Ptr a, const string& b) { return Util::stricmp(a->getName(), b) == 0; }
@@ -0,0 +1,42 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "forward.h"
+#include "noexcept.h"
+
+namespace dcpp {
+
+class DirectoryListing;
+
+class DirectoryListingListener {
+public:
+    virtual ~DirectoryListingListener() { }
+    template<int I> struct X { enum { TYPE = I }; };
+
+    typedef X<0> Progress;
+    typedef X<1> Loaded;
+    typedef X<2> Failed;
+
+    /** Percentage of the file read so far */
+    virtual void on(Progress, DirectoryListing*, int) noexcept { }
+    virtual void on(Loaded, DirectoryListing*) noexcept { }
+    virtual void on(Failed, DirectoryListing*, const string&) noexcept { }
+};
+
+} // namespace dcpp
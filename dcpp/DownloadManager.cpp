@@ -286,6 +286,7 @@ void DownloadManager::startData(UserConnection* aSource, int64_t start, int64_t
             failDownload(aSource, e.getError());
         }
     } else {
+        aSource->setThrottle(d->getType() == Transfer::TYPE_FILE ? ThrottleManager::CLASS_NORMAL : ThrottleManager::CLASS_FILELIST);
         aSource->setDataMode();
     }
 }
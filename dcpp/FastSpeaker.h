@@ -0,0 +1,250 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "CriticalSection.h"
+#include "debug.h"
+#include "noexcept.h"
+
+namespace dcpp {
+
+using std::vector;
+
+/** A fire() of any FastSpeaker running on the current thread */
+struct FastSpeakerFire {
+    const void* speaker;
+    unsigned idx;
+    FastSpeakerFire* prev;
+};
+
+/** Innermost fire() on the current thread, the others are linked through prev */
+inline FastSpeakerFire*& fastSpeakerFires() {
+    static DCPP_THREAD_LOCAL FastSpeakerFire* top = nullptr;
+    return top;
+}
+
+/**
+ * Speaker for events fired from hot paths (socket reads/writes, timer ticks).
+ *
+ * The listener list is an immutable array that is replaced as a whole when
+ * listeners are added or removed, so fire() takes no lock and allocates nothing.
+ * Readers announce themselves in one of two counters selected by the current
+ * epoch.
+ *
+ * Removing a listener marks it as removed, fire() skips it from then on even when
+ * iterating over an older array. Like with Speaker, removeListener() then waits for
+ * fires that are running on other threads (by flipping the epoch twice and waiting
+ * for each counter to drain), but not for those further up its own stack. Once it
+ * returns the listener won't be called again and may be deleted.
+ *
+ * A replaced array is deleted once both counters have been seen at 0 after it was
+ * replaced; this is checked by writers and at the end of fire() while there are
+ * arrays left to delete, so arrays replaced from inside a fire() are freed once it
+ * returns.
+ */
+template<typename Listener>
+class FastSpeaker {
+    struct Entry {
+        Entry(Listener* aListener) : listener(aListener), removed(false) { }
+        Listener* listener;
+        std::atomic<bool> removed;
+    };
+    typedef vector<Entry*> ListenerList;
+
+    /** A replaced array and the entries removed with it */
+    struct Retired {
+        const ListenerList* list;
+        vector<Entry*> entries;
+        /** Bit per reader counter that was seen at 0 since */
+        unsigned drained;
+    };
+
+public:
+    FastSpeaker() noexcept : listeners(new ListenerList()), epoch(0), pending(false) {
+        readers[0] = 0;
+        readers[1] = 0;
+    }
+    virtual ~FastSpeaker() {
+        const ListenerList* l = listeners.load();
+        for(auto i = l->begin(); i != l->end(); ++i)
+            delete *i;
+        delete l;
+        for(auto i = retired.begin(); i != retired.end(); ++i)
+            destroy(*i);
+    }
+
+    template<typename... T>
+    void fire(T&&... type) noexcept {
+        {
+            ReadGuard g(this);
+            const ListenerList* l = listeners.load();
+            for(auto i = l->begin(); i != l->end(); ++i) {
+                if(!(*i)->removed.load())
+                    (*i)->listener->on(std::forward<T>(type)...);
+            }
+        }
+        if(pending.load())
+            collect();
+    }
+
+    void addListener(Listener* aListener) {
+        Lock l(writeCS);
+        const ListenerList* cur = listeners.load();
+        if(find(cur, aListener) == cur->end()) {
+            ListenerList* tmp = new ListenerList(*cur);
+            tmp->push_back(new Entry(aListener));
+            retire(listeners.exchange(tmp), vector<Entry*>());
+        }
+    }
+
+    void removeListener(Listener* aListener) {
+        {
+            Lock l(writeCS);
+            const ListenerList* cur = listeners.load();
+            auto it = find(cur, aListener);
+            if(it == cur->end())
+                return;
+            (*it)->removed.store(true);
+            ListenerList* tmp = new ListenerList(cur->begin(), it);
+            tmp->insert(tmp->end(), it + 1, cur->end());
+            retire(listeners.exchange(tmp), vector<Entry*>(1, *it));
+        }
+        drain();
+    }
+
+    void removeListeners() {
+        {
+            Lock l(writeCS);
+            const ListenerList* cur = listeners.load();
+            if(cur->empty())
+                return;
+            for(auto i = cur->begin(); i != cur->end(); ++i)
+                (*i)->removed.store(true);
+            retire(listeners.exchange(new ListenerList()), *cur);
+        }
+        drain();
+    }
+
+protected:
+    bool hasListeners() const {
+        ReadGuard g(const_cast<FastSpeaker*>(this));
+        return !listeners.load()->empty();
+    }
+
+private:
+    class ReadGuard {
+    public:
+        ReadGuard(FastSpeaker* aSpeaker) : s(aSpeaker), top(fastSpeakerFires()) {
+            fire.speaker = s;
+            fire.idx = s->epoch.load() & 1;
+            fire.prev = top;
+            s->readers[fire.idx].fetch_add(1);
+            top = &fire;
+        }
+        ~ReadGuard() {
+            top = fire.prev;
+            s->readers[fire.idx].fetch_sub(1);
+        }
+    private:
+        FastSpeaker* s;
+        FastSpeakerFire*& top;
+        FastSpeakerFire fire;
+    };
+
+    static typename ListenerList::const_iterator find(const ListenerList* l, Listener* aListener) {
+        auto i = l->begin();
+        while(i != l->end() && (*i)->listener != aListener)
+            ++i;
+        return i;
+    }
+
+    /**
+     * Wait for the fires on other threads that started before a listener was marked as
+     * removed. Not holding writeCS here, a listener we wait for may add or remove
+     * listeners itself.
+     */
+    void drain() {
+        for(int i = 0; i < 2; ++i) {
+            // fires counted after the flip see the mark
+            unsigned idx = epoch.fetch_add(1) & 1;
+            long own = 0;
+            for(FastSpeakerFire* f = fastSpeakerFires(); f; f = f->prev) {
+                if(f->speaker == this && f->idx == idx)
+                    ++own;
+            }
+            while(readers[idx].load() > own)
+                std::this_thread::yield();
+        }
+        if(pending.load())
+            collect();
+    }
+
+    /** Called with writeCS held, right after old was replaced */
+    void retire(const ListenerList* old, const vector<Entry*>& entries) {
+        Retired r = { old, entries, 0 };
+        retired.push_back(r);
+        collect();
+    }
+
+    /** Delete the replaced arrays no fire() can be iterating over anymore */
+    void collect() {
+        Lock l(writeCS);
+        // a counter at 0 means that every fire() counted in it before has left,
+        // those that come later load the current array
+        for(unsigned idx = 0; idx < 2; ++idx) {
+            if(readers[idx].load() == 0) {
+                for(auto i = retired.begin(); i != retired.end(); ++i)
+                    i->drained |= 1 << idx;
+            }
+        }
+        for(auto i = retired.begin(); i != retired.end();) {
+            if(i->drained == 3) {
+                destroy(*i);
+                i = retired.erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        // send new readers to the other counter when it's empty so this one can drain
+        unsigned cur = epoch.load() & 1;
+        if(!retired.empty() && readers[cur].load() > 0 && readers[cur ^ 1].load() == 0)
+            epoch.fetch_add(1);
+        pending.store(!retired.empty());
+    }
+
+    static void destroy(const Retired& r) {
+        for(auto i = r.entries.begin(); i != r.entries.end(); ++i)
+            delete *i;
+        delete r.list;
+    }
+
+    std::atomic<const ListenerList*> listeners;
+    std::atomic<unsigned> epoch;
+    std::atomic<long> readers[2];
+    /** There are replaced arrays left to delete */
+    std::atomic<bool> pending;
+    CriticalSection writeCS;
+    vector<Retired> retired;
+};
+
+} // namespace dcpp
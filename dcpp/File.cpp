@@ -125,6 +125,22 @@ size_t File::read(void* buf, size_t& len) {
     return x;
 }
 
+size_t File::readAt(void* buf, size_t len, int64_t pos) {
+    OVERLAPPED over = { 0 };
+    over.Offset = (DWORD)(pos & 0xffffffff);
+    over.OffsetHigh = (DWORD)(pos >> 32);
+    DWORD x;
+    if(!::ReadFile(h, buf, (DWORD)len, &x, &over)) {
+        if(GetLastError() == ERROR_HANDLE_EOF)
+            return 0;
+        throw(FileException(Util::translateError(GetLastError())));
+    }
+    return x;
+}
+
+void File::advise(int64_t /*pos*/, int64_t /*len*/, int /*advice*/) noexcept {
+}
+
 size_t File::write(const void* buf, size_t len) {
     DWORD x;
     if(!::WriteFile(h, buf, (DWORD)len, &x, NULL)) {
@@ -282,6 +298,26 @@ size_t File::read(void* buf, size_t& len) {
     return (size_t)result;
 }
 
+size_t File::readAt(void* buf, size_t len, int64_t pos) {
+    ssize_t result;
+    do {
+        result = ::pread(h, buf, len, (off_t)pos);
+    } while(result == -1 && errno == EINTR);
+    if(result == -1) {
+        throw FileException(Util::translateError(errno));
+    }
+    return (size_t)result;
+}
+
+void File::advise(int64_t pos, int64_t len, int advice) noexcept {
+#ifdef POSIX_FADV_WILLNEED
+    static const int advices[] = { POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED };
+    posix_fadvise(h, (off_t)pos, (off_t)len, advices[advice]);
+#else
+    (void)pos; (void)len; (void)advice;
+#endif
+}
+
 size_t File::write(const void* buf, size_t len) {
     ssize_t result;
     char* pointer = (char*)buf;
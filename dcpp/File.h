@@ -42,6 +42,13 @@ public:
         SHARED = 0x08
     };
 
+    /** How a range of the file is going to be read */
+    enum {
+        ADVISE_SEQUENTIAL,
+        ADVISE_WILLNEED,
+        ADVISE_DONTNEED
+    };
+
 #ifdef _WIN32
     enum {
         READ = GENERIC_READ,
@@ -63,6 +70,9 @@ public:
     // not sure if the client code needs this...
     int extendFile(int64_t len) noexcept;
 
+    /** For calls that hand the file to the kernel directly, like sendfile */
+    int getDescriptor() const noexcept { return h; }
+
 #endif // !_WIN32
 
     File(const string& aFileName, int access, int mode);
@@ -79,6 +89,10 @@ public:
     virtual void setEOF();
 
     virtual size_t read(void* buf, size_t& len);
+    /** Read at pos regardless of the current position, so several readers can share the handle */
+    size_t readAt(void* buf, size_t len, int64_t pos);
+    /** Pass a page cache hint to the OS, a no-op where it has no such interface */
+    void advise(int64_t pos, int64_t len, int advice) noexcept;
     virtual size_t write(const void* buf, size_t len);
     virtual size_t flush();
 
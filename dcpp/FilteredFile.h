@@ -197,6 +197,8 @@ public:
         return totalProduced;
     }
 
+    const Filter& getFilter() const { return filter; }
+
 private:
     static const size_t BUF_SIZE = 64*1024;
 
@@ -42,16 +42,18 @@ uint64_t HashBloom::get_m(size_t n, size_t k) {
 
 void HashBloom::add(const TTHValue& tth) {
     for(size_t i = 0; i < k; ++i) {
-        bloom[pos(tth, i)] = true;
+        size_t p = pos(tth, i);
+        words[p / 64] |= uint64_t(1) << (p % 64);
     }
 }
 
 bool HashBloom::match(const TTHValue& tth) const {
-    if(bloom.empty()) {
+    if(m == 0) {
         return false;
     }
     for(size_t i = 0; i < k; ++i) {
-        if(!bloom[pos(tth, i)]) {
+        size_t p = pos(tth, i);
+        if(!(words[p / 64] & (uint64_t(1) << (p % 64)))) {
             return false;
         }
     }
@@ -59,11 +61,18 @@ bool HashBloom::match(const TTHValue& tth) const {
 }
 
 void HashBloom::push_back(bool v) {
-    bloom.push_back(v);
+    if(m % 64 == 0) {
+        words.push_back(0);
+    }
+    if(v) {
+        words[m / 64] |= uint64_t(1) << (m % 64);
+    }
+    ++m;
 }
 
-void HashBloom::reset(size_t k_, size_t m, size_t h_) {
-    bloom.resize(m);
+void HashBloom::reset(size_t k_, size_t m_, size_t h_) {
+    words.assign((m_ + 63) / 64, 0);
+    m = m_;
     k = k_;
     h = h_;
 }
@@ -76,22 +85,28 @@ size_t HashBloom::pos(const TTHValue& tth, size_t n) const {
     uint64_t x = 0;
 
     size_t start = n * h;
-    for(size_t i = 0; i < h; ++i) {
-        size_t bit = start + i;
-        size_t byte = bit / 8;
-        size_t pos = bit % 8;
-
-        if(tth.data[byte] & (1 << pos)) {
-            x |= (1 << i);
+    if(h <= 56) {
+        // the bits are taken lsb first, so they're the bits of the little endian number the bytes form
+        size_t first = start / 8;
+        for(size_t i = (start + h - 1) / 8 + 1; i-- > first; ) {
+            x = (x << 8) | tth.data[i];
+        }
+        x = (x >> (start % 8)) & ((uint64_t(1) << h) - 1);
+    } else {
+        for(size_t i = 0; i < h; ++i) {
+            size_t bit = start + i;
+            if(tth.data[bit / 8] & (1 << (bit % 8))) {
+                x |= uint64_t(1) << i;
+            }
         }
     }
-    return x % bloom.size();
+    return x % m;
 }
 
 void HashBloom::copy_to(ByteVector& v) const {
-    v.resize(bloom.size() / 8);
-    for(size_t i = 0; i < bloom.size(); ++i) {
-        v[i/8] |= bloom[i] << (i % 8);
+    v.resize((m + 7) / 8);
+    for(size_t i = 0; i < v.size(); ++i) {
+        v[i] = static_cast<uint8_t>(words[i / 8] >> (i % 8 * 8));
     }
 }
 
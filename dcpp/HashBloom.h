@@ -33,7 +33,7 @@ namespace dcpp {
  */
 class HashBloom {
 public:
-    HashBloom() : k(0), h(0) { }
+    HashBloom() : m(0), k(0), h(0) { }
 
     /** Return a suitable value for k based on n */
     static size_t get_k(size_t n, size_t h);
@@ -45,12 +45,17 @@ public:
     void reset(size_t k, size_t m, size_t h);
     void push_back(bool v);
 
+    /** Whether the filter was set up for these parameters */
+    bool is(size_t k_, size_t m_, size_t h_) const { return k == k_ && m == m_ && h == h_; }
+
     void copy_to(ByteVector& v) const;
 private:
 
     size_t pos(const TTHValue& tth, size_t n) const;
 
-    std::vector<bool> bloom;
+    /** Bit i of the filter is bit i % 64 of word i / 64 */
+    std::vector<uint64_t> words;
+    size_t m;
     size_t k;
     size_t h;
 };
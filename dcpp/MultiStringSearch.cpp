@@ -0,0 +1,141 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdinc.h"
+
+#include "MultiStringSearch.h"
+#include "Text.h"
+
+#include <deque>
+
+namespace dcpp {
+
+MultiStringSearch::MultiStringSearch() : columns(1) {
+    memset(classes, 0, sizeof(classes));
+}
+
+size_t MultiStringSearch::add(const string& aPattern) {
+    string tmp;
+    auto i = patterns.insert(make_pair(toLower(aPattern, tmp), patterns.size()));
+    return i.first->second;
+}
+
+void MultiStringSearch::clear() {
+    patterns.clear();
+    nodes.clear();
+    table.clear();
+    memset(classes, 0, sizeof(classes));
+    columns = 1;
+}
+
+void MultiStringSearch::compile() {
+    nodes.clear();
+    table.clear();
+
+    // bytes no pattern uses all lead back to the root the same way
+    memset(classes, 0, sizeof(classes));
+    columns = 1;
+    for(auto i = patterns.begin(); i != patterns.end(); ++i) {
+        for(auto j = i->first.begin(); j != i->first.end(); ++j) {
+            uint8_t c = *j;
+            if(classes[c] == 0)
+                classes[c] = columns++;
+        }
+    }
+
+    // trie
+    nodes.push_back(Node());
+    table.resize(columns, NONE);
+    for(auto i = patterns.begin(); i != patterns.end(); ++i) {
+        int cur = 0;
+        for(auto j = i->first.begin(); j != i->first.end(); ++j) {
+            int next = delta(cur, *j);
+            if(next == NONE) {
+                next = nodes.size();
+                nodes.push_back(Node());
+                table.resize(nodes.size() * columns, NONE);
+                delta(cur, *j) = next;
+            }
+            cur = next;
+        }
+        if(cur != 0)
+            nodes[cur].out = i->second;
+    }
+
+    // failure links breadth first, filling in the missing transitions on the way
+    std::deque<int> queue;
+    for(size_t c = 0; c < columns; ++c) {
+        int& next = table[c];
+        if(next == NONE) {
+            next = 0;
+        } else {
+            nodes[next].fail = 0;
+            queue.push_back(next);
+        }
+    }
+
+    while(!queue.empty()) {
+        int cur = queue.front();
+        queue.pop_front();
+
+        const Node& f = nodes[nodes[cur].fail];
+        nodes[cur].dict = f.out != NONE ? nodes[cur].fail : f.dict;
+
+        for(size_t c = 0; c < columns; ++c) {
+            int& next = table[cur * columns + c];
+            int alt = table[nodes[cur].fail * columns + c];
+            if(next == NONE) {
+                next = alt;
+            } else {
+                nodes[next].fail = alt;
+                queue.push_back(next);
+            }
+        }
+    }
+}
+
+const string& MultiStringSearch::toLower(const string& aText, string& tmp) noexcept {
+    tmp.resize(aText.size());
+    for(size_t i = 0, n = aText.size(); i < n; ++i) {
+        uint8_t c = aText[i];
+        if(c & 0x80) {
+            // Text appends to what's there
+            tmp.clear();
+            return Text::toLower(aText, tmp);
+        }
+        tmp[i] = (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+    }
+    return tmp;
+}
+
+void MultiStringSearch::match(const string& aText, Matches& m) const noexcept {
+    m.found.assign(patterns.size(), false);
+    if(nodes.empty())
+        return;
+
+    const string& lower = toLower(aText, m.lower);
+    const int* t = &table[0];
+    int cur = 0;
+    for(auto i = lower.begin(); i != lower.end(); ++i) {
+        cur = t[cur * columns + classes[(uint8_t)*i]];
+        for(int n = nodes[cur].out != NONE ? cur : nodes[cur].dict; n != NONE; n = nodes[n].dict) {
+            m.found[nodes[n].out] = true;
+        }
+    }
+}
+
+} // namespace dcpp
@@ -0,0 +1,91 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "noexcept.h"
+
+namespace dcpp {
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Aho-Corasick automaton matching any number of substrings in a single pass
+ * over the text. Like StringSearch, patterns and texts are compared lower-cased.
+ * The automaton is a full DFA over the bytes used by the patterns, all other
+ * bytes share a single column.
+ */
+class MultiStringSearch {
+public:
+    /** Result of a match, keep it around between matches to not allocate each time */
+    struct Matches {
+        bool operator[](size_t i) const { return found[i]; }
+
+        vector<bool> found;
+        /** The lower-cased text */
+        string lower;
+    };
+
+    MultiStringSearch();
+
+    /**
+     * Add a pattern, the automaton has to be rebuilt with compile() before matching.
+     * @return Id of the pattern, patterns equal once lower-cased share the same id
+     */
+    size_t add(const string& aPattern);
+    void compile();
+
+    void clear();
+    bool empty() const { return patterns.empty(); }
+    /** Number of distinct patterns, ids are below this */
+    size_t size() const { return patterns.size(); }
+
+    /** Flag the ids of all patterns found in the text */
+    void match(const string& aText, Matches& m) const noexcept;
+
+private:
+    enum { NONE = -1 };
+
+    struct Node {
+        Node() : fail(0), out(NONE), dict(NONE) { }
+        int fail;
+        /** Pattern ending here */
+        int out;
+        /** Closest node on the fail chain that ends a pattern */
+        int dict;
+    };
+
+    int& delta(int node, uint8_t c) { return table[node * columns + classes[c]]; }
+
+    /** Lower-case the text, plain ASCII doesn't need to go through Text */
+    static const string& toLower(const string& aText, string& tmp) noexcept;
+
+    unordered_map<string, size_t> patterns;
+    vector<Node> nodes;
+    vector<int> table;
+    /** Column of each byte, 0 for the bytes no pattern uses; up to 257 columns */
+    uint16_t classes[256];
+    size_t columns;
+};
+
+} // namespace dcpp
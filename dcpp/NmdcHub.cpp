@@ -186,6 +186,7 @@ void NmdcHub::onLine(const string& aLine) noexcept {
         }
         string line = toUtf8(aLine);
         if(line[0] != '<') {
+            checkSearchFlood(line);
             fire(ClientListener::StatusMessage(), this, unescape(line));
             return;
         }
@@ -223,6 +224,10 @@ void NmdcHub::onLine(const string& aLine) noexcept {
             chatMessage.from = &o;
         }
 
+        const Identity& id = chatMessage.from->getIdentity();
+        if(id.isHub() || id.isBot() || id.isOp())
+            checkSearchFlood(chatMessage.text);
+
         fire(ClientListener::Message(), this, chatMessage);
         return;
     }
@@ -528,6 +528,8 @@ lastSave(0),
 queueFile(Util::getPath(Util::PATH_USER_CONFIG) + "Queue.xml"),
 rechecker(this),
 dirty(true),
+closing(false),
+saveTimer(0),
 nextSearch(0)
 {
     TimerManager::getInstance()->addListener(this);
@@ -542,6 +544,36 @@ QueueManager::~QueueManager() {
     TimerManager::getInstance()->removeListener(this);
     ClientManager::getInstance()->removeListener(this);
 
+    TimerManager::TimerId timer;
+    {
+        Lock l(cs);
+        closing = true;
+        timer = saveTimer;
+    }
+    // not under cs, it waits for a running onSaveTimer which takes cs
+    TimerManager::getInstance()->removeTimer(timer);
+
+    vector<DirectoryListing*> lists;
+    {
+        Lock l(cs);
+        for(auto i = loadingLists.begin(); i != loadingLists.end(); ++i)
+            lists.push_back(i->first);
+    }
+    // not under cs either, a loader may be in processList or listDone; once they're all
+    // joined every list is in loadedLists or still in loadingLists if it was aborted
+    for(auto i = lists.begin(); i != lists.end(); ++i)
+        (*i)->abort();
+
+    lists.clear();
+    {
+        Lock l(cs);
+        lists.swap(loadedLists);
+        for(auto i = loadingLists.begin(); i != loadingLists.end(); ++i)
+            lists.push_back(i->first);
+        loadingLists.clear();
+    }
+    for_each(lists.begin(), lists.end(), DeleteFunction());
+
     if(!BOOLSETTING(KEEP_LISTS)) {
         string path = Util::getListPath();
 
@@ -579,6 +611,13 @@ struct PartsInfoReqParam{
 };
 
 void QueueManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept {
+    vector<DirectoryListing*> lists;
+    {
+        Lock l(cs);
+        lists.swap(loadedLists);
+    }
+    for_each(lists.begin(), lists.end(), DeleteFunction());
+
     string fn;
     string searchString;
     vector<const PartsInfoReqParam*> params;
@@ -831,10 +870,27 @@ void QueueManager::readd(const string& target, const HintedUser& aUser) {
 }
 
 void QueueManager::setDirty() {
+    Lock l(cs);
     if(!dirty) {
         dirty = true;
         lastSave = GET_TICK();
     }
+    if(saveTimer == 0 && !closing) {
+        saveTimer = TimerManager::getInstance()->addTimer(10000,
+            std::bind(&QueueManager::onSaveTimer, this, std::placeholders::_1));
+    }
+}
+
+void QueueManager::onSaveTimer(uint64_t /*aTick*/) {
+    saveQueue();
+
+    // saveTimer keeps our id until now so that the destructor can wait for us
+    Lock l(cs);
+    saveTimer = 0;
+    if(dirty) {
+        // the save failed, try again later
+        setDirty();
+    }
 }
 
 string QueueManager::checkTarget(const string& aTarget, bool checkExistence) {
@@ -1396,13 +1452,32 @@ void QueueManager::putDownload(Download* aDownload, bool finished) noexcept {
 }
 
 void QueueManager::processList(const string& name, const HintedUser& user, int flags) {
-    DirectoryListing dirList(user);
+    // large lists take a while to parse, don't hold up the connection that brought it in
+    DirectoryListing* dirList = new DirectoryListing(user);
+    dirList->addListener(this);
+    {
+        Lock l(cs);
+        if(closing) {
+            delete dirList;
+            return;
+        }
+        loadingLists[dirList] = make_pair(name, flags);
+    }
+
     try {
-        dirList.loadFile(name);
-    } catch(const Exception&) {
+        dirList->loadFileAsync(name);
+    } catch(const ThreadException&) {
+        {
+            Lock l(cs);
+            loadingLists.erase(dirList);
+        }
+        delete dirList;
         LogManager::getInstance()->message(str(F_("Unable to open filelist: %1%") % Util::addBrackets(name)));
-        return;
     }
+}
+
+void QueueManager::processList(DirectoryListing& dirList, int flags) {
+    const HintedUser& user = dirList.getUser();
 
     if(flags & QueueItem::FLAG_DIRECTORY_DOWNLOAD) {
         DirectoryItem::List dl;
@@ -1428,6 +1503,44 @@ void QueueManager::processList(const string& name, const HintedUser& user, int f
     }
 }
 
+void QueueManager::listDone(DirectoryListing* dirList) {
+    Lock l(cs);
+    loadingLists.erase(dirList);
+    loadedLists.push_back(dirList);
+}
+
+void QueueManager::on(DirectoryListingListener::Loaded, DirectoryListing* dirList) noexcept {
+    int flags;
+    {
+        Lock l(cs);
+        auto i = loadingLists.find(dirList);
+        if(i == loadingLists.end() || closing)
+            return;
+        flags = i->second.second;
+    }
+
+    try {
+        processList(*dirList, flags);
+    } catch(const Exception& e) {
+        LogManager::getInstance()->message(e.getError());
+    }
+    listDone(dirList);
+}
+
+void QueueManager::on(DirectoryListingListener::Failed, DirectoryListing* dirList, const string&) noexcept {
+    string name;
+    {
+        Lock l(cs);
+        auto i = loadingLists.find(dirList);
+        if(i == loadingLists.end())
+            return;
+        name = i->second.first;
+    }
+
+    LogManager::getInstance()->message(str(F_("Unable to open filelist: %1%") % Util::addBrackets(name)));
+    listDone(dirList);
+}
+
 void QueueManager::recheck(const string& aTarget) {
     rechecker.add(aTarget);
 }
@@ -1904,12 +2017,6 @@ void QueueManager::on(ClientManagerListener::UserDisconnected, const UserPtr& aU
     }
 }
 
-void QueueManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept {
-    if(dirty && ((lastSave + 10000) < aTick)) {
-        saveQueue();
-    }
-}
-
 bool QueueManager::handlePartialResult(const UserPtr& aUser, const string& hubHint, const TTHValue& tth, const QueueItem::PartialSource& partialSource, PartsInfo& outPartialInfo) {
     bool wantConnection = false;
     dcassert(outPartialInfo.empty());
@@ -66,7 +66,7 @@ class ConnectionQueueItem;
 class QueueLoader;
 
 class QueueManager : public Singleton<QueueManager>, public Speaker<QueueManagerListener>, private TimerManagerListener,
-    private SearchManagerListener, private ClientManagerListener
+    private SearchManagerListener, private ClientManagerListener, private DirectoryListingListener
 {
 public:
     //NOTE: freedcpp
@@ -266,16 +266,26 @@ private:
     StringList recent;
     /** The queue needs to be saved */
     bool dirty;
+    /** Set by the destructor, no more saves are scheduled and no more lists loaded */
+    bool closing;
+    /** Pending save of a dirty queue */
+    TimerManager::TimerId saveTimer;
     /** Next search */
     uint64_t nextSearch;
     /** File lists not to delete */
     StringList protectedFileLists;
+    /** File lists being loaded by processList, with their file name and flags */
+    unordered_map<DirectoryListing*, pair<string, int> > loadingLists;
+    /** Loaded lists, deleted on the next minute tick once their loader is done */
+    vector<DirectoryListing*> loadedLists;
     /** Sanity check for the target filename */
     static string checkTarget(const string& aTarget, bool checkExsistence);
     /** Add a source to an existing queue item */
     bool addSource(QueueItem* qi, const HintedUser& aUser, Flags::MaskType addBad);
 
     void processList(const string& name, const HintedUser& user, int flags);
+    void processList(DirectoryListing& dirList, int flags);
+    void listDone(DirectoryListing* dirList);
 
     void load(const SimpleXML& aXml);
     void moveFile(const string& source, const string& target);
@@ -284,6 +294,7 @@ private:
     void rechecked(QueueItem* qi);
 
     void setDirty();
+    void onSaveTimer(uint64_t aTick);
 
     string getListPath(const HintedUser& user);
 
@@ -293,7 +304,6 @@ private:
     void logFinishedDownload(QueueItem* qi, Download* d, bool crcError);
 
     // TimerManagerListener
-    virtual void on(TimerManagerListener::Second, uint64_t aTick) noexcept;
     virtual void on(TimerManagerListener::Minute, uint64_t aTick) noexcept;
 
     // SearchManagerListener
@@ -302,6 +312,10 @@ private:
     // ClientManagerListener
     virtual void on(ClientManagerListener::UserConnected, const UserPtr& aUser) noexcept;
     virtual void on(ClientManagerListener::UserDisconnected, const UserPtr& aUser) noexcept;
+
+    // DirectoryListingListener
+    virtual void on(DirectoryListingListener::Loaded, DirectoryListing* dirList) noexcept;
+    virtual void on(DirectoryListingListener::Failed, DirectoryListing* dirList, const string& aError) noexcept;
 };
 
 } // namespace dcpp
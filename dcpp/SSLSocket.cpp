@@ -19,19 +19,32 @@
 #include "stdinc.h"
 
 #include "SSLSocket.h"
+#include "CryptoManager.h"
+#include "File.h"
 #include "LogManager.h"
 #include "SettingsManager.h"
 #include "format.h"
 
 #include <openssl/err.h>
 
+#if !defined(_WIN32) && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define DCPP_KTLS 1
+#endif
+
 namespace dcpp {
 
+std::atomic<uint64_t> SSLSocket::fullHandshakes(0);
+std::atomic<uint64_t> SSLSocket::resumedHandshakes(0);
+std::atomic<uint64_t> SSLSocket::fullMicros(0);
+std::atomic<uint64_t> SSLSocket::resumedMicros(0);
+std::atomic<uint64_t> SSLSocket::kernelHandshakes(0);
+
 SSLSocket::SSLSocket(SSL_CTX* context) : ctx(context), ssl(0) {
 
 }
 
 void SSLSocket::connect(const string& aIp, uint16_t aPort) {
+    peer = aIp + ':' + Util::toString(aPort);
     Socket::connect(aIp, aPort);
 
     waitConnected(0);
@@ -47,6 +60,13 @@ bool SSLSocket::waitConnected(uint32_t millis) {
             checkSSL(-1);
 
         checkSSL(SSL_set_fd(ssl, sock));
+        setup();
+
+        if(!SSL_is_server(ssl) && !peer.empty()) {
+            SSL_set_app_data(ssl, this);
+            CryptoManager::getInstance()->resumeSession(ssl, peer);
+        }
+        handshakeStart = std::chrono::steady_clock::now();
     }
 
     if(SSL_is_init_finished(ssl)) {
@@ -54,9 +74,10 @@ bool SSLSocket::waitConnected(uint32_t millis) {
     }
 
     while(true) {
-        int ret = ssl->server?SSL_accept(ssl):SSL_connect(ssl);
+        int ret = SSL_is_server(ssl)?SSL_accept(ssl):SSL_connect(ssl);
         if(ret == 1) {
-            dcdebug("Connected to SSL server using %s as %s\n", SSL_get_cipher(ssl), ssl->server?"server":"client");
+            dcdebug("Connected to SSL server using %s as %s\n", SSL_get_cipher(ssl), SSL_is_server(ssl)?"server":"client");
+            handshakeDone();
             return true;
         }
         if(!waitWant(ret, millis)) {
@@ -71,6 +92,12 @@ void SSLSocket::accept(const Socket& listeningSocket) {
     waitAccepted(0);
 }
 
+void SSLSocket::accept(socket_t aSock, const string& aIp) {
+    Socket::accept(aSock, aIp);
+
+    waitAccepted(0);
+}
+
 bool SSLSocket::waitAccepted(uint32_t millis) {
     if(!ssl) {
         if(!Socket::waitAccepted(millis)) {
@@ -81,6 +108,8 @@ bool SSLSocket::waitAccepted(uint32_t millis) {
             checkSSL(-1);
 
         checkSSL(SSL_set_fd(ssl, sock));
+        setup();
+        handshakeStart = std::chrono::steady_clock::now();
     }
 
     if(SSL_is_init_finished(ssl)) {
@@ -91,6 +120,7 @@ bool SSLSocket::waitAccepted(uint32_t millis) {
         int ret = SSL_accept(ssl);
         if(ret == 1) {
             dcdebug("Connected to SSL client using %s\n", SSL_get_cipher(ssl));
+            handshakeDone();
             return true;
         }
         if(!waitWant(ret, millis)) {
@@ -99,6 +129,33 @@ bool SSLSocket::waitAccepted(uint32_t millis) {
     }
 }
 
+void SSLSocket::setup() {
+#ifdef DCPP_KTLS
+    // OpenSSL quietly stays in user space when the kernel lacks the tls module
+    // or the negotiated cipher has no kernel implementation
+    if(BOOLSETTING(USE_KERNEL_TLS))
+        SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+void SSLSocket::handshakeDone() {
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - handshakeStart).count();
+    if(SSL_session_reused(ssl)) {
+        ++resumedHandshakes;
+        resumedMicros += micros;
+    } else {
+        ++fullHandshakes;
+        fullMicros += micros;
+    }
+    if(canSendFile())
+        ++kernelHandshakes;
+}
+
+SSLSocket::HandshakeStats SSLSocket::getHandshakeStats() {
+    HandshakeStats stats = { fullHandshakes, resumedHandshakes, fullMicros, resumedMicros, kernelHandshakes };
+    return stats;
+}
+
 bool SSLSocket::waitWant(int ret, uint32_t millis) {
     int err = SSL_get_error(ssl, ret);
     switch(err) {
@@ -139,6 +196,29 @@ int SSLSocket::write(const void* aBuffer, int aLen) {
     return ret;
 }
 
+bool SSLSocket::canSendFile() const noexcept {
+#ifdef DCPP_KTLS
+    return ssl && BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    return false;
+#endif
+}
+
+int SSLSocket::sendFile(File& aFile, int64_t aPos, int aLen) {
+#ifdef DCPP_KTLS
+    if(!ssl) {
+        return -1;
+    }
+    int ret = checkSSL(static_cast<int>(SSL_sendfile(ssl, aFile.getDescriptor(), aPos, aLen, 0)));
+    if(ret > 0) {
+        stats.totalUp += ret;
+    }
+    return ret;
+#else
+    return Socket::sendFile(aFile, aPos, aLen);
+#endif
+}
+
 int SSLSocket::checkSSL(int ret) {
     if(!ssl) {
         return -1;
@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+
 #include "Socket.h"
 #include "Singleton.h"
 #include "SSL.h"
@@ -46,6 +49,7 @@ public:
     virtual ~SSLSocket() { }
 
     virtual void accept(const Socket& listeningSocket);
+    virtual void accept(socket_t aSock, const string& aIp);
     virtual void connect(const string& aIp, uint16_t aPort);
     virtual int read(void* aBuffer, int aBufLen);
     virtual int write(const void* aBuffer, int aLen);
@@ -58,9 +62,23 @@ public:
     virtual std::string getCipherName() const noexcept;
     virtual vector<uint8_t> getKeyprint() const noexcept;
 
+    /** True when records are encrypted by the kernel (kTLS), see SettingsManager::USE_KERNEL_TLS */
+    virtual bool canSendFile() const noexcept;
+    virtual int sendFile(File& aFile, int64_t aPos, int aLen);
+
     virtual bool waitConnected(uint32_t millis);
     virtual bool waitAccepted(uint32_t millis);
 
+    struct HandshakeStats {
+        uint64_t full;
+        uint64_t resumed;
+        /** Time spent in handshakes, network round trips included */
+        uint64_t fullMicros;
+        uint64_t resumedMicros;
+        /** Handshakes after which the kernel took over the encryption */
+        uint64_t kernel;
+    };
+    static HandshakeStats getHandshakeStats();
 
 private:
     friend class CryptoManager;
@@ -72,6 +90,18 @@ private:
     SSL_CTX* ctx;
     ssl::SSL ssl;
 
+    /** Address we connected to, client sessions are kept for it */
+    string peer;
+    std::chrono::steady_clock::time_point handshakeStart;
+
+    static std::atomic<uint64_t> fullHandshakes;
+    static std::atomic<uint64_t> resumedHandshakes;
+    static std::atomic<uint64_t> fullMicros;
+    static std::atomic<uint64_t> resumedMicros;
+    static std::atomic<uint64_t> kernelHandshakes;
+
+    void setup();
+    void handshakeDone();
     int checkSSL(int ret);
     bool waitWant(int ret, uint32_t millis);
 };
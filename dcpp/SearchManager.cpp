@@ -30,8 +30,12 @@
 #include "StringTokenizer.h"
 #include "FinishedManager.h"
 
+#include <thread>
+
 namespace dcpp {
 
+const uint64_t SearchManager::ALIAS_TIME;
+
 const char* SearchManager::types[TYPE_LAST] = {
         N_("Any"),
         N_("Audio"),
@@ -86,6 +90,7 @@ uint64_t SearchManager::search(StringList& who, const string& aName, int64_t aSi
 void SearchManager::listen() {
 
     disconnect();
+    queue.start();
 
     try {
         socket.reset(new Socket);
@@ -116,11 +121,19 @@ void SearchManager::disconnect() noexcept {
 }
 
 #define BUFSIZE 8192
+#define BATCHSIZE 32
 int SearchManager::run() {
     setThreadName("SearchManager");
-    boost::scoped_array<uint8_t> buf(new uint8_t[BUFSIZE]);
-    int len;
-    sockaddr_in remoteAddr = { 0 };
+
+    // buffers are reused for every batch, results are only copied once into the queue
+    boost::scoped_array<uint8_t> buf(new uint8_t[BUFSIZE * BATCHSIZE]);
+    Socket::Datagram packets[BATCHSIZE];
+    for(int i = 0; i < BATCHSIZE; ++i) {
+        packets[i].buf = &buf[i * BUFSIZE];
+        packets[i].size = BUFSIZE;
+    }
+    vector<pair<string, string> > results;
+    results.reserve(BATCHSIZE);
 
     while(!stop) {
         try {
@@ -130,8 +143,14 @@ int SearchManager::run() {
             if(socket->wait(400, Socket::WAIT_READ) != Socket::WAIT_READ) {
                 continue;
             }
-            if ((len = socket->read(&buf[0], BUFSIZE, remoteAddr)) > 0) {
-                onData(&buf[0], len, inet_ntoa(remoteAddr.sin_addr));
+            int n = socket->readBatch(packets, BATCHSIZE);
+            for(int i = 0; i < n; ++i) {
+                if(packets[i].len > 0) {
+                    results.push_back(make_pair(string((char*)packets[i].buf, packets[i].len), string(inet_ntoa(packets[i].addr.sin_addr))));
+                }
+            }
+            if(!results.empty()) {
+                queue.addResults(results);
                 continue;
             }
         } catch(const SocketException& e) {
@@ -168,35 +187,75 @@ int SearchManager::run() {
     return 0;
 }
 
-int SearchManager::UdpQueue::run() {
-    setThreadName("UdpQueue");
-    string x = Util::emptyString;
-    string remoteIp = Util::emptyString;
+void SearchManager::UdpQueue::start() {
+    if(!workers.empty())
+        return;
+
     stop = false;
-;
-    while(true) {
-        if (resultList.empty())
-            s.wait();
+    size_t n = min(max(std::thread::hardware_concurrency(), 1u), (unsigned)MAX_WORKERS);
+    for(size_t i = 0; i < n; ++i) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker(*this)));
+        workers.back()->start();
+    }
+}
+
+void SearchManager::UdpQueue::shutdown() {
+    stop = true;
+    for(size_t i = 0; i < workers.size(); ++i) {
+        s.signal();
+    }
+    for(auto i = workers.begin(); i != workers.end(); ++i) {
+        (*i)->join();
+    }
+    workers.clear();
+}
+
+void SearchManager::UdpQueue::addResults(vector<pair<string, string> >& results) {
+    {
+        Lock l(csudp);
+        for(auto i = results.begin(); i != results.end(); ++i) {
+            resultList.push_back(make_pair(std::move(i->first), std::move(i->second)));
+        }
+    }
+    for(size_t i = 0; i < results.size(); ++i) {
+        s.signal();
+    }
+    results.clear();
+}
+
+int SearchManager::UdpQueue::Worker::run() {
+    setThreadName("UdpQueue");
+    string x;
+    string remoteIp;
 
-        if(stop)
+    while(true) {
+        queue.s.wait();
+        if(queue.stop)
             break;
 
         {
-            Lock l(csudp);
-            if(resultList.empty()) continue;
+            Lock l(queue.csudp);
+            if(queue.resultList.empty())
+                continue;
 
-            x = resultList.front().first;
-            remoteIp = resultList.front().second;
-            resultList.pop_front();
+            x = std::move(queue.resultList.front().first);
+            remoteIp = std::move(queue.resultList.front().second);
+            queue.resultList.pop_front();
         }
 
+        queue.process(x, remoteIp);
+    }
+    return 0;
+}
+
+void SearchManager::UdpQueue::process(const string& x, const string& remoteIp) {
     if(x.compare(0, 4, "$SR ") == 0) {
         string::size_type i, j;
         // Directories: $SR <nick><0x20><directory><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
         // Files:       $SR <nick><0x20><filename><0x05><filesize><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
         i = 4;
         if( (j = x.find(' ', i)) == string::npos) {
-            continue;
+            return;
         }
         string nick = x.substr(i, j-i);
         i = j + 1;
@@ -214,46 +273,46 @@ int SearchManager::UdpQueue::run() {
             type = SearchResult::TYPE_DIRECTORY;
             // Get past the hubname that might contain spaces
             if((j = x.rfind(0x05)) == string::npos) {
-                continue;
+                return;
             }
             // Find the end of the directory info
             if((j = x.rfind(' ', j-1)) == string::npos) {
-                continue;
+                return;
             }
             if(j < i + 1) {
-                continue;
+                return;
             }
             file = x.substr(i, j-i) + '\\';
         } else if(cnt == 2) {
             if( (j = x.find((char)5, i)) == string::npos) {
-                continue;
+                return;
             }
             file = x.substr(i, j-i);
             i = j + 1;
             if( (j = x.find(' ', i)) == string::npos) {
-                continue;
+                return;
             }
             size = Util::toInt64(x.substr(i, j-i));
         }
         i = j + 1;
 
         if( (j = x.find('/', i)) == string::npos) {
-            continue;
+            return;
         }
         uint8_t freeSlots = (uint8_t)Util::toInt(x.substr(i, j-i));
         i = j + 1;
         if( (j = x.find((char)5, i)) == string::npos) {
-            continue;
+            return;
         }
         uint8_t slots = (uint8_t)Util::toInt(x.substr(i, j-i));
         i = j + 1;
         if( (j = x.rfind(" (")) == string::npos) {
-            continue;
+            return;
         }
         string hubName = x.substr(i, j-i);
         i = j + 2;
         if( (j = x.rfind(')')) == string::npos) {
-            continue;
+            return;
         }
 
         string hubIpPort = x.substr(i, j-i);
@@ -269,7 +328,7 @@ int SearchManager::UdpQueue::run() {
             // Could happen if hub has multiple URLs / IPs
             user = ClientManager::getInstance()->findLegacyUser(nick);
             if(!user)
-                continue;
+                return;
         }
 
         ClientManager::getInstance()->setIPUser(user, remoteIp);
@@ -282,7 +341,7 @@ int SearchManager::UdpQueue::run() {
         }
 
         if(tth.empty() && type == SearchResult::TYPE_FILE) {
-            continue;
+            return;
         }
 
         SearchResultPtr sr(new SearchResult(user, type, slots, freeSlots, size,
@@ -292,34 +351,34 @@ int SearchManager::UdpQueue::run() {
     } else if(x.compare(1, 4, "RES ") == 0 && x[x.length() - 1] == 0x0a) {
         AdcCommand c(x.substr(0, x.length()-1));
         if(c.getParameters().empty())
-            continue;
+            return;
         string cid = c.getParam(0);
         if(cid.size() != 39)
-            continue;
+            return;
 
         UserPtr user = ClientManager::getInstance()->findUser(CID(cid));
         if(!user)
-            continue;
+            return;
 
         // This should be handled by AdcCommand really...
         c.getParameters().erase(c.getParameters().begin());
 
         SearchManager::getInstance()->onRES(c, user, remoteIp);
 
-    } if(x.compare(1, 4, "PSR ") == 0 && x[x.length() - 1] == 0x0a) {
-            AdcCommand c(x.substr(0, x.length()-1));
-            if(c.getParameters().empty())
-                    continue;
-            string cid = c.getParam(0);
-            if(cid.size() != 39)
-                    continue;
+    } else if(x.compare(1, 4, "PSR ") == 0 && x[x.length() - 1] == 0x0a) {
+        AdcCommand c(x.substr(0, x.length()-1));
+        if(c.getParameters().empty())
+            return;
+        string cid = c.getParam(0);
+        if(cid.size() != 39)
+            return;
 
-            UserPtr user = ClientManager::getInstance()->findUser(CID(cid));
-            // when user == NULL then it is probably NMDC user, check it later
+        UserPtr user = ClientManager::getInstance()->findUser(CID(cid));
+        // when user == NULL then it is probably NMDC user, check it later
 
-            c.getParameters().erase(c.getParameters().begin());
+        c.getParameters().erase(c.getParameters().begin());
 
-            SearchManager::getInstance()->onPSR(c, user, remoteIp);
+        SearchManager::getInstance()->onPSR(c, user, remoteIp);
 
     } /*else if(x.compare(1, 4, "SCH ") == 0 && x[x.length() - 1] == 0x0a) {
         try {
@@ -327,16 +386,10 @@ int SearchManager::UdpQueue::run() {
         } catch(ParseException& ) {
         }
     }*/ // Needs further DoS investigation
-
-
-                Thread::sleep(10);
-        }
-        return 0;
 }
 
 void SearchManager::onData(const uint8_t* buf, size_t aLen, const string& remoteIp) {
-    string x((char*)buf, aLen);
-    queue.addResult(x, remoteIp);
+    queue.addResult(string((char*)buf, aLen), string(remoteIp));
 }
 
 void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const string& remoteIp) {
@@ -377,7 +430,43 @@ void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const stri
         SearchResultPtr sr(new SearchResult(from, type, slots, (uint8_t)freeSlots, size,
                 file, hubName, hub, remoteIp, TTHValue(tth), token));
         fire(SearchManagerListener::SR(), sr);
+
+        if(token.empty())
+            return;
+
+        StringList aliases;
+        {
+            Lock l(cs);
+            auto i = tokenAliases.find(token);
+            if(i != tokenAliases.end())
+                aliases = i->second.aliases;
+        }
+        for(auto i = aliases.begin(); i != aliases.end(); ++i) {
+            SearchResultPtr alias(new SearchResult(from, type, slots, (uint8_t)freeSlots, size,
+                    file, hubName, hub, remoteIp, TTHValue(tth), *i));
+            fire(SearchManagerListener::SR(), alias);
+        }
+    }
+}
+
+void SearchManager::addTokenAliases(const string& aToken, const StringList& aAliases) {
+    uint64_t now = GET_TICK();
+
+    Lock l(cs);
+    for(auto i = tokenAliases.begin(); i != tokenAliases.end();) {
+        if(i->second.expires < now) {
+            tokenAliases.erase(i++);
+        } else {
+            ++i;
+        }
+    }
+
+    TokenAliases& t = tokenAliases[aToken];
+    for(auto i = aAliases.begin(); i != aAliases.end(); ++i) {
+        if(*i != aToken && find(t.aliases.begin(), t.aliases.end(), *i) == t.aliases.end())
+            t.aliases.push_back(*i);
     }
+    t.expires = now + ALIAS_TIME;
 }
 
 void SearchManager::onPSR(const AdcCommand& cmd, UserPtr from, const string& remoteIp) {
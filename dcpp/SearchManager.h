@@ -85,39 +85,66 @@ public:
         onData((const uint8_t*)aLine.data(), aLine.length(), Util::emptyString);
     }
 
+    /** Results for aToken are delivered with each of aAliases as well, used for merged searches */
+    void addTokenAliases(const string& aToken, const StringList& aAliases);
+
     void onRES(const AdcCommand& cmd, const UserPtr& from, const string& remoteIp = Util::emptyString);
     void onPSR(const AdcCommand& cmd, UserPtr from, const string& remoteIp = Util::emptyString);
     AdcCommand toPSR(bool wantResponse, const string& myNick, const string& hubIpPort, const string& tth, const vector<uint16_t>& partialInfo) const;
 
 private:
-    class UdpQueue: public Thread {
+    /** Parses incoming search results on a few worker threads */
+    class UdpQueue {
     public:
+        /** Upper limit for the number of parser threads */
+        enum { MAX_WORKERS = 4 };
+
         UdpQueue() : stop(false) {}
         ~UdpQueue() noexcept { shutdown(); }
 
-        int run();
-        void shutdown() {
-            stop = true;
-            s.signal();
-        }
-        void addResult(const string& buf, const string& ip) {
+        void start();
+        void shutdown();
+
+        void addResult(string&& buf, string&& ip) {
             {
                 Lock l(csudp);
-                resultList.push_back(make_pair(buf, ip));
+                resultList.push_back(make_pair(std::move(buf), std::move(ip)));
             }
             s.signal();
         }
+        /** Queue a batch of results at once, the strings are moved from */
+        void addResults(vector<pair<string, string> >& results);
 
     private:
+        class Worker : public Thread {
+        public:
+            Worker(UdpQueue& aQueue) : queue(aQueue) { }
+            int run();
+        private:
+            UdpQueue& queue;
+        };
+
+        void process(const string& x, const string& remoteIp);
+
         CriticalSection csudp;
         Semaphore s;
 
         deque<pair<string, string> > resultList;
+        vector<std::unique_ptr<Worker> > workers;
 
         bool stop;
     } queue;
 
+    /** How long results are delivered to the aliases of a token */
+    static const uint64_t ALIAS_TIME = 10 * 60 * 1000;
+
+    struct TokenAliases {
+        StringList aliases;
+        uint64_t expires;
+    };
+
     CriticalSection cs;
+    unordered_map<string, TokenAliases> tokenAliases;
     std::unique_ptr<Socket> socket;
     uint16_t port;
     bool stop;
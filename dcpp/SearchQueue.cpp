@@ -26,6 +26,10 @@
 
 namespace dcpp {
 
+const uint64_t SearchQueue::RECENT_TIME;
+const uint64_t SearchQueue::MAX_BACKOFF;
+const uint64_t SearchQueue::FLOOD_REPLY_TIME;
+
 bool SearchQueue::add(const SearchCore& s)
 {
     dcassert(s.owners.size() == 1);
@@ -35,42 +39,58 @@ bool SearchQueue::add(const SearchCore& s)
     for(auto i = searchQueue.begin(); i != searchQueue.end(); ++i)
     {
         // check dupe
-        if(*i == s) {
+        if(i->isSame(s)) {
             void* aOwner = *s.owners.begin();
             i->owners.insert(aOwner);
+            ++stats.merged;
+
+            if(s.isAuto())
+                return false;
 
-            // if previous search was autosearch and current one isn't, it should be readded before autosearches
-            if(s.token != "auto" && i->token == "auto")
-            {
+            if(i->isAuto()) {
+                // if previous search was autosearch and current one isn't, it should be readded before autosearches
+                SearchCore merged = *i;
+                merged.token = s.token;
                 searchQueue.erase(i);
-                break;
+
+                for(auto j = searchQueue.begin(); j != searchQueue.end(); ++j) {
+                    if(j->isAuto()) {
+                        searchQueue.insert(j, merged);
+                        return true;
+                    }
+                }
+                searchQueue.push_back(merged);
+                return true;
             }
 
+            // both are manual searches, the results are shared through the token
+            if(s.token != i->token && find(i->aliases.begin(), i->aliases.end(), s.token) == i->aliases.end())
+                i->aliases.push_back(s.token);
+
             return false;
         }
     }
 
-    if(s.token == "auto") {
+    if(s.isAuto()) {
+        uint64_t now = GET_TICK();
+        for(auto i = recent.begin(); i != recent.end(); ++i) {
+            if(i->first + RECENT_TIME > now && i->second.isSame(s)) {
+                ++stats.suppressed;
+                return false;
+            }
+        }
+
         // Insert last (automatic search)
         searchQueue.push_back(s);
     } else {
-        bool added = false;
-        if(searchQueue.empty()) {
-            searchQueue.push_front(s);
-            added = true;
-        } else {
-            // Insert before the automatic searches (manual search)
-            for(auto i = searchQueue.begin(); i != searchQueue.end(); ++i) {
-                if(i->token == "auto") {
-                    searchQueue.insert(i, s);
-                    added = true;
-                    break;
-                }
+        // Insert before the automatic searches (manual search)
+        for(auto i = searchQueue.begin(); i != searchQueue.end(); ++i) {
+            if(i->isAuto()) {
+                searchQueue.insert(i, s);
+                return true;
             }
         }
-        if (!added) {
-            searchQueue.push_back(s);
-        }
+        searchQueue.push_back(s);
     }
     return true;
 }
@@ -79,20 +99,49 @@ bool SearchQueue::pop(SearchCore& s, uint64_t now)
 {
     dcassert(interval);
 
+    Lock l(cs);
+
     //uint64_t now = GET_TICK();
-    if(now <= lastSearchTime + interval && lastSearchTime > 0)
+    if(now <= lastSearchTime + interval + backoff && lastSearchTime > 0)
         return false;
 
-    {
-        Lock l(cs);
-        if(!searchQueue.empty()){
-            s = searchQueue.front();
-            searchQueue.pop_front();
-            lastSearchTime = now;
+    if(searchQueue.empty())
+        return false;
+
+    s = searchQueue.front();
+    searchQueue.pop_front();
+    lastSearchTime = now;
+    ++stats.sent;
+
+    // the hub hasn't complained for a while, speed up again
+    backoff = backoff > 4 ? backoff - backoff / 4 : 0;
+
+    while(!recent.empty() && recent.front().first + RECENT_TIME <= now)
+        recent.pop_front();
+    recent.push_back(make_pair(now, s));
+    recent.back().second.owners.clear();
+
+    return true;
+}
+
+void SearchQueue::onFlood(uint64_t now)
+{
+    Lock l(cs);
+    ++stats.floods;
+    backoff = min(max(backoff * 2, max(interval, (uint64_t)5000)), MAX_BACKOFF);
+    lastSearchTime = now;
+}
+
+bool SearchQueue::checkFlood(const string& aMessage, uint64_t now)
+{
+    Lock l(cs);
+    for(auto i = recent.rbegin(); i != recent.rend() && i->first + FLOOD_REPLY_TIME > now; ++i) {
+        const string& query = i->second.query;
+        if(!query.empty() && aMessage.find(query) != string::npos) {
+            onFlood(now);
             return true;
         }
     }
-
     return false;
 }
 
@@ -100,10 +149,13 @@ uint64_t SearchQueue::getSearchTime(void* aOwner, uint64_t now) {
 
     if(aOwner == 0) return 0xFFFFFFFF;
 
-    uint64_t x = max(lastSearchTime, now - interval);
+    Lock l(cs);
+
+    uint64_t step = interval + backoff;
+    uint64_t x = max(lastSearchTime, now - step);
 
     for(auto i = searchQueue.cbegin(); i != searchQueue.cend(); ++i){
-        x += interval;
+        x += step;
 
         if(i->owners.find(aOwner) != i->owners.end())
             return x;
@@ -31,6 +31,8 @@ struct SearchCore
     string      token;
     StringList  exts;
     std::unordered_set<void*>  owners;
+    /** Tokens of identical searches merged into this one, they get the results too */
+    StringList  aliases;
 
     bool operator==(const SearchCore& rhs) const {
          return this->sizeType == rhs.sizeType &&
@@ -39,14 +41,44 @@ struct SearchCore
                 this->query == rhs.query &&
                 this->token == rhs.token;
     }
+
+    /** Same query, no matter who asked for it */
+    bool isSame(const SearchCore& rhs) const {
+         return this->sizeType == rhs.sizeType &&
+                this->size == rhs.size &&
+                this->fileType == rhs.fileType &&
+                this->query == rhs.query &&
+                this->exts == rhs.exts;
+    }
+
+    bool isAuto() const { return token == "auto"; }
 };
 
 class SearchQueue
 {
 public:
+    struct Stats {
+        Stats() : sent(0), merged(0), suppressed(0), floods(0) { }
+
+        /** Searches sent to the hub */
+        uint64_t sent;
+        /** Searches merged into an identical pending one */
+        uint64_t merged;
+        /** Automatic searches dropped because the same one was sent recently */
+        uint64_t suppressed;
+        /** Flood warnings received from the hub */
+        uint64_t floods;
+    };
+
+    /** How long a sent search suppresses identical automatic searches */
+    static const uint64_t RECENT_TIME = 5 * 60 * 1000;
+    /** Upper limit for the extra delay added after flood warnings */
+    static const uint64_t MAX_BACKOFF = 60 * 1000;
+    /** How long after sending a search a hub message about it counts as flood warning */
+    static const uint64_t FLOOD_REPLY_TIME = 60 * 1000;
 
     SearchQueue(uint32_t aInterval = 0)
-        : interval(aInterval), lastSearchTime(0)
+        : interval(aInterval), lastSearchTime(0), backoff(0)
     {
     }
 
@@ -57,6 +89,7 @@ public:
     {
         Lock l(cs);
         searchQueue.clear();
+        recent.clear();
     }
 
     bool cancelSearch(void* aOwner);
@@ -64,6 +97,25 @@ public:
     /** return 0 means not in queue */
     uint64_t getSearchTime(void* aOwner, uint64_t now);
 
+    /** The hub told us we're searching too often, slow down */
+    void onFlood(uint64_t now);
+
+    /** Calls onFlood when the hub message repeats the exact query of a search we've just sent */
+    bool checkFlood(const string& aMessage, uint64_t now);
+
+    /** Time between two searches, including the backoff after flood warnings */
+    uint64_t getEffectiveInterval() const
+    {
+        Lock l(cs);
+        return interval + backoff;
+    }
+
+    Stats getStats() const
+    {
+        Lock l(cs);
+        return stats;
+    }
+
     /**
         by milli-seconds
         0 means no interval, no auto search and manual search is sent immediately
@@ -72,8 +124,12 @@ public:
 
 private:
     deque<SearchCore>   searchQueue;
+    /** Recently sent searches with the time they were sent */
+    deque<pair<uint64_t, SearchCore> > recent;
     uint64_t       lastSearchTime;
-    CriticalSection cs;
+    uint64_t       backoff;
+    Stats          stats;
+    mutable CriticalSection cs;
 };
 
 }
@@ -53,6 +53,7 @@ const string SettingsManager::settingTags[] =
     "Language", "SkipListShare", "InternetIp", "BindIfaceName",
     "DHTKey", "DynDNSServer", "MimeHandler",
     "LogFileCmdDebug", "LogFormatCmdDebug",
+    "DHTSeeds",
     "SENTRY",
     // Ints
     "IncomingConnections", "InPort", "Slots", "AutoFollow",
@@ -99,6 +100,12 @@ const string SettingsManager::settingTags[] =
     "UseADLOnlyOnOwnList", "AllowSimUploads", "CheckTargetsPathsOnStart", "NmdcDebug",
     "ShareSkipZeroByte", "RequireTLS", "LogSpy", "AppUnitBase",
     "LogCmdDebug",
+    "MaxUploadSpeedPerHub", "MaxDownloadSpeedPerHub",
+    "MaxUploadSpeedPerUser", "MaxDownloadSpeedPerUser",
+    "MaxUploadSpeedMiniSlot", "MaxUploadSpeedFileList",
+    "DHTLoopback", "DHTSimulatedLoss", "DHTSendRate", "DHTPublishRate",
+    "UploadFileCache", "UploadReadAhead", "UploadDropBehind",
+    "ConnectRate", "ConnectMaxPending", "UseKernelTLS",
     "SENTRY",
     // Int64
     "TotalUpload", "TotalDownload",
@@ -308,6 +315,22 @@ SettingsManager::SettingsManager()
     setDefault(CHECK_TARGETS_PATHS_ON_START, false);
     setDefault(SHARE_SKIP_ZERO_BYTE, false);
     setDefault(APP_UNIT_BASE, 0);
+    setDefault(MAX_UPLOAD_SPEED_PER_HUB, 0);
+    setDefault(MAX_DOWNLOAD_SPEED_PER_HUB, 0);
+    setDefault(MAX_UPLOAD_SPEED_PER_USER, 0);
+    setDefault(MAX_DOWNLOAD_SPEED_PER_USER, 0);
+    setDefault(MAX_UPLOAD_SPEED_MINISLOT, 0);
+    setDefault(MAX_UPLOAD_SPEED_FILELIST, 0);
+    setDefault(DHT_LOOPBACK, false);
+    setDefault(DHT_SIMULATED_LOSS, 0);
+    setDefault(DHT_SEND_RATE, 100);
+    setDefault(DHT_PUBLISH_RATE, 20);
+    setDefault(UPLOAD_FILE_CACHE, 64);
+    setDefault(UPLOAD_READ_AHEAD, 1024);
+    setDefault(UPLOAD_DROP_BEHIND, false);
+    setDefault(CONNECT_RATE, 5);
+    setDefault(CONNECT_MAX_PENDING, 50);
+    setDefault(USE_KERNEL_TLS, false);
     setSearchTypeDefaults();
 }
 
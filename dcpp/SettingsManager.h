@@ -67,6 +67,7 @@ public:
         LANGUAGE, SKIPLIST_SHARE, INTERNETIP, BIND_IFACE_NAME,
         DHT_KEY, DYNDNS_SERVER, MIME_HANDLER,
         LOG_FILE_CMD_DEBUG, LOG_FORMAT_CMD_DEBUG,
+        DHT_SEEDS,
         STR_LAST };
 
     enum IntSetting { INT_FIRST = STR_LAST + 1,
@@ -118,6 +119,12 @@ public:
         NMDC_DEBUG, SHARE_SKIP_ZERO_BYTE, REQUIRE_TLS, LOG_SPY,
         APP_UNIT_BASE,
         LOG_CMD_DEBUG,
+        MAX_UPLOAD_SPEED_PER_HUB, MAX_DOWNLOAD_SPEED_PER_HUB,
+        MAX_UPLOAD_SPEED_PER_USER, MAX_DOWNLOAD_SPEED_PER_USER,
+        MAX_UPLOAD_SPEED_MINISLOT, MAX_UPLOAD_SPEED_FILELIST,
+        DHT_LOOPBACK, DHT_SIMULATED_LOSS, DHT_SEND_RATE, DHT_PUBLISH_RATE,
+        UPLOAD_FILE_CACHE, UPLOAD_READ_AHEAD, UPLOAD_DROP_BEHIND,
+        CONNECT_RATE, CONNECT_MAX_PENDING, USE_KERNEL_TLS,
         INT_LAST };
 
     enum Int64Setting { INT64_FIRST = INT_LAST + 1,
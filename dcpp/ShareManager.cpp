@@ -53,8 +53,8 @@
 
 namespace dcpp {
 
-ShareManager::ShareManager() : hits(0), xmlListLen(0), bzXmlListLen(0),
-    xmlDirty(true), forceXmlRefresh(false), refreshDirs(false), update(false), initial(true), listN(0), refreshing(false),
+ShareManager::ShareManager() : hits(0), xmlListLen(0), bzXmlListLen(0), lastXmlListUse(0),
+    xmlDirty(true), forceXmlRefresh(false), refreshDirs(false), update(false), initial(true), listN(0), refreshing(false), revision(0),
     lastXmlUpdate(0), lastFullUpdate(GET_TICK()), bloom(1<<20)
 {
     SettingsManager::getInstance()->addListener(this);
@@ -752,7 +752,9 @@ void ShareManager::updateIndices(Directory& dir) {
 }
 
 void ShareManager::rebuildIndices() {
+    ++revision;
     tthIndex.clear();
+    hashBlooms.clear();
     bloom.clear();
 
     for(auto i = directories.begin(); i != directories.end(); ++i) {
@@ -781,11 +783,9 @@ void ShareManager::updateIndices(Directory& dir, const Directory::File::Set::ite
 
     tthIndex.insert(make_pair(f.getTTH(), i));
     bloom.add(Text::toLower(f.getName()));
-#ifdef WITH_DHT
-    dht::IndexManager* im = dht::IndexManager::getInstance();
-    if(im && im->isTimeForPublishing())
-        im->publishFile(f.getTTH(), f.getSize());
-#endif
+    for(auto j = hashBlooms.begin(); j != hashBlooms.end(); ++j) {
+        j->add(f.getTTH());
+    }
 }
 
 void ShareManager::refresh(bool dirs /* = false */, bool aUpdate /* = true */, bool block /* = false */) noexcept {
@@ -869,17 +869,54 @@ int ShareManager::run() {
 #ifdef WITH_DHT
     dht::IndexManager* im = dht::IndexManager::getInstance();
     if(im && im->isTimeForPublishing())
-        im->setNextPublishing();
+        publish();
 #endif
     return 0;
 }
 
+void ShareManager::publish() {
+#ifdef WITH_DHT
+    // queue the whole share, IndexManager spreads it over the republish time
+    dht::IndexManager* im = dht::IndexManager::getInstance();
+    if(!im || im->isPublishing())
+        return;
+
+    dht::IndexManager::FileList files;
+    {
+        Lock l(cs);
+        files.reserve(tthIndex.size());
+        for(auto i = tthIndex.begin(); i != tthIndex.end(); ++i) {
+            files.push_back(dht::File(i->first, i->second->getSize(), false));
+        }
+    }
+
+    // IndexManager takes its own lock, searches and uploads needn't wait for it; when TaskManager
+    // and the refresh thread get here both at once, only one of them starts the round
+    im->startPublishing(files);
+#endif
+}
+
 void ShareManager::getBloom(ByteVector& v, size_t k, size_t m, size_t h) const {
+    Lock l(cs);
+
+    // hubs ask on every connect, usually all with the same parameters
+    for(auto i = hashBlooms.begin(); i != hashBlooms.end(); ++i) {
+        if(i->is(k, m, h)) {
+            i->copy_to(v);
+            std::rotate(i, i + 1, hashBlooms.end());
+            return;
+        }
+    }
+
     dcdebug("Creating bloom filter, k=%u, m=%u, h=%u\n",
             static_cast<unsigned int>(k), static_cast<unsigned int>(m), static_cast<unsigned int>(h));
-    Lock l(cs);
 
-    HashBloom bloom;
+    if(hashBlooms.size() >= MAX_HASH_BLOOMS) {
+        hashBlooms.erase(hashBlooms.begin());
+    }
+    hashBlooms.push_back(HashBloom());
+
+    HashBloom& bloom = hashBlooms.back();
     bloom.reset(k, m, h);
     for(auto i = tthIndex.begin(); i != tthIndex.end(); ++i) {
         bloom.add(i->first);
@@ -887,6 +924,30 @@ void ShareManager::getBloom(ByteVector& v, size_t k, size_t m, size_t h) const {
     bloom.copy_to(v);
 }
 
+shared_ptr<const string> ShareManager::getXmlList() {
+    string bzXml;
+    int n;
+    {
+        Lock l(cs);
+        generateXmlList();
+        lastXmlListUse = GET_TICK();
+        if(xmlList)
+            return xmlList;
+        bzXml = getBZXmlFile();
+        n = listN;
+    }
+
+    // decode without holding up the share, the bz2 file is only replaced by a new generation
+    string bz2 = File(bzXml, File::READ, File::OPEN).read();
+    shared_ptr<string> xml(new string);
+    CryptoManager::getInstance()->decodeBZ2(reinterpret_cast<const uint8_t*>(bz2.data()), bz2.size(), *xml);
+
+    Lock l(cs);
+    if(n == listN && !xmlList)
+        xmlList = xml;
+    return xml;
+}
+
 void ShareManager::generateXmlList() {
     Lock l(cs);
     if(forceXmlRefresh || (xmlDirty && (lastXmlUpdate + 15 * 60 * 1000 < GET_TICK() || lastXmlUpdate < lastFullUpdate))) {
@@ -939,6 +1000,7 @@ void ShareManager::generateXmlList() {
                 File::copyFile(XmlListFileName, XmlListFileName + ".bak");
             } catch(const FileException&) { }
             bzXmlRef = unique_ptr<File>(new File(newXmlName, File::READ, File::OPEN));
+            xmlList.reset();
             setBZXmlFile(newXmlName);
             bzXmlListLen = File::getSize(newXmlName);
             LogManager::getInstance()->message(str(F_("File list %1% generated") % Util::addBrackets(bzXmlFile)));
@@ -1177,33 +1239,50 @@ SearchManager::TypeModes ShareManager::getType(const string& aFileName) const no
     return SearchManager::TYPE_ANY;
 }
 
+bool ShareManager::SearchTerms::match(const string& aName) {
+    search.match(aName, matches);
+    for(auto i = exclude.begin(); i != exclude.end(); ++i) {
+        if(matches[*i])
+            return false;
+    }
+    return true;
+}
+
+bool ShareManager::SearchTerms::hasAll(const List& aInclude) const {
+    for(auto i = aInclude.begin(); i != aInclude.end(); ++i) {
+        if(!matches[*i])
+            return false;
+    }
+    return true;
+}
+
+bool ShareManager::SearchTerms::getRemaining(const List& aInclude, List& aRemaining) const {
+    aRemaining.clear();
+    for(auto i = aInclude.begin(); i != aInclude.end(); ++i) {
+        if(!matches[*i])
+            aRemaining.push_back(*i);
+    }
+    return aRemaining.size() != aInclude.size();
+}
+
 /**
  * Alright, the main point here is that when searching, a search string is most often found in
  * the filename, not directory name, so we want to make that case faster. Also, we want to
- * avoid changing StringLists unless we absolutely have to --> this should only be done if a string
- * has been matched in the directory name. This new stringlist should also be used in all descendants,
+ * avoid changing the word lists unless we absolutely have to --> this should only be done if a word
+ * has been matched in the directory name. This new list should also be used in all descendants,
  * but not the parents...
  */
-void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::List& aStrings, int aSearchType, int64_t aSize, int aFileType, Client* aClient, StringList::size_type maxResults) const noexcept {
+void ShareManager::Directory::search(SearchResultList& aResults, SearchTerms& aTerms, const SearchTerms::List& aInclude, int aSearchType, int64_t aSize, int aFileType, Client* aClient, StringList::size_type maxResults) const noexcept {
     // Skip everything if there's nothing to find here (doh! =)
     if(!hasType(aFileType))
         return;
 
-    StringSearch::List* cur = &aStrings;
-    unique_ptr<StringSearch::List> newStr;
+    const SearchTerms::List* cur = &aInclude;
+    SearchTerms::List remaining;
 
     // Find any matches in the directory name
-    for(auto k = aStrings.begin(); k != aStrings.end(); ++k) {
-        if(k->match(name)) {
-            if(!newStr.get()) {
-                newStr = unique_ptr<StringSearch::List>(new StringSearch::List(aStrings));
-            }
-            newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
-        }
-    }
-
-    if(newStr.get() != 0) {
-        cur = newStr.get();
+    if(!aInclude.empty() && aTerms.match(name) && aTerms.getRemaining(aInclude, remaining)) {
+        cur = &remaining;
     }
 
     bool sizeOk = (aSearchType != SearchManager::SIZE_ATLEAST) || (aSize == 0);
@@ -1223,11 +1302,9 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
             } else if(aSearchType == SearchManager::SIZE_ATMOST && aSize < i->getSize()) {
                 continue;
             }
-            auto j = cur->begin();
-            for(; j != cur->end() && j->match(i->getName()); ++j)
-                ;   // Empty
 
-            if(j != cur->end())
+            // a single pass over the name finds all the words
+            if(!cur->empty() && (!aTerms.match(i->getName()) || !aTerms.hasAll(*cur)))
                 continue;
 
             // Check file type...
@@ -1243,7 +1320,7 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
     }
 
     for(auto l = directories.begin(); (l != directories.end()) && (aResults.size() < maxResults); ++l) {
-        l->second->search(aResults, *cur, aSearchType, aSize, aFileType, aClient, maxResults);
+        l->second->search(aResults, aTerms, *cur, aSearchType, aSize, aFileType, aClient, maxResults);
     }
 }
 
@@ -1268,17 +1345,18 @@ void ShareManager::search(SearchResultList& results, const string& aString, int
     if(!bloom.match(sl))
         return;
 
-    StringSearch::List ssl;
+    SearchTerms terms;
     for(auto i = sl.begin(); i != sl.end(); ++i) {
         if(!i->empty()) {
-            ssl.push_back(StringSearch(*i));
+            terms.addInclude(*i);
         }
     }
-    if(ssl.empty())
+    if(terms.include.empty())
         return;
+    terms.compile();
 
     for(auto j = directories.begin(); (j != directories.end()) && (results.size() < maxResults); ++j) {
-        (*j)->search(results, ssl, aSearchType, aSize, aFileType, aClient, maxResults);
+        (*j)->search(results, terms, terms.include, aSearchType, aSize, aFileType, aClient, maxResults);
     }
 }
 
@@ -1286,7 +1364,7 @@ namespace {
     inline uint16_t toCode(char a, char b) { return (uint16_t)a | ((uint16_t)b)<<8; }
 }
 
-ShareManager::AdcSearch::AdcSearch(const StringList& params) : include(&includeX), gt(0),
+ShareManager::AdcSearch::AdcSearch(const StringList& params) : gt(0),
     lt(numeric_limits<int64_t>::max()), hasRoot(false), isDirectory(false)
 {
     for(auto i = params.begin(); i != params.end(); ++i) {
@@ -1300,9 +1378,10 @@ ShareManager::AdcSearch::AdcSearch(const StringList& params) : include(&includeX
             root = TTHValue(p.substr(2));
             return;
         } else if(toCode('A', 'N') == cmd) {
-            includeX.push_back(StringSearch(p.substr(2)));
+            terms.addInclude(p.substr(2));
+            includeWords.push_back(Text::toLower(p.substr(2)));
         } else if(toCode('N', 'O') == cmd) {
-            exclude.push_back(StringSearch(p.substr(2)));
+            terms.addExclude(p.substr(2));
         } else if(toCode('E', 'X') == cmd) {
             ext.push_back(p.substr(2));
         } else if(toCode('G', 'R') == cmd) {
@@ -1320,14 +1399,7 @@ ShareManager::AdcSearch::AdcSearch(const StringList& params) : include(&includeX
             isDirectory = (p[2] == '2');
         }
     }
-}
-
-bool ShareManager::AdcSearch::isExcluded(const string& str) {
-    for(auto i = exclude.begin(); i != exclude.end(); ++i) {
-        if(i->match(str))
-            return true;
-    }
-    return false;
+    terms.compile();
 }
 
 bool ShareManager::AdcSearch::hasExt(const string& name) {
@@ -1344,24 +1416,14 @@ bool ShareManager::AdcSearch::hasExt(const string& name) {
     return false;
 }
 
-void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const noexcept {
-    StringSearch::List* cur = aStrings.include;
-    StringSearch::List* old = aStrings.include;
-
-    unique_ptr<StringSearch::List> newStr;
+void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStrings, const SearchTerms::List& aInclude, StringList::size_type maxResults) const noexcept {
+    SearchTerms& terms = aStrings.terms;
+    const SearchTerms::List* cur = &aInclude;
+    SearchTerms::List remaining;
 
-    // Find any matches in the directory name
-    for(auto k = cur->begin(); k != cur->end(); ++k) {
-        if(k->match(name) && !aStrings.isExcluded(name)) {
-            if(!newStr.get()) {
-                newStr = unique_ptr<StringSearch::List>(new StringSearch::List(*cur));
-            }
-            newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
-        }
-    }
-
-    if(newStr.get() != 0) {
-        cur = newStr.get();
+    // Find any matches in the directory name, words found here needn't be found below
+    if(!aInclude.empty() && terms.match(name) && terms.getRemaining(aInclude, remaining)) {
+        cur = &remaining;
     }
 
     bool sizeOk = (aStrings.gt == 0);
@@ -1381,14 +1443,8 @@ void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStr
                 continue;
             }
 
-            if(aStrings.isExcluded(i->getName()))
-                continue;
-
-            auto j = cur->begin();
-            for(; j != cur->end() && j->match(i->getName()); ++j)
-                ;   // Empty
-
-            if(j != cur->end())
+            // a single pass over the name finds both the include and the exclude words
+            if((!cur->empty() || !terms.exclude.empty()) && (!terms.match(i->getName()) || !terms.hasAll(*cur)))
                 continue;
 
             // Check file type...
@@ -1406,9 +1462,8 @@ void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStr
     }
 
     for(auto l = directories.begin(); (l != directories.end()) && (aResults.size() < maxResults); ++l) {
-        l->second->search(aResults, aStrings, maxResults);
+        l->second->search(aResults, aStrings, *cur, maxResults);
     }
-    aStrings.include = old;
 }
 
 void ShareManager::search(SearchResultList& results, const StringList& params, StringList::size_type maxResults) noexcept {
@@ -1428,13 +1483,13 @@ void ShareManager::search(SearchResultList& results, const StringList& params, S
         return;
     }
 
-    for(auto i = srch.includeX.begin(); i != srch.includeX.end(); ++i) {
-        if(!bloom.match(i->getPattern()))
+    for(auto i = srch.includeWords.begin(); i != srch.includeWords.end(); ++i) {
+        if(!bloom.match(*i))
             return;
     }
 
     for(auto j = directories.begin(); (j != directories.end()) && (results.size() < maxResults); ++j) {
-        (*j)->search(results, srch, maxResults);
+        (*j)->search(results, srch, srch.terms.include, maxResults);
     }
 }
 
@@ -1491,12 +1546,19 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
     if(d) {
         auto i = d->findFile(Util::getFileName(fname));
         if(i != d->files.end()) {
-            if(root != i->getTTH())
+            if(root != i->getTTH()) {
                 tthIndex.erase(i->getTTH());
+                // bits can't be taken out of a bloom filter
+                hashBlooms.clear();
+            }
             // Get rid of false constness...
             auto f = const_cast<Directory::File*>(&(*i));
             f->setTTH(root);
-            tthIndex.insert(make_pair(f->getTTH(), i));
+            if(tthIndex.insert(make_pair(f->getTTH(), i)).second) {
+                for(auto j = hashBlooms.begin(); j != hashBlooms.end(); ++j) {
+                    j->add(root);
+                }
+            }
         } else {
             string name = Util::getFileName(fname);
             int64_t size = File::getSize(fname);
@@ -1514,6 +1576,13 @@ void ShareManager::on(TimerManagerListener::Minute, uint64_t tick) noexcept {
             refresh(true, true);
         }
     }
+
+    {
+        // the uploads still sending it keep their reference
+        Lock l(cs);
+        if(xmlList && lastXmlListUse + 15 * 60 * 1000 < tick)
+            xmlList.reset();
+    }
 }
 
 } // namespace dcpp
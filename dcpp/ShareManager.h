@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "TimerManager.h"
 #include "SearchManager.h"
 #include "SettingsManager.h"
@@ -25,9 +27,10 @@
 #include "QueueManagerListener.h"
 #include "Exception.h"
 #include "CriticalSection.h"
-#include "StringSearch.h"
+#include "MultiStringSearch.h"
 #include "Singleton.h"
 #include "BloomFilter.h"
+#include "HashBloom.h"
 #include "FastAlloc.h"
 #include "MerkleTree.h"
 #include "Pointer.h"
@@ -70,7 +73,9 @@ public:
     TTHValue getTTH(const string& virtualFile) const;
 
     void refresh(bool dirs = false, bool aUpdate = true, bool block = false) noexcept;
-    void setDirty() { xmlDirty = true; }
+    void setDirty() { xmlDirty = true; ++revision; }
+    /** Changes whenever shared files may have been added, removed or rehashed */
+    uint32_t getRevision() const { return revision; }
 
     void search(SearchResultList& l, const string& aString, int aSearchType, int64_t aSize, int aFileType, Client* aClient, StringList::size_type maxResults) noexcept;
     void search(SearchResultList& l, const StringList& params, StringList::size_type maxResults) noexcept;
@@ -106,6 +111,9 @@ public:
         return getBZXmlFile();
     }
 
+    /** Uncompressed own file list, decoded once per list generation and shared by all uploads of it */
+    std::shared_ptr<const string> getXmlList();
+
     bool isTTHShared(const TTHValue& tth){
         Lock l(cs);
         return tthIndex.find(tth) != tthIndex.end();
@@ -114,6 +122,31 @@ public:
     GETSET(uint32_t, hits, Hits);
     GETSET(string, bzXmlFile, BZXmlFile);
 private:
+    /**
+     * Words of a search, matched against a name in a single pass. Include words
+     * found in a directory name don't have to be found again below it.
+     */
+    struct SearchTerms {
+        /** Ids of include words */
+        typedef vector<size_t> List;
+
+        void addInclude(const string& aWord) { include.push_back(search.add(aWord)); }
+        void addExclude(const string& aWord) { exclude.push_back(search.add(aWord)); }
+        void compile() { search.compile(); }
+
+        /** Match a name, false when it contains one of the exclude words */
+        bool match(const string& aName);
+        /** Whether the last match() found all of these include words */
+        bool hasAll(const List& aInclude) const;
+        /** Include words the last match() didn't find, false when it found none of them */
+        bool getRemaining(const List& aInclude, List& aRemaining) const;
+
+        MultiStringSearch search;
+        List include;
+        List exclude;
+        MultiStringSearch::Matches matches;
+    };
+
     struct AdcSearch;
     class Directory : public FastAlloc<Directory>, public intrusive_ptr_base<Directory>, boost::noncopyable {
     public:
@@ -192,8 +225,8 @@ private:
 
         int64_t getSize() const noexcept;
 
-        void search(SearchResultList& aResults, StringSearch::List& aStrings, int aSearchType, int64_t aSize, int aFileType, Client* aClient, StringList::size_type maxResults) const noexcept;
-        void search(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const noexcept;
+        void search(SearchResultList& aResults, SearchTerms& aTerms, const SearchTerms::List& aInclude, int aSearchType, int64_t aSize, int aFileType, Client* aClient, StringList::size_type maxResults) const noexcept;
+        void search(SearchResultList& aResults, AdcSearch& aStrings, const SearchTerms::List& aInclude, StringList::size_type maxResults) const noexcept;
 
         void toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool fullList) const;
         void filesToXml(OutputStream& xmlFile, string& indent, string& tmp2) const;
@@ -226,11 +259,10 @@ private:
     struct AdcSearch {
         AdcSearch(const StringList& params);
 
-        bool isExcluded(const string& str);
         bool hasExt(const string& name);
-        StringSearch::List* include;
-        StringSearch::List includeX;
-        StringSearch::List exclude;
+        SearchTerms terms;
+        /** Lower-cased include words for the bloom filter */
+        StringList includeWords;
         StringList ext;
         StringList noExt;
 
@@ -248,6 +280,8 @@ private:
     int64_t bzXmlListLen;
     TTHValue bzXmlRoot;
     unique_ptr<File> bzXmlRef;
+    std::shared_ptr<const string> xmlList;
+    uint64_t lastXmlListUse;
 
     bool xmlDirty;
     bool forceXmlRefresh; /// bypass the 15-minutes guard
@@ -258,6 +292,7 @@ private:
     int listN;
 
     Atomic<bool,memory_ordering_strong> refreshing;
+    std::atomic<uint32_t> revision;
 
     uint64_t lastXmlUpdate;
     uint64_t lastFullUpdate;
@@ -282,6 +317,10 @@ private:
 
     BloomFilter<5> bloom;
 
+    /** TTH filters sent to hubs, kept up to date as files are added and dropped on removals */
+    mutable vector<HashBloom> hashBlooms;
+    enum { MAX_HASH_BLOOMS = 4 };
+
     Directory::File::Set::const_iterator findFile(const string& virtualFile) const;
 
     Directory::Ptr buildTree(const string& aName, const Directory::Ptr& aParent);
@@ -67,7 +67,7 @@ static bool isNameChar(int c) {
 }
 
 SimpleXMLReader::SimpleXMLReader(SimpleXMLReader::CallBack* callback) :
-    bufPos(0), pos(0), cb(callback), state(STATE_START)
+    bufPos(0), pos(0), attribCount(0), cb(callback), convert(false), state(STATE_START), depth(0)
 {
     elements.reserve(64);
     attribs.reserve(16);
@@ -87,6 +87,48 @@ void SimpleXMLReader::append(std::string& str, size_t maxLen, std::string::const
     str.append(begin, end);
 }
 
+void SimpleXMLReader::append(std::string& str, size_t maxLen, size_t n) {
+    if(str.size() + n > maxLen) {
+        error("Buffer overflow");
+    }
+    str.append(buf, bufPos, n);
+}
+
+std::string& SimpleXMLReader::pushElement() {
+    if(depth == elements.size()) {
+        elements.push_back(std::string());
+    }
+    std::string& e = elements[depth++];
+    e.clear();
+    return e;
+}
+
+StringPair& SimpleXMLReader::pushAttrib() {
+    if(attribCount == attribs.size()) {
+        attribs.push_back(StringPair());
+        if(!spareAttribs.empty()) {
+            std::swap(attribs.back(), spareAttribs.back());
+            spareAttribs.pop_back();
+        }
+    }
+    StringPair& a = attribs[attribCount++];
+    a.first.clear();
+    a.second.clear();
+    return a;
+}
+
+void SimpleXMLReader::startTag(bool simple) {
+    // the callback must only see attributes of this element, keep the buffers of the others around
+    while(attribs.size() > attribCount) {
+        spareAttribs.push_back(StringPair());
+        std::swap(spareAttribs.back(), attribs.back());
+        attribs.pop_back();
+    }
+    attribCount = 0;
+
+    cb->startTag(topElement(), attribs, simple);
+}
+
 /// @todo This is cheating - we should be converting from the encoding, but since we simplify a few things
 /// this is ok
 int SimpleXMLReader::charAt(size_t n) const { return buf[bufPos + n]; }
@@ -141,13 +183,12 @@ bool SimpleXMLReader::element() {
 
     int c = charAt(1);
         if(charAt(0) == '<' && isNameStartChar(c)) {
-            if(elements.size() >= MAX_NESTING) {
+            if(depth >= MAX_NESTING) {
                 error("Max nesting exceeded");
             }
 
             state = STATE_ELEMENT_NAME;
-            elements.push_back(std::string());
-            append(elements.back(), MAX_NAME_SIZE, c);
+            append(pushElement(), MAX_NAME_SIZE, c);
 
             advancePos(2);
 
@@ -163,22 +204,21 @@ bool SimpleXMLReader::elementName() {
         int c = charAt(i);
 
         if(isSpace(c)) {
-            append(elements.back(), MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+            append(topElement(), MAX_NAME_SIZE, i);
 
             state = STATE_ELEMENT_ATTR;
             advancePos(i + 1);
             return true;
         } else if(c == '/') {
-            append(elements.back(), MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+            append(topElement(), MAX_NAME_SIZE, i);
 
             state = STATE_ELEMENT_END_SIMPLE;
             advancePos(i + 1);
             return true;
         } else if(c == '>') {
-            append(elements.back(), MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+            append(topElement(), MAX_NAME_SIZE, i);
 
-            cb->startTag(elements.back(), attribs, false);
-            attribs.clear();
+            startTag(false);
 
             state = STATE_CONTENT;
             advancePos(i + 1);
@@ -188,7 +228,7 @@ bool SimpleXMLReader::elementName() {
         }
     }
 
-    append(elements.back(), MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+    append(topElement(), MAX_NAME_SIZE, i);
     advancePos(i);
 
     return true;
@@ -201,8 +241,7 @@ bool SimpleXMLReader::elementAttr() {
 
     int c = charAt(0);
     if(isNameStartChar(c)) {
-        attribs.push_back(StringPair());
-        append(attribs.back().first, MAX_NAME_SIZE, c);
+        append(pushAttrib().first, MAX_NAME_SIZE, c);
 
         state = STATE_ELEMENT_ATTR_NAME;
         advancePos(1);
@@ -219,13 +258,13 @@ bool SimpleXMLReader::elementAttrName() {
         int c = charAt(i);
 
         if(isSpace(c)) {
-            append(attribs.back().first, MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+            append(topAttrib().first, MAX_NAME_SIZE, i);
 
             state = STATE_ELEMENT_ATTR_EQ;
             advancePos(i + 1);
             return true;
         } else if(c == '=') {
-            append(attribs.back().first, MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+            append(topAttrib().first, MAX_NAME_SIZE, i);
 
             state = STATE_ELEMENT_ATTR_VALUE;
             advancePos(i + 1);
@@ -235,34 +274,38 @@ bool SimpleXMLReader::elementAttrName() {
         }
     }
 
-    append(attribs.back().first, MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+    append(topAttrib().first, MAX_NAME_SIZE, i);
     advancePos(i);
     return true;
 }
 
 bool SimpleXMLReader::elementAttrValue() {
+    const int quote = (state == STATE_ELEMENT_ATTR_VALUE_APOS) ? '\'' : '"';
+    std::string& v = topAttrib().second;
+
     size_t i = 0;
     for(size_t iend = bufSize(); i < iend; ++i) {
         int c = charAt(i);
 
-        if((state == STATE_ELEMENT_ATTR_VALUE_APOS && c == '\'') || (state == STATE_ELEMENT_ATTR_VALUE_QUOT && c == '"')) {
-            append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+        if(c == quote) {
+            append(v, MAX_VALUE_SIZE, i);
 
-            if(!encoding.empty() && encoding != Text::utf8) {
-                attribs.back().second = Text::toUtf8(attribs.back().second, encoding);
+            if(convert) {
+                v = Text::toUtf8(v, encoding);
             }
 
             state = STATE_ELEMENT_ATTR;
             advancePos(i + 1);
             return true;
         } else if(c == '&') {
-            append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+            // entities are rare, only then the value is decoded piece by piece
+            append(v, MAX_VALUE_SIZE, i);
             advancePos(i);
-            return entref(attribs.back().second);
+            return entref(v);
         }
     }
 
-    append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+    append(v, MAX_VALUE_SIZE, i);
     advancePos(i);
 
     return true;
@@ -274,9 +317,8 @@ bool SimpleXMLReader::elementEndSimple() {
     }
 
     if(charAt(0) == '>') {
-        cb->startTag(elements.back(), attribs, true);
-        elements.pop_back();
-        attribs.clear();
+        startTag(true);
+        --depth;
 
         state = STATE_CONTENT;
         advancePos(1);
@@ -292,8 +334,7 @@ bool SimpleXMLReader::elementEndComplex() {
     }
 
     if(charAt(0) == '>') {
-        cb->startTag(elements.back(), attribs, false);
-        attribs.clear();
+        startTag(false);
 
         state = STATE_CONTENT;
         advancePos(1);
@@ -356,6 +397,7 @@ bool SimpleXMLReader::declEncodingValue() {
 
         if((state == STATE_DECL_ENCODING_NAME_APOS && c == '\'') || (state == STATE_DECL_ENCODING_NAME_QUOT && c == '"')) {
             encoding = Text::toLower(encoding);
+            convert = !encoding.empty() && encoding != Text::utf8;
             state = STATE_DECL_STANDALONE;
             advancePos(1);
             return true;
@@ -475,19 +517,27 @@ bool SimpleXMLReader::content() {
         return entref(value);
     }
 
-    append(value, MAX_VALUE_SIZE, c);
+    // take everything up to the next markup or entity at once
+    size_t i = 1;
+    for(size_t iend = bufSize(); i < iend; ++i) {
+        c = charAt(i);
+        if(c == '<' || c == '&') {
+            break;
+        }
+    }
 
-    advancePos(1);
+    append(value, MAX_VALUE_SIZE, i);
+    advancePos(i);
 
     return true;
 }
 
 bool SimpleXMLReader::elementEnd() {
-    if(elements.empty()) {
+    if(depth == 0) {
         return false;
     }
 
-    const string& top = elements.back();
+    const string& top = topElement();
     if(!needChars(top.size())) {
         return true;
     }
@@ -507,12 +557,12 @@ bool SimpleXMLReader::elementEndEnd() {
     }
 
     if(charAt(0) == '>') {
-        if(!encoding.empty() && encoding != Text::utf8) {
-            value = Text::toUtf8(encoding);
+        if(convert) {
+            value = Text::toUtf8(value, encoding);
         }
-        cb->endTag(elements.back(), value);
+        cb->endTag(topElement(), value);
         value.clear();
-        elements.pop_back();
+        --depth;
 
         state = STATE_CONTENT;
         advancePos(1);
@@ -526,17 +576,21 @@ bool SimpleXMLReader::skipSpace(bool store) {
     if(!needChars(1)) {
         return true;
     }
-    bool skipped = false;
-    int c;
-    while(needChars(1) && isSpace(c = charAt(0))) {
-        if(store) {
-            append(value, MAX_VALUE_SIZE, c);
-        }
-        advancePos();
-        skipped = true;
+
+    size_t i = 0;
+    for(size_t iend = bufSize(); i < iend && isSpace(charAt(i)); ++i)
+        ;
+
+    if(i == 0) {
+        return false;
     }
 
-    return skipped;
+    if(store) {
+        append(value, MAX_VALUE_SIZE, i);
+    }
+    advancePos(i);
+
+    return true;
 }
 
 bool SimpleXMLReader::needChars(size_t n) const {
@@ -559,7 +613,7 @@ void SimpleXMLReader::parse(InputStream& stream, size_t maxSize) {
             error("Greater than maximum allowed size");
 
         if(len == 0) {
-            if(elements.empty()) {
+            if(depth == 0) {
                 // Fine...
                 return;
             }
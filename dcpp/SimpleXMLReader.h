@@ -120,18 +120,33 @@ private:
     std::string::size_type bufPos;
     uint64_t pos;
 
+    /// Attributes of the current element; entries past attribCount are kept for their buffers
     dcpp::StringPairList attribs;
+    size_t attribCount;
+    /// Buffers of attributes an element with fewer of them didn't need
+    dcpp::StringPairList spareAttribs;
     std::string value;
 
     CallBack* cb;
     std::string encoding;
+    /// Whether values have to be converted from encoding to UTF-8
+    bool convert;
 
     ParseState state;
 
+    /// Open elements; entries past depth are kept for their buffers
     dcpp::StringList elements;
+    size_t depth;
+
+    std::string& pushElement();
+    std::string& topElement() { return elements[depth - 1]; }
+    StringPair& pushAttrib();
+    StringPair& topAttrib() { return attribs[attribCount - 1]; }
+    void startTag(bool simple);
 
     void append(std::string& str, size_t maxLen, int c);
     void append(std::string& str, size_t maxLen, std::string::const_iterator begin, std::string::const_iterator end);
+    void append(std::string& str, size_t maxLen, size_t n);
 
     bool needChars(size_t n) const;
     int charAt(size_t n) const;
@@ -56,6 +56,10 @@
 #include <sys/sockio.h>
 #endif
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_MMSG
+#endif
+
 namespace dcpp {
 
 string Socket::udpServer;
@@ -134,6 +138,54 @@ void Socket::accept(const Socket& listeningSocket) {
     setBlocking(false);
 }
 
+void Socket::accept(socket_t aSock, const string& aIp) {
+    if(sock != INVALID_SOCKET) {
+        disconnect();
+    }
+    sock = aSock;
+
+#ifdef _WIN32
+    ::WSAAsyncSelect(sock, NULL, 0, 0);
+#endif
+
+    type = TYPE_TCP;
+
+    setIp(aIp);
+    connected = true;
+#ifndef __linux__
+    // accept4 already did this
+    setBlocking(false);
+#endif
+}
+
+socket_t Socket::acceptPending(string& aIp) {
+    sockaddr_in sock_addr;
+    socklen_t sz;
+    socket_t s;
+
+    for(;;) {
+        sz = sizeof(sock_addr);
+#ifdef __linux__
+        s = ::accept4(sock, (sockaddr*)&sock_addr, &sz, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        s = ::accept(sock, (sockaddr*)&sock_addr, &sz);
+#endif
+        if(s != INVALID_SOCKET)
+            break;
+
+#ifndef _WIN32
+        // ECONNABORTED: the peer gave up while waiting in the backlog, try the next one
+        if(getLastError() == EINTR || getLastError() == ECONNABORTED)
+            continue;
+#endif
+        check(SOCKET_ERROR, true);
+        return INVALID_SOCKET;
+    }
+
+    aIp = inet_ntoa(sock_addr.sin_addr);
+    return s;
+}
+
 
 string Socket::getIfaceI4 (const string &iface){
 #ifdef _WIN32
@@ -182,8 +234,8 @@ uint16_t Socket::bind(uint16_t aPort, const string& aIp /* = 0.0.0.0 */) {
     return ntohs(sock_addr.sin_port);
 }
 
-void Socket::listen() {
-    check(::listen(sock, 20));
+void Socket::listen(int aBacklog) {
+    check(::listen(sock, aBacklog));
     connected = true;
 }
 
@@ -391,6 +443,88 @@ int Socket::read(void* aBuffer, int aBufLen, sockaddr_in &remote) {
     return len;
 }
 
+int Socket::readBatch(Datagram* aPackets, int aCount) {
+    dcassert(type == TYPE_UDP);
+    if(aCount <= 0)
+        return 0;
+
+#ifdef HAVE_MMSG
+    aCount = min(aCount, (int)MAX_BATCH);
+    mmsghdr msgs[MAX_BATCH];
+    iovec iovs[MAX_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for(int i = 0; i < aCount; ++i) {
+        iovs[i].iov_base = aPackets[i].buf;
+        iovs[i].iov_len = aPackets[i].size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &aPackets[i].addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+
+    int n;
+    do {
+        n = ::recvmmsg(sock, msgs, aCount, MSG_WAITFORONE, NULL);
+    } while (n < 0 && getLastError() == EINTR);
+
+    if(check(n, true) == -1)
+        return 0;
+
+    for(int i = 0; i < n; ++i) {
+        aPackets[i].len = msgs[i].msg_len;
+        stats.totalDown += msgs[i].msg_len;
+    }
+    return n;
+#else
+    int len = read(aPackets[0].buf, aPackets[0].size, aPackets[0].addr);
+    if(len < 0)
+        return 0;
+    aPackets[0].len = len;
+    return 1;
+#endif
+}
+
+int Socket::writeToBatch(Datagram* aPackets, int aCount) {
+    dcassert(type == TYPE_UDP);
+    if(aCount <= 0)
+        return 0;
+
+#ifdef HAVE_MMSG
+    if(SETTING(OUTGOING_CONNECTIONS) != SettingsManager::OUTGOING_SOCKS5) {
+        aCount = min(aCount, (int)MAX_BATCH);
+        mmsghdr msgs[MAX_BATCH];
+        iovec iovs[MAX_BATCH];
+        memset(msgs, 0, sizeof(msgs));
+        for(int i = 0; i < aCount; ++i) {
+            iovs[i].iov_base = aPackets[i].buf;
+            iovs[i].iov_len = aPackets[i].len;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &aPackets[i].addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        }
+
+        int n;
+        do {
+            n = ::sendmmsg(sock, msgs, aCount, MSG_NOSIGNAL);
+        } while (n < 0 && getLastError() == EINTR);
+
+        if(check(n, true) == -1)
+            return 0;
+
+        for(int i = 0; i < n; ++i) {
+            stats.totalUp += msgs[i].msg_len;
+        }
+        return n;
+    }
+#endif
+
+    for(int i = 0; i < aCount; ++i) {
+        writeTo(inet_ntoa(aPackets[i].addr.sin_addr), ntohs(aPackets[i].addr.sin_port), aPackets[i].buf, aPackets[i].len);
+    }
+    return aCount;
+}
+
 int Socket::readAll(void* aBuffer, int aBufLen, uint32_t timeout) {
     uint8_t* buf = (uint8_t*)aBuffer;
     int i = 0;
@@ -440,6 +574,12 @@ int Socket::write(const void* aBuffer, int aLen) {
     return sent;
 }
 
+int Socket::sendFile(File&, int64_t, int) {
+    // callers check canSendFile() first
+    dcassert(0);
+    throw SocketException(EINVAL);
+}
+
 /**
 * Sends data, will block until all data has been sent or an exception occurs
 * @param aBuffer Buffer with data
@@ -40,6 +40,8 @@ const int INVALID_SOCKET = -1;
 
 namespace dcpp {
 
+class File;
+
 class SocketException : public Exception {
 public:
 #ifdef _DEBUG
@@ -69,6 +71,9 @@ public:
         TYPE_UDP
     };
 
+    /** Most datagrams handled by a single readBatch()/writeToBatch() call */
+    enum { MAX_BATCH = 64 };
+
     Socket() : sock(INVALID_SOCKET), connected(false) { }
     Socket(const string& aIp, uint16_t aPort) : sock(INVALID_SOCKET), connected(false) { connect(aIp, aPort); }
     virtual ~Socket() { disconnect(); }
@@ -122,6 +127,33 @@ public:
      * @throw SocketException On any failure.
      */
     virtual int read(void* aBuffer, int aBufLen, sockaddr_in& remote);
+
+    /** A datagram for readBatch() and writeToBatch() */
+    struct Datagram {
+        /** Buffer owned by the caller */
+        uint8_t* buf;
+        /** Size of buf */
+        int size;
+        /** Number of bytes received or to send */
+        int len;
+        /** Sender when reading, destination when writing */
+        sockaddr_in addr;
+    };
+    /**
+     * Reads up to aCount (at most MAX_BATCH) datagrams with a single call where the platform supports
+     * it (recvmmsg). Only the first datagram is waited for.
+     * @return Number of datagrams read, 0 if the call would block.
+     * @throw SocketException On any failure.
+     */
+    int readBatch(Datagram* aPackets, int aCount);
+    /**
+     * Sends aCount (at most MAX_BATCH) datagrams, with a single call where the platform supports it
+     * (sendmmsg). Datagrams are sent one by one through the SOCKS5 UDP relay
+     * when that is used.
+     * @return Number of datagrams sent, the rest would have blocked.
+     * @throw SocketException On any failure.
+     */
+    int writeToBatch(Datagram* aPackets, int aCount);
     /**
      * Reads data until aBufLen bytes have been read or an error occurs.
      * If the socket is closed, or the timeout is reached, the number of bytes read
@@ -161,12 +193,34 @@ public:
 
     /** Binds a socket to a certain local port and possibly IP. */
     virtual uint16_t bind(uint16_t aPort = 0, const string& aIp = "0.0.0.0");
-    virtual void listen();
+    virtual void listen(int aBacklog = 20);
     virtual void accept(const Socket& listeningSocket);
+    /**
+     * Takes over a connection returned by acceptPending() on a listening socket.
+     * @param aSock Socket to take over, it's closed together with this object from here on
+     */
+    virtual void accept(socket_t aSock, const string& aIp);
+    /**
+     * Accepts a pending connection on a non-blocking listening socket, uses accept4 to get
+     * a non-blocking, close-on-exec socket in a single call where available.
+     * @param aIp Set to the address of the peer
+     * @return The new socket or INVALID_SOCKET when no connection is pending.
+     * @throw SocketException On any failure other than an empty backlog.
+     */
+    socket_t acceptPending(string& aIp);
 
     int getSocketOptInt(int option);
     void setSocketOpt(int option, int value);
 
+    /** Whether sendFile() can be used, SSL sockets need the kernel to do the encryption */
+    virtual bool canSendFile() const noexcept { return false; }
+    /**
+     * Sends aLen bytes of aFile from aPos on without copying them through user space.
+     * @return Number of bytes sent or -1 if the call would block.
+     * @throw SocketException On any failure.
+     */
+    virtual int sendFile(File& aFile, int64_t aPos, int aLen);
+
     virtual bool isSecure() const noexcept { return false; }
     virtual bool isTrusted() const noexcept { return false; }
     virtual std::string getCipherName() const noexcept { return Util::emptyString; }
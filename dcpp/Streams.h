@@ -19,6 +19,7 @@
 #pragma once
 
 #include <algorithm>
+#include <memory>
 #include "typedefs.h"
 #include "format.h"
 #include "SettingsManager.h"
@@ -106,6 +107,25 @@ private:
     uint8_t* buf;
 };
 
+/** Reads a buffer shared with other readers, without copying it */
+class SharedInputStream : public InputStream {
+public:
+    SharedInputStream(const std::shared_ptr<const string>& aBuf) : buf(aBuf), pos(0) { }
+
+    virtual size_t read(void* tgt, size_t& len) {
+        len = min(len, buf->size() - pos);
+        memcpy(tgt, buf->data() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    size_t getSize() const { return buf->size(); }
+
+private:
+    std::shared_ptr<const string> buf;
+    size_t pos;
+};
+
 class IOStream : public InputStream, public OutputStream {
 };
 
@@ -27,8 +27,7 @@ namespace dcpp {
  * A class that implements a fast substring search algo suited for matching
  * one pattern against many strings (currently Quick Search, a variant of
  * Boyer-Moore. Code based on "A very fast substring search algorithm" by
- * D. Sunday).
- * @todo Perhaps find an algo suitable for matching multiple substrings.
+ * D. Sunday). MultiStringSearch matches several substrings at once.
  */
 class StringSearch {
 public:
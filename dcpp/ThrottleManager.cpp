@@ -34,79 +34,243 @@ namespace dcpp {
  * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
  */
 
+const uint64_t ThrottleManager::MAX_WAIT;
+
+namespace {
+const char* directionNames[ThrottleManager::DIRECTION_LAST] = { "down", "up" };
+const char* classNames[ThrottleManager::CLASS_LAST] = { "normal", "minislot", "filelist" };
+}
+
+ThrottleManager::ThrottleManager() : halt(false)
+{
+    for(int dir = 0; dir < DIRECTION_LAST; ++dir) {
+        curThrottling[dir] = false;
+        hubRates[dir] = userRates[dir] = 0;
+        global[dir] = make_shared<TokenBucket>(directionNames[dir]);
+        for(int cls = 0; cls < CLASS_LAST; ++cls) {
+            classes[dir][cls] = make_shared<TokenBucket>(string(directionNames[dir]) + "/" + classNames[cls]);
+        }
+        defaultHandle.buckets[dir][Handle::LEVEL_GLOBAL] = global[dir];
+        defaultHandle.buckets[dir][Handle::LEVEL_CLASS] = classes[dir][CLASS_NORMAL];
+    }
+
+    updateLimits();
+
+    limitsTimer = TimerManager::getInstance()->addPeriodicTimer(1000,
+        std::bind(&ThrottleManager::onLimitsTimer, this, std::placeholders::_1));
+}
+
+ThrottleManager::~ThrottleManager(void)
+{
+    shutdown();
+    TimerManager::getInstance()->removeTimer(limitsTimer);
+}
+
 /*
  * Throttles traffic and reads a packet from the network
  */
-int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
+int ThrottleManager::read(Socket* sock, void* buffer, size_t len, Handle* handle)
 {
-    int64_t readSize = -1;
     size_t downs = DownloadManager::getInstance()->getDownloadCount();
-    auto downLimit = getDownLimit(); // avoid even intra-function races
-    if(!BOOLSETTING(THROTTLE_ENABLE) || !getCurThrottling() || downLimit == 0 || downs == 0)
+    if(!BOOLSETTING(THROTTLE_ENABLE) || !getCurThrottling(DOWN) || downs == 0)
         return sock->read(buffer, len);
 
-    {
-        Lock l(downCS);
-
-        if(downTokens > 0)
-        {
-            int64_t slice = (downLimit * 1024) / downs;
-            readSize = min(slice, min(static_cast<int64_t>(len), downTokens));
-
-            // read from socket
-            readSize = sock->read(buffer, static_cast<size_t>(readSize));
-
-            if(readSize > 0)
-                downTokens -= readSize;
-        }
+    Handle& h = handle ? *handle : defaultHandle;
+    size_t readSize = acquire(DOWN, h, len, downs);
+    if(readSize == 0)
+        return -1;  // from BufferedSocket: -1 = retry, 0 = connection close
+
+    int actual = -1;
+    try {
+        actual = sock->read(buffer, readSize);
+    } catch(const Exception&) {
+        release(DOWN, h, readSize);
+        throw;
     }
 
-    if(readSize != -1)
-    {
-        Thread::yield(); // give a chance to other transfers to get a token
-        return readSize;
-    }
+    // give back what the socket didn't deliver
+    if(actual < static_cast<int>(readSize))
+        release(DOWN, h, readSize - max(actual, 0));
 
-    waitToken();
-    return -1;  // from BufferedSocket: -1 = retry, 0 = connection close
+    return actual;
 }
 
 /*
  * Throttles traffic and writes a packet to the network
  * Handle this a little bit differently than downloads due to OpenSSL stupidity
  */
-int ThrottleManager::write(Socket* sock, void* buffer, size_t& len)
+int ThrottleManager::write(Socket* sock, void* buffer, size_t& len, Handle* handle)
+{
+    size_t writeSize = acquireUp(len, handle);
+    if(writeSize == 0)
+        return 0;   // from BufferedSocket: -1 = failed, 0 = retry
+
+    // the tokens stay consumed even if the write has to be repeated, the
+    // retry in BufferedSocket must use the same size and bypasses us
+    len = writeSize;
+    return sock->write(buffer, len);
+}
+
+int ThrottleManager::sendFile(Socket* sock, File& file, int64_t pos, size_t& len, Handle* handle)
+{
+    size_t writeSize = acquireUp(len, handle);
+    if(writeSize == 0)
+        return 0;
+
+    len = writeSize;
+    return sock->sendFile(file, pos, static_cast<int>(len));
+}
+
+size_t ThrottleManager::acquireUp(size_t len, Handle* handle)
 {
-    bool gotToken = false;
     size_t ups = UploadManager::getInstance()->getUploadCount();
-    auto upLimit = getUpLimit(); // avoid even intra-function races
-    if(!BOOLSETTING(THROTTLE_ENABLE) || !getCurThrottling() || upLimit == 0 || ups == 0)
-        return sock->write(buffer, len);
+    if(!BOOLSETTING(THROTTLE_ENABLE) || !getCurThrottling(UP) || ups == 0)
+        return len;
 
-    {
-        Lock l(upCS);
+    return acquire(UP, handle ? *handle : defaultHandle, len, ups);
+}
 
-        if(upTokens > 0)
-        {
-            size_t slice = (upLimit * 1024) / ups;
-            len = min(slice, min(len, static_cast<size_t>(upTokens)));
-            upTokens -= len;
+size_t ThrottleManager::acquire(Direction dir, Handle& handle, size_t len, size_t transfers)
+{
+    // no limit at all, don't bother with the lock
+    if(!getCurThrottling(dir))
+        return len;
+
+    Lock l(cs);
+    if(halt)
+        return len;
+
+    auto now = TokenBucket::Clock::now();
+    auto& chain = handle.buckets[dir];
+
+    int64_t allowed = static_cast<int64_t>(len);
+    bool limited = false;
+    for(auto& b: chain) {
+        if(b && b->isLimited()) {
+            limited = true;
+            allowed = min(allowed, b->available(now));
+        }
+    }
+
+    if(limited && global[dir]->isLimited()) {
+        // share the global burst between the running transfers (fairness)
+        int64_t slice = max(global[dir]->getBurst() / static_cast<int64_t>(transfers), TokenBucket::MIN_BURST);
+        allowed = min(allowed, slice);
+    }
 
-            gotToken = true; // token successfuly assigned
+    if(allowed > 0) {
+        for(auto& b: chain) {
+            if(b)
+                b->consume(allowed);
         }
+        return static_cast<size_t>(allowed);
+    }
+
+    // no tokens, sleep until the most restrictive bucket has refilled enough
+    int64_t wanted = min(static_cast<int64_t>(len), TokenBucket::MIN_BURST);
+    uint64_t delay = 1;
+    for(auto& b: chain) {
+        if(b)
+            delay = max(delay, b->getDelay(wanted));
+    }
+    delay = min(delay, MAX_WAIT);
+
+    for(auto& b: chain) {
+        if(b && b->isLimited() && b->getDelay(wanted) > 0)
+            b->addWait(delay);
+    }
+
+    tokenCond.wait_for(cs, std::chrono::milliseconds(delay));
+    return 0;
+}
+
+void ThrottleManager::release(Direction dir, Handle& handle, size_t len)
+{
+    if(len == 0)
+        return;
+
+    Lock l(cs);
+    for(auto& b: handle.buckets[dir]) {
+        if(b)
+            b->refund(len);
+    }
+}
+
+ThrottleManager::HandlePtr ThrottleManager::getHandle(const string& aHubUrl, const CID& aUser, SlotClass aClass)
+{
+    auto h = make_shared<Handle>();
+    string cid = aUser.toBase32();
+
+    Lock l(cs);
+    for(int dir = 0; dir < DIRECTION_LAST; ++dir) {
+        string prefix = directionNames[dir];
+        h->buckets[dir][Handle::LEVEL_GLOBAL] = global[dir];
+        h->buckets[dir][Handle::LEVEL_CLASS] = classes[dir][aClass];
+        if(!aHubUrl.empty())
+            h->buckets[dir][Handle::LEVEL_HUB] = getBucket(hubs[dir], aHubUrl, prefix + "/hub/" + aHubUrl, hubRates[dir]);
+        h->buckets[dir][Handle::LEVEL_USER] = getBucket(users[dir], cid, prefix + "/user/" + cid, userRates[dir]);
     }
+    return h;
+}
 
-    if(gotToken)
-    {
-        // write to socket
-        int sent = sock->write(buffer, len);
+ThrottleManager::BucketPtr& ThrottleManager::getBucket(BucketMap& buckets, const string& aKey, const string& aName, int64_t aRate)
+{
+    auto& b = buckets[aKey];
+    if(!b) {
+        b = make_shared<TokenBucket>(aName);
+        b->setRate(aRate);
+    }
+    return b;
+}
 
-        Thread::yield(); // give a chance to other transfers get a token
-        return sent;
+ThrottleManager::StatsList ThrottleManager::getStats()
+{
+    StatsList ret;
+
+    auto add = [&ret](const BucketPtr& b) {
+        BucketStats s = { b->getName(), b->getRate(), b->getBytes(), b->getWaits(), b->getWaited() };
+        ret.push_back(s);
+    };
+
+    Lock l(cs);
+    for(int dir = 0; dir < DIRECTION_LAST; ++dir) {
+        add(global[dir]);
+        for(int cls = 0; cls < CLASS_LAST; ++cls)
+            add(classes[dir][cls]);
+        for(auto& i: hubs[dir])
+            add(i.second);
+        for(auto& i: users[dir])
+            add(i.second);
     }
+    return ret;
+}
 
-    waitToken();
-    return 0;   // from BufferedSocket: -1 = failed, 0 = retry
+void ThrottleManager::updateLimits()
+{
+    Lock l(cs);
+
+    global[DOWN]->setRate(static_cast<int64_t>(getDownLimit()) * 1024);
+    global[UP]->setRate(static_cast<int64_t>(getUpLimit()) * 1024);
+
+    classes[UP][CLASS_MINISLOT]->setRate(static_cast<int64_t>(SETTING(MAX_UPLOAD_SPEED_MINISLOT)) * 1024);
+    classes[UP][CLASS_FILELIST]->setRate(static_cast<int64_t>(SETTING(MAX_UPLOAD_SPEED_FILELIST)) * 1024);
+
+    hubRates[DOWN] = static_cast<int64_t>(SETTING(MAX_DOWNLOAD_SPEED_PER_HUB)) * 1024;
+    hubRates[UP] = static_cast<int64_t>(SETTING(MAX_UPLOAD_SPEED_PER_HUB)) * 1024;
+    userRates[DOWN] = static_cast<int64_t>(SETTING(MAX_DOWNLOAD_SPEED_PER_USER)) * 1024;
+    userRates[UP] = static_cast<int64_t>(SETTING(MAX_UPLOAD_SPEED_PER_USER)) * 1024;
+
+    for(int dir = 0; dir < DIRECTION_LAST; ++dir) {
+        for(auto& i: hubs[dir])
+            i.second->setRate(hubRates[dir]);
+        for(auto& i: users[dir])
+            i.second->setRate(userRates[dir]);
+
+        bool limited = global[dir]->isLimited() || hubRates[dir] > 0 || userRates[dir] > 0;
+        for(int cls = 0; cls < CLASS_LAST; ++cls)
+            limited = limited || classes[dir][cls]->isLimited();
+        curThrottling[dir] = limited;
+    }
 }
 
 SettingsManager::IntSetting ThrottleManager::getCurSetting(SettingsManager::IntSetting setting) {
@@ -154,134 +318,37 @@ void ThrottleManager::setSetting(SettingsManager::IntSetting setting, int value)
         ClientManager::getInstance()->infoUpdated();
 }
 
-bool ThrottleManager::getCurThrottling() {
-    Lock l(stateCS);
-    return activeWaiter != -1;
-}
-
-void ThrottleManager::waitToken() {
-    // no tokens, wait for them, so long as throttling still active
-    // avoid keeping stateCS lock on whole function
-    CriticalSection *curCS = 0;
-    {
-        Lock l(stateCS);
-        if (activeWaiter != -1)
-            curCS = &waitCS[activeWaiter];
-    }
-    // possible post-CS aW shifts: 0->1/1->0: lock lands in wrong place, will
-    // either fall through immediately or wait depending on whether in
-    // stateCS-protected transition elsewhere; 0/1-> -1: falls through. Both harmless.
-    if (curCS)
-        Lock l(*curCS);
-}
-
-ThrottleManager::~ThrottleManager(void)
-{
-    shutdown();
-    TimerManager::getInstance()->removeListener(this);
-}
-
-#ifdef _WIN32
-
 void ThrottleManager::shutdown() {
-    Lock l(stateCS);
-    if (activeWaiter != -1) {
-        waitCS[activeWaiter].unlock();
-        activeWaiter = -1;
-    }
+    Lock l(cs);
+    halt = true;
+    tokenCond.notify_all();
 }
-#else //*nix
 
-void ThrottleManager::shutdown()
-{
-    bool wait = false;
-    {
-        Lock l(stateCS);
-        if (activeWaiter != -1)
-        {
-            n_lock = activeWaiter;
-            activeWaiter = -1;
-            halt = 1;
-            wait = true;
-        }
-    }
-
-    // wait shutdown...
-    if (wait)
-    {
-        Lock l(shutdownCS);
-    }
-}
-#endif //*nix
-
-// TimerManagerListener
-void ThrottleManager::on(TimerManagerListener::Second, uint64_t /* aTick */) noexcept
+void ThrottleManager::onLimitsTimer(uint64_t /* aTick */)
 {
     int newSlots = SettingsManager::getInstance()->get(getCurSetting(SettingsManager::SLOTS));
     if(newSlots != SETTING(SLOTS)) {
         setSetting(SettingsManager::SLOTS, newSlots);
     }
 
-    {
-        Lock l(stateCS);
-
-#ifndef _WIN32 //*nix
-
-        if (halt == 1)
-        {
-            halt = -1;
-
-            // unlock shutdown and token wait
-            dcassert(n_lock == 0 || n_lock == 1);
-            waitCS[n_lock].unlock();
-            shutdownCS.unlock();
+    Lock l(cs);
 
-            return;
-        }
-        else if (halt == -1)
-        {
-            return;
-        }
-#endif
-        if (activeWaiter == -1)
-        {
-            // This will create slight weirdness for the read/write calls between
-            // here and the first activeWaiter-toggle below.
-            waitCS[activeWaiter = 0].lock();
-
-#ifndef _WIN32 //*nix
+    // limits may have been changed by the user or by the time dependent throttling
+    updateLimits();
 
-            // lock shutdown
-            shutdownCS.lock();
-#endif
+    // forget hubs and users no transfer refers to anymore
+    for(int dir = 0; dir < DIRECTION_LAST; ++dir) {
+        for(auto maps: { &hubs[dir], &users[dir] }) {
+            for(auto i = maps->begin(); i != maps->end();) {
+                if(i->second.use_count() == 1)
+                    i = maps->erase(i);
+                else
+                    ++i;
+            }
         }
     }
 
-    int downLimit = getDownLimit();
-    int upLimit   = getUpLimit();
-
-    // readd tokens
-    {
-        Lock l(downCS);
-        downTokens = downLimit * 1024;
-    }
-
-    {
-        Lock l(upCS);
-        upTokens = upLimit * 1024;
-    }
-
-    // let existing events drain out (fairness).
-    // www.cse.wustl.edu/~schmidt/win32-cv-1.html documents various
-    // fairer strategies, but when only broadcasting, irrelevant
-    {
-        Lock l(stateCS);
-
-        dcassert(activeWaiter == 0 || activeWaiter == 1);
-        waitCS[1-activeWaiter].lock();
-        activeWaiter = 1-activeWaiter;
-        waitCS[1-activeWaiter].unlock();
-    }
+    tokenCond.notify_all();
 }
 
 }   // namespace dcpp
@@ -18,78 +18,136 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+
 #include "Singleton.h"
 #include "Socket.h"
 #include "TimerManager.h"
 #include "SettingsManager.h"
+#include "CriticalSection.h"
+#include "TokenBucket.h"
+#include "CID.h"
 
 namespace dcpp
 {
 /**
  * Manager for throttling traffic flow.
  * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
+ *
+ * Traffic of each connection is accounted against a chain of buckets: the global
+ * limit, the slot class (normal, mini slot, file list), the hub and the user.
+ * Buckets refill continuously so bursts are smoothed to fractions of a second and
+ * throttled threads sleep until their tokens are due instead of spinning.
  */
 class ThrottleManager :
-    public Singleton<ThrottleManager>, private TimerManagerListener
+    public Singleton<ThrottleManager>
 {
 public:
+    enum Direction {
+        DOWN,
+        UP,
+        DIRECTION_LAST
+    };
+
+    enum SlotClass {
+        CLASS_NORMAL,
+        CLASS_MINISLOT,
+        CLASS_FILELIST,
+        CLASS_LAST
+    };
+
+    typedef std::shared_ptr<TokenBucket> BucketPtr;
+
+    /** Set of buckets a connection is accounted against, see getHandle */
+    class Handle : private boost::noncopyable {
+    private:
+        friend class ThrottleManager;
+        enum { LEVEL_GLOBAL, LEVEL_CLASS, LEVEL_HUB, LEVEL_USER, LEVEL_LAST };
+        BucketPtr buckets[DIRECTION_LAST][LEVEL_LAST];
+    };
+    typedef std::shared_ptr<Handle> HandlePtr;
+
+    struct BucketStats {
+        string name;
+        int64_t limit;      // bytes per second, 0 = unlimited
+        int64_t bytes;      // bytes that passed the bucket while any limit was set
+        int64_t waits;      // number of times a transfer had to wait for tokens
+        uint64_t waited;    // total milliseconds spent waiting
+    };
+    typedef vector<BucketStats> StatsList;
 
     /*
      * Throttles traffic and reads a packet from the network
      */
-    int read(Socket* sock, void* buffer, size_t len);
+    int read(Socket* sock, void* buffer, size_t len, Handle* handle = nullptr);
 
     /*
      * Throttles traffic and writes a packet to the network
      * Handle this a little bit differently than downloads due to OpenSSL stupidity
      */
-    int write(Socket* sock, void* buffer, size_t& len);
+    int write(Socket* sock, void* buffer, size_t& len, Handle* handle = nullptr);
+
+    /*
+     * Like write, but the kernel sends len bytes of the file from pos on
+     */
+    int sendFile(Socket* sock, File& file, int64_t pos, size_t& len, Handle* handle = nullptr);
+
+    /** Buckets for a transfer with the given user, sockets without a handle only use the global limits */
+    HandlePtr getHandle(const string& aHubUrl, const CID& aUser, SlotClass aClass);
+
+    StatsList getStats();
 
     static SettingsManager::IntSetting getCurSetting(SettingsManager::IntSetting setting);
 
     static int getUpLimit();
     static int getDownLimit();
 
+    /** Whether any bucket of the direction is limited, transfers skip the buckets otherwise */
+    bool getCurThrottling(Direction dir) const { return curThrottling[dir]; }
+
     static void setSetting(SettingsManager::IntSetting setting, int value);
 
     void shutdown();
 private:
-    // stack up throttled read & write threads
-    CriticalSection stateCS;
-    CriticalSection waitCS[2];
-    long activeWaiter;
+    /** Upper bound for a single wait so that setting changes are picked up */
+    static const uint64_t MAX_WAIT = 1000;
+
+    typedef unordered_map<string, BucketPtr> BucketMap;
+
+    CriticalSection cs;
+    std::condition_variable_any tokenCond;
+    bool halt;
+
+    std::atomic<bool> curThrottling[DIRECTION_LAST];
+    int64_t hubRates[DIRECTION_LAST];
+    int64_t userRates[DIRECTION_LAST];
 
-#ifndef _WIN32 //*nix
+    BucketPtr global[DIRECTION_LAST];
+    BucketPtr classes[DIRECTION_LAST][CLASS_LAST];
+    BucketMap hubs[DIRECTION_LAST];
+    BucketMap users[DIRECTION_LAST];
 
-    // shutdown wait
-    CriticalSection shutdownCS;
-    long n_lock, halt;
-#endif
-    // download limiter
-    CriticalSection downCS;
-    int64_t         downTokens;
+    Handle defaultHandle;
 
-    // upload limiter
-    CriticalSection upCS;
-    int64_t         upTokens;
+    /** Picks up setting changes once a second */
+    TimerManager::TimerId limitsTimer;
 
     friend class Singleton<ThrottleManager>;
 
-    ThrottleManager(void) : activeWaiter(-1), downTokens(0), upTokens(0)
-    {
-#ifndef _WIN32 //*nix
-        n_lock = halt = 0;
-#endif
-        TimerManager::getInstance()->addListener(this);
-    }
+    ThrottleManager();
+    ~ThrottleManager();
 
-    ~ThrottleManager(void);
+    /** @return Number of bytes that may be transferred, 0 if the caller waited for tokens and should retry */
+    size_t acquire(Direction dir, Handle& handle, size_t len, size_t transfers);
+    void release(Direction dir, Handle& handle, size_t len);
+    /** acquire() for uploads, without limits when throttling is off */
+    size_t acquireUp(size_t len, Handle* handle);
 
-    bool getCurThrottling();
-    void waitToken();
+    BucketPtr& getBucket(BucketMap& buckets, const string& aKey, const string& aName, int64_t aRate);
+    void updateLimits();
 
-    // TimerManagerListener
-    void on(TimerManagerListener::Second, uint64_t /* aTick */) noexcept;
+    void onLimitsTimer(uint64_t aTick);
 };
 
 }   // namespace dcpp
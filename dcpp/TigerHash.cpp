@@ -32,11 +32,11 @@
 
 #include <algorithm>
 #include <cstring>
-#include <boost/detail/endian.hpp>
+#include <boost/predef/other/endian.h>
 
 #include "debug.h"
 
-#ifdef BOOST_BIG_ENDIAN
+#if BOOST_ENDIAN_BIG_BYTE
 #define TIGER_BIG_ENDIAN
 #endif
 
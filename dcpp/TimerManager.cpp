@@ -22,6 +22,7 @@
 
 #ifndef TIMER_OLD_BOOST
 #include <boost/date_time/posix_time/ptime.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #endif
 namespace dcpp {
 
@@ -31,55 +32,124 @@ timeval TimerManager::tv;
 using namespace boost::posix_time;
 #endif
 
-TimerManager::TimerManager() {
+TimerManager::TimerManager() : stopping(false), running(0) {
 #ifdef TIMER_OLD_BOOST
     gettimeofday(&tv, NULL);
-#else
-    // This mutex will be unlocked only upon shutdown
-    boostmtx.lock();
 #endif
 }
 
 TimerManager::~TimerManager() {
-    dcassert(listeners.empty());
+    dcassert(!hasListeners());
 }
 
 void TimerManager::shutdown() {
-#ifdef TIMER_OLD_BOOST
-    s.signal();
-#else
-    boostmtx.unlock();
-#endif
+    {
+        TimerLock l(cs);
+        stopping = true;
+    }
+    cond.notify_all();
     join();
 }
 
+TimerManager::TimerId TimerManager::addTimer(uint64_t aDelay, const Callback& aCallback) {
+    TimerId id;
+    {
+        TimerLock l(cs);
+        id = wheel.add(getTick() + aDelay, 0, aCallback);
+    }
+    cond.notify_all();
+    return id;
+}
+
+TimerManager::TimerId TimerManager::addPeriodicTimer(uint64_t aPeriod, const Callback& aCallback) {
+    dcassert(aPeriod > 0);
+    TimerId id;
+    {
+        TimerLock l(cs);
+        id = wheel.add(getTick() + aPeriod, aPeriod, aCallback);
+    }
+    cond.notify_all();
+    return id;
+}
+
+void TimerManager::removeTimer(TimerId aId) {
+    if(aId == 0)
+        return;
+
+    TimerLock l(cs);
+    wheel.remove(aId);
+    for(auto i = expired.begin(); i != expired.end(); ++i) {
+        if(i->id == aId)
+            i->id = 0;
+    }
+
+    if(std::this_thread::get_id() != timerThread) {
+        while(running == aId)
+            cond.wait(l);
+    }
+}
+
+bool TimerManager::wait(uint64_t aUntil) {
+    TimerLock l(cs);
+    while(!stopping) {
+        uint64_t now = getTick();
+        uint64_t next = min(aUntil, wheel.getNextExpiry());
+        if(next <= now)
+            return true;
+        cond.wait_for(l, std::chrono::milliseconds(next - now));
+    }
+    return false;
+}
+
+void TimerManager::runTimers(uint64_t aTick) {
+    {
+        TimerLock l(cs);
+        wheel.advance(aTick, expired);
+    }
+
+    for(size_t i = 0; ; ++i) {
+        TimerWheel::CallbackPtr callback;
+        {
+            TimerLock l(cs);
+            running = 0;
+            // skip the ones removed after they expired
+            while(i < expired.size() && expired[i].id == 0)
+                ++i;
+            if(i < expired.size()) {
+                running = expired[i].id;
+                callback = expired[i].callback;
+            } else {
+                expired.clear();
+            }
+        }
+        cond.notify_all();
+
+        if(!callback)
+            break;
+        (*callback)(aTick);
+    }
+}
+
 int TimerManager::run() {
     setThreadName("TimerManager");
-    int nextMin = 0;
-#ifdef TIMER_OLD_BOOST
-    uint64_t x = getTick();
-    uint64_t nextTick = x + 1000;
-
-    while(!s.wait(nextTick > x ? nextTick - x : 0)) {
-        uint64_t z = getTick();
-        nextTick = z + 1000;
-        fire(TimerManagerListener::Second(), z);
-        if(nextMin++ >= 60) {
-            fire(TimerManagerListener::Minute(), z);
-             nextMin = 0;
-         }
-        x = getTick();
+    {
+        TimerLock l(cs);
+        timerThread = std::this_thread::get_id();
     }
-#else
-    ptime now = microsec_clock::universal_time();
-    ptime nextSecond = now + seconds(1);
 
-    while(!boostmtx.timed_lock(nextSecond)) {
+    int nextMin = 0;
+    uint64_t nextSecond = getTick() + 1000;
+
+    while(wait(nextSecond)) {
         uint64_t t = getTick();
-        now = microsec_clock::universal_time();
-        nextSecond += seconds(1);
-        if(nextSecond < now) {
-                nextSecond = now;
+        runTimers(t);
+
+        if(t < nextSecond)
+            continue;
+
+        nextSecond += 1000;
+        if(nextSecond < t) {
+            nextSecond = t;
         }
 
         fire(TimerManagerListener::Second(), t);
@@ -88,8 +158,6 @@ int TimerManager::run() {
             nextMin = 0;
         }
     }
-    boostmtx.unlock();
-#endif
 
     dcdebug("TimerManager done\n");
     return 0;
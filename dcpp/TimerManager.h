@@ -18,19 +18,20 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "Thread.h"
-#include "Speaker.h"
+#include "CriticalSection.h"
+#include "FastSpeaker.h"
 #include "Singleton.h"
-
-#ifdef TIMER_OLD_BOOST
-    #include "Semaphore.h"
-#else
-    #include <boost/thread/mutex.hpp>
-#endif
+#include "TimerWheel.h"
 
 #ifndef _WIN32
     #include <ctime>
     #ifdef TIMER_OLD_BOOST
+        #include <sys/time.h>
         #include <climits>
     #endif
 #endif
@@ -49,25 +50,55 @@ public:
     virtual void on(Minute, uint64_t) noexcept { }
 };
 
-class TimerManager : public Speaker<TimerManagerListener>, public Singleton<TimerManager>, public Thread
+class TimerManager : public FastSpeaker<TimerManagerListener>, public Singleton<TimerManager>, public Thread
 {
 public:
+    typedef TimerWheel::TimerId TimerId;
+    typedef TimerWheel::Callback Callback;
+
     void shutdown();
 
+    /**
+     * Call aCallback once, aDelay milliseconds from now. Callbacks run on the timer
+     * thread with the current tick and should return quickly, like Second listeners.
+     * @return Id to remove the timer with, never 0
+     */
+    TimerId addTimer(uint64_t aDelay, const Callback& aCallback);
+    /** Call aCallback every aPeriod milliseconds, the first time aPeriod milliseconds from now */
+    TimerId addPeriodicTimer(uint64_t aPeriod, const Callback& aCallback);
+    /**
+     * Once this returns the callback isn't running and won't be called anymore,
+     * unless it's the callback itself removing its timer. Unknown ids are ignored.
+     */
+    void removeTimer(TimerId aId);
+
     static time_t getTime() { return (time_t)time(NULL); }
     static uint64_t getTick();
 private:
     friend class Singleton<TimerManager>;
 #ifdef TIMER_OLD_BOOST
-    Semaphore s;
     static timeval tv;
-#else
-    boost::timed_mutex boostmtx;
 #endif
     TimerManager();
     virtual ~TimerManager();
 
     virtual int run();
+
+    /** Sleep until aUntil or the next timer expires, false when shutting down */
+    bool wait(uint64_t aUntil);
+    void runTimers(uint64_t aTick);
+
+    /** A plain mutex, waiting on cond must release it completely */
+    typedef std::unique_lock<std::mutex> TimerLock;
+    std::mutex cs;
+    std::condition_variable cond;
+    bool stopping;
+
+    TimerWheel wheel;
+    /** Timers due in the current round, the id is cleared when one is removed meanwhile */
+    vector<TimerWheel::Expired> expired;
+    TimerId running;
+    std::thread::id timerThread;
 };
 
 #define GET_TICK() TimerManager::getTick()
@@ -0,0 +1,136 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdinc.h"
+
+#include "TimerWheel.h"
+
+namespace dcpp {
+
+const uint64_t TimerWheel::RESOLUTION;
+
+TimerWheel::TimerWheel() : cur(0), nextId(1) {
+}
+
+TimerWheel::TimerId TimerWheel::add(uint64_t when, uint64_t period, const Callback& callback) {
+    TimerId id = nextId++;
+    Timer& t = timers[id];
+    t.when = when;
+    t.period = period;
+    t.callback = std::make_shared<Callback>(callback);
+    schedule(id, when);
+    return id;
+}
+
+bool TimerWheel::remove(TimerId id) {
+    return timers.erase(id) > 0;
+}
+
+void TimerWheel::schedule(TimerId id, uint64_t when) {
+    // round up, a timer may fire late but never early
+    uint64_t expires = max((when + RESOLUTION - 1) / RESOLUTION, cur);
+    uint64_t delta = expires - cur;
+
+    int level = 0;
+    while(level < LEVELS - 1 && delta >= (uint64_t(1) << ((level + 1) * SLOT_BITS)))
+        ++level;
+
+    if(delta >= (uint64_t(1) << (LEVELS * SLOT_BITS))) {
+        // out of range, park it on the top level, it'll be rescheduled when it comes down
+        expires = cur + (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+    }
+
+    slots[level][(expires >> (level * SLOT_BITS)) & (SLOTS - 1)].push_back(id);
+}
+
+void TimerWheel::cascade(int level) {
+    Slot slot;
+    slot.swap(slots[level][(cur >> (level * SLOT_BITS)) & (SLOTS - 1)]);
+    for(auto i = slot.begin(); i != slot.end(); ++i) {
+        auto t = timers.find(*i);
+        if(t != timers.end())
+            schedule(*i, t->second.when);
+    }
+}
+
+void TimerWheel::advance(uint64_t aNow, vector<Expired>& expired) {
+    uint64_t target = aNow / RESOLUTION;
+
+    if(timers.empty()) {
+        // nothing but stale ids left, no need to walk through the slots
+        for(int i = 0; i < LEVELS; ++i) {
+            for(int j = 0; j < SLOTS; ++j)
+                slots[i][j].clear();
+        }
+        cur = max(cur, target + 1);
+        return;
+    }
+
+    Slot slot;
+    for(; cur <= target; ++cur) {
+        for(int level = 1; level < LEVELS; ++level) {
+            if(((cur >> ((level - 1) * SLOT_BITS)) & (SLOTS - 1)) != 0)
+                break;
+            cascade(level);
+        }
+
+        slot.clear();
+        slot.swap(slots[0][cur & (SLOTS - 1)]);
+        for(auto i = slot.begin(); i != slot.end(); ++i) {
+            auto j = timers.find(*i);
+            if(j == timers.end())
+                continue;
+
+            Timer& t = j->second;
+            if((t.when + RESOLUTION - 1) / RESOLUTION > cur) {
+                // parked out of range
+                schedule(*i, t.when);
+                continue;
+            }
+
+            Expired e = { *i, t.callback };
+            expired.push_back(e);
+
+            if(t.period > 0) {
+                // skip missed runs instead of catching up
+                t.when += t.period;
+                if(t.when <= aNow)
+                    t.when = aNow + t.period;
+                schedule(*i, t.when);
+            } else {
+                timers.erase(j);
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::getNextExpiry() const {
+    if(timers.empty())
+        return numeric_limits<uint64_t>::max();
+
+    // upper levels are cascaded when the lowest level wraps
+    if((cur & (SLOTS - 1)) == 0)
+        return cur * RESOLUTION;
+
+    for(uint64_t i = cur; (i & (SLOTS - 1)) != 0; ++i) {
+        if(!slots[0][i & (SLOTS - 1)].empty())
+            return i * RESOLUTION;
+    }
+
+    return ((cur | (SLOTS - 1)) + 1) * RESOLUTION;
+}
+
+} // namespace dcpp
@@ -0,0 +1,102 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Hierarchical timing wheel. Each level has SLOTS slots, a slot on level n
+ * spans SLOTS^n slots of the level below; timers are moved down a level
+ * whenever the level below wraps around. Adding and removing a timer is O(1),
+ * advancing costs O(1) per elapsed RESOLUTION plus the timers that expire.
+ *
+ * The wheel does no locking on its own, TimerManager serializes all access.
+ */
+class TimerWheel : private boost::noncopyable {
+public:
+    typedef uint64_t TimerId;
+    typedef std::function<void (uint64_t)> Callback;
+
+    /** Milliseconds covered by a slot on the lowest level */
+    static const uint64_t RESOLUTION = 10;
+
+    enum {
+        SLOT_BITS = 6,
+        SLOTS = 1 << SLOT_BITS,
+        LEVELS = 4
+    };
+
+    typedef std::shared_ptr<Callback> CallbackPtr;
+
+    struct Expired {
+        TimerId id;
+        CallbackPtr callback;
+    };
+
+    TimerWheel();
+
+    /**
+     * @param when Tick at which the timer expires
+     * @param period Repeat interval in milliseconds, 0 for a one-shot timer
+     * @return Id of the new timer, never 0
+     */
+    TimerId add(uint64_t when, uint64_t period, const Callback& callback);
+    bool remove(TimerId id);
+
+    /**
+     * Advance the wheel to aNow and collect the expired timers. Periodic timers
+     * are rescheduled right away, one-shot timers are gone once returned here.
+     */
+    void advance(uint64_t aNow, vector<Expired>& expired);
+
+    /** Tick the wheel has to be advanced at next, or UINT64_MAX when it's empty */
+    uint64_t getNextExpiry() const;
+
+    size_t size() const { return timers.size(); }
+    bool empty() const { return timers.empty(); }
+
+private:
+    struct Timer {
+        uint64_t when;
+        uint64_t period;
+        CallbackPtr callback;
+    };
+
+    typedef vector<TimerId> Slot;
+
+    void schedule(TimerId id, uint64_t when);
+    void cascade(int level);
+
+    unordered_map<TimerId, Timer> timers;
+    /** Removed timers are only dropped from the map, slots skip ids they don't find */
+    Slot slots[LEVELS][SLOTS];
+    /** Next position to process, in RESOLUTION units */
+    uint64_t cur;
+    TimerId nextId;
+};
+
+} // namespace dcpp
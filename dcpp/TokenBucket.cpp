@@ -0,0 +1,75 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdinc.h"
+
+#include "TokenBucket.h"
+
+namespace dcpp {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+const int64_t TokenBucket::BURST_MS;
+const int64_t TokenBucket::MIN_BURST;
+
+void TokenBucket::setRate(int64_t aRate) {
+    if(aRate == rate)
+        return;
+
+    bool wasLimited = isLimited();
+    rate = max(aRate, (int64_t)0);
+    burst = max(rate * BURST_MS / 1000, MIN_BURST);
+    if(!wasLimited) {
+        // start over, nothing was refilled while unlimited
+        tokens = burst;
+        last = Clock::now();
+    } else {
+        tokens = min(tokens, burst);
+    }
+}
+
+int64_t TokenBucket::available(const Clock::time_point& now) {
+    if(!isLimited())
+        return numeric_limits<int64_t>::max();
+
+    int64_t elapsed = duration_cast<microseconds>(now - last).count();
+    if(elapsed > 0) {
+        int64_t refill = rate * elapsed / 1000000;
+        if(refill > 0) {
+            tokens = min(tokens + refill, burst);
+            // only advance by the time that was actually converted into tokens
+            last += microseconds(refill * 1000000 / rate);
+        }
+        if(tokens == burst) {
+            last = now;
+        }
+    }
+    return max(tokens, (int64_t)0);
+}
+
+uint64_t TokenBucket::getDelay(int64_t n) const {
+    if(!isLimited())
+        return 0;
+
+    int64_t missing = min(n, burst) - tokens;
+    if(missing <= 0)
+        return 0;
+
+    return static_cast<uint64_t>((missing * 1000 + rate - 1) / rate);
+}
+
+} // namespace dcpp
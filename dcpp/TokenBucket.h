@@ -0,0 +1,83 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+using std::string;
+
+/**
+ * A single token bucket refilled continuously from a monotonic clock.
+ * The bucket does no locking on its own, ThrottleManager serializes all access.
+ */
+class TokenBucket : private boost::noncopyable {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /** How much traffic (in milliseconds worth of the rate) may pass in a single burst */
+    static const int64_t BURST_MS = 100;
+    /** Smallest burst allowed, so that low limits still let reasonably sized packets through */
+    static const int64_t MIN_BURST = 2048;
+
+    explicit TokenBucket(const string& aName) : name(aName), rate(0), burst(0), tokens(0),
+        last(Clock::now()), bytes(0), waits(0), waited(0) { }
+
+    /** @param aRate Bytes per second, 0 means unlimited */
+    void setRate(int64_t aRate);
+    int64_t getRate() const { return rate; }
+    bool isLimited() const { return rate > 0; }
+
+    /** Refill the bucket up to now and return the number of bytes that may pass */
+    int64_t available(const Clock::time_point& now);
+    /** Largest amount of bytes a single consumer may get at once */
+    int64_t getBurst() const { return burst; }
+
+    /** Unlimited buckets only count the traffic, they don't refill and so mustn't run into debt */
+    void consume(int64_t n) { if(isLimited()) tokens -= n; bytes += n; }
+    void refund(int64_t n) { if(isLimited()) tokens = std::min(tokens + n, burst); bytes -= n; }
+
+    /** Milliseconds until n bytes become available */
+    uint64_t getDelay(int64_t n) const;
+
+    void addWait(uint64_t millis) { ++waits; waited += millis; }
+
+    const string& getName() const { return name; }
+    int64_t getBytes() const { return bytes; }
+    int64_t getWaits() const { return waits; }
+    uint64_t getWaited() const { return waited; }
+
+private:
+    string name;
+
+    int64_t rate;
+    int64_t burst;
+    int64_t tokens;
+    Clock::time_point last;
+
+    // statistics
+    int64_t bytes;
+    int64_t waits;
+    uint64_t waited;
+};
+
+} // namespace dcpp
@@ -22,10 +22,11 @@
 
 #include "UserConnection.h"
 #include "Streams.h"
+#include "ZUtils.h"
 
 namespace dcpp {
 
-Upload::Upload(UserConnection& conn, const string& path, const TTHValue& tth) : Transfer(conn, path, tth), stream(0) {
+Upload::Upload(UserConnection& conn, const string& path, const TTHValue& tth) : Transfer(conn, path, tth), stream(0), compression(0), progressPos(0), progressTick(0) {
     conn.setUpload(this);
 }
 
@@ -37,6 +38,11 @@ Upload::~Upload() {
 void Upload::getParams(const UserConnection& aSource, StringMap& params) {
     Transfer::getParams(aSource, params);
     params["source"] = getPath();
+    if(compression) {
+        params["compressionRatio"] = Util::toString(compression->getRatio());
+        params["compressionLevel"] = Util::toString(compression->isCompressing() ? compression->getLevel() : 0);
+        params["compressionTime"] = Util::toString(compression->getCpuTime() / 1000);
+    }
 }
 
 } // namespace dcpp
@@ -38,6 +38,11 @@ public:
 
     GETSET(int64_t, fileSize, FileSize);
     GETSET(InputStream*, stream, Stream);
+    /** Set for ZLIG uploads, owned by the stream */
+    GETSET(const ZFilter*, compression, Compression);
+    /** Position and time of the last progress check, see UploadManager::STALL_TIME */
+    GETSET(int64_t, progressPos, ProgressPos);
+    GETSET(uint64_t, progressTick, ProgressTick);
 };
 
 } // namespace dcpp
@@ -0,0 +1,214 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdinc.h"
+
+#include "UploadFileCache.h"
+
+#include "File.h"
+#include "SettingsManager.h"
+#include "ShareManager.h"
+#include "TimerManager.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace dcpp {
+
+const uint64_t UploadFileCache::IDLE_TIME;
+
+UploadFileCache::Entry::Entry(const string& aRealPath, const string& aVirtualPath, File* aFile, uint32_t aRevision) :
+    realPath(aRealPath), virtualPath(aVirtualPath), file(aFile), size(aFile->getSize()),
+    modified(aFile->getLastModified()), revision(aRevision), lastUsed(GET_TICK()), dropBehind(false),
+    streams(0)
+{
+}
+
+UploadFileCache::Entry::~Entry() {
+}
+
+UploadFileCache::Stream::Stream(UploadFileCache& aCache, const EntryPtr& aEntry, int64_t aPos, int64_t aEnd) :
+    cache(aCache), entry(aEntry), pos(aPos), end(aEnd), blockSize((int64_t)max(SETTING(UPLOAD_READ_AHEAD), 0) * 1024)
+{
+    if(blockSize > 0) {
+        Lock l(entry->cs);
+        ++entry->streams;
+    }
+    entry->file->advise(pos, end - pos, File::ADVISE_SEQUENTIAL);
+}
+
+UploadFileCache::Stream::~Stream() {
+    if(blockSize > 0) {
+        Lock l(entry->cs);
+        if(--entry->streams == 0)
+            entry->blocks.clear();
+    }
+}
+
+size_t UploadFileCache::Stream::read(void* buf, size_t& len) {
+    len = static_cast<size_t>(min((int64_t)len, end - pos));
+    if(len == 0)
+        return 0;
+
+    if(blockSize == 0) {
+        len = entry->file->readAt(buf, len, pos);
+        cache.diskBytes += len;
+    } else {
+        bool loaded = false;
+        Entry::BlockPtr b = getBlock(loaded);
+        int64_t offset = pos - b->pos;
+        len = static_cast<size_t>(max(min((int64_t)len, (int64_t)b->data.size() - offset), (int64_t)0));
+        if(len > 0)
+            memcpy(buf, &b->data[offset], len);
+        (loaded ? cache.diskBytes : cache.readAheadBytes) += len;
+    }
+
+    pos += len;
+    return len;
+}
+
+void UploadFileCache::Stream::skip(int64_t n) {
+    if(entry->dropBehind)
+        entry->file->advise(pos, n, File::ADVISE_DONTNEED);
+    pos += n;
+    cache.directBytes += n;
+}
+
+UploadFileCache::Entry::BlockPtr UploadFileCache::Stream::getBlock(bool& loaded) {
+    {
+        Lock l(entry->cs);
+        for(auto i = entry->blocks.rbegin(); i != entry->blocks.rend(); ++i) {
+            const Entry::BlockPtr& b = *i;
+            if(b->pos <= pos && pos < b->pos + (int64_t)b->data.size())
+                return b;
+        }
+    }
+
+    // read without the lock, the other uploads of the file may have their blocks ready
+    Entry::BlockPtr b(new Entry::Block);
+    b->pos = pos - pos % blockSize;
+    b->data.resize(static_cast<size_t>(max(min(blockSize, entry->size - b->pos), (int64_t)0)));
+    size_t n = 0;
+    while(n < b->data.size()) {
+        size_t x = entry->file->readAt(&b->data[n], b->data.size() - n, b->pos + n);
+        if(x == 0)
+            break;
+        n += x;
+    }
+    b->data.resize(n);
+    loaded = true;
+
+    // let the OS fetch the next block while this one is being sent
+    int64_t next = b->pos + blockSize;
+    if(next < end)
+        entry->file->advise(next, blockSize, File::ADVISE_WILLNEED);
+
+    Lock l(entry->cs);
+    entry->blocks.push_back(b);
+    while(entry->blocks.size() > 2 * max(entry->streams, (size_t)1)) {
+        const Entry::BlockPtr& old = entry->blocks.front();
+        if(entry->dropBehind)
+            entry->file->advise(old->pos, old->data.size(), File::ADVISE_DONTNEED);
+        entry->blocks.erase(entry->blocks.begin());
+    }
+    return b;
+}
+
+UploadFileCache::UploadFileCache() : hits(0), misses(0), readAheadBytes(0), diskBytes(0), directBytes(0) {
+}
+
+static int64_t getPhysicalMemory() {
+#ifdef _SC_PHYS_PAGES
+    static const int64_t memory = (int64_t)sysconf(_SC_PHYS_PAGES) * (int64_t)sysconf(_SC_PAGESIZE);
+    return memory > 0 ? memory : numeric_limits<int64_t>::max();
+#else
+    return numeric_limits<int64_t>::max();
+#endif
+}
+
+bool UploadFileCache::isValid(const Entry& aEntry) {
+    // a removed share bumps the revision, files changed in place show up in the open handle
+    return aEntry.revision == ShareManager::getInstance()->getRevision() &&
+        aEntry.file->getSize() == aEntry.size && aEntry.file->getLastModified() == aEntry.modified;
+}
+
+UploadFileCache::EntryPtr UploadFileCache::get(const string& aFile) {
+    {
+        Lock l(cs);
+        auto i = index.find(aFile);
+        if(i != index.end()) {
+            EntryPtr e = i->second->second;
+            if(isValid(*e)) {
+                ++hits;
+                e->lastUsed = GET_TICK();
+                lru.splice(lru.begin(), lru, i->second);
+                return e;
+            }
+            lru.erase(i->second);
+            index.erase(i);
+        }
+        ++misses;
+    }
+
+    // resolve and open without holding the lock, the share may be busy
+    ShareManager* sm = ShareManager::getInstance();
+    uint32_t revision = sm->getRevision();
+    string realPath = sm->toReal(aFile);
+    string virtualPath = sm->toVirtual(sm->getTTH(aFile));
+    EntryPtr e(new Entry(realPath, virtualPath, new File(realPath, File::READ, File::OPEN), revision));
+    e->dropBehind = BOOLSETTING(UPLOAD_DROP_BEHIND) && e->size > getPhysicalMemory();
+
+    size_t maxFiles = static_cast<size_t>(max(SETTING(UPLOAD_FILE_CACHE), 0));
+    if(maxFiles > 0) {
+        Lock l(cs);
+        auto i = index.find(aFile);
+        if(i != index.end()) {
+            // someone else was faster
+            lru.erase(i->second);
+            index.erase(i);
+        }
+        lru.push_front(make_pair(aFile, e));
+        index[aFile] = lru.begin();
+        trim(maxFiles);
+    }
+    return e;
+}
+
+void UploadFileCache::trim(size_t aMax) {
+    while(lru.size() > aMax) {
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void UploadFileCache::prune(uint64_t aTick) {
+    Lock l(cs);
+    while(!lru.empty() && lru.back().second->lastUsed + IDLE_TIME < aTick) {
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+    trim(static_cast<size_t>(max(SETTING(UPLOAD_FILE_CACHE), 0)));
+}
+
+void UploadFileCache::clear() {
+    Lock l(cs);
+    index.clear();
+    lru.clear();
+}
+
+} // namespace dcpp
@@ -0,0 +1,156 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "CriticalSection.h"
+#include "Streams.h"
+
+namespace dcpp {
+
+using std::list;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+class File;
+
+/**
+ * Shared files kept open between upload requests. Segmented downloaders ask for
+ * the same file in many chunks; a cached entry saves resolving the share path and
+ * opening the file for each of them. Reads are positional, so all uploads of a
+ * file share a single handle.
+ *
+ * Streams read ahead in large aligned blocks that are shared by all uploads of the
+ * same file, and hint the OS to fetch the next block while the current one is sent,
+ * so concurrent uploads from one disk don't seek for every socket buffer.
+ */
+class UploadFileCache : private boost::noncopyable {
+public:
+    struct Entry : private boost::noncopyable {
+        struct Block {
+            int64_t pos;
+            ByteVector data;
+        };
+        typedef shared_ptr<Block> BlockPtr;
+
+        Entry(const string& aRealPath, const string& aVirtualPath, File* aFile, uint32_t aRevision);
+        ~Entry();
+
+        string realPath;
+        /** Virtual path of the file, for the per folder limits */
+        string virtualPath;
+        unique_ptr<File> file;
+        int64_t size;
+        uint32_t modified;
+        /** Share revision the paths were resolved at */
+        uint32_t revision;
+        uint64_t lastUsed;
+        /** Drop the pages behind the readers, the file won't stay cached anyway */
+        bool dropBehind;
+
+        CriticalSection cs;
+        /** Read-ahead blocks, most recently loaded last */
+        vector<BlockPtr> blocks;
+        /** Streams reading the file, each one keeps up to two blocks around */
+        size_t streams;
+    };
+    typedef shared_ptr<Entry> EntryPtr;
+
+    /** Reads [aPos, aEnd) of a cached file, the handle stays open while the stream exists */
+    class Stream : public InputStream {
+    public:
+        Stream(UploadFileCache& aCache, const EntryPtr& aEntry, int64_t aPos, int64_t aEnd);
+        virtual ~Stream();
+
+        virtual size_t read(void* buf, size_t& len);
+
+        /** For sockets that send straight from the file, the block cache is bypassed then */
+        File& getFile() { return *entry->file; }
+        int64_t getPos() const { return pos; }
+        int64_t getLeft() const { return end - pos; }
+        /** Account for n bytes sent by the kernel */
+        void skip(int64_t n);
+
+    private:
+        /** @param loaded Set when the block had to be read from the file */
+        Entry::BlockPtr getBlock(bool& loaded);
+
+        UploadFileCache& cache;
+        EntryPtr entry;
+        int64_t pos;
+        int64_t end;
+        /** 0 to read straight from the file */
+        int64_t blockSize;
+    };
+
+    /** Milliseconds an unused file is kept open */
+    static const uint64_t IDLE_TIME = 5 * 60 * 1000;
+
+    UploadFileCache();
+
+    /**
+     * Get an open handle for a shared file, reopening it when the share or the file
+     * has changed since it was cached.
+     * @param aFile File name as requested by the remote user
+     * @throw ShareException, FileException
+     */
+    EntryPtr get(const string& aFile);
+
+    /** Close files that weren't used for IDLE_TIME */
+    void prune(uint64_t aTick);
+    void clear();
+
+    /** Requests served from an already open handle */
+    int64_t getHits() const { Lock l(cs); return hits; }
+    /** Requests that had to resolve and open the file */
+    int64_t getMisses() const { Lock l(cs); return misses; }
+    /** Upload bytes copied from a block that was already read ahead */
+    int64_t getReadAheadBytes() const { return readAheadBytes; }
+    /** Upload bytes that had to wait for the file to be read */
+    int64_t getDiskBytes() const { return diskBytes; }
+    /** Upload bytes the kernel sent straight from the file */
+    int64_t getDirectBytes() const { return directBytes; }
+
+private:
+    typedef list<std::pair<string, EntryPtr> > LruList;
+
+    static bool isValid(const Entry& aEntry);
+    void trim(size_t aMax);
+
+    /** Most recently used first */
+    LruList lru;
+    unordered_map<string, LruList::iterator> index;
+    mutable CriticalSection cs;
+
+    int64_t hits;
+    int64_t misses;
+    std::atomic<int64_t> readAheadBytes;
+    std::atomic<int64_t> diskBytes;
+    std::atomic<int64_t> directBytes;
+};
+
+} // namespace dcpp
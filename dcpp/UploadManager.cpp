@@ -34,6 +34,7 @@
 #include "UserConnection.h"
 #include "QueueManager.h"
 #include "FinishedManager.h"
+#include "ThrottleManager.h"
 #include "extra/ipfilter.h"
 #include <functional>
 
@@ -42,7 +43,11 @@ namespace dcpp {
 static const string UPLOAD_AREA = "Uploads";
 
 
-UploadManager::UploadManager() noexcept : extra(0), lastGrant(0), running(0), limits(NULL), lastFreeSlots(-1) {
+const uint64_t UploadManager::SLOT_CHECK_TIME;
+const int UploadManager::MAX_AUTO_SLOTS;
+
+UploadManager::UploadManager() noexcept : extra(0), lastGrant(0), running(0), limits(NULL), compressionStats(), lastFreeSlots(-1),
+    autoSlots(0), uploadedBytes(0), lastCheckBytes(0), lastSlotCheck(0) {
     ClientManager::getInstance()->addListener(this);
     TimerManager::getInstance()->addListener(this);
 }
@@ -104,37 +109,15 @@ bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, co
 
     try {
         if(aType == Transfer::names[Transfer::TYPE_FILE]) {
-            sourceFile = ShareManager::getInstance()->toReal(aFile);
-
             if(aFile == Transfer::USER_LIST_NAME) {
-                // Unpack before sending...
-                string bz2 = File(sourceFile, File::READ, File::OPEN).read();
-                string xml;
-                CryptoManager::getInstance()->decodeBZ2(reinterpret_cast<const uint8_t*>(bz2.data()), bz2.size(), xml);
-                // Clear to save some memory...
-                string().swap(bz2);
-                is = new MemoryInputStream(xml);
+                sourceFile = ShareManager::getInstance()->toReal(aFile);
+                // Unpacked once per list, shared by everyone getting it
+                SharedInputStream* xml = new SharedInputStream(ShareManager::getInstance()->getXmlList());
+                is = xml;
                 start = 0;
-                fileSize = size = xml.size();
-            } else {
-                {
-                    ShareManager *SM = ShareManager::getInstance();
-                    string msg;
-                    if ( aFile != Transfer::USER_LIST_NAME_BZ && aFile != Transfer::USER_LIST_NAME &&
-                         !limits.IsUserAllowed(SM->toVirtual(SM->getTTH(aFile)), aSource.getUser(), &msg)
-                       )
-                    {
-                        throw ShareException(msg);
-                    }
-                    else if ( aFile != Transfer::USER_LIST_NAME_BZ && aFile != Transfer::USER_LIST_NAME &&
-                              hasUpload(aSource)
-                            )
-                    {
-                        msg = _("Connection already exists.");
-
-                        throw ShareException(msg);
-                    }
-                }
+                fileSize = size = xml->getSize();
+            } else if(aFile == Transfer::USER_LIST_NAME_BZ) {
+                sourceFile = ShareManager::getInstance()->toReal(aFile);
                 File* f = new File(sourceFile, File::READ, File::OPEN);
 
                 start = aStartPos;
@@ -148,13 +131,38 @@ bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, co
                     return false;
                 }
 
-                free = free || (sz <= (int64_t)(SETTING(SET_MINISLOT_SIZE) * 1024) );
-
                 f->setPos(start);
                 is = f;
                 if((start + size) < sz) {
                     is = new LimitedInputStream<true>(is, size);
                 }
+            } else {
+                // the share lookups are cached along with the open file
+                sourceFile = aFile; // for the error message until it's resolved
+                UploadFileCache::EntryPtr entry = fileCache.get(aFile);
+                sourceFile = entry->realPath;
+
+                string msg;
+                if(!limits.IsUserAllowed(entry->virtualPath, aSource.getUser(), &msg)) {
+                    throw ShareException(msg);
+                } else if(hasUpload(aSource)) {
+                    msg = _("Connection already exists.");
+                    throw ShareException(msg);
+                }
+
+                start = aStartPos;
+                int64_t sz = entry->size;
+                size = (aBytes == -1) ? sz - start : aBytes;
+                fileSize = sz;
+
+                if((start + size) > sz) {
+                    aSource.fileNotAvail();
+                    return false;
+                }
+
+                free = free || (sz <= (int64_t)(SETTING(SET_MINISLOT_SIZE) * 1024) );
+
+                is = new UploadFileCache::Stream(fileCache, entry, start, start + size);
             }
             type = userlist ? Transfer::TYPE_FULL_LIST : Transfer::TYPE_FILE;
         } else if(aType == Transfer::names[Transfer::TYPE_TREE]) {
@@ -277,25 +285,25 @@ ok:
     bool extraSlot = false;
 
     if(!aSource.isSet(UserConnection::FLAG_HASSLOT)) {
-        bool hasReserved = (reservedSlots.find(aSource.getUser()) != reservedSlots.end());
-        bool isFavorite = FavoriteManager::getInstance()->hasSlot(aSource.getUser());
+        bool hasGranted = hasGrantedSlot(aSource.getUser());
+        bool hasFree = waiting.hasSlotFor(aSource.getUser(), getFreeSlots(), GET_TICK());
 
-        if(!(hasReserved || isFavorite || getFreeSlots() > 0 || getAutoSlot())) {
+        if(!(hasGranted || hasFree)) {
             bool supportsFree = aSource.isSet(UserConnection::FLAG_SUPPORTS_MINISLOTS);
             bool allowedFree = aSource.isSet(UserConnection::FLAG_HASEXTRASLOT) || aSource.isSet(UserConnection::FLAG_OP) || getFreeExtraSlots() > 0;
             if(free && supportsFree && allowedFree) {
                 extraSlot = true;
             } else {
                 delete is;
-                aSource.maxedOut();
 
                 // Check for tth root identifier
                 string tFile = aFile;
                 if (tFile.compare(0, 4, "TTH/") == 0)
                     tFile = ShareManager::getInstance()->toVirtual(TTHValue(aFile.substr(4)));
 
-                addFailedUpload(aSource, tFile +
+                size_t position = addFailedUpload(aSource, tFile +
                     " (" +  Util::formatBytes(aStartPos) + " - " + Util::formatBytes(aStartPos + aBytes) + ")");
+                aSource.maxedOut(position);
                 aSource.disconnect();
                 return false;
             }
@@ -311,9 +319,18 @@ ok:
     u->setSegment(Segment(start, size));
 
     u->setType(type);
+    u->setProgressTick(GET_TICK());
 
     uploads.push_back(u);
 
+    if(type != Transfer::TYPE_FILE) {
+        aSource.setThrottle(ThrottleManager::CLASS_FILELIST);
+    } else if(extraSlot || aSource.isSet(UserConnection::FLAG_HASEXTRASLOT)) {
+        aSource.setThrottle(ThrottleManager::CLASS_MINISLOT);
+    } else {
+        aSource.setThrottle(ThrottleManager::CLASS_NORMAL);
+    }
+
     if(!aSource.isSet(UserConnection::FLAG_HASSLOT)) {
         if(extraSlot) {
             if(!aSource.isSet(UserConnection::FLAG_HASEXTRASLOT)) {
@@ -345,21 +362,59 @@ int64_t UploadManager::getRunningAverage() {
     return avg;
 }
 
-bool UploadManager::getAutoSlot() {
-    /** A 0 in settings means disable */
-    if(SETTING(MIN_UPLOAD_SPEED) == 0)
+namespace {
+
+/** Extensions ShareManager::getType doesn't know that are compressed already */
+const char* incompressible[] = { ".7z", ".bz2", ".gz", ".xz", ".jpeg", ".flac", ".m4a", ".m4v", ".webm" };
+/** Types of getType that are worth compressing nevertheless */
+const char* compressible[] = { ".wav", ".bmp", ".tar" };
+
+bool hasExtension(const string& aExt, const char** aList, size_t aCount) {
+    for(size_t i = 0; i < aCount; ++i) {
+        if(aExt == aList[i])
+            return true;
+    }
+    return false;
+}
+
+}
+
+bool UploadManager::isCompressible(const Upload& u) {
+    if(u.getType() == Transfer::TYPE_TREE)
+        return false;   // hashes don't compress
+
+    string ext = Text::toLower(Util::getFileExt(u.getPath()));
+    if(hasExtension(ext, compressible, sizeof(compressible) / sizeof(compressible[0])))
+        return true;
+    if(hasExtension(ext, incompressible, sizeof(incompressible) / sizeof(incompressible[0])))
         return false;
-    /** Only grant one slot per 30 sec */
-    if(GET_TICK() < getLastGrant() + 30*1000)
+
+    switch(ShareManager::getInstance()->getType(u.getPath())) {
+    case SearchManager::TYPE_AUDIO:
+    case SearchManager::TYPE_COMPRESSED:
+    case SearchManager::TYPE_PICTURE:
+    case SearchManager::TYPE_VIDEO:
         return false;
-    /** Grant if upload speed is less than the threshold speed */
-    return getRunningAverage() < (SETTING(MIN_UPLOAD_SPEED)*1024);
+    default:
+        // anything else is left to the sample ZFilter takes
+        return true;
+    }
 }
 
 void UploadManager::removeUpload(Upload* aUpload) {
     Lock l(cs);
     dcassert(find(uploads.begin(), uploads.end(), aUpload) != uploads.end());
     uploads.erase(remove(uploads.begin(), uploads.end(), aUpload), uploads.end());
+
+    const ZFilter* z = aUpload->getCompression();
+    if(z) {
+        compressionStats.compressed++;
+        if(!z->isCompressing())
+            compressionStats.abandoned++;
+        compressionStats.bytesIn += z->getTotalIn();
+        compressionStats.bytesOut += z->getTotalOut();
+        compressionStats.cpuTime += z->getCpuTime();
+    }
     delete aUpload;
 }
 
@@ -422,9 +477,17 @@ void UploadManager::on(AdcCommand::GET, UserConnection* aSource, const AdcComman
                     .addParam(Util::toString(u->getSize()));
 
             if(c.hasFlag("ZL", 4)) {
-                u->setStream(new FilteredInputStream<ZFilter, true>(u->getStream()));
-                u->setFlag(Upload::FLAG_ZUPLOAD);
-                cmd.addParam("ZL1");
+                // compression is optional, the SND without ZL1 tells the client
+                if(isCompressible(*u)) {
+                    FilteredInputStream<ZFilter, true>* z = new FilteredInputStream<ZFilter, true>(u->getStream());
+                    u->setStream(z);
+                    u->setCompression(&z->getFilter());
+                    u->setFlag(Upload::FLAG_ZUPLOAD);
+                    cmd.addParam("ZL1");
+                } else {
+                    Lock l(cs);
+                    compressionStats.skipped++;
+                }
             }
 
             aSource->send(cmd);
@@ -448,6 +511,7 @@ void UploadManager::on(UserConnectionListener::BytesSent, UserConnection* aSourc
     dcassert(u != NULL);
     u->addPos(aBytes, aActual);
     u->tick();
+    uploadedBytes += aActual;
 }
 
 void UploadManager::on(UserConnectionListener::Failed, UserConnection* aSource, const string& aError) noexcept {
@@ -481,58 +545,46 @@ void UploadManager::on(UserConnectionListener::TransmitDone, UserConnection* aSo
 }
 
 void UploadManager::notifyQueuedUsers() {
-    Lock l(cs);
-    int freeSlots = getFreeSlots()*2;               //because there will be non-connecting users
-
-    //while all contacted users may not connect, many probably will; it's fine that the rest are filled with randomly allocated slots
-    while (freeSlots) {
-        //get rid of offline users
-        while (!waitingUsers.empty() && !waitingUsers.front().first.user->isOnline()) waitingUsers.pop_front();
-        if (waitingUsers.empty()) break;                //no users to notify
+    HintedUserList offers;
+    {
+        Lock l(cs);
+        offers = waiting.offer(getFreeSlots(), GET_TICK());
+    }
 
+    // the slot is kept for them for a while, see UploadQueue::OFFER_TIME
+    for(auto i = offers.begin(); i != offers.end(); ++i) {
         // FIXME: record and replay a client url hint URL
-        ClientManager::getInstance()->connect(waitingUsers.front().first, Util::toString(Util::rand()));
-        --freeSlots;
-
-        waitingUsers.pop_front();
+        ClientManager::getInstance()->connect(*i, Util::toString(Util::rand()));
     }
 }
 
-void UploadManager::addFailedUpload(const UserConnection& source, string filename) {
+size_t UploadManager::addFailedUpload(const UserConnection& source, string filename) {
+    size_t position;
     {
         Lock l(cs);
-        WaitingUserList::iterator it = find_if(waitingUsers.begin(), waitingUsers.end(), CompareFirst<UserPtr, uint32_t>(source.getUser()));
-        if (it==waitingUsers.end()) {
-            waitingUsers.push_back(WaitingUser(source.getHintedUser(), GET_TICK()));
-        } else {
-            it->second = GET_TICK();
-        }
+        UploadQueue::Priority prio = FavoriteManager::getInstance()->isFavoriteUser(source.getUser()) ?
+            UploadQueue::PRIO_FAVORITE : UploadQueue::PRIO_NORMAL;
+        position = waiting.add(source.getHintedUser(), prio, GET_TICK());
         waitingFiles[source.getUser()].insert(filename);        //files for which user's asked
     }
 
     fire(UploadManagerListener::WaitingAddFile(), source.getHintedUser(), filename);
+    return position;
 }
 
 void UploadManager::clearUserFiles(const UserPtr& source) {
     Lock l(cs);
     //run this when a user's got a slot or goes offline.
-    WaitingUserList::iterator sit = find_if(waitingUsers.begin(), waitingUsers.end(), CompareFirst<UserPtr, uint32_t>(source));
-    if (sit == waitingUsers.end()) return;
+    HintedUser removed(source, Util::emptyString);
+    if (!waiting.remove(source, removed)) return;
 
-    FilesMap::iterator fit = waitingFiles.find(sit->first);
-    if (fit != waitingFiles.end()) waitingFiles.erase(fit);
-    fire(UploadManagerListener::WaitingRemoveUser(), sit->first);
-
-    waitingUsers.erase(sit);
+    waitingFiles.erase(source);
+    fire(UploadManagerListener::WaitingRemoveUser(), removed);
 }
 
 HintedUserList UploadManager::getWaitingUsers() const {
     Lock l(cs);
-    HintedUserList u;
-    for(auto i = waitingUsers.begin(), iend = waitingUsers.end(); i != iend; ++i) {
-        u.push_back(i->first);
-    }
-    return u;
+    return waiting.getUsers();
 }
 
 const UploadManager::FileSet& UploadManager::getWaitingUserFiles(const UserPtr& u) {
@@ -571,34 +623,33 @@ void UploadManager::addConnection(UserConnectionPtr conn) {
 void UploadManager::removeConnection(UserConnection* aSource) {
     dcassert(aSource->getUpload() == NULL);
     aSource->removeListener(this);
+    bool freed = false;
     if(aSource->isSet(UserConnection::FLAG_HASSLOT)) {
         running--;
         aSource->unsetFlag(UserConnection::FLAG_HASSLOT);
+        freed = true;
     }
     if(aSource->isSet(UserConnection::FLAG_HASEXTRASLOT)) {
         extra--;
         aSource->unsetFlag(UserConnection::FLAG_HASEXTRASLOT);
     }
+
+    if(freed)
+        notifyQueuedUsers();
 }
 
 void UploadManager::reloadRestrictions(){
     limits.RenewList(NULL);
 }
 
-void UploadManager::on(TimerManagerListener::Minute, uint64_t /* aTick */) noexcept {
+void UploadManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept {
+    // don't keep files open for downloaders that are gone
+    fileCache.prune(aTick);
+
     UserList disconnects;
     {
         Lock l(cs);
 
-        auto i = stable_partition(waitingUsers.begin(), waitingUsers.end(), WaitingUserFresh());
-        for (auto j = i; j != waitingUsers.end(); ++j) {
-            auto fit = waitingFiles.find(j->first);
-            if (fit != waitingFiles.end()) waitingFiles.erase(fit);
-            fire(UploadManagerListener::WaitingRemoveUser(), j->first);
-        }
-
-        waitingUsers.erase(i, waitingUsers.end());
-
         if( BOOLSETTING(AUTO_KICK) ) {
             for(auto i = uploads.begin(); i != uploads.end(); ++i) {
                 Upload* u = *i;
@@ -665,21 +716,91 @@ void UploadManager::on(AdcCommand::GFI, UserConnection* aSource, const AdcComman
 }
 
 // TimerManagerListener
-void UploadManager::on(TimerManagerListener::Second, uint64_t) noexcept {
-    Lock l(cs);
-    UploadList ticks;
+void UploadManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept {
+    StalledList stalled;
+    {
+        Lock l(cs);
+        UploadList ticks;
 
-    for(auto i = uploads.begin(); i != uploads.end(); ++i) {
-        if((*i)->getPos() > 0) {
-            ticks.push_back(*i);
-            (*i)->tick();
+        for(auto i = uploads.begin(); i != uploads.end(); ++i) {
+            if((*i)->getPos() > 0) {
+                ticks.push_back(*i);
+                (*i)->tick();
+            }
+        }
+
+        if(!uploads.empty())
+            fire(UploadManagerListener::Tick(), UploadList(uploads));
+
+        HintedUserList gone = waiting.prune(aTick);
+        for(auto i = gone.begin(); i != gone.end(); ++i) {
+            waitingFiles.erase(i->user);
+            fire(UploadManagerListener::WaitingRemoveUser(), *i);
         }
+
+        if(aTick >= lastSlotCheck + SLOT_CHECK_TIME) {
+            adjustAutoSlots(aTick);
+            findStalled(aTick, stalled);
+        }
+    }
+
+    // outside of cs so that we never wait for ConnectionManager's lock while holding ours
+    for(auto i = stalled.begin(); i != stalled.end(); ++i) {
+        LogManager::getInstance()->message(str(F_("Upload to %1% has stalled, giving the slot to a waiting user") %
+            Util::toString(ClientManager::getInstance()->getNicks(i->second->getCID(), Util::emptyString))));
+        ConnectionManager::getInstance()->disconnect(i->first, i->second);
+    }
+
+    notifyQueuedUsers();
+}
+
+void UploadManager::adjustAutoSlots(uint64_t aTick) {
+    int64_t bytes = uploadedBytes;
+    int64_t speed = lastSlotCheck > 0 ? (bytes - lastCheckBytes) * 1000 / (int64_t)(aTick - lastSlotCheck) : 0;
+    bool first = lastSlotCheck == 0;
+    lastCheckBytes = bytes;
+    lastSlotCheck = aTick;
+
+    /** A 0 in settings means disable */
+    int64_t target = (int64_t)SETTING(MIN_UPLOAD_SPEED) * 1024;
+    if(target == 0) {
+        autoSlots = 0;
+        return;
     }
+    if(first)
+        return;
+
+    if(speed < target) {
+        // only grow while the slots we have are in use and somebody waits for one
+        if(getFreeSlots() == 0 && !waiting.empty() && autoSlots < MAX_AUTO_SLOTS) {
+            autoSlots++;
+            setLastGrant(aTick);
+        }
+    } else if(autoSlots > 0 && getFreeSlots() > 0) {
+        autoSlots--;
+    }
+}
 
-    if(!uploads.empty())
-        fire(UploadManagerListener::Tick(), UploadList(uploads));
+bool UploadManager::hasGrantedSlot(const UserPtr& aUser) const {
+    return reservedSlots.find(aUser) != reservedSlots.end() || FavoriteManager::getInstance()->hasSlot(aUser);
+}
 
-        //notifyQueuedUsers();
+void UploadManager::findStalled(uint64_t aTick, StalledList& stalled) {
+    for(auto i = uploads.begin(); i != uploads.end(); ++i) {
+        Upload* u = *i;
+        uint64_t elapsed = aTick - u->getProgressTick();
+        if(elapsed < UploadQueue::STALL_TIME)
+            continue;
+
+        int64_t bytes = u->getPos() - u->getProgressPos();
+        u->setProgressPos(u->getPos());
+        u->setProgressTick(aTick);
+
+        UserConnection& conn = u->getUserConnection();
+        bool fullSlot = u->getType() == Transfer::TYPE_FILE && conn.isSet(UserConnection::FLAG_HASSLOT);
+        if(waiting.shouldReclaim(bytes, elapsed, fullSlot, hasGrantedSlot(u->getUser())))
+            stalled.push_back(make_pair(&conn, u->getUser()));
+    }
 }
 
 void UploadManager::on(ClientManagerListener::UserDisconnected, const UserPtr& aUser) noexcept {
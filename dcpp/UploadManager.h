@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "forward.h"
 #include "UserConnectionListener.h"
 #include "Singleton.h"
@@ -30,6 +32,8 @@
 #include "TimerManager.h"
 #include "Speaker.h"
 #include "PerFolderLimit.h"
+#include "UploadFileCache.h"
+#include "UploadQueue.h"
 #include "SettingsManager.h"
 
 namespace dcpp {
@@ -48,8 +52,10 @@ public:
      */
     int64_t getRunningAverage();
     uint8_t getSlots() const { return (uint8_t) (SETTING(SLOTS)* Client::getTotalCounts());}
-    /** @return Number of free slots. */
-    int getFreeSlots() { return max((SETTING(SLOTS) - running), 0); }
+    /** @return Number of free slots, including the ones granted automatically. */
+    int getFreeSlots() { return max((SETTING(SLOTS) + autoSlots - running), 0); }
+    /** @return Slots granted on top of SLOTS because the upload speed is below MIN_UPLOAD_SPEED */
+    int getAutoSlots() const { return autoSlots; }
 
     /** @internal */
     int getFreeExtraSlots() { return max(3 - getExtra(), 0); }
@@ -65,6 +71,8 @@ public:
     void clearUserFiles(const UserPtr&);
     HintedUserList getWaitingUsers() const;
     const FileSet& getWaitingUserFiles(const UserPtr&);
+    /** @return Position of the user in the slot queue starting at 1, 0 if not queued */
+    size_t getQueuePosition(const UserPtr& aUser) const { Lock l(cs); return waiting.getPosition(aUser); }
 
     /** @internal */
     void addConnection(UserConnectionPtr conn);
@@ -78,6 +86,21 @@ public:
     GETSET(uint64_t, lastGrant, LastGrant);
 
     void updateLimits() {limits.RenewList(NULL);}
+
+    const UploadFileCache& getFileCache() const { return fileCache; }
+
+    struct CompressionStats {
+        /** ZLIG requests sent uncompressed because of the file type */
+        int64_t skipped;
+        /** Compressed uploads, and those among them that gave up after the sample */
+        int64_t compressed;
+        int64_t abandoned;
+        int64_t bytesIn;
+        int64_t bytesOut;
+        /** Microseconds spent compressing */
+        uint64_t cpuTime;
+    };
+    CompressionStats getCompressionStats() const { Lock l(cs); return compressionStats; }
 private:
     int running;
     UploadList uploads;
@@ -87,25 +110,39 @@ private:
     typedef SlotSet::iterator SlotIter;
     SlotSet reservedSlots;
     CPerfolderLimit limits;
+    UploadFileCache fileCache;
+    CompressionStats compressionStats;
     int lastFreeSlots; /// amount of free slots at the previous minute
 
-    typedef pair<HintedUser, uint64_t> WaitingUser;
-    typedef list<WaitingUser> WaitingUserList;
+    /** Milliseconds between automatic slot adjustments and checks for stalled uploads */
+    static const uint64_t SLOT_CHECK_TIME = 10 * 1000;
+    /** Most slots granted on top of SLOTS */
+    static const int MAX_AUTO_SLOTS = 10;
 
-    struct WaitingUserFresh {
-        bool operator()(const WaitingUser& wu) { return wu.second > GET_TICK() - 5*60*1000; }
-    };
-
-    //functions for manipulating waitingFiles and waitingUsers
-    WaitingUserList waitingUsers;       //this one merely lists the users waiting for slots
+    //functions for manipulating waitingFiles and waiting
+    UploadQueue waiting;        //users waiting for slots
     FilesMap waitingFiles;      //set of files which this user has asked for
-    void addFailedUpload(const UserConnection& source, string filename);
+    /** @return Position of the user in the queue */
+    size_t addFailedUpload(const UserConnection& source, string filename);
+
+    int autoSlots;
+    /** Bytes sent by all uploads, for the automatic slots */
+    std::atomic<int64_t> uploadedBytes;
+    int64_t lastCheckBytes;
+    uint64_t lastSlotCheck;
+
+    void adjustAutoSlots(uint64_t aTick);
+    /** Reserved slots and those of favorites are never refused or taken back */
+    bool hasGrantedSlot(const UserPtr& aUser) const;
+    typedef vector<pair<UserConnection*, UserPtr> > StalledList;
+    void findStalled(uint64_t aTick, StalledList& stalled);
 
     friend class Singleton<UploadManager>;
     UploadManager() noexcept;
     virtual ~UploadManager();
 
-    bool getAutoSlot();
+    /** Whether a ZLIG upload is worth compressing, judged by the file type */
+    static bool isCompressible(const Upload& u);
     bool hasUpload ( UserConnection& aSource );
     void removeConnection(UserConnection* aConn);
     void removeUpload(Upload* aUpload);
@@ -0,0 +1,152 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdinc.h"
+
+#include "UploadQueue.h"
+
+namespace dcpp {
+
+const uint64_t UploadQueue::OFFER_TIME;
+const int UploadQueue::MAX_MISSES;
+const uint64_t UploadQueue::WAIT_TIME;
+const uint64_t UploadQueue::STALL_TIME;
+const int64_t UploadQueue::STALL_SPEED;
+
+size_t UploadQueue::add(const HintedUser& aUser, Priority aPrio, uint64_t aTick) {
+    auto i = index.find(aUser.user);
+    if(i != index.end()) {
+        Entry& e = *i->second;
+        e.user = aUser;
+        e.lastSeen = aTick;
+        // the user came after all, an offer that was taken by someone else doesn't count
+        e.misses = 0;
+        if(e.prio != aPrio) {
+            // keep the place among the users queued at the same time
+            EntryList& from = entries[e.prio];
+            EntryList& to = entries[aPrio];
+            auto pos = to.begin();
+            while(pos != to.end() && pos->queued <= e.queued)
+                ++pos;
+            e.prio = aPrio;
+            to.splice(pos, from, i->second);
+        }
+    } else {
+        Entry e = { aUser, aPrio, aTick, aTick, 0, 0 };
+        EntryList& l = entries[aPrio];
+        index[aUser.user] = l.insert(l.end(), e);
+    }
+    return getPosition(aUser.user);
+}
+
+bool UploadQueue::remove(const UserPtr& aUser, HintedUser& aRemoved) {
+    auto i = index.find(aUser);
+    if(i == index.end())
+        return false;
+
+    aRemoved = i->second->user;
+    entries[i->second->prio].erase(i->second);
+    index.erase(i);
+    return true;
+}
+
+size_t UploadQueue::getPosition(const UserPtr& aUser) const {
+    auto i = index.find(aUser);
+    if(i == index.end())
+        return 0;
+
+    size_t pos = 1;
+    for(int p = PRIO_LAST - 1; p > i->second->prio; --p)
+        pos += entries[p].size();
+
+    const EntryList& l = entries[i->second->prio];
+    for(auto j = l.begin(); j != i->second; ++j)
+        ++pos;
+    return pos;
+}
+
+size_t UploadQueue::getOffersAhead(const UserPtr& aUser, uint64_t aTick) const {
+    size_t n = 0;
+    for(int p = PRIO_LAST - 1; p >= 0; --p) {
+        for(auto i = entries[p].begin(); i != entries[p].end(); ++i) {
+            if(i->user.user == aUser)
+                return n;
+            if(hasOffer(*i, aTick))
+                ++n;
+        }
+    }
+    return n;
+}
+
+bool UploadQueue::shouldReclaim(int64_t aBytes, uint64_t aElapsed, bool aFullSlot, bool aGranted) const {
+    if(empty() || !aFullSlot || aGranted || aElapsed < STALL_TIME)
+        return false;
+    return aBytes < STALL_SPEED * static_cast<int64_t>(aElapsed) / 1000;
+}
+
+HintedUserList UploadQueue::offer(size_t aSlots, uint64_t aTick) {
+    HintedUserList ret;
+    for(int p = PRIO_LAST - 1; p >= 0 && aSlots > 0; --p) {
+        for(auto i = entries[p].begin(); i != entries[p].end() && aSlots > 0; ++i) {
+            if(!i->user.user->isOnline())
+                continue;
+
+            if(!hasOffer(*i, aTick)) {
+                i->offered = aTick;
+                ret.push_back(i->user);
+            }
+            --aSlots;
+        }
+    }
+    return ret;
+}
+
+HintedUserList UploadQueue::prune(uint64_t aTick) {
+    HintedUserList ret;
+    for(int p = 0; p < PRIO_LAST; ++p) {
+        for(auto i = entries[p].begin(); i != entries[p].end();) {
+            Entry& e = *i;
+            if(e.offered != 0 && !hasOffer(e, aTick)) {
+                // the offer went unanswered, let the ones behind have a go
+                e.offered = 0;
+                ++e.misses;
+            }
+
+            bool offered = e.offered != 0;
+            if(!e.user.user->isOnline() || e.misses >= MAX_MISSES || (!offered && aTick > e.lastSeen + WAIT_TIME)) {
+                ret.push_back(e.user);
+                index.erase(e.user.user);
+                i = entries[p].erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+    return ret;
+}
+
+HintedUserList UploadQueue::getUsers() const {
+    HintedUserList ret;
+    ret.reserve(index.size());
+    for(int p = PRIO_LAST - 1; p >= 0; --p) {
+        for(auto i = entries[p].begin(); i != entries[p].end(); ++i)
+            ret.push_back(i->user);
+    }
+    return ret;
+}
+
+} // namespace dcpp
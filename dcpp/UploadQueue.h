@@ -0,0 +1,127 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include "forward.h"
+#include "User.h"
+
+namespace dcpp {
+
+using std::list;
+using std::unordered_map;
+
+/**
+ * Users waiting for an upload slot, served first come first served within each
+ * priority. When slots become free the users at the head are offered one by
+ * connecting to them; an offer holds the slot for OFFER_TIME so that users
+ * further back can't take it in the meantime.
+ *
+ * The queue does no locking on its own, UploadManager serializes all access.
+ */
+class UploadQueue : private boost::noncopyable {
+public:
+    /** Higher priorities are served first */
+    enum Priority {
+        PRIO_NORMAL,
+        PRIO_FAVORITE,
+        PRIO_LAST
+    };
+
+    /** Milliseconds an offered slot is held for the user */
+    static const uint64_t OFFER_TIME = 30 * 1000;
+    /** Ignored offers after which a user loses the place in the queue */
+    static const int MAX_MISSES = 2;
+    /** Milliseconds a user stays queued without asking again */
+    static const uint64_t WAIT_TIME = 5 * 60 * 1000;
+    /** An upload slower than STALL_SPEED B/s over STALL_TIME milliseconds is given up when others wait */
+    static const uint64_t STALL_TIME = 60 * 1000;
+    static const int64_t STALL_SPEED = 1024;
+
+    struct Entry {
+        HintedUser user;
+        Priority prio;
+        /** When the user was queued, the position doesn't change with retries */
+        uint64_t queued;
+        /** Last time the user asked for a slot */
+        uint64_t lastSeen;
+        /** Time of the pending offer, 0 if there is none */
+        uint64_t offered;
+        int misses;
+    };
+
+    UploadQueue() { }
+
+    /**
+     * Queue a user that was denied a slot, or refresh the entry of one already queued.
+     * @return Position in the queue, starting at 1
+     */
+    size_t add(const HintedUser& aUser, Priority aPrio, uint64_t aTick);
+    /**
+     * @param aRemoved Set to the entry's user with the hub hint
+     * @return Whether the user was queued
+     */
+    bool remove(const UserPtr& aUser, HintedUser& aRemoved);
+
+    /** @return Position in the queue starting at 1, 0 if not queued */
+    size_t getPosition(const UserPtr& aUser) const;
+    /** Number of users ahead of aUser (all of them if not queued) holding an offer */
+    size_t getOffersAhead(const UserPtr& aUser, uint64_t aTick) const;
+    /** Whether aUser may take one of aFreeSlots, the ones offered to users ahead are kept for them */
+    bool hasSlotFor(const UserPtr& aUser, int aFreeSlots, uint64_t aTick) const {
+        return aFreeSlots > static_cast<int>(getOffersAhead(aUser, aTick));
+    }
+    /**
+     * Whether an upload should give its slot to a waiting user.
+     * @param aBytes Bytes the upload sent during the last aElapsed milliseconds
+     * @param aFullSlot It's a file upload holding a normal slot
+     * @param aGranted The user has a reserved or a favorite's slot, those are never taken back
+     */
+    bool shouldReclaim(int64_t aBytes, uint64_t aElapsed, bool aFullSlot, bool aGranted) const;
+
+    /**
+     * Make sure the first aSlots users who are online have an offer.
+     * @return Users that got a new offer and should be connected to
+     */
+    HintedUserList offer(size_t aSlots, uint64_t aTick);
+    /**
+     * Drop users that are offline, haven't asked for WAIT_TIME or ignored MAX_MISSES offers.
+     * @return The removed users
+     */
+    HintedUserList prune(uint64_t aTick);
+
+    /** Queued users, head first */
+    HintedUserList getUsers() const;
+    size_t size() const { return index.size(); }
+    bool empty() const { return index.empty(); }
+
+private:
+    typedef list<Entry> EntryList;
+    typedef unordered_map<UserPtr, EntryList::iterator, User::Hash> Index;
+
+    bool hasOffer(const Entry& e, uint64_t aTick) const { return e.offered != 0 && aTick < e.offered + OFFER_TIME; }
+
+    EntryList entries[PRIO_LAST];
+    Index index;
+};
+
+} // namespace dcpp
@@ -169,11 +169,23 @@ void UserConnection::connect(const string& aServer, uint16_t aPort, uint16_t loc
     socket->connect(aServer, aPort, localPort, natRole, isSet(FLAG_SECURE), BOOLSETTING(ALLOW_UNTRUSTED_CLIENTS), true);
 }
 
-void UserConnection::accept(const Socket& aServer) throw(SocketException, ThreadException) {
+void UserConnection::accept(socket_t aSock, const string& aIp) throw(SocketException, ThreadException) {
     dcassert(!socket);
-    socket = BufferedSocket::getSocket(0);
+    try {
+        socket = BufferedSocket::getSocket(0);
+    } catch(const Exception&) {
+        // nothing owns aSock yet, close it here so it doesn't leak
+        Socket rejected;
+        rejected.accept(aSock, aIp);
+        throw;
+    }
     socket->addListener(this);
-    socket->accept(aServer, isSet(FLAG_SECURE), BOOLSETTING(ALLOW_UNTRUSTED_CLIENTS));
+    socket->accept(aSock, aIp, isSet(FLAG_SECURE), BOOLSETTING(ALLOW_UNTRUSTED_CLIENTS));
+}
+
+void UserConnection::setThrottle(ThrottleManager::SlotClass aClass) {
+    if(socket && user)
+        socket->setThrottle(ThrottleManager::getInstance()->getHandle(getHubUrl(), user->getCID(), aClass));
 }
 
 void UserConnection::inf(bool withToken) {
@@ -185,6 +197,21 @@ void UserConnection::inf(bool withToken) {
     send(c);
 }
 
+string UserConnection::getMaxedOut(bool nmdc, size_t queuePosition) {
+    // "$MaxedOut 3|" and QP3 are the queue position extensions several other clients use
+    if(nmdc)
+        return queuePosition > 0 ? "$MaxedOut " + Util::toString(queuePosition) + "|" : string("$MaxedOut|");
+
+    AdcCommand c(AdcCommand::SEV_RECOVERABLE, AdcCommand::ERROR_SLOTS_FULL, "Slots full");
+    if(queuePosition > 0)
+        c.addParam("QP", Util::toString(queuePosition));
+    return c.toString(0, false);
+}
+
+void UserConnection::maxedOut(size_t queuePosition) {
+    send(getMaxedOut(isSet(FLAG_NMDC), queuePosition));
+}
+
 void UserConnection::sup(const StringList& features) {
     AdcCommand c(AdcCommand::CMD_SUP);
     for(StringIterC i = features.begin(); i != features.end(); ++i)
@@ -42,7 +42,7 @@ protected:
 };
 #endif
 
-class UserConnection : public Speaker<UserConnectionListener>,
+class UserConnection : public FastSpeaker<UserConnectionListener>,
     private BufferedSocketListener, public Flags, private CommandHandler<UserConnection>,
     private boost::noncopyable
 #ifdef LUA_SCRIPT
@@ -126,7 +126,10 @@ public:
     void error(const string& aError) { isSet(FLAG_NMDC) ? send("$Error " + aError + '|') :
  send(AdcCommand(AdcCommand::SEV_FATAL, AdcCommand::ERROR_TRANSFER_GENERIC, aError)); }
     void listLen(const string& aLength) { send("$ListLen " + aLength + '|'); }
-    void maxedOut() { isSet(FLAG_NMDC) ? send("$MaxedOut|") : send(AdcCommand(AdcCommand::SEV_RECOVERABLE, AdcCommand::ERROR_SLOTS_FULL, "Slots full")); }
+    /** @param queuePosition Position in the slot queue starting at 1, 0 to leave it out */
+    void maxedOut(size_t queuePosition = 0);
+    /** The reply maxedOut() sends, without a queue position when it's 0 */
+    static string getMaxedOut(bool nmdc, size_t queuePosition);
     void fileNotAvail(const std::string& msg = FILE_NOT_AVAILABLE) { isSet(FLAG_NMDC) ? send("$Error " + msg + "|") : send(AdcCommand(AdcCommand::SEV_RECOVERABLE, AdcCommand::ERROR_FILE_NOT_AVAILABLE, msg)); }
     void supports(const StringList& feat);
 
@@ -141,12 +144,15 @@ public:
     void setLineMode(size_t rollback) { dcassert(socket); socket->setLineMode(rollback); }
 
     void connect(const string& aServer, uint16_t aPort, uint16_t localPort, const BufferedSocket::NatRoles natRole) throw(SocketException, ThreadException);
-    void accept(const Socket& aServer) throw(SocketException, ThreadException);
+    /** Takes over aSock, it's closed on failure as well */
+    void accept(socket_t aSock, const string& aIp) throw(SocketException, ThreadException);
 
     void updated() { if(socket) socket->updated(); }
 
     void disconnect(bool graceless = false) { if(socket) socket->disconnect(graceless); }
     void transmitFile(InputStream* f) { socket->transmitFile(f); }
+    /** Account the transfer against the hub, user and slot class buckets of ThrottleManager */
+    void setThrottle(ThrottleManager::SlotClass aClass);
 
     const string& getDirectionString() {
         dcassert(isSet(FLAG_UPLOAD) ^ isSet(FLAG_DOWNLOAD));
@@ -23,26 +23,64 @@
 #include "format.h"
 #include "Exception.h"
 #include "File.h"
+#include "SettingsManager.h"
+
+#include <chrono>
+#include <thread>
 
 namespace dcpp {
 
 using std::max;
 
-const double ZFilter::MIN_COMPRESSION_LEVEL = 0.9;
+const double ZFilter::MIN_COMPRESSION_LEVEL = 0.95;
+const int64_t ZFilter::SAMPLE_SIZE;
+
+std::atomic<int> ZFilter::active(0);
+
+namespace {
+
+/** CPU time of the calling thread in microseconds, wall time where there's no such clock */
+uint64_t threadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
 
-ZFilter::ZFilter() : totalIn(0), totalOut(0), compressing(true) {
+ZFilter::ZFilter(int aLevel) : level(aLevel < 0 ? getAdaptiveLevel() : aLevel), totalIn(0), totalOut(0), cpuTime(0), compressing(true), sampled(false) {
     memset(&zs, 0, sizeof(zs));
 
-    if(deflateInit(&zs, 3) != Z_OK) {
+    if(deflateInit(&zs, level) != Z_OK) {
         throw Exception(_("Error during compression"));
     }
+    ++active;
 }
 
 ZFilter::~ZFilter() {
-    dcdebug("ZFilter end, %ld/%ld = %.04f\n", zs.total_out, zs.total_in, (float)zs.total_out / max((float)zs.total_in, (float)1));
+    dcdebug("ZFilter end, %ld/%ld = %.04f, level %d, %llu us\n", zs.total_out, zs.total_in, (float)zs.total_out / max((float)zs.total_in, (float)1),
+        level, (unsigned long long)cpuTime);
+    if(compressing)
+        --active;
     deflateEnd(&zs);
 }
 
+int ZFilter::getAdaptiveLevel() {
+    int maxLevel = std::min(max(SETTING(MAX_COMPRESSION), 0), (int)Z_BEST_COMPRESSION);
+    int cores = max((int)std::thread::hardware_concurrency(), 1);
+    int busy = active;
+
+    if(busy < cores / 2)
+        return maxLevel;
+    // the level that was always used before, about half the cost of the default
+    if(busy < cores)
+        return std::min(maxLevel, 3);
+    return std::min(maxLevel, (int)Z_BEST_SPEED);
+}
+
 bool ZFilter::operator()(const void* in, size_t& insize, void* out, size_t& outsize) {
     if(outsize == 0)
         return false;
@@ -51,7 +89,7 @@ bool ZFilter::operator()(const void* in, size_t& insize, void* out, size_t& outs
     zs.next_out = (Bytef*)out;
 
     // Check if there's any use compressing; if not, save some cpu...
-    if(compressing && insize > 0 && outsize > 16 && (totalIn > (64*1024)) && ((static_cast<double>(totalOut) / totalIn) > 0.95)) {
+    if(compressing && sampled && insize > 0 && outsize > 16 && getRatio() > MIN_COMPRESSION_LEVEL) {
         zs.avail_in = 0;
         zs.avail_out = outsize;
         if(deflateParams(&zs, 0, Z_DEFAULT_STRATEGY) != Z_OK) {
@@ -59,6 +97,7 @@ bool ZFilter::operator()(const void* in, size_t& insize, void* out, size_t& outs
         }
         zs.avail_in = insize;
         compressing = false;
+        --active;
         dcdebug("Dynamically disabled compression");
 
         // Check if we ate all space already...
@@ -74,27 +113,32 @@ bool ZFilter::operator()(const void* in, size_t& insize, void* out, size_t& outs
         zs.avail_out = outsize;
     }
 
-    if(insize == 0) {
-        int err = ::deflate(&zs, Z_FINISH);
+    bool finish = insize == 0;
+    uint64_t start = compressing ? threadCpuTime() : 0;
+    int err;
+    if(finish) {
+        err = ::deflate(&zs, Z_FINISH);
         if(err != Z_OK && err != Z_STREAM_END)
             throw Exception(_("Error during compression"));
-
-        outsize = outsize - zs.avail_out;
-        insize = insize - zs.avail_in;
-        totalOut += outsize;
-        totalIn += insize;
-        return err == Z_OK;
     } else {
-        int err = ::deflate(&zs, Z_NO_FLUSH);
+        // deflate holds back a good part of the output, flush it once to get
+        // the real ratio of the sample. When the output doesn't fit the rest is
+        // sent with the next calls, the sample is known to be bad then anyway.
+        bool sample = !sampled && totalIn + static_cast<int64_t>(insize) >= SAMPLE_SIZE;
+        err = ::deflate(&zs, sample ? Z_SYNC_FLUSH : Z_NO_FLUSH);
         if(err != Z_OK)
             throw Exception(_("Error during compression"));
-
-        outsize = outsize - zs.avail_out;
-        insize = insize - zs.avail_in;
-        totalOut += outsize;
-        totalIn += insize;
-        return true;
+        if(sample && zs.avail_in == 0)
+            sampled = true;
     }
+    if(compressing)
+        cpuTime += threadCpuTime() - start;
+
+    outsize = outsize - zs.avail_out;
+    insize = insize - zs.avail_in;
+    totalOut += outsize;
+    totalIn += insize;
+    return finish ? err == Z_OK : true;
 }
 
 UnZFilter::UnZFilter() {
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <string>
@@ -31,8 +32,11 @@ class ZFilter {
 public:
     /** Compression will automatically be turned off if below this... */
     static const double MIN_COMPRESSION_LEVEL;
+    /** Input compressed before the ratio is checked the first time */
+    static const int64_t SAMPLE_SIZE = 64*1024;
 
-    ZFilter();
+    /** @param aLevel zlib level, -1 to pick one from getAdaptiveLevel() */
+    explicit ZFilter(int aLevel = -1);
     ~ZFilter();
     /**
      * Compress data.
@@ -43,11 +47,34 @@ public:
      * @return True if there's more processing to be done
      */
     bool operator()(const void* in, size_t& insize, void* out, size_t& outsize);
+
+    int getLevel() const { return level; }
+    bool isCompressing() const { return compressing; }
+    int64_t getTotalIn() const { return totalIn; }
+    int64_t getTotalOut() const { return totalOut; }
+    /** Compressed / uncompressed size so far */
+    double getRatio() const { return totalIn > 0 ? static_cast<double>(totalOut) / totalIn : 1.0; }
+    /** CPU time spent in zlib, in microseconds */
+    uint64_t getCpuTime() const { return cpuTime; }
+
+    /**
+     * Level for a new stream, SettingsManager::MAX_COMPRESSION while there are
+     * cores to spare, cheaper the more streams are being compressed at once.
+     */
+    static int getAdaptiveLevel();
+
 private:
     z_stream zs;
+    int level;
     int64_t totalIn;
     int64_t totalOut;
+    uint64_t cpuTime;
     bool compressing;
+    /** Whether SAMPLE_SIZE has been compressed and flushed */
+    bool sampled;
+
+    /** Filters that are still compressing */
+    static std::atomic<int> active;
 };
 
 class UnZFilter {
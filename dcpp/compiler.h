@@ -61,6 +61,15 @@
 #define U64_FMT "%lld"
 #endif
 
+// thread_local is only available since GCC 4.8 and MSVC 2015
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ == 4 && __GNUC_MINOR__ < 8)
+#define DCPP_THREAD_LOCAL __thread
+#elif defined(_MSC_VER) && _MSC_VER < 1900
+#define DCPP_THREAD_LOCAL __declspec(thread)
+#else
+#define DCPP_THREAD_LOCAL thread_local
+#endif
+
 #ifndef _REENTRANT
 # define _REENTRANT 1
 #endif
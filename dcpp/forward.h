@@ -87,6 +87,8 @@ class Transfer;
 
 class UnZFilter;
 
+class ZFilter;
+
 class Upload;
 typedef Upload* UploadPtr;
 
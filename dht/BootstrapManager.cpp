@@ -21,10 +21,13 @@
 #include "Constants.h"
 #include "DHT.h"
 #include "SearchManager.h"
+#include "Utils.h"
 #include "dcpp/AdcCommand.h"
 #include "dcpp/ClientManager.h"
 #include "dcpp/HttpConnection.h"
 #include "dcpp/LogManager.h"
+#include "dcpp/SettingsManager.h"
+#include "dcpp/StringTokenizer.h"
 #include <zlib.h>
 
 namespace dht
@@ -47,6 +50,23 @@ namespace dht
         if(bootstrapNodes.empty())
         {
             LogManager::getInstance()->message("DHT bootstrapping started");
+
+            // local test networks bootstrap from a fixed list of their own nodes
+            const string& seeds = SETTING(DHT_SEEDS);
+            if(!seeds.empty())
+            {
+                StringTokenizer<string> st(seeds, ';');
+                for(StringIter i = st.getTokens().begin(); i != st.getTokens().end(); ++i)
+                {
+                    string ip;
+                    uint16_t port = 0;
+                    Util::parseIpPort(*i, ip, port);
+                    if(Utils::isGoodIPPort(ip, port))
+                        addBootstrapNode(ip, port, CID(), UDPKey());
+                }
+                return;
+            }
+
             string dhturl = dhtservers[Util::rand(dhtservers.size())];
             // TODO: make URL settable
             string url = dhturl  + "?cid=" + ClientManager::getInstance()->getMe()->getCID().toBase32() + "&encryption=1";
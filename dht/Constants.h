@@ -23,6 +23,7 @@ namespace dht
 
 #define DHT_UDPPORT                                     6250                                                    // default DHT port
 #define DHT_FILE                                        "dht.xml"                                               // local file with all information got from the network
+#define DHT_INDEX_FILE                                  "dhtindex.dat"                                          // local file with sources published to us by other nodes
 
 #define ID_BITS                                         192                                                             // size of identificator (in bits)
 
@@ -43,12 +44,14 @@ namespace dht
 
 #define K                                                       10                                                              // maximum nodes in one bucket
 
-#define MAX_PUBLISHED_FILES                     200                                                             // max local files to publish
 #define MIN_PUBLISH_FILESIZE            1024 * 1024 // 1 MiB                    // files below this size won't be published
 #define REPUBLISH_TIME                          5*60*60*1000    // 5 hours              // when our filelist should be republished
 #define PFS_REPUBLISH_TIME                      1*60*60*1000    // 1 hour               // when partially downloaded files should be republished
-#define MAX_PUBLISHES_AT_TIME           3                                                               // how many files can be published at one time
-#define PUBLISH_TIME                            2*1000  // 2 seconds                    // how often publishes files
+#define MAX_PUBLISHES_AT_TIME           16                                                              // how many publishing lookups can run at one time
+#define PUBLISH_TIME                            1*1000  // 1 second                     // how often publishes files
+#define MAX_PUBLISH_GROUP                       8                                                               // most files published with one lookup, older nodes accept 10 PUBs a minute only
+#define MAX_FILES_PER_PUB                       32                                                              // most files in one bulk PUB packet
+#define PUBLISH_LOOKUP_PACKETS          12                                                              // estimated packets sent by one publishing lookup
 
 #define FW_RESPONSES                            3                                                               // how many UDP port checks are needed to detect we are firewalled
 #define FWCHECK_TIME                            1*60*60*1000                                    // how often request firewalled UDP check
@@ -56,6 +59,10 @@ namespace dht
 #define NODE_RESPONSE_TIMEOUT           2*60*1000       // 2 minutes            // node has this time to response else we ignore him/mark him as dead node
 #define NODE_EXPIRATION                         2*60*60*1000 // 2 hours                 // when node should be marked as possibly dead
 
+#define MAX_INDEXED_SOURCES                     250000                                                  // most sources published to us, the least recently used files are dropped above it
+#define INDEX_EXPIRATION_STEP           60*1000 // 1 minute                     // granularity of source expiration
+#define INDEX_SAVE_TIME                         15*60*1000      // 15 minutes   // how often to save changed indexes to disk
+
 #define TIME_FOR_RESPONSE                       3*60*1000       // 3 minutes            // node has this time to respond to request; after that response will be marked as unwanted
 
 #define CLIENT_PROTOCOL                         "ADC/1.0"                                               // protocol used for file transfers
@@ -64,6 +71,7 @@ namespace dht
 #define TCP4_FEATURE                            "TCP4"                                                  // support for active TCP
 #define UDP4_FEATURE                            "UDP4"                                                  // support for active UDP
 #define DHT_FEATURE                                     "DHT0"
+#define BULK_PUBLISH_FEATURE            "BPUB"                                                  // support for more files in one PUB
 
 const std::string NetworkName =         "DHT";
 
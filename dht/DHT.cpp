@@ -104,9 +104,13 @@ namespace dht
         if(!BOOLSETTING(USE_DHT) || exiting)
         {
             saveData();
+            IndexManager::getInstance()->saveIndexes(true);
 
             lastPacket = 0;
 
+            if(BOOLSETTING(DHT_LOOPBACK))
+                SearchManager::getInstance()->logStats();
+
             ConnectionManager::deleteInstance();
             TaskManager::deleteInstance();
             SearchManager::deleteInstance();
@@ -141,8 +145,8 @@ namespace dht
             if(cid.size() != 39)
                 return;
 
-            // ignore message from myself
-            if(CID(cid) == ClientManager::getInstance()->getMe()->getCID() || ip == lastExternalIP)
+            // ignore message from myself, local test nodes all share our IP
+            if(CID(cid) == ClientManager::getInstance()->getMe()->getCID() || (ip == lastExternalIP && !BOOLSETTING(DHT_LOOPBACK)))
                 return;
 
             lastPacket = GET_TICK();
@@ -241,12 +245,15 @@ namespace dht
         bool isAcceptable = true;
         if(!node->isOnline())
         {
+            bool inTable;
             {
                 Lock l(cs);
                 isAcceptable = bucket->insert(node); // insert node to our routing table
+                inTable = node->isInList;
             }
 
-            if(makeOnline)
+            // nodes waiting in the replacement cache stay offline until they get into the table
+            if(makeOnline && inTable)
             {
                 // put him online so we can make a connection with him
                 node->inc();
@@ -331,6 +338,8 @@ namespace dht
         if(!isFirewalled())
             su += UDP4_FEATURE ",";
 
+        su += BULK_PUBLISH_FEATURE ",";
+
         if(!su.empty()) {
             su.erase(su.size() - 1);
         }
@@ -378,14 +387,15 @@ namespace dht
             if(f.getLastModified() > time(NULL) - 7 * 24 * 60 * 60)
                 bucket->loadNodes(xml);
 
-            // load indexes
-            IndexManager::getInstance()->loadIndexes(xml);
             xml.stepOut();
         }
         catch(Exception& e)
         {
             dcdebug("%s\n", e.getError().c_str());
         }
+
+        // load indexes
+        IndexManager::getInstance()->loadIndexes();
     }
 
     /*
@@ -393,6 +403,9 @@ namespace dht
      */
     void DHT::saveData()
     {
+        // foreign published files are saved separately, they change much more often than nodes
+        IndexManager::getInstance()->saveIndexes(false);
+
         if(!dirty)
             return;
 
@@ -405,9 +418,6 @@ namespace dht
         // save nodes
         bucket->saveNodes(xml);
 
-        // save foreign published files
-        IndexManager::getInstance()->saveIndexes(xml);
-
         xml.stepOut();
 
         try
@@ -520,21 +530,23 @@ namespace dht
             if(resTo == "PUB")
             {
 #ifdef _DEBUG
-                // don't do anything
-                string tth;
-                if(!c.getParam("TR", 1, tth))
-                    return;
-
-                try
+                // don't do anything, bulk publishing acknowledges more files at once
+                for(StringIterC i = c.getParameters().begin() + 1; i != c.getParameters().end(); ++i)
                 {
-                    string fileName = Util::getFileName(ShareManager::getInstance()->toVirtual(TTHValue(tth)));
-                    LogManager::getInstance()->message("DHT (" + fromIP + "): File published: " + fileName);
-                }
-                catch(ShareException&)
-                {
-                    // published non-shared file??? Maybe partial file
-                    LogManager::getInstance()->message("DHT (" + fromIP + "): Partial file published: " + tth);
+                    if(i->compare(0, 2, "TR") != 0)
+                        continue;
 
+                    string tth = i->substr(2);
+                    try
+                    {
+                        string fileName = Util::getFileName(ShareManager::getInstance()->toVirtual(TTHValue(tth)));
+                        LogManager::getInstance()->message("DHT (" + fromIP + "): File published: " + fileName);
+                    }
+                    catch(ShareException&)
+                    {
+                        // published non-shared file??? Maybe partial file
+                        LogManager::getInstance()->message("DHT (" + fromIP + "): Partial file published: " + tth);
+                    }
                 }
 #endif
             }
@@ -22,16 +22,32 @@
 #include "IndexManager.h"
 #include "SearchManager.h"
 #include "dcpp/CID.h"
+#include "dcpp/File.h"
 #include "dcpp/LogManager.h"
+#include "dcpp/SettingsManager.h"
 #include "dcpp/ShareManager.h"
 #include "dcpp/TimerManager.h"
 
 namespace dht
 {
 
+    string Source::getIp() const
+    {
+        in_addr addr;
+        addr.s_addr = ip4;
+        return inet_ntoa(addr);
+    }
+
+    void Source::setIp(const string& aIp)
+    {
+        ip4 = inet_addr(aIp.c_str());
+    }
+
     IndexManager::IndexManager(void) :
-        publish(false), publishing(0), nextRepublishTime(GET_TICK())
+        sourcesCount(0), dirty(false), lastSave(GET_TICK()), queueSorted(true), publishCredit(0),
+        lastPublishTick(GET_TICK()), roundDone(false), publish(false), publishing(0), nextRepublishTime(GET_TICK())
     {
+        memset(&publishStats, 0, sizeof(publishStats));
     }
 
     IndexManager::~IndexManager(void)
@@ -52,36 +68,72 @@ namespace dht
         source.setPartial(partial);
 
         Lock l(cs);
+        insertSource(tth, source);
+
+        // drop the least recently used files when there are too many sources
+        while(sourcesCount > MAX_INDEXED_SOURCES && lru.back() != tth)
+            removeIndex(tthList.find(lru.back()));
 
+        dirty = true;
+    }
+
+    /*
+     * Stores source to tth list, the caller has to lock
+     */
+    void IndexManager::insertSource(const TTHValue& tth, const Source& source)
+    {
         TTHMap::iterator i = tthList.find(tth);
         if(i != tthList.end())
         {
             // no user duplicites
-            SourceList& sources = i->second;
+            SourceList& sources = i->second.sources;
             for(SourceList::iterator s = sources.begin(); s != sources.end(); ++s)
             {
-                if(node->getUser()->getCID() == (*s).getCID())
+                if(source.getCID() == s->getCID())
                 {
                     // delete old item
                     sources.erase(s);
+                    --sourcesCount;
                     break;
                 }
             }
 
             // old items in front, new items in back
             sources.push_back(source);
+            ++sourcesCount;
 
             // if maximum sources reached, remove the oldest one
             if(sources.size() > MAX_SEARCH_RESULTS)
-                sources.pop_front();
+            {
+                sources.erase(sources.begin());
+                --sourcesCount;
+            }
+
+            lru.splice(lru.begin(), lru, i->second.lruPos);
         }
         else
         {
             // new file
-            tthList.insert(std::make_pair(tth, SourceList(1, source)));
+            Index& index = tthList[tth];
+            index.sources.push_back(source);
+            index.lruPos = lru.insert(lru.begin(), tth);
+            ++sourcesCount;
         }
 
-        DHT::getInstance()->setDirty();
+        // the expiration check will look at this file once the source expires, once per step
+        // no matter how many of its sources expire then
+        expirations[(source.getExpires() + INDEX_EXPIRATION_STEP - 1) / INDEX_EXPIRATION_STEP].insert(tth);
+    }
+
+    /*
+     * Removes the whole index, the caller has to lock
+     */
+    void IndexManager::removeIndex(TTHMap::iterator i)
+    {
+        // expirations may still refer to it, they skip hashes they don't find
+        sourcesCount -= i->second.sources.size();
+        lru.erase(i->second.lruPos);
+        tthList.erase(i);
     }
 
     /*
@@ -94,101 +146,319 @@ namespace dht
         TTHMap::const_iterator i = tthList.find(tth);
         if(i != tthList.end())
         {
-            sources = i->second;
+            sources = i->second.sources;
+            lru.splice(lru.begin(), lru, i->second.lruPos);
             return true;
         }
 
         return false;
     }
 
+    namespace
+    {
+        /** Partial files go first, shared files are ordered by TTH */
+        struct PublishOrder
+        {
+            bool operator()(const File& a, const File& b) const
+            {
+                if(a.partial != b.partial)
+                    return a.partial;
+                return a.tth < b.tth;
+            }
+        };
+    }
+
     /*
-     * Try to publish next file in queue
+     * Starts publishing next files in queue, as many as the publishing budget allows
      */
     void IndexManager::publishNextFile()
     {
-        File f;
+        // files sharing this many leading bits are likely to be stored on the same nodes
+        int groupBits = max(static_cast<int>(DHT::getInstance()->getBucketsCount()) - 1, 0);
+        int rate = SETTING(DHT_PUBLISH_RATE);
+        uint64_t tick = GET_TICK();
+
+        std::vector<FileList> groups;
         {
             Lock l(cs);
 
-            if(publishQueue.empty() || publishing >= MAX_PUBLISHES_AT_TIME)
-                return;
+            // a lookup and a PUB to each of K nodes
+            const double cost = PUBLISH_LOOKUP_PACKETS + K;
+            if(rate > 0)
+                publishCredit = min(publishCredit + (double)(tick - lastPublishTick) * rate / 1000, max((double)rate, cost));
+            lastPublishTick = tick;
 
-            incPublishing();
+            if(!queueSorted)
+            {
+                std::sort(publishQueue.begin(), publishQueue.end(), PublishOrder());
+                queueSorted = true;
+            }
 
-            f = publishQueue.front(); // get the first file in queue
-            publishQueue.pop_front(); // and remove it from queue
+            while(!publishQueue.empty() && publishing < MAX_PUBLISHES_AT_TIME && (rate <= 0 || publishCredit >= cost))
+            {
+                incPublishing();
+                publishCredit -= cost;
+
+                FileList files(1, publishQueue.front()); // get the first file in queue
+                publishQueue.pop_front(); // and remove it from queue
+
+                while(!files.front().partial && files.size() < MAX_PUBLISH_GROUP && !publishQueue.empty() && !publishQueue.front().partial &&
+                    KBucket::getPrefixLength(CID(files.front().tth.data), CID(publishQueue.front().tth.data)) >= groupBits)
+                {
+                    files.push_back(publishQueue.front());
+                    publishQueue.pop_front();
+                }
+
+                groups.push_back(files);
+            }
         }
-        SearchManager::getInstance()->findStore(f.tth.toBase32(), f.size, f.partial);
+
+        for(std::vector<FileList>::const_iterator i = groups.begin(); i != groups.end(); ++i)
+            SearchManager::getInstance()->findStore(*i);
     }
 
     /*
-     * Loads existing indexes from disk
+     * Publishing of a group of files has finished
      */
-    void IndexManager::loadIndexes(SimpleXML& xml)
+    void IndexManager::publishDone(const FileList& files, bool published)
     {
-        xml.resetCurrentChild();
-        if(xml.findChild("Indexes"))
+        string msg;
         {
-            xml.stepIn();
-            while(xml.findChild("Index"))
+            Lock l(cs);
+            decPublishing();
+
+            for(FileList::const_iterator i = files.begin(); i != files.end(); ++i)
+            {
+                if(i->partial)
+                    continue;
+
+                if(published)
+                    publishStats.published++;
+                else
+                    publishStats.failed++;
+            }
+
+            if(!roundDone && publishQueue.empty() && publishing == 0 && publishStats.total > 0)
             {
-                const TTHValue tth = TTHValue(xml.getChildAttrib("TTH"));
-                SourceList sources;
+                roundDone = true;
+                msg = "DHT: " + Util::toString(publishStats.published) + " of " + Util::toString(publishStats.total) + " shared files published";
+            }
+        }
+
+        if(!msg.empty())
+            LogManager::getInstance()->message(msg);
+    }
+
+    /*
+     * Progress of publishing our share
+     */
+    IndexManager::PublishStats IndexManager::getPublishStats() const
+    {
+        Lock l(cs);
+        PublishStats ret = publishStats;
+        ret.queued = 0;
+        for(FileQueue::const_iterator i = publishQueue.begin(); i != publishQueue.end(); ++i)
+        {
+            if(!i->partial)
+                ++ret.queued;
+        }
+        return ret;
+    }
+
+    namespace
+    {
+        const uint32_t INDEX_MAGIC = 0x49544844; // "DHTI"
+        const uint32_t INDEX_VERSION = 1;
+
+        // integers are stored little endian, the file stays readable when moved to another machine
+        template<typename T>
+        void writeValue(string& buf, size_t pos, T value)
+        {
+            for(size_t i = 0; i < sizeof(value); ++i)
+                buf[pos + i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+
+        template<typename T>
+        void writeValue(string& buf, T value)
+        {
+            buf.resize(buf.size() + sizeof(value));
+            writeValue(buf, buf.size() - sizeof(value), value);
+        }
+
+        template<typename T>
+        bool readValue(const string& buf, size_t& pos, T& value)
+        {
+            if(buf.size() - pos < sizeof(value))
+                return false;
+
+            value = 0;
+            for(size_t i = 0; i < sizeof(value); ++i)
+                value |= static_cast<T>(static_cast<uint8_t>(buf[pos + i])) << (8 * i);
+            pos += sizeof(value);
+            return true;
+        }
+
+        bool readBytes(const string& buf, size_t& pos, uint8_t* data, size_t len)
+        {
+            if(buf.size() - pos < len)
+                return false;
+
+            memcpy(data, buf.data() + pos, len);
+            pos += len;
+            return true;
+        }
+    }
 
-                xml.stepIn();
-                while(xml.findChild("Source"))
+    /*
+     * Loads existing indexes from disk
+     */
+    void IndexManager::loadIndexes()
+    {
+        {
+            // still in memory when DHT is started again
+            Lock l(cs);
+            if(!tthList.empty())
+                return;
+        }
+
+        string buf;
+        try
+        {
+            buf = dcpp::File(Util::getPath(Util::PATH_USER_CONFIG) + DHT_INDEX_FILE, dcpp::File::READ, dcpp::File::OPEN).read();
+        }
+        catch(const FileException&)
+        {
+            return;
+        }
+
+        // expiration times are stored as wall clock time, ticks don't survive a restart
+        uint64_t tick = GET_TICK();
+        uint32_t now = static_cast<uint32_t>(time(NULL));
+
+        size_t pos = 0;
+        uint32_t magic, version, files;
+        if(!readValue(buf, pos, magic) || magic != INDEX_MAGIC || !readValue(buf, pos, version) || version != INDEX_VERSION ||
+            !readValue(buf, pos, files))
+        {
+            dcdebug("DHT index file has unknown format\n");
+            return;
+        }
+
+        Lock l(cs);
+        for(uint32_t i = 0; i < files; ++i)
+        {
+            uint8_t tth[TTHValue::BYTES];
+            uint16_t count;
+            if(!readBytes(buf, pos, tth, sizeof(tth)) || !readValue(buf, pos, count))
+                break;
+
+            for(uint16_t j = 0; j < count; ++j)
+            {
+                uint8_t cid[CID::SIZE];
+                uint32_t ip4, expires;
+                uint16_t udpPort;
+                uint64_t size;
+                if(!readBytes(buf, pos, cid, sizeof(cid)) || !readValue(buf, pos, ip4) || !readValue(buf, pos, udpPort) ||
+                    !readValue(buf, pos, size) || !readValue(buf, pos, expires))
                 {
-                    Source source;
-                    source.setCID(CID(xml.getChildAttrib("CID")));
-                    source.setIp(xml.getChildAttrib("I4"));
-                    source.setUdpPort(static_cast<uint16_t>(xml.getIntChildAttrib("U4")));
-                    source.setSize(xml.getLongLongChildAttrib("SI"));
-                    source.setExpires(xml.getLongLongChildAttrib("EX"));
-                    source.setPartial(false);
-
-                    sources.push_back(source);
+                    // truncated file, keep what has been read so far
+                    i = files;
+                    break;
                 }
 
-                tthList.insert(std::make_pair(tth, sources));
-                xml.stepOut();
+                if(expires <= now)
+                    continue;
+
+                Source source;
+                source.setCID(CID(cid));
+                source.setIp4(ip4);
+                source.setUdpPort(udpPort);
+                source.setSize(size);
+                source.setExpires(tick + static_cast<uint64_t>(expires - now) * 1000);
+                source.setPartial(false);
+
+                insertSource(TTHValue(tth), source);
             }
-            xml.stepOut();
         }
+
+        while(sourcesCount > MAX_INDEXED_SOURCES)
+            removeIndex(tthList.find(lru.back()));
     }
 
     /*
-     * Save all indexes to disk
+     * Saves indexes to disk when they changed, at most once per INDEX_SAVE_TIME unless forced
      */
-    void IndexManager::saveIndexes(SimpleXML& xml)
+    void IndexManager::saveIndexes(bool force)
     {
-        xml.addTag("Files");
-        xml.stepIn();
+        uint64_t tick = GET_TICK();
+        uint32_t now = static_cast<uint32_t>(time(NULL));
 
-        Lock l(cs);
-        for(TTHMap::const_iterator i = tthList.begin(); i != tthList.end(); ++i)
+        string buf;
         {
-            xml.addTag("File");
-            xml.addChildAttrib("TTH", i->first.toBase32());
+            Lock l(cs);
+            if(!dirty || (!force && tick < lastSave + INDEX_SAVE_TIME))
+                return;
 
-            xml.stepIn();
-            for(SourceList::const_iterator j = i->second.begin(); j != i->second.end(); ++j)
+            dirty = false;
+            lastSave = tick;
+
+            // TTH, count and one source of 42 bytes per file at least
+            buf.reserve(12 + tthList.size() * (TTHValue::BYTES + 2) + sourcesCount * 42);
+            writeValue(buf, INDEX_MAGIC);
+            writeValue(buf, INDEX_VERSION);
+            writeValue(buf, static_cast<uint32_t>(0)); // file count, filled in below
+
+            uint32_t files = 0;
+            for(TTHMap::const_iterator i = tthList.begin(); i != tthList.end(); ++i)
             {
-                const Source& source = *j;
+                const SourceList& sources = i->second.sources;
+
+                size_t countPos = buf.size() + TTHValue::BYTES;
+                uint16_t count = 0;
+                buf.append(reinterpret_cast<const char*>(i->first.data), TTHValue::BYTES);
+                writeValue(buf, count);
+
+                for(SourceList::const_iterator j = sources.begin(); j != sources.end(); ++j)
+                {
+                    const Source& source = *j;
 
-                if(source.getPartial())
-                    continue;   // don't store partial sources
+                    if(source.getPartial() || source.getExpires() <= tick)
+                        continue;   // don't store partial sources
+
+                    buf.append(reinterpret_cast<const char*>(source.getCID().data()), CID::SIZE);
+                    writeValue(buf, source.getIp4());
+                    writeValue(buf, source.getUdpPort());
+                    writeValue(buf, source.getSize());
+                    writeValue(buf, static_cast<uint32_t>(now + (source.getExpires() - tick) / 1000));
+                    ++count;
+                }
+
+                if(count == 0)
+                {
+                    buf.resize(countPos - TTHValue::BYTES);
+                    continue;
+                }
 
-                xml.addTag("Source");
-                xml.addChildAttrib("CID", source.getCID().toBase32());
-                xml.addChildAttrib("I4", source.getIp());
-                xml.addChildAttrib("U4", source.getUdpPort());
-                xml.addChildAttrib("SI", source.getSize());
-                xml.addChildAttrib("EX", source.getExpires());
+                writeValue(buf, countPos, count);
+                ++files;
             }
-            xml.stepOut();
+
+            writeValue(buf, 8, files);
         }
 
-        xml.stepOut();
+        const string path = Util::getPath(Util::PATH_USER_CONFIG) + DHT_INDEX_FILE;
+        try
+        {
+            {
+                dcpp::File file(path + ".tmp", dcpp::File::WRITE, dcpp::File::CREATE | dcpp::File::TRUNCATE);
+                file.write(buf);
+            }
+            dcpp::File::deleteFile(path);
+            dcpp::File::renameFile(path + ".tmp", path);
+        }
+        catch(const FileException&)
+        {
+        }
     }
 
     /*
@@ -196,23 +466,43 @@ namespace dht
      */
     void IndexManager::processPublishSourceRequest(const Node::Ptr& node, const AdcCommand& cmd)
     {
-        string tth;
-        if(!cmd.getParam("TR", 1, tth))
+        // nodes supporting BULK_PUBLISH_FEATURE send more TR/SI pairs in one packet
+        StringList tths, sizes;
+        for(StringIterC i = cmd.getParameters().begin() + 1; i != cmd.getParameters().end(); ++i)
+        {
+            if(i->compare(0, 2, "TR") == 0)
+                tths.push_back(i->substr(2));
+            else if(i->compare(0, 2, "SI") == 0)
+                sizes.push_back(i->substr(2));
+        }
+
+        if(tths.empty())
             return; // nothing to identify a file?
 
-        string size;
-        if(!cmd.getParam("SI", 1, size))
+        if(sizes.size() != tths.size())
             return; // no file size?
 
         string partial;
         cmd.getParam("PF", 1, partial);
 
-        addSource(TTHValue(tth), node, Util::toInt64(size), partial == "1");
-
-        // send response
+        // the response names every file we've accepted
         AdcCommand res(AdcCommand::SEV_SUCCESS, AdcCommand::SUCCESS, "File published", AdcCommand::TYPE_UDP);
         res.addParam("FC", "PUB");
-        res.addParam("TR", tth);
+
+        bool accepted = false;
+        for(size_t i = 0; i < tths.size() && i < MAX_FILES_PER_PUB; ++i)
+        {
+            if(tths[i].size() != 39)
+                continue;
+
+            addSource(TTHValue(tths[i]), node, Util::toInt64(sizes[i]), partial == "1");
+            res.addParam("TR", tths[i]);
+            accepted = true;
+        }
+
+        if(!accepted)
+            return;
+
         DHT::getInstance()->send(res, node->getIdentity().getIp(), static_cast<uint16_t>(Util::toInt(node->getIdentity().getUdpPort())), node->getUser()->getCID(), node->getUdpKey());
     }
 
@@ -223,43 +513,82 @@ namespace dht
     {
         Lock l(cs);
 
-        bool dirty = false;
-
-        TTHMap::iterator i = tthList.begin();
-        while(i != tthList.end())
+        // only files with sources expiring by now need to be looked at
+        ExpirationMap::iterator e = expirations.begin();
+        while(e != expirations.end() && e->first * INDEX_EXPIRATION_STEP <= aTick)
         {
-            SourceList::iterator j = i->second.begin();
-            while(j != i->second.end())
+            for(std::unordered_set<TTHValue>::const_iterator t = e->second.begin(); t != e->second.end(); ++t)
             {
-                const Source& source = *j;
-                if(source.getExpires() <= aTick)
+                TTHMap::iterator i = tthList.find(*t);
+                if(i == tthList.end())
+                    continue;
+
+                // partial sources expire sooner, so the list isn't sorted by expiration
+                SourceList& sources = i->second.sources;
+                for(SourceList::iterator j = sources.begin(); j != sources.end();)
                 {
-                    dirty = true;
-                    j = i->second.erase(j);
+                    if(j->getExpires() <= aTick)
+                    {
+                        j = sources.erase(j);
+                        --sourcesCount;
+                        dirty = true;
+                    }
+                    else
+                    {
+                        ++j;
+                    }
                 }
-                else
-                    break;  // list is sorted, so finding first non-expired can stop iteration
 
+                if(sources.empty())
+                    removeIndex(i);
             }
 
-            if(i->second.empty())
-                tthList.erase(i++);
-            else
-                ++i;
+            expirations.erase(e++);
         }
+    }
 
-        if(dirty)
-            DHT::getInstance()->setDirty();
+    /*
+     * Is the previous round of publishing our share still running?
+     */
+    bool IndexManager::isPublishing() const
+    {
+        Lock l(cs);
+        return !roundDone && publishStats.total > 0;
     }
 
-    /** Publishes shared file */
-    void IndexManager::publishFile(const TTHValue& tth, int64_t size)
+    /*
+     * Starts a new round of publishing shared files, unless the previous one is still running
+     */
+    bool IndexManager::startPublishing(const FileList& files)
     {
-        if(size > MIN_PUBLISH_FILESIZE)
+        Lock l(cs);
+        if(isPublishing())
+            return false;
+
+        // only partial files can be left over
+        FileQueue partial;
+        for(FileQueue::const_iterator i = publishQueue.begin(); i != publishQueue.end(); ++i)
         {
-            Lock l(cs);
-            publishQueue.push_back(File(tth, size, false));
+            if(i->partial)
+                partial.push_back(*i);
         }
+        publishQueue.swap(partial);
+
+        memset(&publishStats, 0, sizeof(publishStats));
+        roundDone = false;
+
+        for(FileList::const_iterator i = files.begin(); i != files.end(); ++i)
+        {
+            if(i->size > MIN_PUBLISH_FILESIZE)
+            {
+                publishQueue.push_back(*i);
+                publishStats.total++;
+            }
+        }
+
+        queueSorted = false;
+        setNextPublishing();
+        return true;
     }
 
     /*
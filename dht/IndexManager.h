@@ -43,10 +43,14 @@ namespace dht
 
     struct Source
     {
+        /** IPv4 address is kept in binary form, there can be hundreds of thousands of sources */
+        string getIp() const;
+        void setIp(const string& aIp);
+
         GETSET(CID, cid, CID);
-        GETSET(string, ip, Ip);
         GETSET(uint64_t, expires, Expires);
         GETSET(uint64_t, size, Size);
+        GETSET(uint32_t, ip4, Ip4);
         GETSET(uint16_t, udpPort, UdpPort);
         GETSET(bool, partial, Partial);
     };
@@ -58,19 +62,35 @@ namespace dht
         IndexManager(void);
         ~IndexManager(void);
 
-        typedef std::deque<Source> SourceList;
+        typedef std::vector<Source> SourceList;
+        typedef std::vector<File> FileList;
+
+        /** Progress of publishing our share */
+        struct PublishStats
+        {
+            size_t total;       // shared files queued in the current round
+            size_t published;   // files at least one node has been asked to store
+            size_t failed;      // files no node has been found for
+            size_t queued;      // files still waiting
+        };
 
         /** Finds TTH in known indexes and returns it */
         bool findResult(const TTHValue& tth, SourceList& sources) const;
 
-        /** Try to publish next file in queue */
+        /** Starts publishing next files in queue, as many as the publishing budget allows */
         void publishNextFile();
 
+        /** Publishing of a group of files has finished */
+        void publishDone(const FileList& files, bool published);
+
+        /** Progress of publishing our share */
+        PublishStats getPublishStats() const;
+
         /** Loads existing indexes from disk */
-        void loadIndexes(SimpleXML& xml);
+        void loadIndexes();
 
-        /** Save all indexes to disk */
-        void saveIndexes(SimpleXML& xml);
+        /** Saves indexes to disk when they changed, at most once per INDEX_SAVE_TIME unless forced */
+        void saveIndexes(bool force);
 
         /** How many files is currently being published */
         void incPublishing() { ++publishing; } //{ Thread::safeInc(publishing); }
@@ -86,8 +106,11 @@ namespace dht
         /** Removes old sources */
         void checkExpiration(uint64_t aTick);
 
-        /** Publishes shared file */
-        void publishFile(const TTHValue& tth, int64_t size);
+        /** Is the previous round of publishing the share still running? */
+        bool isPublishing() const;
+
+        /** Starts a new round of publishing shared files, false while the previous round is still running */
+        bool startPublishing(const FileList& files);
 
         /** Publishes partially downloaded file */
         void publishPartialFile(const TTHValue& tth);
@@ -100,14 +123,46 @@ namespace dht
 
     private:
 
+        /** Known hashes ordered by their last use, the most recent in front */
+        typedef std::list<TTHValue> LRUList;
+        mutable LRUList lru;
+
+        struct Index
+        {
+            SourceList sources;         // the oldest sources in front
+            LRUList::iterator lruPos;   // position in lru
+        };
+
         /** Contains known hashes in the network and their sources */
-        typedef std::unordered_map<TTHValue, SourceList> TTHMap;
+        typedef std::unordered_map<TTHValue, Index> TTHMap;
         TTHMap tthList;
 
+        /** Number of sources in all indexes */
+        size_t sourcesCount;
+
+        /** Hashes with sources expiring in the same minute, to check only those when it passes */
+        typedef std::map<uint64_t, std::unordered_set<TTHValue> > ExpirationMap;
+        ExpirationMap expirations;
+
+        /** Indexes changed since they were saved last time */
+        bool dirty;
+        uint64_t lastSave;
+
         /** Queue of files prepared for publishing */
         typedef std::deque<File> FileQueue;
         FileQueue publishQueue;
 
+        /** Queue is sorted by TTH when publishing starts, so close hashes are next to each other */
+        bool queueSorted;
+
+        /** Packets publishing may send now, refilled by DHTPublishRate per second */
+        double publishCredit;
+        uint64_t lastPublishTick;
+
+        /** Current publishing round */
+        PublishStats publishStats;
+        bool roundDone;
+
         /** Is publishing allowed? */
         bool publish;
 
@@ -123,6 +178,12 @@ namespace dht
         /** Add new source to tth list */
         void addSource(const TTHValue& tth, const Node::Ptr& node, uint64_t size, bool partial);
 
+        /** Stores source to tth list, the caller has to lock */
+        void insertSource(const TTHValue& tth, const Source& source);
+
+        /** Removes the whole index, the caller has to lock */
+        void removeIndex(TTHMap::iterator i);
+
     };
 
 } // namespace dht
@@ -32,6 +32,11 @@ namespace dht
     {
     }
 
+    Node::Node(const UserPtr& u, ClientBase& client) :
+        OnlineUser(u, client, 0), created(GET_TICK()), expires(0), type(3), ipVerified(false), online(false)
+    {
+    }
+
     CID Node::getUdpKey() const
     {
         // if our external IP changed from the last time, we can't encrypt packet with this key
@@ -78,23 +83,58 @@ namespace dht
     }
 
 
-    KBucket::KBucket(void)
+    KBucket::KBucket(void) : myCID(ClientManager::getInstance()->getMe()->getCID()), buckets(1), nodesCount(0)
+    {
+    }
+
+    KBucket::KBucket(const CID& cid) : myCID(cid), buckets(1), nodesCount(0)
     {
     }
 
     KBucket::~KBucket(void)
     {
         // empty table
-        for(NodeList::iterator it = nodes.begin(); it != nodes.end(); ++it)
+        for(vector<Bucket>::iterator b = buckets.begin(); b != buckets.end(); ++b)
         {
-            Node::Ptr& node = *it;
-            if(node->isOnline())
+            NodeList* lists[] = { &b->nodes, &b->replacements };
+            for(size_t l = 0; l < 2; ++l)
             {
-                ClientManager::getInstance()->putOffline(node.get());
-                node->dec();
+                for(NodeList::iterator it = lists[l]->begin(); it != lists[l]->end(); ++it)
+                {
+                    Node::Ptr& node = *it;
+                    if(node->isOnline())
+                    {
+                        ClientManager::getInstance()->putOffline(node.get());
+                        node->dec();
+                    }
+                }
             }
         }
-        nodes.clear();
+        buckets.clear();
+    }
+
+    int KBucket::getPrefixLength(const CID& a, const CID& b)
+    {
+        for(size_t i = 0; i < CID::SIZE; ++i)
+        {
+            uint8_t x = a.data()[i] ^ b.data()[i];
+            if(x != 0)
+            {
+                int bits = i * 8;
+                while(!(x & 0x80))
+                {
+                    x <<= 1;
+                    ++bits;
+                }
+                return bits;
+            }
+        }
+        return ID_BITS;
+    }
+
+    size_t KBucket::getBucketIndex(const CID& cid) const
+    {
+        return min((size_t)getPrefixLength(myCID, cid), buckets.size() - 1);
     }
 
     /*
@@ -107,19 +147,35 @@ namespace dht
             Node::Ptr node = NULL;
 
             // no online node found, try get from routing table
-            for(NodeList::iterator it = nodes.begin(); it != nodes.end(); ++it)
+            Bucket& bucket = buckets[getBucketIndex(u->getCID())];
+            for(NodeList::iterator it = bucket.nodes.begin(); it != bucket.nodes.end(); ++it)
             {
                 if(u->getCID() == (*it)->getUser()->getCID())
                 {
                     node = *it;
 
                     // put node at the end of the list
-                    nodes.erase(it);
-                    nodes.push_back(node);
+                    bucket.nodes.erase(it);
+                    bucket.nodes.push_back(node);
                     break;
                 }
             }
 
+            if(node == NULL)
+            {
+                for(NodeList::iterator it = bucket.replacements.begin(); it != bucket.replacements.end(); ++it)
+                {
+                    if(u->getCID() == (*it)->getUser()->getCID())
+                    {
+                        node = *it;
+
+                        bucket.replacements.erase(it);
+                        bucket.replacements.push_back(node);
+                        break;
+                    }
+                }
+            }
+
             if(node == NULL && u->isOnline())
             {
                 // try to get node from ClientManager (user can be online but not in our routing table)
@@ -142,8 +198,11 @@ namespace dht
                          // TODO: don't allow update when new IP already exists for different node
 
                         // erase old IP and remember new one
-                        ipMap.erase(oldIp + ":" + oldPort);
-                        ipMap.insert(ip + ":" + Util::toString(port));
+                        if(node->isInList)
+                        {
+                            ipMap.erase(oldIp + ":" + oldPort);
+                            ipMap.insert(ip + ":" + Util::toString(port));
+                        }
                     }
 
                     if(!node->isIpVerified())
@@ -182,28 +241,129 @@ namespace dht
 
         // allow only one same IP:port
         bool isAcceptable = (ipMap.find(ip + ":" + port) == ipMap.end());
+        if(!isAcceptable)
+            return false;
 
-        if((nodes.size() < (K * ID_BITS)) && isAcceptable)
+        const CID& cid = node->getUser()->getCID();
+        if(cid == myCID)
+            return false;
+
+        for(;;)
         {
-            nodes.push_back(node);
-            node->isInList = true;
-            ipMap.insert(ip + ":" + port);
+            size_t index = getBucketIndex(cid);
+            Bucket& bucket = buckets[index];
+
+            if(bucket.nodes.size() < K)
+            {
+                bucket.nodes.push_back(node);
+                node->isInList = true;
+                ipMap.insert(ip + ":" + port);
+                nodesCount++;
+
+                // it could have been waiting as a replacement
+                NodeList::iterator r = std::find(bucket.replacements.begin(), bucket.replacements.end(), node);
+                if(r != bucket.replacements.end())
+                    bucket.replacements.erase(r);
+
+                if(DHT::getInstance())
+                    DHT::getInstance()->setDirty();
+
+                return true;
+            }
+
+            // only the bucket covering our own CID can be split
+            if(index == buckets.size() - 1 && buckets.size() < ID_BITS)
+            {
+                split();
+                continue;
+            }
 
-            if(DHT::getInstance())
-                DHT::getInstance()->setDirty();
+            // bucket is full, remember the node in case some of the nodes dies
+            NodeList::iterator r = std::find(bucket.replacements.begin(), bucket.replacements.end(), node);
+            if(r != bucket.replacements.end())
+                bucket.replacements.erase(r);
+
+            bucket.replacements.push_back(node);
+            if(bucket.replacements.size() > K)
+            {
+                putOffline(bucket.replacements.front());
+                bucket.replacements.pop_front();
+            }
 
             return true;
         }
+    }
+
+    /*
+     * Splits the last bucket in two
+     */
+    void KBucket::split()
+    {
+        size_t depth = buckets.size() - 1;
+        buckets.push_back(Bucket());
+
+        Bucket& oldBucket = buckets[depth];
+        Bucket& newBucket = buckets[depth + 1];
+
+        NodeList* lists[] = { &oldBucket.nodes, &oldBucket.replacements };
+        NodeList* newLists[] = { &newBucket.nodes, &newBucket.replacements };
+        for(size_t l = 0; l < 2; ++l)
+        {
+            NodeList keep;
+            for(NodeList::iterator it = lists[l]->begin(); it != lists[l]->end(); ++it)
+            {
+                if((size_t)getPrefixLength(myCID, (*it)->getUser()->getCID()) > depth)
+                    newLists[l]->push_back(*it);
+                else
+                    keep.push_back(*it);
+            }
+            lists[l]->swap(keep);
+        }
+    }
 
-        return isAcceptable;
+    /*
+     * Moves the most recently seen usable replacement into the bucket
+     */
+    void KBucket::promoteReplacement(Bucket& bucket)
+    {
+        while(!bucket.replacements.empty() && bucket.nodes.size() < K)
+        {
+            Node::Ptr node = bucket.replacements.back();
+            bucket.replacements.pop_back();
+
+            string ipPort = node->getIdentity().getIp() + ":" + node->getIdentity().getUdpPort();
+            if(node->getType() == 4 || ipMap.find(ipPort) != ipMap.end())
+            {
+                putOffline(node);
+                continue;
+            }
+
+            bucket.nodes.push_back(node);
+            node->isInList = true;
+            ipMap.insert(ipPort);
+            nodesCount++;
+        }
     }
 
     /*
-     * Finds "max" closest nodes and stores them to the list
+     * Takes a node leaving the replacement cache offline, nodes only go online once they are in the table
      */
-    void KBucket::getClosestNodes(const CID& cid, Node::Map& closest, unsigned int max, uint8_t maxType) const
+    void KBucket::putOffline(const Node::Ptr& node)
+    {
+        if(node->isOnline())
+        {
+            ClientManager::getInstance()->putOffline(node.get());
+            node->dec();
+            node->setOnline(false);
+        }
+    }
+
+    /*
+     * Adds suitable nodes from the bucket to the closest nodes
+     */
+    void KBucket::addClosest(const Bucket& bucket, const CID& cid, Node::Map& closest, unsigned int max, uint8_t maxType)
     {
-        for(NodeList::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+        for(NodeList::const_iterator it = bucket.nodes.begin(); it != bucket.nodes.end(); ++it)
         {
             const Node::Ptr& node = *it;
             if(node->getType() <= maxType && node->isIpVerified() && !node->getUser()->isSet(User::PASSIVE))
@@ -228,6 +388,30 @@ namespace dht
         }
     }
 
+    /*
+     * Finds "max" closest nodes and stores them to the list
+     */
+    void KBucket::getClosestNodes(const CID& cid, Node::Map& closest, unsigned int max, uint8_t maxType) const
+    {
+        if(max == 0)
+            return;
+
+        // Nodes in the bucket of the target are closer to it than any other node. Then come
+        // nodes in the deeper buckets, they all differ from the target in the same bit.
+        // Nodes in the buckets above are farther and farther away.
+        size_t index = getBucketIndex(cid);
+        addClosest(buckets[index], cid, closest, max, maxType);
+
+        if(closest.size() < max)
+        {
+            for(size_t i = index + 1; i < buckets.size(); ++i)
+                addClosest(buckets[i], cid, closest, max, maxType);
+        }
+
+        for(size_t i = index; i > 0 && closest.size() < max; --i)
+            addClosest(buckets[i - 1], cid, closest, max, maxType);
+    }
+
     /*
      * Remove dead nodes
      */
@@ -235,73 +419,103 @@ namespace dht
     {
         bool dirty = false;
 
-        // we should ping oldest node from every bucket here
-        // but since we have only one bucket now, simulate it by pinging more nodes
-        unsigned int pingCount = max(K, min((int)2 * K, (int)(nodes.size() / (K * 10)) + 1)); // <-- pings 10 - 20 oldest nodes
-        unsigned int pinged = 0;
+        // ping the least recently seen expired node from every bucket
+        dcdrun(unsigned int pinged = 0);
         dcdrun(unsigned int removed = 0);
 
-        // first, remove dead nodes
-        NodeList::iterator i = nodes.begin();
-        while(i != nodes.end())
+        for(vector<Bucket>::iterator b = buckets.begin(); b != buckets.end(); ++b)
         {
-            Node::Ptr& node = *i;
+            bool bucketPinged = false;
 
-            if(node->getType() == 4 && node->expires > 0 && node->expires <= currentTime)
+            // first, remove dead nodes
+            NodeList::iterator i = b->nodes.begin();
+            while(i != b->nodes.end())
             {
-                if(node->unique(2))
-                {
-                    // node is dead, remove it
-                    string ip   = node->getIdentity().getIp();
-                    string port = node->getIdentity().getUdpPort();
-                    ipMap.erase(ip + ":" + port);
+                Node::Ptr& node = *i;
 
-                    if(node->isOnline())
+                if(node->getType() == 4 && node->expires > 0 && node->expires <= currentTime)
+                {
+                    if(node->unique(2))
                     {
-                        ClientManager::getInstance()->putOffline(node.get());
-                        node->dec();
+                        // node is dead, remove it
+                        string ip   = node->getIdentity().getIp();
+                        string port = node->getIdentity().getUdpPort();
+                        ipMap.erase(ip + ":" + port);
+
+                        if(node->isOnline())
+                        {
+                            ClientManager::getInstance()->putOffline(node.get());
+                            node->dec();
+                        }
+
+                        node->isInList = false;
+                        i = b->nodes.erase(i);
+                        nodesCount--;
+                        dirty = true;
+
+                        dcdrun(removed++);
+                    }
+                    else
+                    {
+                        ++i;
                     }
 
-                    i = nodes.erase(i);
-                    dirty = true;
-
-                    dcdrun(removed++);
+                    continue;
                 }
-                else
+
+                if(node->expires == 0)
+                    node->expires = currentTime;
+
+                // select the oldest expired node
+                if(!bucketPinged && node->getType() < 4 && node->expires <= currentTime)
                 {
-                    ++i;
+                    // ping the oldest (expired) node
+                    node->setTimeout(currentTime);
+                    DHT::getInstance()->info(node->getIdentity().getIp(), static_cast<uint16_t>(Util::toInt(node->getIdentity().getUdpPort())), DHT::PING, node->getUser()->getCID(), node->getUdpKey());
+                    bucketPinged = true;
+                    dcdrun(pinged++);
                 }
 
-                continue;
+                ++i;
             }
 
-            if(node->expires == 0)
-                node->expires = currentTime;
-
-            // select the oldest expired node
-            if(pinged < pingCount && node->getType() < 4 && node->expires <= currentTime)
+            // forget replacements that haven't been seen for a long time
+            i = b->replacements.begin();
+            while(i != b->replacements.end())
             {
-                // ping the oldest (expired) node
-                node->setTimeout(currentTime);
-                DHT::getInstance()->info(node->getIdentity().getIp(), static_cast<uint16_t>(Util::toInt(node->getIdentity().getUdpPort())), DHT::PING, node->getUser()->getCID(), node->getUdpKey());
-                pinged++;
+                Node::Ptr& node = *i;
+                if(node->expires == 0)
+                {
+                    node->expires = currentTime + NODE_EXPIRATION;
+                }
+                else if(node->expires <= currentTime)
+                {
+                    putOffline(node);
+                    i = b->replacements.erase(i);
+                    continue;
+                }
+                ++i;
             }
 
-            ++i;
+            promoteReplacement(*b);
         }
 
 #ifdef _DEBUG
-        int verified = 0; int types[5] = { 0 };
-        for(NodeList::const_iterator j = nodes.begin(); j != nodes.end(); ++j)
+        int verified = 0; int types[5] = { 0 }; size_t replacements = 0;
+        for(vector<Bucket>::const_iterator b = buckets.begin(); b != buckets.end(); ++b)
         {
-            Node::Ptr n = *j;
-            if(n->isIpVerified()) verified++;
+            for(NodeList::const_iterator j = b->nodes.begin(); j != b->nodes.end(); ++j)
+            {
+                Node::Ptr n = *j;
+                if(n->isIpVerified()) verified++;
 
-            dcassert(n->getType() >= 0 && n->getType() <= 4);
-            types[n->getType()]++;
+                dcassert(n->getType() >= 0 && n->getType() <= 4);
+                types[n->getType()]++;
+            }
+            replacements += b->replacements.size();
         }
 
-        dcdebug("DHT Nodes: %d (%d verified), Types: %d/%d/%d/%d/%d, pinged %d of %d, removed %d\n", nodes.size(), verified, types[0], types[1], types[2], types[3], types[4], pinged, pingCount, removed);
+        dcdebug("DHT Nodes: %d (%d verified, %d replacements, %d buckets), Types: %d/%d/%d/%d/%d, pinged %d, removed %d\n", nodesCount, verified, replacements, buckets.size(), types[0], types[1], types[2], types[3], types[4], pinged, removed);
 #endif
 
         return dirty;
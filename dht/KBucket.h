@@ -42,6 +42,7 @@ namespace dht
         typedef std::map<CID, Node::Ptr> Map;
 
         Node(const UserPtr& u);
+        Node(const UserPtr& u, ClientBase& client);
         ~Node() throw() {}
 
         uint8_t getType() const { return type; }
@@ -71,10 +72,17 @@ namespace dht
         bool        online; // getUser()->isOnline() returns true when node is online in any hub, we need info when he is online in DHT
     };
 
+    /**
+     * Kademlia routing table. Nodes are kept in up to ID_BITS buckets of K nodes,
+     * bucket i holds nodes sharing exactly i leading bits with our CID, the
+     * last bucket holds all nodes closer than that and is split when it's full.
+     * Nodes that don't fit into a full bucket wait in its replacement cache.
+     */
     class KBucket
     {
     public:
         KBucket(void);
+        explicit KBucket(const CID& cid);   // routing table of another node, used by simulations
         ~KBucket(void);
 
         typedef std::deque<Node::Ptr> NodeList;
@@ -88,8 +96,11 @@ namespace dht
         /** Finds "max" closest nodes and stores them to the list */
         void getClosestNodes(const CID& cid, Node::Map& closest, unsigned int max, uint8_t maxType) const;
 
-        /** Return list of all nodes in this bucket */
-        const NodeList& getNodes() const { return nodes; }
+        /** Returns number of nodes in the routing table, without replacements */
+        size_t getNodesCount() const { return nodesCount; }
+
+        /** Returns number of buckets the routing table consists of */
+        size_t getBucketsCount() const { return buckets.size(); }
 
         /** Removes dead nodes */
         bool checkExpiration(uint64_t currentTime);
@@ -100,10 +111,42 @@ namespace dht
         /** Save bootstrap nodes to disk */
         void saveNodes(SimpleXML& xml);
 
+        /** Number of leading bits both CIDs have in common */
+        static int getPrefixLength(const CID& a, const CID& b);
+
     private:
 
-        /** List of nodes in this bucket */
-        NodeList nodes;
+        struct Bucket
+        {
+            /** Nodes in this bucket, least recently seen first */
+            NodeList nodes;
+
+            /** Nodes to replace dead ones with, most recently seen last */
+            NodeList replacements;
+        };
+
+        /** Index of the bucket where node with this CID belongs to */
+        size_t getBucketIndex(const CID& cid) const;
+
+        /** Splits the last bucket in two */
+        void split();
+
+        /** Moves the most recently seen usable replacement into the bucket */
+        void promoteReplacement(Bucket& bucket);
+
+        /** Takes a node leaving the replacement cache offline */
+        static void putOffline(const Node::Ptr& node);
+
+        /** Adds suitable nodes from the bucket to the closest nodes */
+        static void addClosest(const Bucket& bucket, const CID& cid, Node::Map& closest, unsigned int max, uint8_t maxType);
+
+        /** Our own CID, buckets are relative to it */
+        CID myCID;
+
+        /** Buckets by length of the prefix shared with our CID */
+        vector<Bucket> buckets;
+
+        size_t nodesCount;
 
         /** List of known IPs in this bucket */
         StringSet ipMap;
@@ -23,6 +23,7 @@
 #include "IndexManager.h"
 #include "Utils.h"
 #include "dcpp/ClientManager.h"
+#include "dcpp/LogManager.h"
 #include "dcpp/SearchManager.h"
 #include "dcpp/SearchResult.h"
 #include "dcpp/SimpleXML.h"
@@ -35,7 +36,7 @@ namespace dht
         switch(type)
         {
             case TYPE_NODE: IndexManager::getInstance()->setPublish(true); break;
-            case TYPE_STOREFILE: IndexManager::getInstance()->decPublishing(); break;
+            case TYPE_STOREFILE: IndexManager::getInstance()->publishDone(files, !respondedNodes.empty()); break;
             default: break;
         }
     }
@@ -58,6 +59,9 @@ namespace dht
 
         // send search request to the first ALPHA closest nodes
         size_t nodesCount = min((size_t)SEARCH_ALPHA, possibleNodes.size());
+        ++hops;
+        messages += nodesCount;
+
         Node::Map::iterator it;
         for(size_t i = 0; i < nodesCount; ++i)
         {
@@ -146,21 +150,20 @@ namespace dht
     }
 
     /*
-     * Performs node lookup to store key/value pair in the network
+     * Performs node lookup to store key/value pairs in the network
      */
-    void SearchManager::findStore(const string& tth, int64_t size, bool partial)
+    void SearchManager::findStore(const IndexManager::FileList& files)
     {
-        if(isAlreadySearchingFor(tth))
+        if(isAlreadySearchingFor(files.front().tth.toBase32()))
         {
-            IndexManager::getInstance()->decPublishing();
+            IndexManager::getInstance()->publishDone(files, false);
             return;
         }
 
         Search* s = new Search();
         s->type = Search::TYPE_STOREFILE;
-        s->term = tth;
-        s->filesize = size;
-        s->partial = partial;
+        s->term = files.front().tth.toBase32();
+        s->files = files;
         s->token = Util::toString(Util::rand());
 
         search(*s);
@@ -323,6 +326,12 @@ namespace dht
 
         Search* s = i->second;
 
+        if(s->resultTime == 0)
+            s->resultTime = GET_TICK();
+
+        if(s->type == Search::TYPE_NODE && node->getUser()->getCID().toBase32() == s->term)
+            s->found = true;
+
         // store this node
         s->respondedNodes.insert(std::make_pair(Utils::getDistance(node->getUser()->getCID(), CID(s->term)), node));
 
@@ -347,6 +356,8 @@ namespace dht
                     if( cid.isZero() || ClientManager::getInstance()->getMe()->getCID() == cid || !Utils::isGoodIPPort(i4, u4))
                         continue;
 
+                    s->found = true;
+
                     // create user as offline (only TCP connected users will be online)
                     Node::Ptr source = DHT::getInstance()->createNode(cid, i4, u4, false, false);
 
@@ -395,6 +406,9 @@ namespace dht
                 CID cid = CID(xml.getChildAttrib("CID"));
                 CID distance = Utils::getDistance(cid, CID(s->term));
 
+                if(s->type == Search::TYPE_NODE && distance.isZero())
+                    s->found = true;
+
                 // don't bother with myself and nodes we've already tried or queued
                 if( ClientManager::getInstance()->getMe()->getCID() == cid ||
                     s->possibleNodes.find(distance) != s->possibleNodes.end() ||
@@ -435,7 +449,7 @@ namespace dht
     /*
      * Sends publishing request
      */
-    void SearchManager::publishFile(const Node::Map& nodes, const string& tth, int64_t size, bool partial)
+    void SearchManager::publishFile(const Node::Map& nodes, const IndexManager::FileList& files)
     {
         // send PUB command to K nodes
         int n = K;
@@ -443,15 +457,24 @@ namespace dht
         {
             const Node::Ptr& node = i->second;
 
-            AdcCommand cmd(AdcCommand::CMD_PUB, AdcCommand::TYPE_UDP);
-            cmd.addParam("TR", tth);
-            cmd.addParam("SI", Util::toString(size));
+            // nodes knowing bulk publishing get all files in as few packets as possible
+            size_t perPacket = node->getIdentity().supports(BULK_PUBLISH_FEATURE) ? MAX_FILES_PER_PUB : 1;
+            for(size_t j = 0; j < files.size(); j += perPacket)
+            {
+                AdcCommand cmd(AdcCommand::CMD_PUB, AdcCommand::TYPE_UDP);
+                for(size_t k = j; k < files.size() && k < j + perPacket; ++k)
+                {
+                    cmd.addParam("TR", files[k].tth.toBase32());
+                    cmd.addParam("SI", Util::toString(files[k].size));
+                }
 
-            if(partial)
-                cmd.addParam("PF", "1");
+                // groups have a single file when it's partial
+                if(files[j].partial)
+                    cmd.addParam("PF", "1");
 
-            //i->second->setTimeout();
-            DHT::getInstance()->send(cmd, node->getIdentity().getIp(), static_cast<uint16_t>(Util::toInt(node->getIdentity().getUdpPort())), node->getUser()->getCID(), node->getUdpKey());
+                //i->second->setTimeout();
+                DHT::getInstance()->send(cmd, node->getIdentity().getIp(), static_cast<uint16_t>(Util::toInt(node->getIdentity().getUdpPort())), node->getUser()->getCID(), node->getUdpKey());
+            }
         }
     }
 
@@ -475,10 +498,11 @@ namespace dht
             {
                 // search timed out, stop it
                 searches.erase(it++);
+                addStats(*s);
 
                 if(s->type == Search::TYPE_STOREFILE)
                 {
-                    publishFile(s->respondedNodes, s->term, s->filesize, s->partial);
+                    publishFile(s->respondedNodes, s->files);
                 }
 
                 delete s;
@@ -490,6 +514,73 @@ namespace dht
         }
     }
 
+    /*
+     * Adds finished search to statistics
+     */
+    void SearchManager::addStats(const Search& s)
+    {
+        LookupStats& st = stats[s.type];
+        st.lookups++;
+        st.hops += s.hops;
+        st.messages += s.messages;
+
+        if(s.type == Search::TYPE_STOREFILE)
+        {
+            // file is published to K closest nodes at most
+            st.responses += min(s.respondedNodes.size(), (size_t)K);
+            if(!s.respondedNodes.empty())
+                st.succeeded++;
+        }
+        else
+        {
+            st.responses += s.respondedNodes.size();
+            if(s.found)
+                st.succeeded++;
+        }
+
+        if(s.resultTime != 0)
+        {
+            st.answered++;
+            st.timeToResult += s.resultTime - s.startTime;
+        }
+
+        dcdebug("DHT search %s (type %d) finished: %u hops, %u messages, %u responses, %s\n", s.term.c_str(), s.type,
+            s.hops, s.messages, (unsigned int)s.respondedNodes.size(), s.found ? "found" : "not found");
+    }
+
+    /*
+     * Statistics of finished searches of given type
+     */
+    SearchManager::LookupStats SearchManager::getStats(Search::SearchType type) const
+    {
+        Lock l(cs);
+        StatsMap::const_iterator i = stats.find(type);
+        return i != stats.end() ? i->second : LookupStats();
+    }
+
+    /*
+     * Writes statistics of all search types to the system log
+     */
+    void SearchManager::logStats() const
+    {
+        const Search::SearchType types[] = { Search::TYPE_FILE, Search::TYPE_NODE, Search::TYPE_STOREFILE };
+        const char* names[] = { "file", "node", "store" };
+
+        for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+        {
+            LookupStats st = getStats(types[i]);
+            if(st.lookups == 0)
+                continue;
+
+            char buf[256];
+            snprintf(buf, sizeof(buf), "DHT %s lookups: %llu, succeeded %.1f%%, %.2f hops, %.2f messages, %.2f responses per lookup, %llu ms to first response",
+                names[i], (unsigned long long)st.lookups, 100.0 * st.succeeded / st.lookups,
+                (double)st.hops / st.lookups, (double)st.messages / st.lookups, (double)st.responses / st.lookups,
+                (unsigned long long)(st.answered > 0 ? st.timeToResult / st.answered : 0));
+            LogManager::getInstance()->message(buf);
+        }
+    }
+
     /*
      * Processes incoming search results
      */
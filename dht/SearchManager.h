@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "IndexManager.h"
 #include "KBucket.h"
 
 #include "dcpp/CID.h"
@@ -34,7 +35,7 @@ namespace dht
         public FastAlloc<Search>
     {
 
-        Search() : partial(false), stopping(false)
+        Search() : stopping(false), startTime(GET_TICK()), resultTime(0), hops(0), messages(0), found(false)
         {
         }
 
@@ -49,11 +50,16 @@ namespace dht
         string token;               // search identificator
         string term;                // search term (TTH/CID)
         uint64_t lifeTime;          // time when this search has been started
-        int64_t filesize;           // file size
         SearchType type;            // search type
-        bool partial;               // is this partial file search?
+        IndexManager::FileList files; // files to publish, the first one is the search term
         bool stopping;              // search is being stopped
 
+        uint64_t startTime;         // time when this search has been created
+        uint64_t resultTime;        // time of the first response, 0 if none yet
+        unsigned int hops;          // rounds of requests sent
+        unsigned int messages;      // number of requests sent
+        bool found;                 // source or the node itself has been found
+
         /** Processes this search request */
         void process();
     };
@@ -62,6 +68,22 @@ namespace dht
         public Singleton<SearchManager>
     {
     public:
+        /** Totals of finished searches of one type */
+        struct LookupStats
+        {
+            LookupStats() : lookups(0), succeeded(0), hops(0), messages(0), responses(0), answered(0), timeToResult(0)
+            {
+            }
+
+            uint64_t lookups;       // finished searches
+            uint64_t succeeded;     // searches which found what they were looking for
+            uint64_t hops;          // request rounds of all searches
+            uint64_t messages;      // requests sent by all searches
+            uint64_t responses;     // nodes which responded, for publishing it's the coverage
+            uint64_t answered;      // searches with at least one response
+            uint64_t timeToResult;  // sum of times to the first response of answered searches
+        };
+
         SearchManager(void);
         ~SearchManager(void);
 
@@ -71,8 +93,8 @@ namespace dht
         /** Performs value lookup in the network */
         void findFile(const string& tth, const string& token);
 
-        /** Performs node lookup to store key/value pair in the network */
-        void findStore(const string& tth, int64_t size, bool partial);
+        /** Performs node lookup to store key/value pairs in the network, files should be close to the first one */
+        void findStore(const IndexManager::FileList& files);
 
         /** Process incoming search request */
         void processSearchRequest(const Node::Ptr& node, const AdcCommand& cmd);
@@ -86,14 +108,26 @@ namespace dht
         /** Processes incoming search results */
         bool processSearchResults(const UserPtr& user, size_t slots);
 
+        /** Statistics of finished searches of given type */
+        LookupStats getStats(Search::SearchType type) const;
+
+        /** Writes statistics of all search types to the system log */
+        void logStats() const;
+
     private:
 
         /** Running search operations */
         typedef std::unordered_map<string*, Search*, CaseStringHash, CaseStringEq> SearchMap;
         SearchMap searches;
 
-        /** Locks access to "searches" */
-        CriticalSection cs;
+        /** Locks access to "searches" and "stats" */
+        mutable CriticalSection cs;
+
+        typedef std::unordered_map<int, LookupStats> StatsMap;
+        StatsMap stats;
+
+        /** Adds finished search to statistics */
+        void addStats(const Search& s);
 
         typedef std::unordered_multimap< CID, std::pair<uint64_t, SearchResultPtr> > ResultsMap;
         ResultsMap searchResults;
@@ -102,7 +136,7 @@ namespace dht
         void search(Search& s);
 
         /** Sends publishing request */
-        void publishFile(const Node::Map& nodes, const string& tth, int64_t size, bool partial);
+        void publishFile(const Node::Map& nodes, const IndexManager::FileList& files);
 
         /** Checks whether we are alreading searching for a term */
         bool isAlreadySearchingFor(const string& term);
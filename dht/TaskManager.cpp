@@ -93,6 +93,10 @@ namespace dht
         DHT::getInstance()->checkExpiration(aTick);
         IndexManager::getInstance()->checkExpiration(aTick);
 
+        // sources published by us expire after REPUBLISH_TIME, even when the share hasn't been refreshed
+        if(IndexManager::getInstance()->isTimeForPublishing() && !ShareManager::getInstance()->isRefreshing())
+            ShareManager::getInstance()->publish();
+
         DHT::getInstance()->saveData();
     }
 
@@ -20,6 +20,7 @@
 #include "UDPSocket.h"
 #include "Constants.h"
 #include "DHT.h"
+#include "SearchManager.h"
 #include "Utils.h"
 #include "dcpp/AdcCommand.h"
 #include "dcpp/ClientManager.h"
@@ -38,18 +39,27 @@ namespace dht
     #define BUFSIZE                 16384
     #define MAGICVALUE_UDP          0x5b
 
-    UDPSocket::UDPSocket(void) : stop(false), port(0), delay(100)
+    UDPSocket::UDPSocket(void) : stop(false), port(0), queueSize(0), sendTokens(0), delay(100),
+        recvBuf(new uint8_t[BUFSIZE * BATCH_SIZE]), inflateBuf(new uint8_t[BUFSIZE])
 #ifdef _DEBUG
         , sentBytes(0), receivedBytes(0), sentPackets(0), receivedPackets(0)
 #endif
     {
+        for(int i = 0; i < BATCH_SIZE; ++i)
+        {
+            recvPackets[i].buf = &recvBuf[i * BUFSIZE];
+            recvPackets[i].size = BUFSIZE;
+        }
+
+        memset(&stats, 0, sizeof(stats));
     }
 
     UDPSocket::~UDPSocket(void)
     {
         disconnect();
 
-        for_each(sendQueue.begin(), sendQueue.end(), DeleteFunction());
+        for(int i = 0; i < PRIO_LAST; ++i)
+            for_each(sendQueue[i].begin(), sendQueue[i].end(), DeleteFunction());
 
 #ifdef _DEBUG
         dcdebug("DHT stats, received: %d bytes, sent: %d bytes\n", receivedBytes, sentBytes);
@@ -103,99 +113,219 @@ namespace dht
     {
         if(socket->wait(delay, Socket::WAIT_READ) == Socket::WAIT_READ)
         {
-            sockaddr_in remoteAddr = { 0 };
-            boost::scoped_array<uint8_t> buf(new uint8_t[BUFSIZE]);
-            int len = socket->read(&buf[0], BUFSIZE, remoteAddr);
-            dcdrun(receivedBytes += len);
-            dcdrun(receivedPackets++);
+            int n = socket->readBatch(recvPackets, BATCH_SIZE);
 
-            if(len > 1)
+            // packet loss can be simulated for local test networks only
+            int loss = BOOLSETTING(DHT_LOOPBACK) ? SETTING(DHT_SIMULATED_LOSS) : 0;
+            for(int i = 0; i < n; ++i)
             {
-                bool isUdpKeyValid = false;
-                if(buf[0] != ADC_PACKED_PACKET_HEADER && buf[0] != ADC_PACKET_HEADER)
-                {
-                    // it seems to be encrypted packet
-                    if(!decryptPacket(&buf[0], len, inet_ntoa(remoteAddr.sin_addr), isUdpKeyValid))
-                        return;
-                }
-                //else
-                //  return; // non-encrypted packets are forbidden
+                dcdrun(receivedBytes += recvPackets[i].len);
+                dcdrun(receivedPackets++);
 
-                unsigned long destLen = BUFSIZE; // what size should be reserved?
-                boost::scoped_array<uint8_t> destBuf(new uint8_t[destLen]);
-                if(buf[0] == ADC_PACKED_PACKET_HEADER) // is this compressed packet?
-                {
-                    if(!decompressPacket(destBuf.get(), destLen, buf.get(), len))
-                        return;
-                }
-                else
-                {
-                    memcpy(destBuf.get(), buf.get(), len);
-                    destLen = len;
-                }
+                if(loss > 0 && static_cast<int>(Util::rand(100)) < loss)
+                    continue;
 
-                // process decompressed packet
-                string s((char*)destBuf.get(), destLen);
-                if(s[0] == ADC_PACKET_HEADER && s[s.length() - 1] == ADC_PACKET_FOOTER) // is it valid ADC command?
-                {
-                    string ip = inet_ntoa(remoteAddr.sin_addr);
-                    uint16_t port = ntohs(remoteAddr.sin_port);
-                    COMMAND_DEBUG(s.substr(0, s.length() - 1), DebugManager::DHT_IN,  ip + ":" + Util::toString(port));
-                    DHT::getInstance()->dispatch(s.substr(0, s.length() - 1), ip, port, isUdpKeyValid);
-                }
+                if(recvPackets[i].len > 1)
+                    processPacket(recvPackets[i]);
+            }
 
+            if(n > 0)
                 Thread::sleep(25);
-            }
+        }
+    }
+
+    void UDPSocket::processPacket(Socket::Datagram& packet)
+    {
+        uint8_t* buf = packet.buf;
+        int len = packet.len;
+        const sockaddr_in& remoteAddr = packet.addr;
+
+        bool isUdpKeyValid = false;
+        if(buf[0] != ADC_PACKED_PACKET_HEADER && buf[0] != ADC_PACKET_HEADER)
+        {
+            // it seems to be encrypted packet
+            if(!decryptPacket(buf, len, inet_ntoa(remoteAddr.sin_addr), isUdpKeyValid))
+                return;
+        }
+        //else
+        //  return; // non-encrypted packets are forbidden
+
+        unsigned long destLen = BUFSIZE; // what size should be reserved?
+        uint8_t* destBuf = buf;
+        if(buf[0] == ADC_PACKED_PACKET_HEADER) // is this compressed packet?
+        {
+            if(!decompressPacket(inflateBuf.get(), destLen, buf, len))
+                return;
+            destBuf = inflateBuf.get();
+        }
+        else
+        {
+            destLen = len;
+        }
+
+        // process decompressed packet
+        string s((char*)destBuf, destLen);
+        if(s[0] == ADC_PACKET_HEADER && s[s.length() - 1] == ADC_PACKET_FOOTER) // is it valid ADC command?
+        {
+            string ip = inet_ntoa(remoteAddr.sin_addr);
+            uint16_t port = ntohs(remoteAddr.sin_port);
+            COMMAND_DEBUG(s.substr(0, s.length() - 1), DebugManager::DHT_IN,  ip + ":" + Util::toString(port));
+            DHT::getInstance()->dispatch(s.substr(0, s.length() - 1), ip, port, isUdpKeyValid);
         }
     }
 
     void UDPSocket::checkOutgoing(uint64_t& timer) throw(SocketException)
     {
-        std::unique_ptr<Packet> packet;
+        std::unique_ptr<Packet> packets[BATCH_SIZE];
+        int count = 0;
         uint64_t now = GET_TICK();
 
         {
             Lock l(cs);
 
-            size_t queueSize = sendQueue.size();
-            if(queueSize && (now - timer > delay))
+            int rate = SETTING(DHT_SEND_RATE);
+            if(rate > 0)
             {
-                // take the first packet in queue
-                packet.reset(sendQueue.front());
-                sendQueue.pop_front();
+                // let a batch through at most, the rest has to wait for its turn
+                sendTokens = min(sendTokens + (double)(now - timer) * rate / 1000, (double)BATCH_SIZE);
+            }
+            else
+            {
+                sendTokens = BATCH_SIZE;
+            }
+            timer = now;
 
-                //dcdebug("Sending DHT %s packet: %d bytes, %d ms, queue size: %d\n", packet->cmdChar, packet->length, (uint32_t)(now - timer), queueSize);
+            count = static_cast<int>(min((size_t)sendTokens, queueSize));
+            for(int i = 0; i < count; ++i)
+                packets[i].reset(popPacket());
 
-                if(queueSize > 9)
-                    delay = 1000 / queueSize;
-                timer = now;
-            }
+            sendTokens -= count;
+
+            // wake up in time for the next packet, but don't miss new ones for too long
+            delay = 100;
+            if(queueSize > 0 && rate > 0)
+                delay = min(max(static_cast<uint64_t>((1 - sendTokens) * 1000 / rate) + 1, (uint64_t)1), (uint64_t)100);
         }
 
-        if(packet.get())
+        if(count == 0)
+            return;
+
+        Socket::Datagram datagrams[BATCH_SIZE];
+        int ready = 0;
+        for(int i = 0; i < count; ++i)
         {
-            try
-            {
-                unsigned long length = compressBound(packet->data.length()) + 2;
-                std::unique_ptr<uint8_t[]> data(new uint8_t[length]);
+            Packet* packet = packets[i].get();
+
+            unsigned long length = compressBound(packet->data.length()) + 2;
+            std::vector<uint8_t>& data = sendBufs[ready];
+            if(data.size() < length)
+                data.resize(length);
+
+            // compress packet
+            compressPacket(packet->data, &data[0], length);
+
+            // encrypt packet
+            encryptPacket(packet->targetCID, packet->udpKey, &data[0], length);
+
+            Socket::Datagram& d = datagrams[ready];
+            memset(&d.addr, 0, sizeof(d.addr));
+            d.addr.sin_family = AF_INET;
+            d.addr.sin_port = htons(packet->port);
+            d.addr.sin_addr.s_addr = inet_addr(packet->ip.c_str());
+            if(d.addr.sin_addr.s_addr == INADDR_NONE)
+                d.addr.sin_addr.s_addr = inet_addr(Socket::resolve(packet->ip).c_str());
+            if(d.addr.sin_addr.s_addr == INADDR_NONE || packet->port == 0)
+                continue;
+
+            d.buf = &data[0];
+            d.size = d.len = static_cast<int>(length);
+            ++ready;
+
+            dcdrun(sentBytes += packet->data.length());
+            dcdrun(sentPackets++);
+        }
 
-                // compress packet
-                compressPacket(packet->data, data.get(), length);
+        int sent = 0;
+        try
+        {
+            sent = socket->writeToBatch(datagrams, ready);
+            if(sent < ready)
+                dcdebug("DHT::run Dropped %d packets\n", ready - sent);
+        }
+        catch(SocketException& e)
+        {
+            dcdebug("DHT::run Write error: %s\n", e.getError().c_str());
+        }
 
-                // encrypt packet
-                encryptPacket(packet->targetCID, packet->udpKey, data.get(), length);
+        Lock l(cs);
+        stats.sent += sent;
+        stats.failed += count - sent;
+    }
 
-                dcdrun(sentBytes += packet->data.length());
-                dcdrun(sentPackets++);
-                socket->writeTo(packet->ip, packet->port, data.get(), length);
+    /*
+     * Takes the next packet to send, higher priorities go first
+     */
+    Packet* UDPSocket::popPacket()
+    {
+        for(int i = 0; i < PRIO_LAST; ++i)
+        {
+            if(!sendQueue[i].empty())
+            {
+                Packet* p = sendQueue[i].front();
+                sendQueue[i].pop_front();
+                queuedKeys.erase(getKey(*p));
+                --queueSize;
+                return p;
             }
-            catch(SocketException& e)
+        }
+
+        dcassert(0);
+        return NULL;
+    }
+
+    /*
+     * Publishing is the bulk of our traffic, it mustn't delay searches and responses
+     */
+    UDPSocket::Priority UDPSocket::getPriority(const AdcCommand& cmd)
+    {
+        switch(cmd.getCommand())
+        {
+            case AdcCommand::CMD_RES:
+            case AdcCommand::CMD_SND:
+            case AdcCommand::CMD_STA:
+                return PRIO_HIGH;
+            case AdcCommand::CMD_PUB:
+                return PRIO_LOW;
+            case AdcCommand::CMD_SCH:
             {
-                dcdebug("DHT::run Write error: %s\n", e.getError().c_str());
+                // looking up nodes to publish to
+                string type;
+                if(cmd.getParam("TY", 1, type) && Util::toInt(type) == Search::TYPE_STOREFILE)
+                    return PRIO_LOW;
+                return PRIO_NORMAL;
             }
+            default:
+                return PRIO_NORMAL;
         }
     }
 
+    string UDPSocket::getKey(const Packet& packet)
+    {
+        return packet.ip + ':' + Util::toString(packet.port) + ' ' + packet.data;
+    }
+
+    /*
+     * Sending queue statistics
+     */
+    UDPSocket::Stats UDPSocket::getStats() const
+    {
+        Lock l(cs);
+        Stats ret = stats;
+        for(int i = 0; i < PRIO_LAST; ++i)
+            ret.queued[i] = sendQueue[i].size();
+        return ret;
+    }
+
     /*
      * Thread for receiving UDP packets
      */
@@ -286,10 +416,41 @@ namespace dht
         string command = cmd.toString(ClientManager::getInstance()->getMe()->getCID());
         COMMAND_DEBUG(command, DebugManager::DHT_OUT, ip + ":" + Util::toString(port));
 
-        Packet* p = new Packet(ip, port, command, targetCID, udpKey);
+        Priority prio = getPriority(cmd);
+        std::unique_ptr<Packet> p(new Packet(ip, port, command, targetCID, udpKey));
 
         Lock l(cs);
-        sendQueue.push_back(p);
+        if(!queuedKeys.insert(getKey(*p)).second)
+        {
+            // the very same packet is still waiting to be sent
+            stats.coalesced++;
+            return;
+        }
+
+        if(queueSize >= MAX_QUEUE_SIZE)
+        {
+            // make room by dropping the oldest packet of the lowest priority, unless it's ours
+            int i = PRIO_LAST - 1;
+            while(sendQueue[i].empty())
+                --i;
+
+            stats.dropped++;
+            if(i < prio)
+            {
+                queuedKeys.erase(getKey(*p));
+                return;
+            }
+
+            Packet* old = sendQueue[i].front();
+            sendQueue[i].pop_front();
+            queuedKeys.erase(getKey(*old));
+            delete old;
+            --queueSize;
+        }
+
+        sendQueue[prio].push_back(p.release());
+        ++queueSize;
+        stats.maxQueued = max(stats.maxQueued, queueSize);
     }
 
     void UDPSocket::compressPacket(const string& data, uint8_t* destBuf, unsigned long& destSize)
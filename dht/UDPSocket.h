@@ -73,6 +73,22 @@ namespace dht
         /** Sends command to ip and port */
         void send(AdcCommand& cmd, const string& ip, uint16_t port, const CID& targetCID, const CID& udpKey);
 
+        /** Outgoing packets are sent in this order */
+        enum Priority { PRIO_HIGH, PRIO_NORMAL, PRIO_LOW, PRIO_LAST };
+
+        struct Stats
+        {
+            size_t queued[PRIO_LAST];   // packets waiting in the queue of each priority
+            size_t maxQueued;           // highest total queue depth seen
+            uint64_t sent;              // packets handed to the socket
+            uint64_t coalesced;         // packets dropped as duplicates of a queued one
+            uint64_t dropped;           // packets dropped because the queue was full
+            uint64_t failed;            // packets the socket didn't take
+        };
+
+        /** Sending queue statistics */
+        Stats getStats() const;
+
     private:
 
         std::unique_ptr<Socket> socket;
@@ -83,14 +99,39 @@ namespace dht
         /** Port for communicating in this network */
         uint16_t port;
 
-        /** Queue for sending packets through UDP socket */
-        std::deque<Packet*> sendQueue;
+        /** Most packets queued for sending, the lowest priority packets are dropped above it */
+        enum { MAX_QUEUE_SIZE = 4096 };
+
+        /** Queues for sending packets through UDP socket, one per priority */
+        std::deque<Packet*> sendQueue[PRIO_LAST];
+        size_t queueSize;
+
+        /** Destination and content of all queued packets, to drop duplicates */
+        std::unordered_set<string> queuedKeys;
+
+        /** Packets allowed to be sent now, refilled by DHTSendRate per second */
+        double sendTokens;
 
-        /** Antiflooding protection */
+        /** How long to wait for incoming packets before the queue needs to be checked again */
         uint64_t delay;
 
+        Stats stats;
+
+        /** Most packets received or sent in one go */
+        enum { BATCH_SIZE = 32 };
+
+        /** Receive ring, allocated once and reused for every batch */
+        boost::scoped_array<uint8_t> recvBuf;
+        Socket::Datagram recvPackets[BATCH_SIZE];
+
+        /** Decompressed packet */
+        boost::scoped_array<uint8_t> inflateBuf;
+
+        /** Compressed and encrypted outgoing packets */
+        std::vector<uint8_t> sendBufs[BATCH_SIZE];
+
         /** Locks access to sending queue */
-        CriticalSection cs;
+        mutable CriticalSection cs;
 
 #ifdef _DEBUG
         // debug constants to optimize bandwidth
@@ -107,6 +148,12 @@ namespace dht
         void checkIncoming() throw(SocketException);
         void checkOutgoing(uint64_t& timer) throw(SocketException);
 
+        void processPacket(Socket::Datagram& packet);
+
+        static Priority getPriority(const AdcCommand& cmd);
+        static string getKey(const Packet& packet);
+        Packet* popPacket();
+
         void compressPacket(const string& data, uint8_t* destBuf, unsigned long& destSize);
         void encryptPacket(const CID& targetCID, const CID& udpKey, uint8_t* destBuf, unsigned long& destSize);
 
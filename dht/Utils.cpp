@@ -54,8 +54,8 @@ namespace dht
         if(ip.empty() || port < 1024)
             return false;
 
-        // don't allow private IPs
-        if(Util::isPrivateIp(ip))
+        // don't allow private IPs, unless all nodes run on this machine for testing
+        if(Util::isPrivateIp(ip) && !BOOLSETTING(DHT_LOOPBACK))
             return false;
 
         return true;
@@ -106,6 +106,10 @@ namespace dht
                 return false;
         }
 
+        // all local test nodes share one IP
+        if(BOOLSETTING(DHT_LOOPBACK))
+            return true;
+
         Lock l(cs);
         std::unordered_multiset<uint32_t>& packetsPerIp = receivedPackets[ip];
                 packetsPerIp.insert(cmd.getCommand());
@@ -27,8 +27,10 @@
 #include "dcpp/HashManager.h"
 #include "dcpp/QueueManager.h"
 #include "dcpp/SearchManager.h"
+#include "dcpp/SSLSocket.h"
 #include "dcpp/StringTokenizer.h"
 #include "dcpp/Text.h"
+#include "dcpp/ThrottleManager.h"
 #include "dcpp/UploadManager.h"
 #include "dcpp/version.h"
 #include "extra/ipfilter.h"
@@ -221,6 +223,11 @@ int ServerThread::run() {
     jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::IpFilterPurgeRules, std::string("ipfilter.purgerules")));
     jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::IpFilterOnOff, std::string("ipfilter.onoff")));
     jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::IpFilterUpDownRule, std::string("ipfilter.updownrule")));
+    jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::ThrottleStats, std::string("throttle.stats")));
+    jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::ConnectionStats, std::string("connection.stats")));
+    jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::SearchStats, std::string("search.stats")));
+    jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::UploadStats, std::string("upload.stats")));
+    jsonserver->AddMethod(new Json::Rpc::RpcMethod<JsonRpcMethods>(a, &JsonRpcMethods::DhtStats, std::string("dht.stats")));
 
     if (!jsonserver->startPolling())
         std::cout << "JSONRPC: Start mongoose failed" << std::endl;
@@ -374,7 +381,7 @@ void ServerThread::on(Redirect, Client* cur, const string& line) noexcept {
         cout << "Redirected to " << line << endl;
 }
 
-void ServerThread::on(Failed, Client* cur, const string& line) noexcept {
+void ServerThread::on(ClientListener::Failed, Client* cur, const string& line) noexcept {
     if (isVerbose)
         cout <<  "Connection failed [ " << cur->getHubUrl() << " ]: " << line << endl;
 }
@@ -1213,25 +1220,9 @@ bool ServerThread::getClientFileList(const string& filelist, string& ret) {
     return true;
 }
 
-class ServerThreadListLoader : public dcpp::Thread
-{
-    public:
-        ServerThreadListLoader(const string& filelist_, const string& nick_, DirectoryListing* dl_) : filelist(filelist_), nick(nick_), dl(dl_) { }
-        int run() {
-            dl->getRoot()->setName(nick);
-            try {
-                dl->getRoot()->setName(nick);
-                dl->loadFile(Util::getListPath() + filelist);
-                ADLSearchManager::getInstance()->matchListing(*dl);
-            } catch (const Exception&) {}
-            delete this;// Cleanup the thread object
-            return 0;
-        }
-    private:
-        string filelist;
-        string nick;
-        DirectoryListing* dl;
-};
+void ServerThread::on(DirectoryListingListener::Loaded, DirectoryListing* dl) noexcept {
+    ADLSearchManager::getInstance()->matchListing(*dl);
+}
 
 //void ServerThread::buildList(const string& filelist, const string& nick, DirectoryListing* listing, bool full) {
     //try
@@ -1266,10 +1257,11 @@ bool ServerThread::openFileList(const string& filelist) {
         }
         HintedUser user(u, Util::emptyString);
         DirectoryListing* dl = new DirectoryListing(user);
+        dl->getRoot()->setName(nick);
+        dl->addListener(this);
         //buildList(filelist, nick, dl, false);
-        ServerThreadListLoader* stld = new ServerThreadListLoader(filelist, nick, dl);
         try {
-            stld->start();
+            dl->loadFileAsync(Util::getListPath() + filelist);
         } catch (const ThreadException&) {
             ///@todo add error message
             delete dl;
@@ -1326,10 +1318,10 @@ void ServerThread::lsDirInList(DirectoryListing::Directory *dir, unordered_map<s
         map["Size"] = Util::toString(file->getSize());
         map["Size preformatted"] = Util::formatBytes(file->getSize());
         map["TTH"] = file->getTTH().toBase32();
-        map["Bitrate"] = file->mediaInfo.bitrate ? (Util::toString(file->mediaInfo.bitrate)) : Util::emptyString;
-        map["Resolution"] = !file->mediaInfo.video_info.empty() ? file->mediaInfo.resolution : Util::emptyString;
-        map["Video"] = file->mediaInfo.video_info;
-        map["Audio"] = file->mediaInfo.audio_info;
+        map["Bitrate"] = file->getMediaInfo().bitrate ? (Util::toString(file->getMediaInfo().bitrate)) : Util::emptyString;
+        map["Resolution"] = !file->getMediaInfo().video_info.empty() ? file->getMediaInfo().resolution : Util::emptyString;
+        map["Video"] = file->getMediaInfo().video_info;
+        map["Audio"] = file->getMediaInfo().audio_info;
         map["Downloaded"] = Util::toString(file->getHit());
         map["Shared"] = Util::formatTime("%Y-%m-%d %H:%M", file->getTS());
         ret[file->getName()] = map;
@@ -1518,3 +1510,72 @@ bool ServerThread::configReload()
     } else 
         return false;
 }
+
+void ServerThread::getThrottleStats(unordered_map<string,StringMap>& stats) {
+    for (const auto& bucket : ThrottleManager::getInstance()->getStats()) {
+        StringMap sm;
+        sm["limit"] = Util::toString(bucket.limit);
+        sm["bytes"] = Util::toString(bucket.bytes);
+        sm["waits"] = Util::toString(bucket.waits);
+        sm["waited"] = Util::toString(bucket.waited);
+        stats[bucket.name] = sm;
+    }
+}
+
+void ServerThread::getConnectionStats(unordered_map<string,StringMap>& stats) {
+    SSLSocket::HandshakeStats tls = SSLSocket::getHandshakeStats();
+    StringMap& sm = stats["tls"];
+    sm["full"] = Util::toString(tls.full);
+    sm["resumed"] = Util::toString(tls.resumed);
+    sm["fullmicros"] = Util::toString(tls.fullMicros);
+    sm["resumedmicros"] = Util::toString(tls.resumedMicros);
+    sm["kernel"] = Util::toString(tls.kernel);
+
+    ConnectionManager::AttemptStats attempts = ConnectionManager::getInstance()->getAttemptStats();
+    StringMap& am = stats["attempts"];
+    am["waiting"] = Util::toString(attempts.waiting);
+    am["connecting"] = Util::toString(attempts.connecting);
+    am["attempts"] = Util::toString(attempts.attempts);
+    am["failed"] = Util::toString(attempts.failed);
+
+    ConnectionManager::AcceptStats accepts = ConnectionManager::getInstance()->getAcceptStats();
+    StringMap& cm = stats["accept"];
+    cm["accepted"] = Util::toString(accepts.accepted);
+    cm["filtered"] = Util::toString(accepts.filtered);
+    cm["errors"] = Util::toString(accepts.errors);
+    cm["rate"] = Util::toString(accepts.rate);
+}
+
+void ServerThread::getSearchStats(unordered_map<string,StringMap>& stats) {
+    for (const auto& client : clientsMap) {
+        Client* cl = client.second.curclient;
+        if (!cl)
+            continue;
+        SearchQueue::Stats search = cl->getSearchStats();
+        StringMap& sm = stats[client.first];
+        sm["sent"] = Util::toString(search.sent);
+        sm["merged"] = Util::toString(search.merged);
+        sm["suppressed"] = Util::toString(search.suppressed);
+        sm["floods"] = Util::toString(search.floods);
+        sm["interval"] = Util::toString(cl->getEffectiveSearchInterval());
+    }
+}
+
+void ServerThread::getUploadStats(unordered_map<string,StringMap>& stats) {
+    UploadManager::CompressionStats compression = UploadManager::getInstance()->getCompressionStats();
+    StringMap& sm = stats["compression"];
+    sm["skipped"] = Util::toString(compression.skipped);
+    sm["compressed"] = Util::toString(compression.compressed);
+    sm["abandoned"] = Util::toString(compression.abandoned);
+    sm["bytesin"] = Util::toString(compression.bytesIn);
+    sm["bytesout"] = Util::toString(compression.bytesOut);
+    sm["cpumicros"] = Util::toString(compression.cpuTime);
+
+    const UploadFileCache& cache = UploadManager::getInstance()->getFileCache();
+    StringMap& cm = stats["filecache"];
+    cm["hits"] = Util::toString(cache.getHits());
+    cm["misses"] = Util::toString(cache.getMisses());
+    cm["readaheadbytes"] = Util::toString(cache.getReadAheadBytes());
+    cm["diskbytes"] = Util::toString(cache.getDiskBytes());
+    cm["directbytes"] = Util::toString(cache.getDirectBytes());
+}
@@ -31,6 +31,7 @@ class ServerThread :
         private QueueManagerListener,
         private LogManagerListener,
         private ClientListener,
+        private DirectoryListingListener,
         public SearchManagerListener,
         public Thread,
         public Singleton<ServerThread>
@@ -88,6 +89,10 @@ public:
     void ipfilterAddRules(const string &rules);
     void ipfilterUpDownRule(bool up, const string &rule);
     bool configReload();
+    void getThrottleStats(unordered_map<string,StringMap>& stats);
+    void getConnectionStats(unordered_map<string,StringMap>& stats);
+    void getSearchStats(unordered_map<string,StringMap>& stats);
+    void getUploadStats(unordered_map<string,StringMap>& stats);
 
 private:
     friend class Singleton<ServerThread>;
@@ -131,7 +136,7 @@ private:
     virtual void on(UsersUpdated, Client* cur, const OnlineUserList&) noexcept;
     virtual void on(UserRemoved, Client* cur, const OnlineUser&) noexcept;
     virtual void on(Redirect, Client* cur, const string&) noexcept;
-    virtual void on(Failed, Client* cur, const string&) noexcept;
+    virtual void on(ClientListener::Failed, Client* cur, const string&) noexcept;
     virtual void on(GetPassword, Client* cur) noexcept;
     virtual void on(HubUpdated, Client* cur) noexcept;
     virtual void on(StatusMessage, Client* cur, const string&, int = ClientListener::FLAG_NORMAL) noexcept;
@@ -142,6 +147,9 @@ private:
     //SearchManagerListener
     virtual void on(SearchManagerListener::SR, const SearchResultPtr &result) noexcept;
 
+    // DirectoryListingListener
+    virtual void on(DirectoryListingListener::Loaded, DirectoryListing* dl) noexcept;
+
     //QueueManagerListener
     //virtual void on(Added, QueueItem*) noexcept;
     //virtual void on(Finished, QueueItem*, const string&, int64_t) noexcept;
@@ -18,6 +18,12 @@
 #include "dcpp/format.h"
 #include "json/jsonrpc-cpp/jsonrpc_common.h"
 
+#ifdef WITH_DHT
+// dht/Constants.h defines macros named like the AdcHub features ServerThread.cpp uses
+#include "dht/DHT.h"
+#include "dht/IndexManager.h"
+#endif
+
 using namespace std;
 
 // ./cli-jsonrpc-curl.pl  '{"jsonrpc": "2.0", "id": "1", "method": "show.version"}'
@@ -998,3 +1004,98 @@ bool JsonRpcMethods::IpFilterUpDownRule(const Json::Value& root, Json::Value& re
     if (isDebug) std::cout << "IpFilterUpDownRule (response): " << response << std::endl;
     return true;
 }
+
+bool JsonRpcMethods::ThrottleStats(const Json::Value& root, Json::Value& response) {
+    if (isDebug) std::cout << "ThrottleStats (root): " << root << std::endl;
+    response["jsonrpc"] = "2.0";
+    response["id"] = root["id"];
+    Json::Value parameters;
+    unordered_map<string,StringMap> stats;
+    ServerThread::getInstance()->getThrottleStats(stats);
+    for (const auto& bucket : stats) {
+        for (const auto& parameter : bucket.second) {
+            parameters[bucket.first][parameter.first] = parameter.second;
+        }
+    }
+    response["result"] = parameters;
+    if (isDebug) std::cout << "ThrottleStats (response): " << response << std::endl;
+    return true;
+}
+
+bool JsonRpcMethods::ConnectionStats(const Json::Value& root, Json::Value& response) {
+    if (isDebug) std::cout << "ConnectionStats (root): " << root << std::endl;
+    response["jsonrpc"] = "2.0";
+    response["id"] = root["id"];
+    Json::Value parameters;
+    unordered_map<string,StringMap> stats;
+    ServerThread::getInstance()->getConnectionStats(stats);
+    for (const auto& section : stats) {
+        for (const auto& parameter : section.second) {
+            parameters[section.first][parameter.first] = parameter.second;
+        }
+    }
+    response["result"] = parameters;
+    if (isDebug) std::cout << "ConnectionStats (response): " << response << std::endl;
+    return true;
+}
+
+bool JsonRpcMethods::SearchStats(const Json::Value& root, Json::Value& response) {
+    if (isDebug) std::cout << "SearchStats (root): " << root << std::endl;
+    response["jsonrpc"] = "2.0";
+    response["id"] = root["id"];
+    Json::Value parameters;
+    unordered_map<string,StringMap> stats;
+    ServerThread::getInstance()->getSearchStats(stats);
+    for (const auto& hub : stats) {
+        for (const auto& parameter : hub.second) {
+            parameters[hub.first][parameter.first] = parameter.second;
+        }
+    }
+    response["result"] = parameters;
+    if (isDebug) std::cout << "SearchStats (response): " << response << std::endl;
+    return true;
+}
+
+bool JsonRpcMethods::UploadStats(const Json::Value& root, Json::Value& response) {
+    if (isDebug) std::cout << "UploadStats (root): " << root << std::endl;
+    response["jsonrpc"] = "2.0";
+    response["id"] = root["id"];
+    Json::Value parameters;
+    unordered_map<string,StringMap> stats;
+    ServerThread::getInstance()->getUploadStats(stats);
+    for (const auto& section : stats) {
+        for (const auto& parameter : section.second) {
+            parameters[section.first][parameter.first] = parameter.second;
+        }
+    }
+    response["result"] = parameters;
+    if (isDebug) std::cout << "UploadStats (response): " << response << std::endl;
+    return true;
+}
+
+bool JsonRpcMethods::DhtStats(const Json::Value& root, Json::Value& response) {
+    if (isDebug) std::cout << "DhtStats (root): " << root << std::endl;
+    response["jsonrpc"] = "2.0";
+    response["id"] = root["id"];
+    Json::Value parameters(Json::objectValue);
+#ifdef WITH_DHT
+    dht::UDPSocket::Stats send = dht::DHT::getInstance()->getSendStats();
+    parameters["send"]["queuedhigh"] = Util::toString(send.queued[dht::UDPSocket::PRIO_HIGH]);
+    parameters["send"]["queuednormal"] = Util::toString(send.queued[dht::UDPSocket::PRIO_NORMAL]);
+    parameters["send"]["queuedlow"] = Util::toString(send.queued[dht::UDPSocket::PRIO_LOW]);
+    parameters["send"]["maxqueued"] = Util::toString(send.maxQueued);
+    parameters["send"]["sent"] = Util::toString(send.sent);
+    parameters["send"]["coalesced"] = Util::toString(send.coalesced);
+    parameters["send"]["dropped"] = Util::toString(send.dropped);
+    parameters["send"]["failed"] = Util::toString(send.failed);
+
+    dht::IndexManager::PublishStats publish = dht::IndexManager::getInstance()->getPublishStats();
+    parameters["publish"]["total"] = Util::toString(publish.total);
+    parameters["publish"]["published"] = Util::toString(publish.published);
+    parameters["publish"]["failed"] = Util::toString(publish.failed);
+    parameters["publish"]["queued"] = Util::toString(publish.queued);
+#endif
+    response["result"] = parameters;
+    if (isDebug) std::cout << "DhtStats (response): " << response << std::endl;
+    return true;
+}
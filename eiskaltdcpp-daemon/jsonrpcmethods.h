@@ -66,6 +66,11 @@ class JsonRpcMethods
     bool IpFilterAddRules(const Json::Value &root, Json::Value &response);
     bool IpFilterPurgeRules(const Json::Value &root, Json::Value &response);
     bool IpFilterUpDownRule(const Json::Value &root, Json::Value &response);
+    bool ThrottleStats(const Json::Value &root, Json::Value &response);
+    bool ConnectionStats(const Json::Value &root, Json::Value &response);
+    bool SearchStats(const Json::Value &root, Json::Value &response);
+    bool UploadStats(const Json::Value &root, Json::Value &response);
+    bool DhtStats(const Json::Value &root, Json::Value &response);
 private:
     void FailedValidateRequest(Json::Value &error);
 };
@@ -357,6 +357,7 @@ void ShareBrowser::updateFiles_gui(DirectoryListing::Directory *dir)
             -1);
 
         size = (*it_file)->getSize();
+        const MediaInfo &mi = (*it_file)->getMediaInfo();
         gtk_list_store_set(fileStore, &iter,
             fileView.col("Icon"), "icon-file",
             fileView.col(_("Size")), Util::formatBytes(size).c_str(),
@@ -364,10 +365,10 @@ void ShareBrowser::updateFiles_gui(DirectoryListing::Directory *dir)
             fileView.col("Size Order"), size,
             fileView.col("DL File"), (gpointer)(*it_file),
             fileView.col(_("TTH")), (*it_file)->getTTH().toBase32().c_str(),
-            fileView.col(_("Bitrate")), ((*it_file)->mediaInfo.bitrate) ? (Util::toString((*it_file)->mediaInfo.bitrate)).c_str() : Util::emptyString.c_str(),
-            fileView.col(_("Resolution")), !(*it_file)->mediaInfo.video_info.empty() ? (*it_file)->mediaInfo.resolution.c_str() : Util::emptyString.c_str(),
-            fileView.col(_("Video")), (*it_file)->mediaInfo.video_info.c_str(),
-            fileView.col(_("Audio")), (*it_file)->mediaInfo.audio_info.c_str(),
+            fileView.col(_("Bitrate")), mi.bitrate ? (Util::toString(mi.bitrate)).c_str() : Util::emptyString.c_str(),
+            fileView.col(_("Resolution")), !mi.video_info.empty() ? mi.resolution.c_str() : Util::emptyString.c_str(),
+            fileView.col(_("Video")), mi.video_info.c_str(),
+            fileView.col(_("Audio")), mi.audio_info.c_str(),
             fileView.col(_("Downloaded")), (Util::toString((*it_file)->getHit())).c_str(),
             fileView.col(_("Shared")), (Util::formatTime("%Y-%m-%d %H:%M", (*it_file)->getTS())).c_str(),
             fileView.col("Shared Order"), (*it_file)->getTS(),
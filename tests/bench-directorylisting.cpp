@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/DirectoryListing.h"
+#include "dcpp/SettingsManager.h"
+#include "dcpp/Streams.h"
+#include "dcpp/Util.h"
+
+#include <cstdlib>
+#include <malloc.h>
+#include <random>
+
+#include "test.h"
+
+/*
+ * Loads generated file lists of 50 files per directory into a DirectoryListing
+ * and reports the heap it takes per file, once for plain lists and once for
+ * lists carrying media info. glibc only, the heap is read with mallinfo2.
+ *
+ * bench-directorylisting [files...] (default 100000 500000)
+ */
+
+using namespace dcpp;
+
+static string makeList(size_t files, bool mediaInfo) {
+    std::mt19937 rnd(42);
+    static const char base32[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+    string xml = "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\r\n"
+        "<FileListing Version=\"1\" CID=\"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\" Base=\"/\" Generator=\"bench\">\r\n";
+    for(size_t i = 0; i < files; ++i) {
+        if(i % 50 == 0) {
+            if(i > 0)
+                xml += "\t</Directory>\r\n";
+            xml += "\t<Directory Name=\"Some Artist - Album " + Util::toString(i / 50) + "\">\r\n";
+        }
+
+        string tth(39, 'A');
+        for(size_t j = 0; j < tth.size(); ++j)
+            tth[j] = base32[rnd() % 32];
+
+        xml += "\t\t<File Name=\"" + Util::toString(i % 50 + 1) + " - Track " + Util::toString(i) + ".flac\" Size=\"" +
+            Util::toString(1000000 + rnd() % 100000000) + "\" TTH=\"" + tth + "\"";
+        if(mediaInfo)
+            xml += " TS=\"1700000000\" HIT=\"3\" BR=\"1024\" WH=\"\" MV=\"\" MA=\"FLAC 2ch 44100Hz\"";
+        xml += "/>\r\n";
+    }
+    if(files > 0)
+        xml += "\t</Directory>\r\n";
+    xml += "</FileListing>\r\n";
+    return xml;
+}
+
+static size_t heapUsed() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static void run(size_t files, bool mediaInfo) {
+    string xml = makeList(files, mediaInfo);
+
+    size_t before = heapUsed();
+    DirectoryListing* list = new DirectoryListing(HintedUser(UserPtr(), Util::emptyString));
+    {
+        MemoryInputStream is(xml);
+        list->loadXML(is, false);
+    }
+    size_t used = heapUsed() - before;
+
+    if(list->getTotalFileCount() != files)
+        std::printf("loaded %u files instead of %u\n", (unsigned)list->getTotalFileCount(), (unsigned)files);
+    std::printf("%8u files%-12s %8.1f MB %7.1f bytes/file\n", (unsigned)files, mediaInfo ? ", media info" : "",
+        used / 1e6, (double)used / files);
+    delete list;
+}
+
+int main(int argc, char** argv) {
+    vector<size_t> sizes;
+    for(int i = 1; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if(sizes.empty()) {
+        sizes.push_back(100000);
+        sizes.push_back(500000);
+    }
+
+    SettingsManager::newInstance();
+
+    std::printf("sizeof(File) %u, sizeof(Directory) %u\n", (unsigned)sizeof(DirectoryListing::File),
+        (unsigned)sizeof(DirectoryListing::Directory));
+    for(auto i = sizes.begin(); i != sizes.end(); ++i) {
+        run(*i, false);
+        run(*i, true);
+    }
+
+    SettingsManager::deleteInstance();
+    return 0;
+}
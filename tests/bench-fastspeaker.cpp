@@ -0,0 +1,84 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/FastSpeaker.h"
+#include "dcpp/Speaker.h"
+
+#include <cstdlib>
+#include <thread>
+
+#include "test.h"
+
+/*
+ * Compares fire() of Speaker and FastSpeaker with a few listeners, fired from
+ * one thread and from several threads at once (each firing its own events,
+ * like BufferedSocket, and all of them the same speaker).
+ *
+ * bench-fastspeaker [fires per thread, default 10000000]
+ */
+
+using namespace dcpp;
+
+struct BenchListener {
+    virtual ~BenchListener() { }
+    virtual void on(int) noexcept = 0;
+};
+
+struct Sink : public BenchListener {
+    Sink() : sum(0) { }
+    virtual void on(int x) noexcept { sum += x; }
+    int64_t sum;
+    char pad[64];
+};
+
+template<typename S>
+static void fireLoop(S* s, long n) {
+    for(long i = 0; i < n; ++i)
+        s->fire(1);
+}
+
+template<typename S>
+static double run(const char* name, int threads, long n) {
+    S s;
+    Sink sinks[4];
+    for(int i = 0; i < 4; ++i)
+        s.addListener(&sinks[i]);
+
+    auto start = std::chrono::steady_clock::now();
+    vector<std::thread> t;
+    for(int i = 0; i < threads; ++i)
+        t.push_back(std::thread(fireLoop<S>, &s, n));
+    for(auto i = t.begin(); i != t.end(); ++i)
+        i->join();
+    double ns = secondsSince(start) * 1e9 / n;
+
+    std::printf("%-12s %2d thread(s): %7.1f ns per fire\n", name, threads, ns);
+    return ns;
+}
+
+int main(int argc, char** argv) {
+    long n = argc > 1 ? std::atol(argv[1]) : 10000000;
+    int cpus = std::max(2u, std::thread::hardware_concurrency());
+
+    std::printf("4 listeners, %ld fires per thread\n", n);
+    for(int threads = 1; threads <= cpus; threads *= 2) {
+        double slow = run<Speaker<BenchListener> >("Speaker", threads, n);
+        double fast = run<FastSpeaker<BenchListener> >("FastSpeaker", threads, n);
+        std::printf("%-12s %2d thread(s): %7.2fx\n", "speedup", threads, slow / fast);
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/MultiStringSearch.h"
+#include "dcpp/StringSearch.h"
+#include "dcpp/Util.h"
+
+#include <cstdlib>
+#include <random>
+
+#include "test.h"
+
+/*
+ * Matches generated file names against ADLSearch-like rules of 1-3 terms,
+ * once with a StringSearch per term (as ADLSearch did before) and once with
+ * all terms merged into one MultiStringSearch.
+ *
+ * bench-multistringsearch [names, default 1000000] [rules, default 200]
+ */
+
+using namespace dcpp;
+
+static const char* words[] = {
+    "ubuntu", "debian", "linux", "x264", "1080p", "720p", "bluray", "dvdrip", "flac", "mp3",
+    "live", "remastered", "deluxe", "edition", "season", "episode", "complete", "collection",
+    "discography", "soundtrack", "documentary", "proper", "repack", "internal", "multi", "subs",
+    "iso", "amd64", "i386", "desktop", "server", "setup", "portable", "final", "beta", "demo"
+};
+static const size_t WORDS = sizeof(words) / sizeof(words[0]);
+
+int main(int argc, char** argv) {
+    size_t names = argc > 1 ? std::atol(argv[1]) : 1000000;
+    size_t rules = argc > 2 ? std::atol(argv[2]) : 200;
+
+    std::mt19937 rnd(42);
+    StringList list;
+    list.reserve(names);
+    for(size_t i = 0; i < names; ++i) {
+        string name;
+        for(size_t n = 2 + rnd() % 5; n > 0; --n) {
+            name += words[rnd() % WORDS];
+            name += rnd() % 3 ? '.' : '_';
+            if(rnd() % 4 == 0)
+                name += Util::toString(rnd() % 100);
+        }
+        name += rnd() % 2 ? "mkv" : "Iso";
+        list.push_back(name);
+    }
+
+    // each rule is a few terms which all have to be found
+    vector<StringSearch::List> perRule(rules);
+    vector<vector<size_t> > ids(rules);
+    MultiStringSearch merged;
+    for(size_t i = 0; i < rules; ++i) {
+        for(size_t n = 1 + rnd() % 3; n > 0; --n) {
+            string term = words[rnd() % WORDS];
+            if(rnd() % 3 == 0)
+                term = term.substr(0, 3 + rnd() % (term.size() - 2));
+            perRule[i].push_back(StringSearch(term));
+            ids[i].push_back(merged.add(term));
+        }
+    }
+    merged.compile();
+
+    std::printf("%u names, %u rules, %u distinct terms\n", (unsigned)names, (unsigned)rules, (unsigned)merged.size());
+
+    auto start = std::chrono::steady_clock::now();
+    size_t slowMatches = 0;
+    for(auto name = list.begin(); name != list.end(); ++name) {
+        for(auto rule = perRule.begin(); rule != perRule.end(); ++rule) {
+            bool all = true;
+            for(auto term = rule->begin(); term != rule->end() && all; ++term)
+                all = term->match(*name);
+            slowMatches += all;
+        }
+    }
+    double slow = secondsSince(start);
+    std::printf("%-18s %8.3f s, %u matches\n", "StringSearch", slow, (unsigned)slowMatches);
+
+    start = std::chrono::steady_clock::now();
+    size_t fastMatches = 0;
+    MultiStringSearch::Matches m;
+    for(auto name = list.begin(); name != list.end(); ++name) {
+        merged.match(*name, m);
+        for(auto rule = ids.begin(); rule != ids.end(); ++rule) {
+            bool all = true;
+            for(auto id = rule->begin(); id != rule->end() && all; ++id)
+                all = m[*id];
+            fastMatches += all;
+        }
+    }
+    double fast = secondsSince(start);
+    std::printf("%-18s %8.3f s, %u matches\n", "MultiStringSearch", fast, (unsigned)fastMatches);
+    std::printf("%-18s %8.2fx\n", "speedup", slow / fast);
+
+    return slowMatches == fastMatches ? 0 : 1;
+}
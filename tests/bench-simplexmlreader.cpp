@@ -0,0 +1,112 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/SimpleXMLReader.h"
+#include "dcpp/Streams.h"
+#include "dcpp/Util.h"
+
+#include <cstdlib>
+#include <random>
+
+#include "test.h"
+
+/*
+ * Parses a generated file list with SimpleXMLReader and reports the speed
+ * of the best round. The list looks like the ones ShareManager writes, with
+ * 50 files per directory and directories nested a few levels deep.
+ *
+ * bench-simplexmlreader [files, default 300000] [rounds, default 5]
+ */
+
+using namespace dcpp;
+
+/** Does about as much work per tag as ListLoader without building a tree */
+class CountingCallBack : public SimpleXMLReader::CallBack {
+public:
+    CountingCallBack() : files(0), dirs(0), bytes(0) { }
+
+    virtual void startTag(const string& name, StringPairList& attribs, bool) {
+        if(name == "File") {
+            ++files;
+            const string& size = getAttrib(attribs, "Size", 1);
+            bytes += Util::toInt64(size);
+        } else if(name == "Directory") {
+            ++dirs;
+        }
+    }
+    virtual void endTag(const string&, const string&) { }
+
+    size_t files;
+    size_t dirs;
+    int64_t bytes;
+};
+
+static string makeList(size_t files) {
+    std::mt19937 rnd(42);
+    static const char base32[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+    string xml = "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\r\n"
+        "<FileListing Version=\"1\" CID=\"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\" Base=\"/\" Generator=\"bench\">\r\n";
+    size_t depth = 0;
+    for(size_t i = 0; i < files; ++i) {
+        if(i % 50 == 0) {
+            // leave some directories, then open a new one
+            for(size_t up = depth > 0 ? rnd() % (depth + 1) : 0; up > 0; --up, --depth)
+                xml += string(depth, '\t') + "</Directory>\r\n";
+            xml += string(depth + 1, '\t') + "<Directory Name=\"Folder &amp; " + Util::toString(i / 50) + "\">\r\n";
+            ++depth;
+        }
+
+        string tth(39, 'A');
+        for(size_t j = 0; j < tth.size(); ++j)
+            tth[j] = base32[rnd() % 32];
+
+        xml += string(depth + 1, '\t') + "<File Name=\"Some Artist - Track " + Util::toString(i) +
+            " (remastered).flac\" Size=\"" + Util::toString(1000000 + rnd() % 100000000) + "\" TTH=\"" + tth + "\"/>\r\n";
+    }
+    for(; depth > 0; --depth)
+        xml += string(depth, '\t') + "</Directory>\r\n";
+    xml += "</FileListing>\r\n";
+    return xml;
+}
+
+int main(int argc, char** argv) {
+    size_t files = argc > 1 ? std::atol(argv[1]) : 300000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    string xml = makeList(files);
+    double mb = xml.size() / 1e6;
+    std::printf("%u files, %.1f MB of XML\n", (unsigned)files, mb);
+
+    double best = 0;
+    for(int i = 0; i < rounds; ++i) {
+        CountingCallBack cb;
+        MemoryInputStream is(xml);
+        auto start = std::chrono::steady_clock::now();
+        SimpleXMLReader(&cb).parse(is);
+        double secs = secondsSince(start);
+
+        if(cb.files != files) {
+            std::printf("parsed %u files instead of %u\n", (unsigned)cb.files, (unsigned)files);
+            return 1;
+        }
+        best = std::max(best, mb / secs);
+        std::printf("round %d: %.3f s, %.1f MB/s\n", i + 1, secs, mb / secs);
+    }
+    std::printf("best: %.1f MB/s\n", best);
+    return 0;
+}
@@ -0,0 +1,393 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * In-process DHT network: hundreds of nodes, each with its own dht::KBucket
+ * routing table, exchange lookups the way dht::SearchManager does them, with
+ * SEARCH_ALPHA requests per round, one round every SEARCH_PROCESSTIME and the
+ * same number of nodes in each response. Packets can get lost and nodes leave
+ * and join (churn). Hops, messages, success rate and time to result are
+ * printed per lookup type, so changes to the routing table or to the search
+ * constants can be measured without the live network.
+ *
+ * Usage: test-dhtsim [nodes] [loss percent] [churn percent]
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/Util.h"
+#include "dht/KBucket.h"
+#include "dht/SearchManager.h"
+#include "dht/Utils.h"
+
+#include <cstdlib>
+#include <random>
+
+#include "test.h"
+
+using namespace dcpp;
+using namespace dht;
+
+/** Simulated nodes are OnlineUsers, this is their hub */
+class SimClient : public ClientBase {
+public:
+    const string& getHubUrl() const { return NetworkName; }
+    string getHubName() const { return NetworkName; }
+    bool isOp() const { return false; }
+    void connect(const OnlineUser&, const string&) { }
+    void privateMessage(const OnlineUser&, const string&, bool) { }
+};
+
+struct SimNode {
+    CID cid;
+    UserPtr user;
+    uint16_t port;
+    uint64_t latency;                       // one way, in ms
+    bool online;
+    KBucket* table;
+    std::unordered_map<CID, Node::Ptr> known; // this node's view of the other nodes
+    std::unordered_set<CID> index;          // files published to this node
+};
+
+struct LookupResult {
+    LookupResult() : hops(0), messages(0), responses(0), found(false), firstResponse(0), foundHops(0), foundTime(0) { }
+
+    unsigned int hops;
+    unsigned int messages;
+    unsigned int responses;                 // for publishing, the nodes which stored the file
+    bool found;
+    uint64_t firstResponse;                 // ms since start, 0 if no response
+    unsigned int foundHops;                 // rounds until found, or until published
+    uint64_t foundTime;
+    vector<SimNode*> responded;
+};
+
+/** Totals of lookups of one type, like SearchManager::LookupStats */
+struct Totals {
+    Totals() : lookups(0), succeeded(0), hops(0), messages(0), responses(0), answered(0), firstResponse(0), foundHops(0), foundTime(0) { }
+
+    void add(const LookupResult& r) {
+        lookups++;
+        hops += r.hops;
+        messages += r.messages;
+        responses += r.responses;
+        if(r.found) {
+            succeeded++;
+            foundHops += r.foundHops;
+            foundTime += r.foundTime;
+        }
+        if(r.firstResponse != 0) {
+            answered++;
+            firstResponse += r.firstResponse;
+        }
+    }
+
+    double successRate() const { return lookups > 0 ? (double)succeeded / lookups : 0; }
+
+    void print(const char* name) const {
+        std::printf("%-6s %4llu lookups, %5.1f%% succeeded, %5.2f hops, %5.2f messages, %5.2f responses, %5llu ms to first response, %5.2f hops and %5llu ms to result\n",
+            name, (unsigned long long)lookups, 100.0 * successRate(),
+            (double)hops / lookups, (double)messages / lookups, (double)responses / lookups,
+            (unsigned long long)(answered > 0 ? firstResponse / answered : 0),
+            succeeded > 0 ? (double)foundHops / succeeded : 0, (unsigned long long)(succeeded > 0 ? foundTime / succeeded : 0));
+    }
+
+    uint64_t lookups;
+    uint64_t succeeded;
+    uint64_t hops;
+    uint64_t messages;
+    uint64_t responses;
+    uint64_t answered;
+    uint64_t firstResponse;
+    uint64_t foundHops;
+    uint64_t foundTime;
+};
+
+class Network {
+public:
+    Network() : rng(1), loss(0) { }
+
+    ~Network() {
+        for(vector<SimNode*>::iterator i = nodes.begin(); i != nodes.end(); ++i) {
+            delete (*i)->table;
+            delete *i;
+        }
+    }
+
+    void setLoss(unsigned int percent) { loss = percent; }
+
+    /**
+     * New node gets nodes from a seed, as from a bootstrap node, and pings them.
+     * Then it looks up itself and pings the nodes it reached, so they know it.
+     */
+    SimNode& join() {
+        SimNode* n = new SimNode;
+        n->cid = randomCID();
+        n->user = new User(n->cid);
+        n->user->setFlag(User::DHT);
+        n->port = static_cast<uint16_t>(10000 + nodes.size());
+        n->latency = 10 + rng() % 140;
+        n->online = true;
+        n->table = new KBucket(n->cid);
+
+        bool first = nodes.empty();
+        nodes.push_back(n);
+        byCid[n->cid] = n;
+        if(first)
+            return *n;
+
+        SimNode& seed = randomOnline(n);
+        ping(*n, seed);
+
+        Node::Map seedNodes;
+        seed.table->getClosestNodes(randomCID(), seedNodes, 20, 3);
+        for(Node::Map::const_iterator i = seedNodes.begin(); i != seedNodes.end(); ++i)
+            ping(*n, *byCid[i->second->getUser()->getCID()]);
+
+        LookupResult self = lookup(*n, n->cid, Search::TYPE_NODE);
+        for(vector<SimNode*>::const_iterator i = self.responded.begin(); i != self.responded.end(); ++i)
+            ping(*n, **i);
+
+        return *n;
+    }
+
+    /** Node goes away without telling anybody */
+    void leave(SimNode& n) { n.online = false; }
+
+    /** Random online node other than "except" */
+    SimNode& randomOnline(const SimNode* except = NULL) {
+        for(;;) {
+            SimNode* n = nodes[rng() % nodes.size()];
+            if(n->online && n != except)
+                return *n;
+        }
+    }
+
+    CID randomCID() {
+        uint8_t data[CID::SIZE];
+        for(size_t i = 0; i < CID::SIZE; ++i)
+            data[i] = static_cast<uint8_t>(rng());
+        return CID(data);
+    }
+
+    /**
+     * Runs a lookup started by "from" like Search::process and
+     * SearchManager::processSearchResult. Publishing sends the file to the K
+     * closest responding nodes at the end, like SearchManager::publishFile.
+     */
+    LookupResult lookup(SimNode& from, const CID& target, Search::SearchType type) {
+        LookupResult r;
+        Node::Map possibleNodes, triedNodes, respondedNodes;
+        from.table->getClosestNodes(target, possibleNodes, 50, 3);
+
+        uint64_t lifeTime = type == Search::TYPE_FILE ? SEARCHFILE_LIFETIME : (type == Search::TYPE_NODE ? SEARCHNODE_LIFETIME : SEARCHSTOREFILE_LIFETIME);
+        unsigned int count = type == Search::TYPE_FILE ? 2 : (type == Search::TYPE_NODE ? 10 : 4);
+
+        uint64_t now = 0;
+        for(; now < lifeTime && !possibleNodes.empty(); now += SEARCH_PROCESSTIME) {
+            size_t nodesCount = min((size_t)SEARCH_ALPHA, possibleNodes.size());
+            ++r.hops;
+            r.messages += nodesCount;
+
+            for(size_t i = 0; i < nodesCount; ++i) {
+                Node::Map::iterator it = possibleNodes.begin();
+                Node::Ptr node = it->second;
+                triedNodes[it->first] = node;
+                possibleNodes.erase(it);
+
+                SimNode& to = *byCid[node->getUser()->getCID()];
+                if(!to.online || lost()) {
+                    node->setTimeout();
+                    continue;
+                }
+                received(to, from, false);
+
+                // response
+                if(lost()) {
+                    node->setTimeout();
+                    continue;
+                }
+                received(from, to, false);
+
+                uint64_t arrival = now + 2 * (from.latency + to.latency);
+                if(r.firstResponse == 0 || arrival < r.firstResponse)
+                    r.firstResponse = arrival;
+
+                respondedNodes.insert(std::make_pair(Utils::getDistance(to.cid, target), node));
+
+                bool hit = type == Search::TYPE_NODE && to.cid == target;
+                if(type == Search::TYPE_FILE && to.index.count(target) > 0) {
+                    // sources instead of nodes
+                    hit = true;
+                } else {
+                    Node::Map nodes;
+                    to.table->getClosestNodes(target, nodes, count, 2);
+
+                    unsigned int n = K;
+                    for(Node::Map::const_iterator j = nodes.begin(); j != nodes.end() && n-- > 0; ++j) {
+                        const CID& cid = j->second->getUser()->getCID();
+                        CID distance = Utils::getDistance(cid, target);
+
+                        if(type == Search::TYPE_NODE && distance.isZero())
+                            hit = true;
+
+                        if(cid == from.cid || possibleNodes.find(distance) != possibleNodes.end() || triedNodes.find(distance) != triedNodes.end())
+                            continue;
+
+                        Node::Ptr next = view(from, *byCid[cid]);
+                        if(from.table->insert(next))
+                            possibleNodes[distance] = next;
+                    }
+                }
+
+                if(hit && (!r.found || arrival < r.foundTime)) {
+                    r.found = true;
+                    r.foundHops = r.hops;
+                    r.foundTime = arrival;
+                }
+            }
+        }
+
+        int n = K;
+        for(Node::Map::const_iterator i = respondedNodes.begin(); i != respondedNodes.end(); ++i) {
+            SimNode& to = *byCid[i->second->getUser()->getCID()];
+            r.responded.push_back(&to);
+
+            if(type == Search::TYPE_STOREFILE && n-- > 0 && to.online && !lost()) {
+                to.index.insert(target);
+                r.responses++;
+            }
+        }
+
+        if(type == Search::TYPE_STOREFILE) {
+            r.found = r.responses > 0;
+            r.foundHops = r.hops;
+            r.foundTime = now;
+        } else
+            r.responses = respondedNodes.size();
+
+        return r;
+    }
+
+private:
+    std::mt19937 rng;
+    unsigned int loss;
+    SimClient client;
+    vector<SimNode*> nodes;
+    std::unordered_map<CID, SimNode*> byCid;
+
+    bool lost() { return rng() % 100 < loss; }
+
+    /** Owner's node for the other one, like KBucket::createNode without an update */
+    Node::Ptr view(SimNode& owner, SimNode& other) {
+        Node::Ptr& node = owner.known[other.cid];
+        if(node == NULL) {
+            node = new Node(other.user, client);
+            node->getIdentity().setIp("127.0.0.1");
+            node->getIdentity().setUdpPort(Util::toString(other.port));
+        }
+        return node;
+    }
+
+    /**
+     * A packet from "other" reached "owner". Known nodes are updated like
+     * KBucket::createNode does, INF also adds the node like DHT::addNode.
+     */
+    void received(SimNode& owner, SimNode& other, bool inf) {
+        if(!inf && owner.known.find(other.cid) == owner.known.end())
+            return;
+
+        Node::Ptr node = view(owner, other);
+        node->setAlive();
+        node->setIpVerified(true);
+        if(inf)
+            owner.table->insert(node);
+    }
+
+    /** INF with the PING flag and the answering INF */
+    void ping(SimNode& a, SimNode& b) {
+        if(!b.online || lost())
+            return;
+        received(b, a, true);
+        if(lost())
+            return;
+        received(a, b, true);
+    }
+};
+
+struct PhaseTotals {
+    Totals nodes;
+    Totals stores;
+    Totals files;
+};
+
+/** Node lookups for online nodes, then files published and looked up from random nodes */
+static PhaseTotals runLookups(Network& net, const char* name) {
+    PhaseTotals t;
+    for(int i = 0; i < 200; ++i) {
+        SimNode& from = net.randomOnline();
+        SimNode& target = net.randomOnline(&from);
+        t.nodes.add(net.lookup(from, target.cid, Search::TYPE_NODE));
+    }
+
+    vector<CID> files;
+    for(int i = 0; i < 100; ++i) {
+        files.push_back(net.randomCID());
+        t.stores.add(net.lookup(net.randomOnline(), files.back(), Search::TYPE_STOREFILE));
+    }
+
+    for(int i = 0; i < 200; ++i)
+        t.files.add(net.lookup(net.randomOnline(), files[i % files.size()], Search::TYPE_FILE));
+
+    std::printf("%s:\n", name);
+    t.nodes.print("node");
+    t.stores.print("store");
+    t.files.print("file");
+    return t;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int nodeCount = argc > 1 ? std::atoi(argv[1]) : 500;
+    unsigned int loss = argc > 2 ? std::atoi(argv[2]) : 10;
+    unsigned int churn = argc > 3 ? std::atoi(argv[3]) : 20;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    Network net;
+    for(unsigned int i = 0; i < nodeCount; ++i)
+        net.join();
+
+    std::printf("%u nodes, SEARCH_ALPHA %d, K %d\n", nodeCount, SEARCH_ALPHA, K);
+    PhaseTotals stable = runLookups(net, "stable network");
+    CHECK(stable.nodes.successRate() >= 0.95);
+    CHECK(stable.stores.successRate() >= 0.95);
+    CHECK(stable.files.successRate() >= 0.95);
+
+    // the same number of nodes leaves and joins
+    for(unsigned int i = 0; i < nodeCount * churn / 100; ++i) {
+        net.leave(net.randomOnline());
+        net.join();
+    }
+    net.setLoss(loss);
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "%u%% loss, %u%% churn", loss, churn);
+    PhaseTotals churned = runLookups(net, name);
+    CHECK(churned.nodes.successRate() >= 0.8);
+    CHECK(churned.files.successRate() >= 0.8);
+
+    std::printf("%.1f s\n", secondsSince(start));
+    return checkResult();
+}
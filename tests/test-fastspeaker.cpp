@@ -0,0 +1,174 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/FastSpeaker.h"
+
+#include <thread>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2
+#endif
+
+#include "test.h"
+
+using namespace dcpp;
+
+struct TestListener {
+    virtual ~TestListener() { }
+    virtual void on(int) noexcept = 0;
+};
+
+struct TestSpeaker : public FastSpeaker<TestListener> {
+    using FastSpeaker<TestListener>::hasListeners;
+};
+
+/** Counts its calls, detects calls after removal or deletion */
+struct Counter : public TestListener {
+    static const unsigned ALIVE = 0x600dF00d;
+
+    Counter() : alive(ALIVE), calls(0), removed(false), late(0) { }
+    ~Counter() { alive = 0; }
+
+    virtual void on(int) noexcept {
+        if(alive != ALIVE || removed)
+            ++late;
+        ++calls;
+    }
+
+    volatile unsigned alive;
+    std::atomic<int> calls;
+    std::atomic<bool> removed;
+    std::atomic<int> late;
+};
+
+/** Removes listeners while being called */
+struct Remover : public TestListener {
+    Remover(TestSpeaker& aSpeaker) : speaker(aSpeaker), other(nullptr), calls(0) { }
+
+    virtual void on(int) noexcept {
+        ++calls;
+        speaker.removeListener(this);
+        if(other) {
+            speaker.removeListener(other);
+            other->removed = true;
+        }
+    }
+
+    TestSpeaker& speaker;
+    Counter* other;
+    int calls;
+};
+
+static void testAddRemove() {
+    TestSpeaker s;
+    Counter a, b;
+    CHECK(!s.hasListeners());
+    s.addListener(&a);
+    s.addListener(&b);
+    s.addListener(&a);
+    s.fire(0);
+    CHECK_EQUAL(a.calls.load(), 1);
+    CHECK_EQUAL(b.calls.load(), 1);
+
+    s.removeListener(&a);
+    s.fire(0);
+    CHECK_EQUAL(a.calls.load(), 1);
+    CHECK_EQUAL(b.calls.load(), 2);
+
+    s.removeListeners();
+    s.fire(0);
+    CHECK_EQUAL(b.calls.load(), 2);
+    CHECK(!s.hasListeners());
+}
+
+static void testRemoveFromFire() {
+    TestSpeaker s;
+    Remover r(s);
+    Counter c;
+    r.other = &c;
+    // c comes after r in the array this fire() iterates over
+    s.addListener(&r);
+    s.addListener(&c);
+    s.fire(0);
+    s.fire(0);
+    CHECK_EQUAL(r.calls, 1);
+    CHECK_EQUAL(c.calls.load(), 0);
+    CHECK(!s.hasListeners());
+}
+
+static void fireUntil(TestSpeaker* s, std::atomic<bool>* stop) {
+    while(!*stop)
+        s->fire(0);
+}
+
+/** A listener removed on one thread is not called by fires running on another */
+static void testRemoveWhileFiring() {
+    TestSpeaker s;
+    std::atomic<bool> stop(false);
+    std::thread firing(fireUntil, &s, &stop);
+
+    int late = 0;
+    for(int i = 0; i < 1000; ++i) {
+        Counter* c = new Counter;
+        s.addListener(c);
+        while(c->calls == 0)
+            std::this_thread::yield();
+        s.removeListener(c);
+        c->removed = true;
+        std::this_thread::yield();
+        late += c->late;
+        delete c;
+    }
+
+    stop = true;
+    firing.join();
+    CHECK_EQUAL(late, 0);
+}
+
+/** Lists replaced from inside a fire() are freed afterwards, not kept */
+static void testNoPileUp() {
+    TestSpeaker s;
+    Counter c;
+    size_t heap = 0;
+    for(int i = 0; i < 100000; ++i) {
+        Remover* r = new Remover(s);
+        s.addListener(r);
+        s.addListener(&c);
+        s.fire(0);
+        s.removeListener(&c);
+        delete r;
+#ifdef HAVE_MALLINFO2
+        if(i == 1000)
+            heap = mallinfo2().uordblks;
+#endif
+    }
+#ifdef HAVE_MALLINFO2
+    // each round retires four lists from inside a fire(), kept they would take megabytes
+    CHECK(mallinfo2().uordblks < heap + 64 * 1024);
+#endif
+    CHECK_EQUAL(c.late.load(), 0);
+    CHECK_EQUAL(c.calls.load(), 100000);
+    CHECK(!s.hasListeners());
+}
+
+int main() {
+    testAddRemove();
+    testRemoveFromFire();
+    testRemoveWhileFiring();
+    testNoPileUp();
+    return checkResult();
+}
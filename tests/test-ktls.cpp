@@ -0,0 +1,176 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs a TLS connection over loopback with UseKernelTLS on and sends a file
+ * through it. When the kernel took over the encryption the file goes through
+ * SSLSocket::sendFile (SSL_sendfile), otherwise through write() as
+ * BufferedSocket does then, and SSL_sendfile has to refuse to send.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/DCPlusPlus.h"
+#include "dcpp/CryptoManager.h"
+#include "dcpp/File.h"
+#include "dcpp/SettingsManager.h"
+#include "dcpp/SSLSocket.h"
+#include "dcpp/Util.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#include "test.h"
+
+using namespace dcpp;
+
+static const size_t FILE_SIZE = 4 * 1024 * 1024;
+
+static Socket listener;
+static std::unique_ptr<SSLSocket> server;
+static string serverError;
+
+static void acceptClient() {
+    try {
+        // the listening socket doesn't block, there's nothing to accept before the client connects
+        while(!(listener.wait(100, Socket::WAIT_READ) & Socket::WAIT_READ))
+            ;
+        server->accept(listener);
+        while(!server->waitAccepted(100))
+            ;
+    } catch(const Exception& e) {
+        serverError = e.getError();
+    }
+}
+
+/** What BufferedSocket sends over the socket, with sendfile when it can */
+static void sendFile(File* file, bool direct) {
+    try {
+        int64_t pos = 0;
+        vector<char> buf(64 * 1024);
+        while(pos < (int64_t)FILE_SIZE) {
+            int len = (int)min((int64_t)buf.size(), (int64_t)FILE_SIZE - pos);
+            int n;
+            if(direct) {
+                n = server->sendFile(*file, pos, len);
+            } else {
+                file->setPos(pos);
+                size_t got = len;
+                file->read(&buf[0], got);
+                n = server->write(&buf[0], (int)got);
+            }
+            if(n > 0)
+                pos += n;
+            else
+                server->wait(100, Socket::WAIT_WRITE);
+        }
+    } catch(const Exception& e) {
+        serverError = e.getError();
+    }
+}
+
+static string tlsModules() {
+    // procfs files have no size, File::read can't be used
+    std::ifstream f("/proc/sys/net/ipv4/tcp_available_ulp");
+    string ulp;
+    return std::getline(f, ulp) ? ulp : "unknown";
+}
+
+int main() {
+    char dir[] = "/tmp/dcpp-ktls-XXXXXX";
+    if(!mkdtemp(dir))
+        return 1;
+    setenv("HOME", dir, 1);
+    setenv("XDG_CONFIG_HOME", dir, 1);
+    setenv("XDG_DATA_HOME", dir, 1);
+
+    startup(NULL, NULL);
+    SettingsManager::getInstance()->set(SettingsManager::USE_KERNEL_TLS, true);
+    CHECK(CryptoManager::getInstance()->TLSOk());
+
+    string path = string(dir) + "/upload";
+    {
+        File f(path, File::WRITE, File::CREATE | File::TRUNCATE);
+        string data(FILE_SIZE, 0);
+        for(size_t i = 0; i < data.size(); ++i)
+            data[i] = static_cast<char>(i * 7 + i / 4096);
+        f.write(data);
+    }
+
+    listener.create();
+    uint16_t port = listener.bind(0, "127.0.0.1");
+    listener.listen();
+
+    server.reset(CryptoManager::getInstance()->getServerSocket(true));
+    std::unique_ptr<SSLSocket> client(CryptoManager::getInstance()->getClientSocket(true));
+
+    std::thread accepting(&acceptClient);
+    client->connect("127.0.0.1", port);
+    while(!client->waitConnected(100))
+        ;
+    accepting.join();
+    CHECK_EQUAL(serverError, string());
+
+    bool kernel = server->canSendFile();
+    SSLSocket::HandshakeStats hs = SSLSocket::getHandshakeStats();
+    CHECK_EQUAL(hs.full + hs.resumed, 2u);
+    CHECK_EQUAL(hs.kernel, (uint64_t)(kernel ? 1 : 0) + (client->canSendFile() ? 1 : 0));
+
+    std::printf("%s, TCP upper layer protocols: %s, kernel TLS %s\n", server->getCipherName().c_str(),
+        tlsModules().c_str(), kernel ? "on" : "off, falling back to write()");
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    File file(path, File::READ, File::OPEN);
+    std::thread sending(&sendFile, &file, kernel);
+
+    string received;
+    vector<char> buf(64 * 1024);
+    while(received.size() < FILE_SIZE && serverError.empty()) {
+        int n = client->read(&buf[0], (int)buf.size());
+        if(n > 0)
+            received.append(&buf[0], n);
+        else
+            client->wait(100, Socket::WAIT_READ);
+    }
+    sending.join();
+    double secs = secondsSince(start);
+
+    CHECK_EQUAL(serverError, string());
+    CHECK_EQUAL(received.size(), FILE_SIZE);
+    CHECK(received == File(path, File::READ, File::OPEN).read());
+    std::printf("%u MiB sent with %s in %.3f s\n", (unsigned)(FILE_SIZE >> 20), kernel ? "SSL_sendfile" : "SSL_write", secs);
+
+    if(!kernel) {
+        // without kernel TLS SSL_sendfile must not send the file unencrypted
+        bool refused = false;
+        try {
+            refused = server->sendFile(file, 0, 4096) <= 0;
+        } catch(const SocketException& e) {
+            std::printf("sendfile without kernel TLS: %s\n", e.getError().c_str());
+            refused = true;
+        }
+        CHECK(refused);
+    }
+
+    client.reset();
+    server.reset();
+    listener.disconnect();
+    shutdown();
+
+    std::system((string("rm -rf ") + dir).c_str());
+    return checkResult();
+}
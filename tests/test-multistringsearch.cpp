@@ -0,0 +1,116 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/MultiStringSearch.h"
+#include "dcpp/Text.h"
+
+#include "test.h"
+
+using namespace dcpp;
+
+/** What match() has to find, one pattern at a time */
+static bool contains(const string& aText, const string& aPattern) {
+    return Text::toLower(aText).find(Text::toLower(aPattern)) != string::npos;
+}
+
+static void checkAll(const MultiStringSearch& s, const StringList& patterns, const StringList& texts) {
+    MultiStringSearch::Matches m;
+    for(auto t = texts.begin(); t != texts.end(); ++t) {
+        s.match(*t, m);
+        for(size_t i = 0; i < patterns.size(); ++i) {
+            CHECK_EQUAL(m[i], contains(*t, patterns[i]));
+        }
+    }
+}
+
+static MultiStringSearch compile(const StringList& patterns) {
+    MultiStringSearch s;
+    for(size_t i = 0; i < patterns.size(); ++i) {
+        CHECK_EQUAL(s.add(patterns[i]), i);
+    }
+    s.compile();
+    return s;
+}
+
+/** Overlapping patterns and patterns inside other patterns are all found */
+static void testOverlapping() {
+    StringList patterns;
+    patterns.push_back("he");
+    patterns.push_back("she");
+    patterns.push_back("his");
+    patterns.push_back("hers");
+    patterns.push_back("ushers");
+
+    StringList texts;
+    texts.push_back("ushers");
+    texts.push_back("SHE said HIS");
+    texts.push_back("hhhhers");
+    texts.push_back("nothing here");
+    texts.push_back("");
+
+    checkAll(compile(patterns), patterns, texts);
+}
+
+/** Case-insensitive, non-ASCII patterns match, and equal patterns share an id */
+static void testCase() {
+    MultiStringSearch s;
+    size_t id = s.add("Ubuntu");
+    CHECK_EQUAL(s.add("UBUNTU"), id);
+    size_t cyr = s.add("\xD0\xBC\xD0\xB8\xD1\x80");  // "мир"
+    s.compile();
+    CHECK_EQUAL(s.size(), (size_t)2);
+
+    MultiStringSearch::Matches m;
+    s.match("ubuntu-24.04-desktop-amd64.iso", m);
+    CHECK(m[id]);
+    CHECK(!m[cyr]);
+    s.match("\xD0\x92\xD0\xBE\xD0\xB9\xD0\xBD\xD0\xB0 \xD0\xB8 \xD0\xBC\xD0\xB8\xD1\x80.avi", m);  // "Война и мир.avi"
+    CHECK(!m[id]);
+    CHECK(m[cyr]);
+}
+
+/** Patterns using every byte that can be left after lower-casing still get columns of their own */
+static void testManyBytes() {
+    StringList patterns;
+    for(int c = 1; c < 0x80; ++c) {
+        if(c >= 'A' && c <= 'Z')
+            continue;
+        patterns.push_back(string(1, (char)c) + "x");
+    }
+    // two-byte UTF-8 characters, lower case already, using all continuation bytes
+    for(int c = 0xE0; c < 0x250; ++c) {
+        string u;
+        Text::wcToUtf8((wchar_t)c, u);
+        if(Text::toLower(u) == u)
+            patterns.push_back(u);
+    }
+
+    StringList texts;
+    texts.push_back("x");
+    for(size_t i = 0; i < patterns.size(); i += 7) {
+        texts.push_back("__" + patterns[i] + "__" + patterns[patterns.size() - 1 - i]);
+    }
+
+    checkAll(compile(patterns), patterns, texts);
+}
+
+int main() {
+    testOverlapping();
+    testCase();
+    testManyBytes();
+    return checkResult();
+}
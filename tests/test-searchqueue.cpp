@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/SearchQueue.h"
+#include "dcpp/TimerManager.h"
+#include "dcpp/Util.h"
+
+#include "test.h"
+
+using namespace dcpp;
+
+static SearchCore makeSearch(const string& query, const string& token) {
+    SearchCore s;
+    s.sizeType = 0;
+    s.size = 0;
+    s.fileType = 0;
+    s.query = query;
+    s.token = token;
+    s.owners.insert(&s);
+    return s;
+}
+
+/** Only a hub message naming the query we've just sent is a flood warning */
+static void testFloodMatchesQuery() {
+    SearchQueue q(10000);
+    SearchCore s;
+    CHECK(q.add(makeSearch("ubuntu 24.04 iso", "1")));
+    CHECK(q.pop(s, 1000));
+
+    CHECK(!q.checkFlood("Please wait, searching is limited on this hub", 2000));
+    CHECK(!q.checkFlood("Search ignored: ubuntu", 2000));
+    CHECK_EQUAL(q.getStats().floods, (uint64_t)0);
+
+    CHECK(q.checkFlood("Search ignored: ubuntu 24.04 iso", 2000));
+    CHECK_EQUAL(q.getStats().floods, (uint64_t)1);
+    CHECK(q.getEffectiveInterval() > 10000);
+
+    // too late to be an answer to that search
+    CHECK(!q.checkFlood("Search ignored: ubuntu 24.04 iso", 1000 + SearchQueue::FLOOD_REPLY_TIME));
+    CHECK_EQUAL(q.getStats().floods, (uint64_t)1);
+}
+
+/** The backoff decays back to the plain interval once the hub stops complaining */
+static void testBackoffDecays() {
+    SearchQueue q(1000);
+    q.onFlood(0);
+    CHECK(q.getEffectiveInterval() > 1000);
+
+    SearchCore s;
+    uint64_t now = 0;
+    for(int i = 0; i < 100; ++i) {
+        CHECK(q.add(makeSearch("file" + Util::toString(i), Util::toString(i))));
+        now += q.getEffectiveInterval() + 1;
+        CHECK(q.pop(s, now));
+    }
+    CHECK_EQUAL(q.getEffectiveInterval(), (uint64_t)1000);
+    CHECK_EQUAL(q.getStats().sent, (uint64_t)100);
+}
+
+/** Identical searches are merged while pending and automatic repeats are suppressed */
+static void testMergeAndSuppress() {
+    SearchQueue q(1000);
+    CHECK(q.add(makeSearch("some file", "1")));
+    q.add(makeSearch("some file", "2"));
+    CHECK_EQUAL(q.getStats().merged, (uint64_t)1);
+
+    // suppressing compares against the real clock
+    SearchCore s;
+    uint64_t now = GET_TICK();
+    CHECK(q.pop(s, now));
+    CHECK(!q.pop(s, now + 2000));
+
+    q.add(makeSearch("some file", "auto"));
+    CHECK_EQUAL(q.getStats().suppressed, (uint64_t)1);
+}
+
+int main() {
+    testFloodMatchesQuery();
+    testBackoffDecays();
+    testMergeAndSuppress();
+    return checkResult();
+}
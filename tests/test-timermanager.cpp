@@ -0,0 +1,98 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/Thread.h"
+#include "dcpp/TimerManager.h"
+
+#include <atomic>
+
+#include "test.h"
+
+using namespace dcpp;
+
+static std::atomic<int> calls(0);
+static std::atomic<bool> inCallback(false);
+static TimerManager::TimerId selfId = 0;
+
+static void countCall(uint64_t) {
+    calls++;
+}
+
+static void slow(uint64_t) {
+    inCallback = true;
+    Thread::sleep(200);
+    calls++;
+    inCallback = false;
+}
+
+static void removeSelf(uint64_t) {
+    calls++;
+    TimerManager::getInstance()->removeTimer(selfId);
+}
+
+static void testOneShot() {
+    calls = 0;
+    TimerManager::getInstance()->addTimer(20, &countCall);
+    Thread::sleep(300);
+    CHECK_EQUAL(calls.load(), 1);
+}
+
+static void testPeriodic() {
+    calls = 0;
+    TimerManager::TimerId id = TimerManager::getInstance()->addPeriodicTimer(20, &countCall);
+    Thread::sleep(300);
+    TimerManager::getInstance()->removeTimer(id);
+    int n = calls;
+    CHECK(n >= 5);
+
+    Thread::sleep(100);
+    CHECK_EQUAL(calls.load(), n);
+}
+
+/** removeTimer returns only when the callback is done */
+static void testRemoveWaits() {
+    calls = 0;
+    TimerManager::TimerId id = TimerManager::getInstance()->addTimer(10, &slow);
+    while(!inCallback)
+        Thread::sleep(1);
+
+    TimerManager::getInstance()->removeTimer(id);
+    CHECK(!inCallback);
+    CHECK_EQUAL(calls.load(), 1);
+}
+
+/** A periodic timer can remove itself */
+static void testRemoveSelf() {
+    calls = 0;
+    selfId = TimerManager::getInstance()->addPeriodicTimer(10, &removeSelf);
+    Thread::sleep(200);
+    CHECK_EQUAL(calls.load(), 1);
+}
+
+int main() {
+    TimerManager::newInstance();
+    TimerManager::getInstance()->start();
+
+    testOneShot();
+    testPeriodic();
+    testRemoveWaits();
+    testRemoveSelf();
+
+    TimerManager::getInstance()->shutdown();
+    TimerManager::deleteInstance();
+    return checkResult();
+}
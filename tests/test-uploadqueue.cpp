@@ -0,0 +1,135 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dcpp/stdinc.h"
+#include "dcpp/UploadQueue.h"
+#include "dcpp/UserConnection.h"
+
+#include "test.h"
+
+using namespace dcpp;
+
+static HintedUser newUser() {
+    UserPtr u(new User(CID::generate()));
+    u->setFlag(User::ONLINE);
+    return HintedUser(u, "adc://hub:411");
+}
+
+/** First come first served within a priority, favorites before the others */
+static void testOrder() {
+    UploadQueue q;
+    HintedUser a = newUser(), b = newUser(), c = newUser(), fav = newUser();
+
+    CHECK_EQUAL(q.add(a, UploadQueue::PRIO_NORMAL, 1000), 1u);
+    CHECK_EQUAL(q.add(b, UploadQueue::PRIO_NORMAL, 2000), 2u);
+    CHECK_EQUAL(q.add(c, UploadQueue::PRIO_NORMAL, 3000), 3u);
+
+    // asking again keeps the place
+    CHECK_EQUAL(q.add(a, UploadQueue::PRIO_NORMAL, 4000), 1u);
+    CHECK_EQUAL(q.add(b, UploadQueue::PRIO_NORMAL, 4000), 2u);
+
+    // a favorite goes ahead of all normal users, but not of earlier favorites
+    CHECK_EQUAL(q.add(fav, UploadQueue::PRIO_FAVORITE, 5000), 1u);
+    CHECK_EQUAL(q.getPosition(a.user), 2u);
+    CHECK_EQUAL(q.getPosition(c.user), 4u);
+
+    // promoted to favorite, c keeps its place among those queued before fav
+    CHECK_EQUAL(q.add(c, UploadQueue::PRIO_FAVORITE, 6000), 1u);
+    CHECK_EQUAL(q.getPosition(fav.user), 2u);
+
+    HintedUserList users = q.getUsers();
+    CHECK_EQUAL(users.size(), 4u);
+    CHECK(users[0].user == c.user && users[1].user == fav.user && users[2].user == a.user && users[3].user == b.user);
+
+    HintedUser removed(UserPtr(), Util::emptyString);
+    CHECK(q.remove(fav.user, removed));
+    CHECK(removed.user == fav.user && removed.hint == fav.hint);
+    CHECK(!q.remove(fav.user, removed));
+    CHECK_EQUAL(q.getPosition(fav.user), 0u);
+    CHECK_EQUAL(q.getPosition(a.user), 2u);
+}
+
+/** An offered slot is held for its user for OFFER_TIME */
+static void testOfferHold() {
+    UploadQueue q;
+    HintedUser a = newUser(), b = newUser(), late = newUser();
+    q.add(a, UploadQueue::PRIO_NORMAL, 0);
+    q.add(b, UploadQueue::PRIO_NORMAL, 0);
+
+    // one slot frees up: only the head gets an offer, and only once
+    HintedUserList offers = q.offer(1, 1000);
+    CHECK(offers.size() == 1 && offers[0].user == a.user);
+    CHECK(q.offer(1, 2000).empty());
+
+    // the slot is kept for a: users behind it and newcomers can't take it
+    CHECK(q.hasSlotFor(a.user, 1, 10000));
+    CHECK(!q.hasSlotFor(b.user, 1, 10000));
+    CHECK(!q.hasSlotFor(late.user, 1, 10000));
+    CHECK(q.hasSlotFor(late.user, 2, 10000));
+    CHECK(!q.hasSlotFor(b.user, 1, 1000 + UploadQueue::OFFER_TIME - 1));
+
+    // once the offer lapses it no longer holds the slot and counts as missed
+    CHECK(q.hasSlotFor(b.user, 1, 1000 + UploadQueue::OFFER_TIME));
+    CHECK(q.prune(1000 + UploadQueue::OFFER_TIME).empty());
+
+    // the next offer goes to a again, a second miss costs the place
+    offers = q.offer(1, 40000);
+    CHECK(offers.size() == 1 && offers[0].user == a.user);
+    HintedUserList gone = q.prune(40000 + UploadQueue::OFFER_TIME);
+    CHECK(gone.size() == 1 && gone[0].user == a.user);
+    CHECK_EQUAL(q.getPosition(b.user), 1u);
+
+    // offline users are skipped and dropped
+    b.user->unsetFlag(User::ONLINE);
+    CHECK(q.offer(1, 80000).empty());
+    CHECK_EQUAL(q.prune(80000).size(), 1u);
+    CHECK(q.empty());
+}
+
+/** Slow uploads are reclaimed for waiting users, granted slots never */
+static void testStallReclaim() {
+    UploadQueue q;
+    const uint64_t t = UploadQueue::STALL_TIME;
+    const int64_t slow = UploadQueue::STALL_SPEED * (int64_t)t / 1000 - 1;
+    const int64_t fast = UploadQueue::STALL_SPEED * (int64_t)t / 1000;
+
+    // nobody waits, nothing to give the slot to
+    CHECK(!q.shouldReclaim(0, t, true, false));
+
+    q.add(newUser(), UploadQueue::PRIO_NORMAL, 0);
+    CHECK(q.shouldReclaim(slow, t, true, false));
+    CHECK(!q.shouldReclaim(fast, t, true, false));
+    CHECK(!q.shouldReclaim(0, t - 1, true, false));
+    // reserved and favorite slots, and uploads without a normal slot, are spared
+    CHECK(!q.shouldReclaim(0, t, true, true));
+    CHECK(!q.shouldReclaim(0, t, false, false));
+}
+
+/** The slots full reply carries the queue position */
+static void testMaxedOut() {
+    CHECK_EQUAL(UserConnection::getMaxedOut(true, 0), "$MaxedOut|");
+    CHECK_EQUAL(UserConnection::getMaxedOut(true, 3), "$MaxedOut 3|");
+    CHECK_EQUAL(UserConnection::getMaxedOut(false, 0), "CSTA 153 Slots\\sfull\n");
+    CHECK_EQUAL(UserConnection::getMaxedOut(false, 12), "CSTA 153 Slots\\sfull QP12\n");
+}
+
+int main() {
+    testOrder();
+    testOfferHold();
+    testStallReclaim();
+    testMaxedOut();
+    return checkResult();
+}
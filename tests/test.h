@@ -0,0 +1,44 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+/** Helpers shared by the tests and benchmarks in this directory */
+
+static int checkFailures = 0;
+
+#define CHECK(x) do { if(!(x)) { \
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+    ++checkFailures; } } while(0)
+
+#define CHECK_EQUAL(a, b) do { if(!((a) == (b))) { \
+    std::fprintf(stderr, "%s:%d: check failed: %s == %s\n", __FILE__, __LINE__, #a, #b); \
+    ++checkFailures; } } while(0)
+
+/** Exit code for main() */
+inline int checkResult() {
+    if(checkFailures > 0)
+        std::fprintf(stderr, "%d checks failed\n", checkFailures);
+    return checkFailures > 0 ? 1 : 0;
+}
+
+/** Seconds since start */
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
@@ -77,7 +77,8 @@ if [ "${OS}" != "Windows" ]; then
                    -DXMLRPC_DAEMON=OFF
                    -DJSONRPC_DAEMON=ON
                    -DUSE_CLI_JSONRPC=ON
-                   -DUSE_CLI_XMLRPC=OFF"
+                   -DUSE_CLI_XMLRPC=OFF
+                   -DWITH_TESTS=ON"
     fi
 
     cmake ${CMAKEOPTS} \
@@ -85,6 +86,9 @@ if [ "${OS}" != "Windows" ]; then
           -DCMAKE_SHARED_LINKER_FLAGS="${LDFLAGS}" \
           -DCMAKE_EXE_LINKER_FLAGS="${LDFLAGS}"
     make VERBOSE=1
+    if [ ! -z "${USE_DAEMON}" ]; then
+        ctest --output-on-failure || exit 1
+    fi
     sudo make install
 
     du -shc /usr/bin/eiskaltdcpp-*